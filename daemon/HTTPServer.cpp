@@ -293,6 +293,24 @@ namespace http {
 		s << "<b>" << tr("Transit") << ":</b> ";
 		ShowTraffic (s, i2p::transport::transports.GetTotalTransitTransmittedBytes ());
 		s << " (" << (double) i2p::transport::transports.GetTransitBandwidth () / 1024 << " " << tr(/* tr: Kibibit/s */ "KiB/s") << ")<br>\r\n";
+		auto residentMemory = i2p::util::GetResidentMemory ();
+		if (residentMemory)
+		{
+			s << "<b>" << tr("Memory") << ":</b> ";
+			ShowTraffic (s, residentMemory);
+			s << "<br>\r\n";
+		}
+		s << "<b>" << tr("I2NP buffers") << ":</b> ";
+		uint64_t cachedBytes = 0, allocationRate = 0;
+		for (const auto& it: i2p::GetI2NPBuffersStats ())
+		{
+			s << it.size/1024 << "K: " << it.numInUse << " ";
+			cachedBytes += it.numCached*(it.size + i2p::I2NP_BUFFER_OVERHEAD);
+			allocationRate += it.allocationRate;
+		}
+		s << tr("in use") << ", ";
+		ShowTraffic (s, cachedBytes);
+		s << " " << tr("cached") << " (" << allocationRate << " " << tr("allocations") << "/" << tr(/* tr: Seconds */ "s") << ")<br>\r\n";
 		s << "<b>" << tr("Data path") << ":</b> " << i2p::fs::GetUTF8DataDir() << "<br>\r\n";
 		s << "<div class='slide'>";
 		if((outputFormat == OutputFormatEnum::forWebConsole) || !includeHiddenContent) {
@@ -343,6 +361,12 @@ namespace http {
 		s << "<b>" << tr("Routers") << ":</b> " << i2p::data::netdb.GetNumRouters () << " ";
 		s << "<b>" << tr("Floodfills") << ":</b> " << i2p::data::netdb.GetNumFloodfills () << " ";
 		s << "<b>" << tr("LeaseSets") << ":</b> " << i2p::data::netdb.GetNumLeaseSets () << "<br>\r\n";
+		auto loadTime = i2p::data::netdb.GetLoadTime ();
+		auto numLoaded = i2p::data::netdb.GetNumLoadedRouters ();
+		s << "<b>" << tr("NetDb load") << ":</b> " << numLoaded << " " << tr("routers") << ", " << loadTime << " "
+		  << tr(/* tr: Milliseconds */ "ms") << " (" << numLoaded*1000/(loadTime ? loadTime : 1) << "/" << tr(/* tr: Seconds */ "s") << ")";
+		if (i2p::data::netdb.IsLoadedFromSnapshot ()) s << " " << tr("from snapshot");
+		s << "<br>\r\n";
 
 		size_t clientTunnelCount = i2p::tunnel::tunnels.CountOutboundTunnels();
 		clientTunnelCount += i2p::tunnel::tunnels.CountInboundTunnels();
@@ -709,10 +733,26 @@ namespace http {
 
 	void ShowTransitTunnels (std::stringstream& s)
 	{
-		if(i2p::tunnel::tunnels.CountTransitTunnels())
+		auto stats = i2p::tunnel::tunnels.GetTunnelBuildStats ();
+		s << "<b>" << tr("Build requests") << ":</b> " << stats.numRequests << " (" << tr("accepted") << ": " << stats.numAccepted
+			<< ", " << tr("rejected") << ": " << stats.numRejected << ", " << tr("queue full") << ": " << stats.numQueueRejected
+			<< ", " << tr("dropped") << ": " << stats.numDropped << ")<br>\r\n";
+		s << "<b>" << tr("Build queue size") << ":</b> " << i2p::tunnel::tunnels.GetBuildQueueSize () << "<br>\r\n";
+		auto numHandled = stats.numAccepted + stats.numRejected;
+		if (numHandled)
+		{
+			const char * stages[] = { "queue", "decrypt", "accept", "reply" };
+			s << "<b>" << tr("Build request stages") << ":</b>";
+			for (int i = 0; i < i2p::tunnel::eNumTunnelBuildStages; i++)
+				s << " " << tr(stages[i]) << " " << stats.stageTimes[i]/numHandled << tr(/* tr: Microseconds */ "us");
+			s << "<br>\r\n";
+		}
+		s << "<br>\r\n";
+		auto transitTunnels = i2p::tunnel::tunnels.GetTransitTunnels ();
+		if (!transitTunnels.empty ())
 		{
 			s << "<b>" << tr("Transit Tunnels") << ":</b><br>\r\n<div class=\"list\">\r\n";
-			for (const auto& it: i2p::tunnel::tunnels.GetTransitTunnels ())
+			for (const auto& it: transitTunnels)
 			{
 				s << "<div class=\"listitem\">\r\n";
 				if (std::dynamic_pointer_cast<i2p::tunnel::TransitTunnelGateway>(it))
@@ -799,6 +839,9 @@ namespace http {
 					s << endpoint.address ().to_string () << ":" << endpoint.port ();
 					if (!it.second->IsOutgoing ()) s << " &#8658; ";
 					s << " [" << it.second->GetNumSentBytes () << ":" << it.second->GetNumReceivedBytes () << "]";
+					if (it.second->GetRTT () >= 0)
+						s << " [rtt:" << (int)it.second->GetRTT () << tr(/* tr: Milliseconds */ "ms") << "]";
+					s << " [cwnd:" << it.second->GetCongestionWindow ()/1024 << tr(/* tr: Kibibit */ "KiB") << "]";
 					if (it.second->GetRelayTag ())
 						s << " [itag:" << it.second->GetRelayTag () << "]";
 					s << "</div>\r\n" << std::endl;
@@ -817,6 +860,9 @@ namespace http {
 					s << "[" << endpoint.address ().to_string () << "]:" << endpoint.port ();
 					if (!it.second->IsOutgoing ()) s << " &#8658; ";
 					s << " [" << it.second->GetNumSentBytes () << ":" << it.second->GetNumReceivedBytes () << "]";
+					if (it.second->GetRTT () >= 0)
+						s << " [rtt:" << (int)it.second->GetRTT () << tr(/* tr: Milliseconds */ "ms") << "]";
+					s << " [cwnd:" << it.second->GetCongestionWindow ()/1024 << tr(/* tr: Kibibit */ "KiB") << "]";
 					if (it.second->GetRelayTag ())
 						s << " [itag:" << it.second->GetRelayTag () << "]";
 					s << "</div>\r\n" << std::endl;
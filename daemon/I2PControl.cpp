@@ -450,7 +450,7 @@ namespace client
 
 	void I2PControlService::TunnelsParticipatingHandler (std::ostringstream& results)
 	{
-		int transit = i2p::tunnel::tunnels.GetTransitTunnels ().size ();
+		int transit = i2p::tunnel::tunnels.CountTransitTunnels ();
 		InsertParam (results, "i2p.router.net.tunnels.participating", transit);
 	}
 
@@ -1,11 +1,12 @@
 /*
-* Copyright (c) 2013-2020, The PurpleI2P Project
+* Copyright (c) 2013-2022, The PurpleI2P Project
 *
 * This file is part of Purple i2pd project and licensed under BSD3
 *
 * See full license text in LICENSE file at top of project tree
 */
 
+#include <inttypes.h>
 #include "CPU.h"
 #if defined(__x86_64__) || defined(__i386__)
 #include <cpuid.h>
@@ -18,6 +19,15 @@
 #ifndef bit_AVX
 #define bit_AVX (1 << 28)
 #endif
+#ifndef bit_OSXSAVE
+#define bit_OSXSAVE (1 << 27)
+#endif
+#ifndef bit_AVX512F
+#define bit_AVX512F (1 << 16)
+#endif
+#ifndef bit_VAES
+#define bit_VAES (1 << 9)
+#endif
 
 
 namespace i2p
@@ -26,6 +36,22 @@ namespace cpu
 {
 	bool aesni = false;
 	bool avx = false;
+	bool vaes = false;
+
+#if defined(__x86_64__)
+	static bool IsAVX512Supported ()
+	{
+		int info[4];
+		__cpuid(0x00000001, info[0], info[1], info[2], info[3]);
+		if (!(info[2] & bit_OSXSAVE)) return false;
+		uint32_t xcr0, edx;
+		__asm__ ("xgetbv" : "=a"(xcr0), "=d"(edx) : "c"(0));
+		if ((xcr0 & 0xE6) != 0xE6) return false; // OS saves XMM, YMM, opmask and ZMM state
+		if (__get_cpuid_max (0, nullptr) < 7) return false;
+		__cpuid_count(7, 0, info[0], info[1], info[2], info[3]);
+		return (info[1] & bit_AVX512F) && (info[2] & bit_VAES);
+	}
+#endif
 
 	void Detect(bool AesSwitch, bool AvxSwitch, bool force)
 	{
@@ -49,10 +75,16 @@ namespace cpu
 				avx = true;
 			}
 		}
+#if defined(__x86_64__)
+		// never forced, illegal instruction otherwise
+		if (aesni && avx && IsAVX512Supported ())
+			vaes = true;
+#endif
 #endif // defined(__x86_64__) || defined(__i386__)
 
 		LogPrint(eLogInfo, "AESNI ", (aesni ? "enabled" : "disabled"));
 		LogPrint(eLogInfo, "AVX ", (avx ? "enabled" : "disabled"));
+		LogPrint(eLogInfo, "VAES ", (vaes ? "enabled" : "disabled"));
 	}
 }
 }
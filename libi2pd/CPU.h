@@ -1,5 +1,5 @@
 /*
-* Copyright (c) 2013-2020, The PurpleI2P Project
+* Copyright (c) 2013-2022, The PurpleI2P Project
 *
 * This file is part of Purple i2pd project and licensed under BSD3
 *
@@ -15,6 +15,7 @@ namespace cpu
 {
 	extern bool aesni;
 	extern bool avx;
+	extern bool vaes; // VAES with AVX-512 registers
 
 	void Detect(bool AesSwitch, bool AvxSwitch, bool force);
 }
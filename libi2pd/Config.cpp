@@ -81,6 +81,11 @@ namespace config {
 			("limits.ntcpsoft", value<uint16_t>()->default_value(0),          "Threshold to start probabilistic backoff with ntcp sessions (default: use system limit)")
 			("limits.ntcphard", value<uint16_t>()->default_value(0),          "Maximum number of ntcp sessions (default: use system limit)")
 			("limits.ntcpthreads", value<uint16_t>()->default_value(1),       "Maximum number of threads used by NTCP DH worker (default: 1)")
+			("limits.tunnelthreads", value<uint16_t>()->default_value(0),     "Number of threads handling tunnel data (default: 0 - use tunnels thread)")
+			("limits.ssuthreads", value<uint16_t>()->default_value(1),        "Number of SSU threads and sockets per address family (default: 1)")
+			("limits.tunnelbuildthreads", value<uint16_t>()->default_value(1), "Number of threads decrypting tunnel build requests (default: 1, 0 - use tunnels thread)")
+			("limits.tunnelbuildqueue", value<uint16_t>()->default_value(256), "Build requests queued before rejecting, dropped above twice of it (default: 256)")
+			("limits.destinationthreads", value<uint16_t>()->default_value(0), "Number of threads running client destinations (default: 0 - thread per destination)")
 		;
 
 		options_description httpserver("HTTP Server options");
@@ -274,6 +279,7 @@ namespace config {
 		ntcp2.add_options()
 			("ssu2.enabled", value<bool>()->default_value(false),         "Enable SSU2 (default: disabled)")
 			("ssu2.port", value<uint16_t>()->default_value(0),            "Port to listen for incoming SSU2 packets (default: auto)")
+			("ssu2.offload", value<bool>()->default_value(true),          "Use UDP segmentation and receive offload if supported (default: enabled)")
 		;
 		
 		options_description nettime("Time sync options");
@@ -293,6 +299,7 @@ namespace config {
 		persist.add_options()
 			("persist.profiles", value<bool>()->default_value(true),       "Persist peer profiles (default: true)")
 			("persist.addressbook", value<bool>()->default_value(true),    "Persist full addresses (default: true)")
+			("persist.netdbsnapshot", value<bool>()->default_value(false), "Keep netDb in single memory-mapped snapshot file as well (default: false)")
 		;
 
 		options_description cpuext("CPU encryption extensions options");
@@ -808,6 +808,88 @@ namespace crypto
 		"aesdeclast (%["#sched"]), %%xmm0 \n"
 #endif
 
+#if defined(__AES__) && defined(__x86_64__)
+	#define AESx4(op, offset, sched) \
+		#op" "#offset"(%["#sched"]), %%xmm0 \n" \
+		#op" "#offset"(%["#sched"]), %%xmm1 \n" \
+		#op" "#offset"(%["#sched"]), %%xmm2 \n" \
+		#op" "#offset"(%["#sched"]), %%xmm3 \n"
+
+	#define EncryptAES256x4(sched) \
+		AESx4(pxor, 0, sched) \
+		AESx4(aesenc, 16, sched) \
+		AESx4(aesenc, 32, sched) \
+		AESx4(aesenc, 48, sched) \
+		AESx4(aesenc, 64, sched) \
+		AESx4(aesenc, 80, sched) \
+		AESx4(aesenc, 96, sched) \
+		AESx4(aesenc, 112, sched) \
+		AESx4(aesenc, 128, sched) \
+		AESx4(aesenc, 144, sched) \
+		AESx4(aesenc, 160, sched) \
+		AESx4(aesenc, 176, sched) \
+		AESx4(aesenc, 192, sched) \
+		AESx4(aesenc, 208, sched) \
+		AESx4(aesenclast, 224, sched)
+
+	#define DecryptAES256x4(sched) \
+		AESx4(pxor, 224, sched) \
+		AESx4(aesdec, 208, sched) \
+		AESx4(aesdec, 192, sched) \
+		AESx4(aesdec, 176, sched) \
+		AESx4(aesdec, 160, sched) \
+		AESx4(aesdec, 144, sched) \
+		AESx4(aesdec, 128, sched) \
+		AESx4(aesdec, 112, sched) \
+		AESx4(aesdec, 96, sched) \
+		AESx4(aesdec, 80, sched) \
+		AESx4(aesdec, 64, sched) \
+		AESx4(aesdec, 48, sched) \
+		AESx4(aesdec, 32, sched) \
+		AESx4(aesdec, 16, sched) \
+		AESx4(aesdeclast, 0, sched)
+
+	// round key is broadcasted to all 4 lanes of zmm2, 8 blocks in zmm0 and zmm1
+	#define VAESx2(op, offset, sched) \
+		"vbroadcasti32x4 "#offset"(%["#sched"]), %%zmm2 \n" \
+		#op" %%zmm2, %%zmm0, %%zmm0 \n" \
+		#op" %%zmm2, %%zmm1, %%zmm1 \n"
+
+	#define EncryptVAES256x2(sched) \
+		VAESx2(vpxorq, 0, sched) \
+		VAESx2(vaesenc, 16, sched) \
+		VAESx2(vaesenc, 32, sched) \
+		VAESx2(vaesenc, 48, sched) \
+		VAESx2(vaesenc, 64, sched) \
+		VAESx2(vaesenc, 80, sched) \
+		VAESx2(vaesenc, 96, sched) \
+		VAESx2(vaesenc, 112, sched) \
+		VAESx2(vaesenc, 128, sched) \
+		VAESx2(vaesenc, 144, sched) \
+		VAESx2(vaesenc, 160, sched) \
+		VAESx2(vaesenc, 176, sched) \
+		VAESx2(vaesenc, 192, sched) \
+		VAESx2(vaesenc, 208, sched) \
+		VAESx2(vaesenclast, 224, sched)
+
+	#define DecryptVAES256x2(sched) \
+		VAESx2(vpxorq, 224, sched) \
+		VAESx2(vaesdec, 208, sched) \
+		VAESx2(vaesdec, 192, sched) \
+		VAESx2(vaesdec, 176, sched) \
+		VAESx2(vaesdec, 160, sched) \
+		VAESx2(vaesdec, 144, sched) \
+		VAESx2(vaesdec, 128, sched) \
+		VAESx2(vaesdec, 112, sched) \
+		VAESx2(vaesdec, 96, sched) \
+		VAESx2(vaesdec, 80, sched) \
+		VAESx2(vaesdec, 64, sched) \
+		VAESx2(vaesdec, 48, sched) \
+		VAESx2(vaesdec, 32, sched) \
+		VAESx2(vaesdec, 16, sched) \
+		VAESx2(vaesdeclast, 0, sched)
+#endif
+
 	void ECBDecryption::Decrypt (const ChipherBlock * in, ChipherBlock * out)
 	{
 #ifdef __AES__
@@ -952,6 +1034,25 @@ namespace crypto
 
 	void CBCDecryption::Decrypt (int numBlocks, const ChipherBlock * in, ChipherBlock * out)
 	{
+#if defined(__AES__) && defined(__x86_64__)
+		// blocks are independent, decrypt 8 or 4 at once, rest one by one
+		if (i2p::cpu::aesni && numBlocks >= 4)
+		{
+			if (i2p::cpu::vaes && numBlocks >= 8)
+			{
+				int num = numBlocks >> 3;
+				DecryptVAESx8 (num, in, out);
+				in += num << 3; out += num << 3; numBlocks &= 7;
+			}
+			if (numBlocks >= 4)
+			{
+				int num = numBlocks >> 2;
+				DecryptAESNIx4 (num, in, out);
+				in += num << 2; out += num << 2; numBlocks &= 3;
+			}
+			if (!numBlocks) return;
+		}
+#endif
 #ifdef __AES__
 		if(i2p::cpu::aesni)
 		{
@@ -989,6 +1090,73 @@ namespace crypto
 		}
 	}
 
+#if defined(__AES__) && defined(__x86_64__)
+	void CBCDecryption::DecryptAESNIx4 (int num, const ChipherBlock * in, ChipherBlock * out)
+	{
+		__asm__ __volatile__ // has outputs
+			(
+				"movups (%[iv]), %%xmm8 \n"
+				"1: \n"
+				"movups (%[in]), %%xmm0 \n"
+				"movups 16(%[in]), %%xmm1 \n"
+				"movups 32(%[in]), %%xmm2 \n"
+				"movups 48(%[in]), %%xmm3 \n"
+				"movaps %%xmm0, %%xmm4 \n"
+				"movaps %%xmm1, %%xmm5 \n"
+				"movaps %%xmm2, %%xmm6 \n"
+				"movaps %%xmm3, %%xmm7 \n"
+				DecryptAES256x4(sched)
+				// xor with previous ciphertext blocks, xmm8 is IV or last block of previous iteration
+				"pxor %%xmm8, %%xmm0 \n"
+				"pxor %%xmm4, %%xmm1 \n"
+				"pxor %%xmm5, %%xmm2 \n"
+				"pxor %%xmm6, %%xmm3 \n"
+				"movaps %%xmm7, %%xmm8 \n"
+				"movups %%xmm0, (%[out]) \n"
+				"movups %%xmm1, 16(%[out]) \n"
+				"movups %%xmm2, 32(%[out]) \n"
+				"movups %%xmm3, 48(%[out]) \n"
+				"add $64, %[in] \n"
+				"add $64, %[out] \n"
+				"dec %[num] \n"
+				"jnz 1b \n"
+				"movups %%xmm8, (%[iv]) \n"
+				: [in]"+r"(in), [out]"+r"(out), [num]"+r"(num)
+				: [iv]"r"((uint8_t *)m_IV), [sched]"r"(m_ECBDecryption.GetKeySchedule ())
+				: "%xmm0", "%xmm1", "%xmm2", "%xmm3", "%xmm4", "%xmm5", "%xmm6", "%xmm7", "%xmm8", "cc", "memory"
+			);
+	}
+
+	void CBCDecryption::DecryptVAESx8 (int num, const ChipherBlock * in, ChipherBlock * out)
+	{
+		__asm__ __volatile__ // has outputs
+			(
+				"vbroadcasti32x4 (%[iv]), %%zmm8 \n" // IV in lane 3
+				"1: \n"
+				"vmovdqu64 (%[in]), %%zmm0 \n"
+				"vmovdqu64 64(%[in]), %%zmm1 \n"
+				// previous ciphertext blocks, shifted by one lane
+				"valignq $6, %%zmm8, %%zmm0, %%zmm4 \n"
+				"valignq $6, %%zmm0, %%zmm1, %%zmm5 \n"
+				"vmovdqa64 %%zmm1, %%zmm8 \n"
+				DecryptVAES256x2(sched)
+				"vpxorq %%zmm4, %%zmm0, %%zmm0 \n"
+				"vpxorq %%zmm5, %%zmm1, %%zmm1 \n"
+				"vmovdqu64 %%zmm0, (%[out]) \n"
+				"vmovdqu64 %%zmm1, 64(%[out]) \n"
+				"add $128, %[in] \n"
+				"add $128, %[out] \n"
+				"dec %[num] \n"
+				"jnz 1b \n"
+				"vextracti32x4 $3, %%zmm8, (%[iv]) \n"
+				"vzeroupper \n"
+				: [in]"+r"(in), [out]"+r"(out), [num]"+r"(num)
+				: [iv]"r"((uint8_t *)m_IV), [sched]"r"(m_ECBDecryption.GetKeySchedule ())
+				: "%xmm0", "%xmm1", "%xmm2", "%xmm4", "%xmm5", "%xmm8", "cc", "memory"
+			);
+	}
+#endif
+
 	void CBCDecryption::Decrypt (const uint8_t * in, std::size_t len, uint8_t * out)
 	{
 		int numBlocks = len >> 4;
@@ -1061,9 +1229,157 @@ namespace crypto
 		}
 	}
 
+	void TunnelEncryption::Encrypt (int num, const uint8_t * const * in, uint8_t * const * out)
+	{
+		int i = 0;
+#if defined(__AES__) && defined(__x86_64__)
+		if(i2p::cpu::aesni)
+		{
+			if (i2p::cpu::vaes)
+				for (; i + 8 <= num; i += 8)
+					EncryptVAESx8 (in + i, out + i);
+			for (; i + 4 <= num; i += 4)
+				EncryptAESNIx4 (in + i, out + i);
+		}
+#endif
+		for (; i < num; i++)
+			Encrypt (in[i], out[i]);
+	}
+
+#if defined(__AES__) && defined(__x86_64__)
+	// xmm0-3 ^= block at offset off of each message
+	#define XorBlocksx4(ptrs) \
+		"mov (%["#ptrs"]), %[tmp] \n" \
+		"movups (%[tmp],%[off]), %%xmm4 \n" \
+		"pxor %%xmm4, %%xmm0 \n" \
+		"mov 8(%["#ptrs"]), %[tmp] \n" \
+		"movups (%[tmp],%[off]), %%xmm4 \n" \
+		"pxor %%xmm4, %%xmm1 \n" \
+		"mov 16(%["#ptrs"]), %[tmp] \n" \
+		"movups (%[tmp],%[off]), %%xmm4 \n" \
+		"pxor %%xmm4, %%xmm2 \n" \
+		"mov 24(%["#ptrs"]), %[tmp] \n" \
+		"movups (%[tmp],%[off]), %%xmm4 \n" \
+		"pxor %%xmm4, %%xmm3 \n"
+
+	#define StoreBlocksx4(ptrs) \
+		"mov (%["#ptrs"]), %[tmp] \n" \
+		"movups %%xmm0, (%[tmp],%[off]) \n" \
+		"mov 8(%["#ptrs"]), %[tmp] \n" \
+		"movups %%xmm1, (%[tmp],%[off]) \n" \
+		"mov 16(%["#ptrs"]), %[tmp] \n" \
+		"movups %%xmm2, (%[tmp],%[off]) \n" \
+		"mov 24(%["#ptrs"]), %[tmp] \n" \
+		"movups %%xmm3, (%[tmp],%[off]) \n"
+
+	void TunnelEncryption::EncryptAESNIx4 (const uint8_t * const * in, uint8_t * const * out)
+	{
+		size_t off, tmp;
+		__asm__ __volatile__ // has outputs
+			(
+				// encrypt IVs
+				"xor %[off], %[off] \n"
+				"pxor %%xmm0, %%xmm0 \n"
+				"pxor %%xmm1, %%xmm1 \n"
+				"pxor %%xmm2, %%xmm2 \n"
+				"pxor %%xmm3, %%xmm3 \n"
+				XorBlocksx4(in)
+				EncryptAES256x4(sched_iv)
+				"movaps %%xmm0, %%xmm5 \n"
+				"movaps %%xmm1, %%xmm6 \n"
+				"movaps %%xmm2, %%xmm7 \n"
+				"movaps %%xmm3, %%xmm8 \n"
+				// double IV encryption
+				EncryptAES256x4(sched_iv)
+				StoreBlocksx4(out)
+				// encrypt data, IVs are xmm5-8
+				"movaps %%xmm5, %%xmm0 \n"
+				"movaps %%xmm6, %%xmm1 \n"
+				"movaps %%xmm7, %%xmm2 \n"
+				"movaps %%xmm8, %%xmm3 \n"
+				"1: \n"
+				"add $16, %[off] \n"
+				XorBlocksx4(in)
+				EncryptAES256x4(sched_l)
+				StoreBlocksx4(out)
+				"cmp $1008, %[off] \n" // 63 blocks = 1008 bytes
+				"jne 1b \n"
+				: [off]"=&r"(off), [tmp]"=&r"(tmp)
+				: [sched_iv]"r"(m_IVEncryption.GetKeySchedule ()), [sched_l]"r"(m_LayerEncryption.ECB().GetKeySchedule ()),
+					[in]"r"(in), [out]"r"(out)
+				: "%xmm0", "%xmm1", "%xmm2", "%xmm3", "%xmm4", "%xmm5", "%xmm6", "%xmm7", "%xmm8", "cc", "memory"
+			);
+	}
+
+	#define LoadLanesx4(ptrs, first, zreg, xreg) \
+		"mov "#first"(%["#ptrs"]), %[tmp] \n" \
+		"vmovdqu (%[tmp],%[off]), %%"#xreg" \n" \
+		"mov "#first"+8(%["#ptrs"]), %[tmp] \n" \
+		"vinserti32x4 $1, (%[tmp],%[off]), %%"#zreg", %%"#zreg" \n" \
+		"mov "#first"+16(%["#ptrs"]), %[tmp] \n" \
+		"vinserti32x4 $2, (%[tmp],%[off]), %%"#zreg", %%"#zreg" \n" \
+		"mov "#first"+24(%["#ptrs"]), %[tmp] \n" \
+		"vinserti32x4 $3, (%[tmp],%[off]), %%"#zreg", %%"#zreg" \n"
+
+	#define StoreLanesx4(ptrs, first, zreg, xreg) \
+		"mov "#first"(%["#ptrs"]), %[tmp] \n" \
+		"vmovdqu %%"#xreg", (%[tmp],%[off]) \n" \
+		"mov "#first"+8(%["#ptrs"]), %[tmp] \n" \
+		"vextracti32x4 $1, %%"#zreg", (%[tmp],%[off]) \n" \
+		"mov "#first"+16(%["#ptrs"]), %[tmp] \n" \
+		"vextracti32x4 $2, %%"#zreg", (%[tmp],%[off]) \n" \
+		"mov "#first"+24(%["#ptrs"]), %[tmp] \n" \
+		"vextracti32x4 $3, %%"#zreg", (%[tmp],%[off]) \n"
+
+	// zmm0,1 ^= block at offset off of each message
+	#define XorBlocksVAESx8(ptrs) \
+		LoadLanesx4(ptrs, 0, zmm2, xmm2) \
+		"vpxorq %%zmm2, %%zmm0, %%zmm0 \n" \
+		LoadLanesx4(ptrs, 32, zmm3, xmm3) \
+		"vpxorq %%zmm3, %%zmm1, %%zmm1 \n"
+
+	#define StoreBlocksVAESx8(ptrs) \
+		StoreLanesx4(ptrs, 0, zmm0, xmm0) \
+		StoreLanesx4(ptrs, 32, zmm1, xmm1)
+
+	void TunnelEncryption::EncryptVAESx8 (const uint8_t * const * in, uint8_t * const * out)
+	{
+		size_t off, tmp;
+		__asm__ __volatile__ // has outputs
+			(
+				// encrypt IVs
+				"xor %[off], %[off] \n"
+				"vpxorq %%zmm0, %%zmm0, %%zmm0 \n"
+				"vpxorq %%zmm1, %%zmm1, %%zmm1 \n"
+				XorBlocksVAESx8(in)
+				EncryptVAES256x2(sched_iv)
+				"vmovdqa64 %%zmm0, %%zmm4 \n"
+				"vmovdqa64 %%zmm1, %%zmm5 \n"
+				// double IV encryption
+				EncryptVAES256x2(sched_iv)
+				StoreBlocksVAESx8(out)
+				// encrypt data, IVs are zmm4 and zmm5
+				"vmovdqa64 %%zmm4, %%zmm0 \n"
+				"vmovdqa64 %%zmm5, %%zmm1 \n"
+				"1: \n"
+				"add $16, %[off] \n"
+				XorBlocksVAESx8(in)
+				EncryptVAES256x2(sched_l)
+				StoreBlocksVAESx8(out)
+				"cmp $1008, %[off] \n" // 63 blocks = 1008 bytes
+				"jne 1b \n"
+				"vzeroupper \n"
+				: [off]"=&r"(off), [tmp]"=&r"(tmp)
+				: [sched_iv]"r"(m_IVEncryption.GetKeySchedule ()), [sched_l]"r"(m_LayerEncryption.ECB().GetKeySchedule ()),
+					[in]"r"(in), [out]"r"(out)
+				: "%xmm0", "%xmm1", "%xmm2", "%xmm3", "%xmm4", "%xmm5", "cc", "memory"
+			);
+	}
+#endif
+
 	void TunnelDecryption::Decrypt (const uint8_t * in, uint8_t * out)
 	{
-#ifdef __AES__
+#if defined(__AES__) && !defined(__x86_64__)
 		if(i2p::cpu::aesni)
 		{
 			__asm__
@@ -1096,6 +1412,7 @@ namespace crypto
 		else
 #endif
 		{
+			// data blocks are decrypted in parallel with AES-NI on x86_64
 			m_IVDecryption.Decrypt ((const ChipherBlock *)in, (ChipherBlock *)out); // iv
 			m_LayerDecryption.SetIV (out);
 			m_LayerDecryption.Decrypt (in + 16, i2p::tunnel::TUNNEL_DATA_ENCRYPTED_SIZE, out + 16); // data
@@ -1103,6 +1420,116 @@ namespace crypto
 		}
 	}
 
+	void TunnelDecryption::Decrypt (int numLayers, TunnelDecryption * const * layers, const uint8_t * in, uint8_t * out)
+	{
+#if defined(__AES__) && defined(__x86_64__)
+		// with AES-NI only hop by hop is not slower, CBC blocks of layer are decrypted in parallel
+		if (i2p::cpu::vaes && numLayers > 1 && numLayers <= MAX_NUM_FUSED_TUNNEL_LAYERS)
+		{
+			// IV goes through all layers first, then groups of 16 data blocks go through all layers
+			// while in registers, CBC chain of every layer continues from prev
+			uint8_t * scheds[MAX_NUM_FUSED_TUNNEL_LAYERS];
+			AESAlignedBuffer<16*MAX_NUM_FUSED_TUNNEL_LAYERS> prevBuf;
+			auto prev = prevBuf.GetChipherBlock ();
+			ChipherBlock iv = *(const ChipherBlock *)in;
+			for (int i = 0; i < numLayers; i++)
+			{
+				auto layer = layers[i];
+				layer->m_IVDecryption.Decrypt (&iv, &iv);
+				prev[i] = iv; // IV of layer
+				layer->m_IVDecryption.Decrypt (&iv, &iv); // double iv
+				scheds[i] = layer->m_LayerDecryption.ECB ().GetKeySchedule ();
+			}
+			// 63 data blocks and one more, result of last one is not used
+			AESAlignedBuffer<i2p::tunnel::TUNNEL_DATA_ENCRYPTED_SIZE + 16> blocks;
+			memcpy (blocks, in + 16, i2p::tunnel::TUNNEL_DATA_ENCRYPTED_SIZE);
+			const int numBlocks = (i2p::tunnel::TUNNEL_DATA_ENCRYPTED_SIZE + 16) >> 4; // 64
+			DecryptLayersVAESx16 (numLayers, scheds, prev, numBlocks >> 4, blocks.GetChipherBlock ());
+			memcpy (out, &iv, 16);
+			memcpy (out + 16, blocks, i2p::tunnel::TUNNEL_DATA_ENCRYPTED_SIZE);
+			return;
+		}
+#endif
+		for (int i = 0; i < numLayers; i++)
+		{
+			layers[i]->Decrypt (in, out);
+			in = out;
+		}
+	}
+
+#if defined(__AES__) && defined(__x86_64__)
+	// round key is broadcasted to all 4 lanes of zmm8, 16 blocks in zmm0, zmm1, zmm2 and zmm3
+	#define VAESx4(op, offset, sched) \
+		"vbroadcasti32x4 "#offset"(%["#sched"]), %%zmm8 \n" \
+		#op" %%zmm8, %%zmm0, %%zmm0 \n" \
+		#op" %%zmm8, %%zmm1, %%zmm1 \n" \
+		#op" %%zmm8, %%zmm2, %%zmm2 \n" \
+		#op" %%zmm8, %%zmm3, %%zmm3 \n"
+
+	#define DecryptVAES256x4(sched) \
+		VAESx4(vpxorq, 224, sched) \
+		VAESx4(vaesdec, 208, sched) \
+		VAESx4(vaesdec, 192, sched) \
+		VAESx4(vaesdec, 176, sched) \
+		VAESx4(vaesdec, 160, sched) \
+		VAESx4(vaesdec, 144, sched) \
+		VAESx4(vaesdec, 128, sched) \
+		VAESx4(vaesdec, 112, sched) \
+		VAESx4(vaesdec, 96, sched) \
+		VAESx4(vaesdec, 80, sched) \
+		VAESx4(vaesdec, 64, sched) \
+		VAESx4(vaesdec, 48, sched) \
+		VAESx4(vaesdec, 32, sched) \
+		VAESx4(vaesdec, 16, sched) \
+		VAESx4(vaesdeclast, 0, sched)
+
+	void TunnelDecryption::DecryptLayersVAESx16 (int numLayers, uint8_t * const * scheds, ChipherBlock * prev,
+		int num, ChipherBlock * blocks)
+	{
+		uint8_t * sched; uint8_t * const * s; ChipherBlock * p; long l;
+		__asm__ __volatile__ // has outputs
+			(
+				"1: \n"
+				"vmovdqu64 (%[blocks]), %%zmm0 \n"
+				"vmovdqu64 64(%[blocks]), %%zmm1 \n"
+				"vmovdqu64 128(%[blocks]), %%zmm2 \n"
+				"vmovdqu64 192(%[blocks]), %%zmm3 \n"
+				"mov %[scheds], %[s] \n"
+				"mov %[prev], %[p] \n"
+				"mov %[numLayers], %[l] \n"
+				"2: \n"
+				// next layer, previous ciphertext blocks shifted by one lane
+				"mov (%[s]), %[sched] \n"
+				"vbroadcasti32x4 (%[p]), %%zmm8 \n"
+				"valignq $6, %%zmm8, %%zmm0, %%zmm4 \n"
+				"valignq $6, %%zmm0, %%zmm1, %%zmm5 \n"
+				"valignq $6, %%zmm1, %%zmm2, %%zmm6 \n"
+				"valignq $6, %%zmm2, %%zmm3, %%zmm7 \n"
+				"vextracti32x4 $3, %%zmm3, (%[p]) \n"
+				DecryptVAES256x4(sched)
+				"vpxorq %%zmm4, %%zmm0, %%zmm0 \n"
+				"vpxorq %%zmm5, %%zmm1, %%zmm1 \n"
+				"vpxorq %%zmm6, %%zmm2, %%zmm2 \n"
+				"vpxorq %%zmm7, %%zmm3, %%zmm3 \n"
+				"add $8, %[s] \n"
+				"add $16, %[p] \n"
+				"dec %[l] \n"
+				"jnz 2b \n"
+				"vmovdqu64 %%zmm0, (%[blocks]) \n"
+				"vmovdqu64 %%zmm1, 64(%[blocks]) \n"
+				"vmovdqu64 %%zmm2, 128(%[blocks]) \n"
+				"vmovdqu64 %%zmm3, 192(%[blocks]) \n"
+				"add $256, %[blocks] \n"
+				"dec %[num] \n"
+				"jnz 1b \n"
+				"vzeroupper \n"
+				: [blocks]"+r"(blocks), [num]"+r"(num), [sched]"=&r"(sched), [s]"=&r"(s), [p]"=&r"(p), [l]"=&r"(l)
+				: [scheds]"r"(scheds), [prev]"r"(prev), [numLayers]"r"((long)numLayers)
+				: "%xmm0", "%xmm1", "%xmm2", "%xmm3", "%xmm4", "%xmm5", "%xmm6", "%xmm7", "%xmm8", "cc", "memory"
+			);
+	}
+#endif
+
 // AEAD/ChaCha20/Poly1305
 
 	bool AEADChaCha20Poly1305 (const uint8_t * msg, size_t msgLen, const uint8_t * ad, size_t adLen, const uint8_t * key, const uint8_t * nonce, uint8_t * buf, size_t len, bool encrypt)
@@ -1267,6 +1694,69 @@ namespace crypto
 #endif
 	}
 
+	class RandomGenerator
+	{
+		public:
+
+			RandomGenerator (): m_Offset (RANDOM_BUFFER_SIZE), m_NumGenerated (RANDOM_RESEED_INTERVAL) {};
+			~RandomGenerator ()
+			{
+				memset (m_Key, 0, 32);
+				memset (m_Buffer, 0, RANDOM_BUFFER_SIZE);
+			}
+
+			void GetBytes (uint8_t * buf, size_t len)
+			{
+				while (len > 0)
+				{
+					if (m_Offset >= RANDOM_BUFFER_SIZE) Refill ();
+					size_t l = RANDOM_BUFFER_SIZE - m_Offset;
+					if (l > len) l = len;
+					memcpy (buf, m_Buffer + m_Offset, l);
+					memset (m_Buffer + m_Offset, 0, l); // don't keep handed out bytes
+					m_Offset += l;
+					buf += l; len -= l;
+				}
+			}
+
+		private:
+
+			void Refill ()
+			{
+				if (m_NumGenerated >= RANDOM_RESEED_INTERVAL)
+				{
+					RAND_bytes (m_Key, 32);
+					m_NumGenerated = 0;
+				}
+				static const uint8_t nonce[12] = { 0 }; // key is never reused
+				memset (m_Buffer, 0, RANDOM_BUFFER_SIZE);
+				ChaCha20 (m_Buffer, RANDOM_BUFFER_SIZE, m_Key, nonce, m_Buffer);
+				memcpy (m_Key, m_Buffer, 32); // next key, previous output can't be recovered
+				memset (m_Buffer, 0, 32);
+				m_Offset = 32;
+				m_NumGenerated += RANDOM_BUFFER_SIZE;
+			}
+
+		private:
+
+			uint8_t m_Key[32], m_Buffer[RANDOM_BUFFER_SIZE];
+			size_t m_Offset, m_NumGenerated;
+	};
+
+	static thread_local RandomGenerator g_RandomGenerator;
+
+	void RandBytes (uint8_t * buf, size_t len)
+	{
+		g_RandomGenerator.GetBytes (buf, len);
+	}
+
+	uint32_t RandUInt32 ()
+	{
+		uint32_t r;
+		g_RandomGenerator.GetBytes ((uint8_t *)&r, 4);
+		return r;
+	}
+
 	void HKDF (const uint8_t * salt, const uint8_t * key, size_t keyLen, const std::string& info,
 		uint8_t * out, size_t outLen)
 	{
@@ -259,6 +259,13 @@ namespace crypto
 
 		private:
 
+#if defined(__AES__) && defined(__x86_64__)
+			void DecryptAESNIx4 (int num, const ChipherBlock * in, ChipherBlock * out); // num*4 blocks
+			void DecryptVAESx8 (int num, const ChipherBlock * in, ChipherBlock * out); // num*8 blocks
+#endif
+
+		private:
+
 			AESAlignedBuffer<16> m_IV;
 			ECBDecryption m_ECBDecryption;
 	};
@@ -274,6 +281,14 @@ namespace crypto
 			}
 
 			void Encrypt (const uint8_t * in, uint8_t * out); // 1024 bytes (16 IV + 1008 data)
+			void Encrypt (int num, const uint8_t * const * in, uint8_t * const * out); // num independent messages, 1024 bytes each
+
+		private:
+
+#if defined(__AES__) && defined(__x86_64__)
+			void EncryptAESNIx4 (const uint8_t * const * in, uint8_t * const * out); // 4 CBC chains interleaved
+			void EncryptVAESx8 (const uint8_t * const * in, uint8_t * const * out); // 8 CBC chains in 2 zmm registers
+#endif
 
 		private:
 
@@ -281,6 +296,7 @@ namespace crypto
 			CBCEncryption m_LayerEncryption;
 	};
 
+	const int MAX_NUM_FUSED_TUNNEL_LAYERS = 8;
 	class TunnelDecryption // with double IV encryption
 	{
 		public:
@@ -292,6 +308,15 @@ namespace crypto
 			}
 
 			void Decrypt (const uint8_t * in, uint8_t * out); // 1024 bytes (16 IV + 1008 data)
+			static void Decrypt (int numLayers, TunnelDecryption * const * layers, const uint8_t * in, uint8_t * out); // layers in order, all at once
+
+		private:
+
+#if defined(__AES__) && defined(__x86_64__)
+			// through every layer with previous ciphertext block in prev
+			static void DecryptLayersVAESx16 (int numLayers, uint8_t * const * scheds, ChipherBlock * prev,
+				int num, ChipherBlock * blocks); // num*16 blocks in 4 zmm registers, in place
+#endif
 
 		private:
 
@@ -307,6 +332,15 @@ namespace crypto
 // ChaCha20
 	void ChaCha20 (const uint8_t * msg, size_t msgLen, const uint8_t * key, const uint8_t * nonce, uint8_t * out);
 
+// Random
+	const size_t RANDOM_BUFFER_SIZE = 1024; // ChaCha20 keystream generated at once
+	const size_t RANDOM_RESEED_INTERVAL = 1024*1024; // generated bytes before new key from RAND_bytes
+
+	/** thread local ChaCha20 keystream, key is replaced from keystream after every refill and reseeded from RAND_bytes.
+	 *  No locks. For IVs, padding, nonces and message IDs, long term keys must use RAND_bytes */
+	void RandBytes (uint8_t * buf, size_t len);
+	uint32_t RandUInt32 ();
+
 // HKDF
 
 	void HKDF (const uint8_t * salt, const uint8_t * key, size_t keyLen, const std::string& info, uint8_t * out, size_t outLen = 64); // salt - 32, out - 32 or 64, info <= 32
@@ -897,6 +897,7 @@ namespace client
 		LeaseSetDestination (service, isPublic, params),
 		m_Keys (keys), m_StreamingAckDelay (DEFAULT_INITIAL_ACK_DELAY),
 		m_IsStreamingAnswerPings (DEFAULT_ANSWER_PINGS),
+		m_StreamingCongestionControl (i2p::stream::eCongestionControlReno),
 		m_DatagramDestination (nullptr), m_RefCounter (0),
 		m_ReadyChecker(service)
 	{
@@ -967,6 +968,9 @@ namespace client
 				it = params->find (I2CP_PARAM_STREAMING_ANSWER_PINGS);
 				if (it != params->end ())
 					i2p::config::GetOption (it->second, m_IsStreamingAnswerPings);
+				it = params->find (I2CP_PARAM_STREAMING_CONGESTION_CONTROL);
+				if (it != params->end ())
+					m_StreamingCongestionControl = i2p::stream::GetCongestionControlType (it->second);
 
 				if (GetLeaseSetType () == i2p::data::NETDB_STORE_TYPE_ENCRYPTED_LEASESET2)
 				{
@@ -1353,33 +1357,40 @@ namespace client
 		return false;
 	}
 
+	i2p::util::RunnableServicePool destinationsPool ("Destinations");
+
 	RunnableClientDestination::RunnableClientDestination (const i2p::data::PrivateKeys& keys, bool isPublic, const std::map<std::string, std::string> * params):
 		RunnableService ("Destination"),
-		ClientDestination (GetIOService (), keys, isPublic, params)
+		ClientDestination (destinationsPool.Acquire (GetIOService ()), keys, isPublic, params),
+		m_IsPooled (&GetService () != &GetIOService ()), m_IsStarted (false)
 	{
 	}
 
 	RunnableClientDestination::~RunnableClientDestination ()
 	{
-		if (IsRunning ())
+		if (m_IsStarted)
 			Stop ();
+		if (m_IsPooled)
+			destinationsPool.Release (GetService ());
 	}
 
 	void RunnableClientDestination::Start ()
 	{
-		if (!IsRunning ())
+		if (!m_IsStarted)
 		{
+			m_IsStarted = true;
 			ClientDestination::Start ();
-			StartIOService ();
+			if (!m_IsPooled) StartIOService ();
 		}
 	}
 
 	void RunnableClientDestination::Stop ()
 	{
-		if (IsRunning ())
+		if (m_IsStarted)
 		{
+			m_IsStarted = false;
 			ClientDestination::Stop ();
-			StopIOService ();
+			if (!m_IsPooled) StopIOService ();
 		}
 	}
 
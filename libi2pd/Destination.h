@@ -85,6 +85,8 @@ namespace client
 	const int DEFAULT_INITIAL_ACK_DELAY = 200; // milliseconds
 	const char I2CP_PARAM_STREAMING_ANSWER_PINGS[] = "i2p.streaming.answerPings";
 	const int DEFAULT_ANSWER_PINGS = true;
+	const char I2CP_PARAM_STREAMING_CONGESTION_CONTROL[] = "i2p.streaming.congestionControl";
+	const char DEFAULT_STREAMING_CONGESTION_CONTROL[] = "reno"; // or bbr
 
 	typedef std::function<void (std::shared_ptr<i2p::stream::Stream> stream)> StreamRequestComplete;
 
@@ -255,6 +257,7 @@ namespace client
 			void AcceptOnce (const i2p::stream::StreamingDestination::Acceptor& acceptor);
 			int GetStreamingAckDelay () const { return m_StreamingAckDelay; }
 			bool IsStreamingAnswerPings () const { return m_IsStreamingAnswerPings; }
+			i2p::stream::CongestionControlType GetStreamingCongestionControl () const { return m_StreamingCongestionControl; }
 
 			// datagram
 			i2p::datagram::DatagramDestination * GetDatagramDestination () const { return m_DatagramDestination; };
@@ -289,6 +292,7 @@ namespace client
 
 			int m_StreamingAckDelay;
 			bool m_IsStreamingAnswerPings;
+			i2p::stream::CongestionControlType m_StreamingCongestionControl;
 			std::shared_ptr<i2p::stream::StreamingDestination> m_StreamingDestination; // default
 			std::map<uint16_t, std::shared_ptr<i2p::stream::StreamingDestination> > m_StreamingDestinationsByPorts;
 			i2p::datagram::DatagramDestination * m_DatagramDestination;
@@ -305,6 +309,7 @@ namespace client
 			bool DeleteStream (uint32_t recvStreamID);
 	};
 
+	/** runs in own thread or in thread from destinationsPool if the pool is running at creation */
 	class RunnableClientDestination: private i2p::util::RunnableService, public ClientDestination
 	{
 		public:
@@ -314,8 +319,15 @@ namespace client
 
 			void Start ();
 			void Stop ();
+			bool IsPooled () const { return m_IsPooled; };
+
+		private:
+
+			bool m_IsPooled, m_IsStarted;
 	};
 
+	extern i2p::util::RunnableServicePool destinationsPool; // limits.destinationthreads
+
 }
 }
 
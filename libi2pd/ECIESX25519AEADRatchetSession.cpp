@@ -1,5 +1,5 @@
 /*
-* Copyright (c) 2013-2021, The PurpleI2P Project
+* Copyright (c) 2013-2022, The PurpleI2P Project
 *
 * This file is part of Purple i2pd project and licensed under BSD3
 *
@@ -164,7 +164,7 @@ namespace garlic
 		GarlicRoutingSession (owner, true)
 	{
 		if (!attachLeaseSetNS) SetLeaseSetUpdateStatus (eLeaseSetUpToDate);
-		RAND_bytes (m_PaddingSizes, 32); m_NextPaddingSize = 0;
+		i2p::crypto::RandBytes (m_PaddingSizes, 32); m_NextPaddingSize = 0;
 	}
 
 	ECIESX25519AEADRatchetSession::~ECIESX25519AEADRatchetSession ()
@@ -896,7 +896,7 @@ namespace garlic
 				paddingSize = m_PaddingSizes[m_NextPaddingSize++] & 0x0F; // 0 - 15
 				if (m_NextPaddingSize >= 32)
 				{
-					RAND_bytes (m_PaddingSizes, 32);
+					i2p::crypto::RandBytes (m_PaddingSizes, 32);
 					m_NextPaddingSize = 0;
 				}
 				if (delta > 3)
@@ -1035,7 +1035,7 @@ namespace garlic
 		buf += 3;
 		*buf = 0; buf++; // flag and delivery instructions
 		*buf = eI2NPDatabaseStore; buf++; // I2NP msg type
-		RAND_bytes (buf, 4); buf += 4; // msgID
+		i2p::crypto::RandBytes (buf, 4); buf += 4; // msgID
 		htobe32buf (buf, (ts + I2NP_MESSAGE_EXPIRATION_TIMEOUT)/1000); buf += 4; // expiration
 		// payload
 		memcpy (buf + DATABASE_STORE_KEY_OFFSET, ls->GetStoreHash (), 32);
@@ -1133,7 +1133,7 @@ namespace garlic
 		int delta = (int)optimalSize - (int)len;
 		if (delta < 0 || delta > 3) // don't create padding if we are close to optimal size
 		{
-			uint8_t paddingSize = rand () & 0x0F; // 0 - 15
+			uint8_t paddingSize = i2p::crypto::RandUInt32 () & 0x0F; // 0 - 15
 			if (delta > 3)
 			{
 				delta -= 3;
@@ -0,0 +1,501 @@
+/*
+* Copyright (c) 2013-2022, The PurpleI2P Project
+*
+* This file is part of Purple i2pd project and licensed under BSD3
+*
+* See full license text in LICENSE file at top of project tree
+*/
+
+#include <string.h>
+#include <openssl/sha.h>
+#include <openssl/rand.h>
+#include <openssl/bn.h>
+#include "Crypto.h"
+#include "Ed25519Batch.h"
+
+namespace i2p
+{
+namespace crypto
+{
+	void EDDSA25519BatchVerifier::Add (const uint8_t * publicKey, const uint8_t * buf, size_t len, const uint8_t * signature)
+	{
+		m_Items.emplace_back ();
+		auto& item = m_Items.back ();
+		memcpy (item.publicKey, publicKey, EDDSA25519_PUBLIC_KEY_LENGTH);
+		memcpy (item.signature, signature, EDDSA25519_SIGNATURE_LENGTH);
+		SHA512_CTX ctx;
+		SHA512_Init (&ctx);
+		SHA512_Update (&ctx, signature, EDDSA25519_SIGNATURE_LENGTH/2); // R
+		SHA512_Update (&ctx, publicKey, EDDSA25519_PUBLIC_KEY_LENGTH); // public key
+		SHA512_Update (&ctx, buf, len); // data
+		SHA512_Final (item.digest, &ctx);
+	}
+
+#if defined(__SIZEOF_INT128__)
+	// field arithmetic mod 2^255-19, 5 limbs of 51 bits
+	__extension__ typedef unsigned __int128 uint128_t;
+	typedef uint64_t fe[5];
+	const uint64_t FE_MASK = (1ULL << 51) - 1;
+
+	static inline uint64_t Load64 (const uint8_t * buf)
+	{
+		uint64_t r = 0;
+		for (int i = 7; i >= 0; i--) r = (r << 8) | buf[i];
+		return r;
+	}
+
+	static inline void FeCopy (fe r, const fe a)
+	{
+		memcpy (r, a, sizeof (fe));
+	}
+
+	static inline void FeSet (fe r, uint64_t a)
+	{
+		r[0] = a; r[1] = 0; r[2] = 0; r[3] = 0; r[4] = 0;
+	}
+
+	static inline void FeCarry (fe r)
+	{
+		r[1] += r[0] >> 51; r[0] &= FE_MASK;
+		r[2] += r[1] >> 51; r[1] &= FE_MASK;
+		r[3] += r[2] >> 51; r[2] &= FE_MASK;
+		r[4] += r[3] >> 51; r[3] &= FE_MASK;
+		r[0] += 19*(r[4] >> 51); r[4] &= FE_MASK;
+	}
+
+	static inline void FeAdd (fe r, const fe a, const fe b)
+	{
+		for (int i = 0; i < 5; i++) r[i] = a[i] + b[i];
+		FeCarry (r);
+	}
+
+	static inline void FeSub (fe r, const fe a, const fe b)
+	{
+		// add 4p to avoid underflow
+		r[0] = a[0] + 0x1FFFFFFFFFFFB4ULL - b[0];
+		for (int i = 1; i < 5; i++) r[i] = a[i] + 0x1FFFFFFFFFFFFCULL - b[i];
+		FeCarry (r);
+	}
+
+	static inline void FeNeg (fe r, const fe a)
+	{
+		fe zero = {0};
+		FeSub (r, zero, a);
+	}
+
+	static inline void FeMul (fe r, const fe a, const fe b)
+	{
+		uint64_t b1 = 19*b[1], b2 = 19*b[2], b3 = 19*b[3], b4 = 19*b[4];
+		uint128_t t0 = (uint128_t)a[0]*b[0] + (uint128_t)a[1]*b4 + (uint128_t)a[2]*b3 + (uint128_t)a[3]*b2 + (uint128_t)a[4]*b1;
+		uint128_t t1 = (uint128_t)a[0]*b[1] + (uint128_t)a[1]*b[0] + (uint128_t)a[2]*b4 + (uint128_t)a[3]*b3 + (uint128_t)a[4]*b2;
+		uint128_t t2 = (uint128_t)a[0]*b[2] + (uint128_t)a[1]*b[1] + (uint128_t)a[2]*b[0] + (uint128_t)a[3]*b4 + (uint128_t)a[4]*b3;
+		uint128_t t3 = (uint128_t)a[0]*b[3] + (uint128_t)a[1]*b[2] + (uint128_t)a[2]*b[1] + (uint128_t)a[3]*b[0] + (uint128_t)a[4]*b4;
+		uint128_t t4 = (uint128_t)a[0]*b[4] + (uint128_t)a[1]*b[3] + (uint128_t)a[2]*b[2] + (uint128_t)a[3]*b[1] + (uint128_t)a[4]*b[0];
+		t1 += (uint64_t)(t0 >> 51); r[0] = (uint64_t)t0 & FE_MASK;
+		t2 += (uint64_t)(t1 >> 51); r[1] = (uint64_t)t1 & FE_MASK;
+		t3 += (uint64_t)(t2 >> 51); r[2] = (uint64_t)t2 & FE_MASK;
+		t4 += (uint64_t)(t3 >> 51); r[3] = (uint64_t)t3 & FE_MASK;
+		r[0] += 19*(uint64_t)(t4 >> 51); r[4] = (uint64_t)t4 & FE_MASK;
+		r[1] += r[0] >> 51; r[0] &= FE_MASK;
+	}
+
+	static inline void FeSqr (fe r, const fe a, int n = 1) // a^(2^n)
+	{
+		FeMul (r, a, a);
+		for (int i = 1; i < n; i++) FeMul (r, r, r);
+	}
+
+	static void FeFromBytes (fe r, const uint8_t * buf) // highest bit is ignored
+	{
+		r[0] = Load64 (buf) & FE_MASK;
+		r[1] = (Load64 (buf + 6) >> 3) & FE_MASK;
+		r[2] = (Load64 (buf + 12) >> 6) & FE_MASK;
+		r[3] = (Load64 (buf + 19) >> 1) & FE_MASK;
+		r[4] = (Load64 (buf + 24) >> 12) & FE_MASK;
+	}
+
+	static void FeToBytes (uint8_t * buf, const fe a) // canonical
+	{
+		fe t;
+		FeCopy (t, a);
+		FeCarry (t); FeCarry (t);
+		// t < 2^255, add 19 and subtract 2^255 if not negative
+		t[0] += 19;
+		FeCarry (t);
+		t[0] += (1ULL << 51) - 19;
+		for (int i = 1; i < 5; i++) t[i] += (1ULL << 51) - 1;
+		t[1] += t[0] >> 51; t[0] &= FE_MASK;
+		t[2] += t[1] >> 51; t[1] &= FE_MASK;
+		t[3] += t[2] >> 51; t[2] &= FE_MASK;
+		t[4] += t[3] >> 51; t[3] &= FE_MASK;
+		t[4] &= FE_MASK;
+		uint64_t w[4];
+		w[0] = t[0] | (t[1] << 51);
+		w[1] = (t[1] >> 13) | (t[2] << 38);
+		w[2] = (t[2] >> 26) | (t[3] << 25);
+		w[3] = (t[3] >> 39) | (t[4] << 12);
+		for (int i = 0; i < 4; i++)
+			for (int j = 0; j < 8; j++)
+				buf[i*8 + j] = w[i] >> (8*j);
+	}
+
+	static bool FeIsZero (const fe a)
+	{
+		uint8_t buf[32], zero[32] = {0};
+		FeToBytes (buf, a);
+		return !memcmp (buf, zero, 32);
+	}
+
+	static bool FeIsNegative (const fe a)
+	{
+		uint8_t buf[32];
+		FeToBytes (buf, a);
+		return buf[0] & 1;
+	}
+
+	static bool FeEqual (const fe a, const fe b)
+	{
+		fe t;
+		FeSub (t, a, b);
+		return FeIsZero (t);
+	}
+
+	static void FePow2523 (fe r, const fe z) // z^(2^252-3)
+	{
+		fe t0, t1, t2;
+		FeSqr (t0, z); // 2
+		FeSqr (t1, t0, 2); // 8
+		FeMul (t1, z, t1); // 9
+		FeMul (t0, t0, t1); // 11
+		FeSqr (t0, t0); // 22
+		FeMul (t0, t1, t0); // 2^5 - 1
+		FeSqr (t1, t0, 5);
+		FeMul (t0, t1, t0); // 2^10 - 1
+		FeSqr (t1, t0, 10);
+		FeMul (t1, t1, t0); // 2^20 - 1
+		FeSqr (t2, t1, 20);
+		FeMul (t1, t2, t1); // 2^40 - 1
+		FeSqr (t1, t1, 10);
+		FeMul (t0, t1, t0); // 2^50 - 1
+		FeSqr (t1, t0, 50);
+		FeMul (t1, t1, t0); // 2^100 - 1
+		FeSqr (t2, t1, 100);
+		FeMul (t1, t2, t1); // 2^200 - 1
+		FeSqr (t1, t1, 50);
+		FeMul (t0, t1, t0); // 2^250 - 1
+		FeSqr (t0, t0, 2); // 2^252 - 4
+		FeMul (r, t0, z); // 2^252 - 3
+	}
+
+	static void FeInvert (fe r, const fe z) // z^(p-2)
+	{
+		fe t0, t1;
+		FePow2523 (t1, z); // 2^252 - 3
+		FeSqr (t1, t1, 3); // 2^255 - 24
+		FeSqr (t0, z); // 2
+		FeMul (t0, t0, z); // 3
+		FeMul (r, t1, t0); // 2^255 - 21
+	}
+
+	// points in extended coordinates, x = X/Z, y = Y/Z, x*y = T/Z
+	struct GePoint
+	{
+		fe X, Y, Z, T;
+	};
+
+	// prepared for addition
+	struct GeCached
+	{
+		fe YplusX, YminusX, Z2, T2d;
+	};
+
+	struct Ed25519Constants
+	{
+		fe d, d2, sqrtm1;
+		GeCached B[16]; // i*B
+
+		Ed25519Constants ();
+	};
+
+	static const Ed25519Constants& GetConstants ();
+
+	static void GeIdentity (GePoint& p)
+	{
+		FeSet (p.X, 0); FeSet (p.Y, 1); FeSet (p.Z, 1); FeSet (p.T, 0);
+	}
+
+	static void GeToCached (GeCached& c, const GePoint& p, const fe d2)
+	{
+		FeAdd (c.YplusX, p.Y, p.X);
+		FeSub (c.YminusX, p.Y, p.X);
+		FeAdd (c.Z2, p.Z, p.Z);
+		FeMul (c.T2d, p.T, d2);
+	}
+
+	static void GeAdd (GePoint& r, const GePoint& p, const GeCached& q)
+	{
+		fe a, b, c, d, e, f, g, h;
+		FeSub (a, p.Y, p.X);
+		FeMul (a, a, q.YminusX);
+		FeAdd (b, p.Y, p.X);
+		FeMul (b, b, q.YplusX);
+		FeMul (c, p.T, q.T2d);
+		FeMul (d, p.Z, q.Z2);
+		FeSub (e, b, a);
+		FeSub (f, d, c);
+		FeAdd (g, d, c);
+		FeAdd (h, b, a);
+		FeMul (r.X, e, f);
+		FeMul (r.Y, g, h);
+		FeMul (r.T, e, h);
+		FeMul (r.Z, f, g);
+	}
+
+	static void GeDouble (GePoint& r, const GePoint& p)
+	{
+		fe a, b, c, e, f, g, h;
+		FeSqr (a, p.X);
+		FeSqr (b, p.Y);
+		FeSqr (c, p.Z);
+		FeAdd (c, c, c);
+		FeAdd (e, p.X, p.Y);
+		FeSqr (e, e);
+		FeSub (e, e, a);
+		FeSub (e, e, b); // 2xy
+		FeSub (g, b, a); // -a + b
+		FeSub (f, g, c);
+		FeAdd (h, a, b);
+		FeNeg (h, h); // -a - b
+		FeMul (r.X, e, f);
+		FeMul (r.Y, g, h);
+		FeMul (r.T, e, h);
+		FeMul (r.Z, f, g);
+	}
+
+	static bool GeIsIdentity (const GePoint& p)
+	{
+		return FeIsZero (p.X) && FeEqual (p.Y, p.Z);
+	}
+
+	// RFC 8032 5.1.3, non-canonical encodings are rejected
+	static bool GeDecode (GePoint& p, const uint8_t * buf, const Ed25519Constants& c)
+	{
+		bool sign = buf[31] & 0x80;
+		FeFromBytes (p.Y, buf);
+		uint8_t canonical[32];
+		FeToBytes (canonical, p.Y);
+		if (memcmp (canonical, buf, 31) || canonical[31] != (buf[31] & 0x7F)) return false; // y >= p
+		fe u, v, v3, vxx, t;
+		FeSet (p.Z, 1);
+		FeSqr (u, p.Y);
+		FeMul (v, u, c.d);
+		FeSub (u, u, p.Z); // u = y^2 - 1
+		FeAdd (v, v, p.Z); // v = d*y^2 + 1
+		// x = u*v^3*(u*v^7)^((p-5)/8)
+		FeSqr (v3, v);
+		FeMul (v3, v3, v); // v^3
+		FeSqr (t, v3);
+		FeMul (t, t, v);
+		FeMul (t, t, u); // u*v^7
+		FePow2523 (t, t);
+		FeMul (t, t, v3);
+		FeMul (p.X, t, u);
+		FeSqr (vxx, p.X);
+		FeMul (vxx, vxx, v);
+		if (!FeEqual (vxx, u))
+		{
+			FeNeg (t, u);
+			if (!FeEqual (vxx, t)) return false;
+			FeMul (p.X, p.X, c.sqrtm1);
+		}
+		if (FeIsNegative (p.X) != sign)
+		{
+			if (FeIsZero (p.X)) return false; // -0
+			FeNeg (p.X, p.X);
+		}
+		FeMul (p.T, p.X, p.Y);
+		return true;
+	}
+
+	Ed25519Constants::Ed25519Constants ()
+	{
+		// d = -121665/121666
+		fe t;
+		FeSet (t, 121666);
+		FeInvert (t, t);
+		FeSet (d, 121665);
+		FeNeg (d, d);
+		FeMul (d, d, t);
+		FeAdd (d2, d, d);
+		// sqrt(-1) = 2^((p-1)/4)
+		FeSet (t, 2);
+		FePow2523 (sqrtm1, t);
+		FeSqr (sqrtm1, sqrtm1);
+		FeMul (sqrtm1, sqrtm1, t);
+		// base point, y = 4/5
+		uint8_t encoded[32];
+		memset (encoded, 0x66, 32);
+		encoded[0] = 0x58;
+		GePoint p;
+		GeIdentity (p);
+		GeToCached (B[0], p, d2);
+		GeDecode (p, encoded, *this);
+		GeToCached (B[1], p, d2);
+		for (int i = 2; i < 16; i++)
+		{
+			GeAdd (p, p, B[1]);
+			GeToCached (B[i], p, d2);
+		}
+	}
+
+	static const Ed25519Constants& GetConstants ()
+	{
+		static const Ed25519Constants constants;
+		return constants;
+	}
+
+	static void BNToScalar (const BIGNUM * bn, uint8_t * buf) // little endian 32 bytes
+	{
+		uint8_t be[32];
+		bn2buf (bn, be, 32);
+		for (int i = 0; i < 32; i++) buf[i] = be[31 - i];
+	}
+
+	static BIGNUM * ScalarToBN (const uint8_t * buf, size_t len) // from little endian
+	{
+		uint8_t be[64];
+		for (size_t i = 0; i < len; i++) be[i] = buf[len - 1 - i];
+		return BN_bin2bn (be, len, nullptr);
+	}
+
+	static bool GeIsSmallOrder (const GePoint& p)
+	{
+		GePoint q;
+		GeDouble (q, p);
+		GeDouble (q, q);
+		GeDouble (q, q);
+		return GeIsIdentity (q); // 8*p
+	}
+
+	bool EDDSA25519BatchVerifier::VerifyItems (const Item * items, size_t num) const
+	{
+		if (!num) return true;
+		const auto& c = GetConstants ();
+		// points R and A, scalars z and z*h
+		size_t numPoints = 2*num;
+		std::vector<GeCached> tables (numPoints*16);
+		std::vector<uint8_t> scalars (numPoints*32);
+		BN_CTX * ctx = BN_CTX_new ();
+		BN_CTX_start (ctx);
+		BIGNUM * l = BN_CTX_get (ctx), * s = BN_CTX_get (ctx), * t = BN_CTX_get (ctx);
+		// 2^252 + 27742317777372353535851937790883648493
+		BN_set_word (l, 0);
+		BN_set_bit (l, 252);
+		BIGNUM * tmp = nullptr;
+		BN_dec2bn (&tmp, "27742317777372353535851937790883648493");
+		BN_add (l, l, tmp);
+		BN_free (tmp);
+		BN_zero (s);
+		bool ret = true;
+		for (size_t i = 0; i < num && ret; i++)
+		{
+			GePoint p[2];
+			if (!GeDecode (p[0], items[i].signature, c) || !GeDecode (p[1], items[i].publicKey, c) ||
+				GeIsSmallOrder (p[0]) || GeIsSmallOrder (p[1]))
+			{
+				ret = false;
+				break;
+			}
+			BIGNUM * S = ScalarToBN (items[i].signature + 32, 32);
+			if (BN_cmp (S, l) >= 0) ret = false; // malleable
+			uint8_t rnd[16];
+			RAND_bytes (rnd, 16);
+			BIGNUM * z = BN_bin2bn (rnd, 16, nullptr);
+			BIGNUM * h = ScalarToBN (items[i].digest, 64);
+			BN_mod_mul (h, h, z, l, ctx); // z*h
+			BN_mod_mul (S, S, z, l, ctx);
+			BN_mod_add (s, s, S, l, ctx); // sum of z*S
+			BNToScalar (z, scalars.data () + 64*i);
+			BNToScalar (h, scalars.data () + 64*i + 32);
+			BN_free (S); BN_free (z); BN_free (h);
+			// tables of 0..15 multiples
+			for (int j = 0; j < 2; j++)
+			{
+				GeCached * table = tables.data () + (2*i + j)*16;
+				GePoint q;
+				GeIdentity (q);
+				GeToCached (table[0], q, c.d2);
+				GeToCached (table[1], p[j], c.d2);
+				GeDouble (q, p[j]);
+				GeToCached (table[2], q, c.d2);
+				for (int k = 3; k < 16; k++)
+				{
+					GeAdd (q, q, table[1]);
+					GeToCached (table[k], q, c.d2);
+				}
+			}
+		}
+		uint8_t b[32];
+		if (ret)
+		{
+			// move B to the other side, (l - s)*B
+			BN_sub (t, l, s);
+			BN_mod (t, t, l, ctx);
+			BNToScalar (t, b);
+		}
+		BN_CTX_end (ctx);
+		BN_CTX_free (ctx);
+		if (!ret) return false;
+
+		// Straus, 4 bits windows with shared doublings
+		GePoint q;
+		GeIdentity (q);
+		for (int w = 63; w >= 0; w--)
+		{
+			if (w < 63)
+				for (int k = 0; k < 4; k++) GeDouble (q, q);
+			int shift = (w & 1) ? 4 : 0;
+			int nibble = (b[w >> 1] >> shift) & 0x0F;
+			if (nibble) GeAdd (q, q, c.B[nibble]);
+			for (size_t i = 0; i < numPoints; i++)
+			{
+				nibble = (scalars[32*i + (w >> 1)] >> shift) & 0x0F;
+				if (nibble) GeAdd (q, q, tables[16*i + nibble]);
+			}
+		}
+		// multiply by cofactor, small order components of R and A don't matter
+		for (int k = 0; k < 3; k++) GeDouble (q, q);
+		return GeIsIdentity (q);
+	}
+#endif
+
+	bool EDDSA25519BatchVerifier::VerifyItem (const Item& item) const
+	{
+		BN_CTX * ctx = BN_CTX_new ();
+		auto publicKey = GetEd25519 ()->DecodePublicKey (item.publicKey, ctx);
+		bool ret = GetEd25519 ()->Verify (publicKey, item.digest, item.signature);
+		BN_CTX_free (ctx);
+		return ret;
+	}
+
+	bool EDDSA25519BatchVerifier::Verify (std::vector<bool>& results) const
+	{
+#if defined(__SIZEOF_INT128__)
+		if (m_Items.size () >= EDDSA25519_MIN_BATCH_SIZE && VerifyItems (m_Items.data (), m_Items.size ()))
+		{
+			results.assign (m_Items.size (), true);
+			return true;
+		}
+#endif
+		// one by one
+		bool ret = true;
+		results.assign (m_Items.size (), false);
+		for (size_t i = 0; i < m_Items.size (); i++)
+		{
+			results[i] = VerifyItem (m_Items[i]);
+			if (!results[i]) ret = false;
+		}
+		return ret;
+	}
+}
+}
@@ -0,0 +1,58 @@
+/*
+* Copyright (c) 2013-2022, The PurpleI2P Project
+*
+* This file is part of Purple i2pd project and licensed under BSD3
+*
+* See full license text in LICENSE file at top of project tree
+*/
+
+#ifndef ED25519_BATCH_H__
+#define ED25519_BATCH_H__
+
+#include <inttypes.h>
+#include <vector>
+#include "Ed25519.h"
+
+namespace i2p
+{
+namespace crypto
+{
+	const size_t EDDSA25519_MIN_BATCH_SIZE = 4; // verify one by one if less
+
+	/** verifies many Ed25519 signatures at once.
+	 *  random linear combination of verification equations is checked by one multi-scalar multiplication,
+	 *  8(sum z*S)B = 8(sum z*R) + 8(sum (z*h)A), with random 128 bits z, R and A of small order are rejected.
+	 *  without cofactor 8 small order component of R or A would pass with probability 1/8.
+	 *  signatures valid for Ed25519::Verify are always accepted, the batch also accepts signatures
+	 *  differing from valid ones by small order component only, such can be created by owner of the key only.
+	 *  if combination doesn't hold every signature is checked separately by Ed25519::Verify */
+	class EDDSA25519BatchVerifier
+	{
+		public:
+
+			void Add (const uint8_t * publicKey, const uint8_t * buf, size_t len, const uint8_t * signature); // buf is not stored
+			size_t GetSize () const { return m_Items.size (); };
+			void Clear () { m_Items.clear (); };
+
+			bool Verify (std::vector<bool>& results) const; // true if all are valid, results in order of Add
+
+		private:
+
+			struct Item
+			{
+				uint8_t publicKey[EDDSA25519_PUBLIC_KEY_LENGTH];
+				uint8_t signature[EDDSA25519_SIGNATURE_LENGTH];
+				uint8_t digest[64]; // SHA512(R || A || M)
+			};
+
+			bool VerifyItems (const Item * items, size_t num) const; // batch
+			bool VerifyItem (const Item& item) const;
+
+		private:
+
+			std::vector<Item> m_Items;
+	};
+}
+}
+
+#endif
@@ -1,5 +1,5 @@
 /*
-* Copyright (c) 2013-2020, The PurpleI2P Project
+* Copyright (c) 2013-2022, The PurpleI2P Project
 *
 * This file is part of Purple i2pd project and licensed under BSD3
 *
@@ -263,5 +263,26 @@ namespace fs {
 			v(t);
 		}
 	}
+
+	void HashedStorage::Iterate(FilenameVisitor v, int part, int numParts)
+	{
+		boost::filesystem::path p(root);
+		boost::filesystem::directory_iterator it(p);
+		boost::filesystem::directory_iterator end;
+
+		std::hash<std::string> hash;
+		for ( ; it != end; it++) {
+			if ((int)(hash(it->path().filename().string()) % numParts) != part)
+				continue;
+			if (boost::filesystem::is_directory( it->status() )) {
+				boost::filesystem::recursive_directory_iterator it1(it->path()), end1;
+				for ( ; it1 != end1; it1++)
+					if (boost::filesystem::is_regular_file( it1->status() ))
+						v(it1->path().string());
+			}
+			else if (boost::filesystem::is_regular_file( it->status() ))
+				v(it->path().string());
+		}
+	}
 } // fs
 } // i2p
@@ -1,5 +1,5 @@
 /*
-* Copyright (c) 2013-2020, The PurpleI2P Project
+* Copyright (c) 2013-2022, The PurpleI2P Project
 *
 * This file is part of Purple i2pd project and licensed under BSD3
 *
@@ -65,6 +65,8 @@ namespace fs {
 			void Traverse(std::vector<std::string> & files);
 			/** visit every file in this storage with a visitor */
 			void Iterate(FilenameVisitor v);
+			/** visit files in every numParts-th top level entry of this storage starting from part, for parallel visitors */
+			void Iterate(FilenameVisitor v, int part, int numParts);
 	};
 
 	/** @brief Returns current application name, default 'i2pd' */
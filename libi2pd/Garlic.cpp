@@ -1,5 +1,5 @@
 /*
-* Copyright (c) 2013-2021, The PurpleI2P Project
+* Copyright (c) 2013-2022, The PurpleI2P Project
 *
 * This file is part of Purple i2pd project and licensed under BSD3
 *
@@ -223,7 +223,7 @@ namespace garlic
 	{
 		uint64_t ts = i2p::util::GetMillisecondsSinceEpoch ();
 		uint32_t msgID;
-		RAND_bytes ((uint8_t *)&msgID, 4);
+		msgID = i2p::crypto::RandUInt32 ();
 		size_t size = 0;
 		uint8_t * numCloves = payload + size;
 		*numCloves = 0;
@@ -307,7 +307,7 @@ namespace garlic
 		memcpy (buf + size, msg->GetBuffer (), msg->GetLength ());
 		size += msg->GetLength ();
 		uint32_t cloveID;
-		RAND_bytes ((uint8_t *)&cloveID, 4);
+		cloveID = i2p::crypto::RandUInt32 ();
 		htobe32buf (buf + size, cloveID); // CloveID
 		size += 4;
 		htobe64buf (buf + size, ts); // Expiration of clove
@@ -342,7 +342,7 @@ namespace garlic
 				// fill clove
 				uint64_t ts = i2p::util::GetMillisecondsSinceEpoch () + 8000; // 8 sec
 				uint32_t cloveID;
-				RAND_bytes ((uint8_t *)&cloveID, 4);
+				cloveID = i2p::crypto::RandUInt32 ();
 				htobe32buf (buf + size, cloveID); // CloveID
 				size += 4;
 				htobe64buf (buf + size, ts); // Expiration of clove
@@ -1,5 +1,5 @@
 /*
-* Copyright (c) 2013-2020, The PurpleI2P Project
+* Copyright (c) 2013-2022, The PurpleI2P Project
 *
 * This file is part of Purple i2pd project and licensed under BSD3
 *
@@ -197,5 +197,16 @@ namespace data
 		return len + 23;
 	}
 
+	size_t GzipNoCompressionInPlace (uint8_t * buf, uint16_t len)
+	{
+		static const uint8_t gzipHeader[11] = { 0x1f, 0x8b, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0xff, 0x01 };
+		memcpy (buf, gzipHeader, 11);
+		htole16buf (buf + 11, len);
+		htole16buf (buf + 13, 0xffff - len);
+		htole32buf (buf + len + 15, crc32 (0, buf + 15, len));
+		htole32buf (buf + len + 19, len);
+		return len + 23;
+	}
+
 } // data
 } // i2p
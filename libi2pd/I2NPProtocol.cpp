@@ -1,5 +1,5 @@
 /*
-* Copyright (c) 2013-2021, The PurpleI2P Project
+* Copyright (c) 2013-2022, The PurpleI2P Project
 *
 * This file is part of Purple i2pd project and licensed under BSD3
 *
@@ -8,6 +8,10 @@
 
 #include <string.h>
 #include <atomic>
+#include <mutex>
+#include <chrono>
+#include <vector>
+#include <algorithm>
 #include "Base.h"
 #include "Log.h"
 #include "Crypto.h"
@@ -26,14 +30,260 @@ using namespace i2p::transport;
 
 namespace i2p
 {
+	static size_t GetI2NPBufferBlockSize (int sizeClass)
+	{
+		return I2NP_BUFFER_SIZES[sizeClass] + I2NP_BUFFER_OVERHEAD;
+	}
+
+	static int GetI2NPBuffersMagazineSize (int sizeClass) // in blocks
+	{
+		int size = I2NP_BUFFERS_MAGAZINE_SIZE/GetI2NPBufferBlockSize (sizeClass);
+		return size > 2 ? size : 2;
+	}
+
+	const int I2NP_BUFFERS_MAX_MAGAZINE_SIZE = I2NP_BUFFERS_MAGAZINE_SIZE/(I2NP_BUFFER_SIZES[eI2NPBuffer2K] + I2NP_BUFFER_OVERHEAD);
+
+	// free blocks of a thread, exchanged with depot by half of capacity
+	struct I2NPBuffersMagazine
+	{
+		void * blocks[2*I2NP_BUFFERS_MAX_MAGAZINE_SIZE];
+		int num;
+		int numAllocated, numFreed; // not added to depot's counters yet
+	};
+
+	class I2NPBuffersDepot
+	{
+		public:
+
+			I2NPBuffersDepot (): m_NumAllocations (0), m_NumFreed (0), m_NumHeapAllocations (0),
+				m_LastNumAllocations (0), m_LastUpdateTime (0), m_AllocationRate (0) {};
+
+			void Init (int sizeClass)
+			{
+				m_BlockSize = GetI2NPBufferBlockSize (sizeClass);
+				m_MagazineSize = GetI2NPBuffersMagazineSize (sizeClass);
+				m_MaxNumBlocks = I2NP_BUFFERS_MAX_CACHED_SIZE/m_BlockSize;
+				m_Blocks.reserve (m_MaxNumBlocks);
+			}
+
+			void * Allocate (I2NPBuffersMagazine * magazine)
+			{
+				void * block = nullptr;
+				if (magazine)
+				{
+					if (!magazine->num) Refill (*magazine);
+					if (magazine->num) block = magazine->blocks[--magazine->num];
+					magazine->numAllocated++;
+					if (magazine->numAllocated + magazine->numFreed >= I2NP_BUFFERS_STATS_FLUSH_INTERVAL)
+						FlushStats (*magazine);
+				}
+				else
+				{
+					// thread is being finished
+					std::unique_lock<std::mutex> l(m_Mutex);
+					if (!m_Blocks.empty ())
+					{
+						block = m_Blocks.back ();
+						m_Blocks.pop_back ();
+					}
+					m_NumAllocations++;
+				}
+				if (!block)
+				{
+					block = ::operator new (m_BlockSize);
+					m_NumHeapAllocations++;
+				}
+				return block;
+			}
+
+			void Free (I2NPBuffersMagazine * magazine, void * block)
+			{
+				if (magazine)
+				{
+					if (magazine->num >= 2*m_MagazineSize) Return (*magazine, m_MagazineSize);
+					magazine->blocks[magazine->num++] = block;
+					magazine->numFreed++;
+					if (magazine->numAllocated + magazine->numFreed >= I2NP_BUFFERS_STATS_FLUSH_INTERVAL)
+						FlushStats (*magazine);
+				}
+				else
+				{
+					{
+						std::unique_lock<std::mutex> l(m_Mutex);
+						m_NumFreed++;
+						if (m_Blocks.size () < m_MaxNumBlocks)
+						{
+							m_Blocks.push_back (block);
+							block = nullptr;
+						}
+					}
+					if (block) ::operator delete (block);
+				}
+			}
+
+			void Return (I2NPBuffersMagazine& magazine, int num)
+			{
+				if (num > magazine.num) num = magazine.num;
+				int numCached = 0;
+				{
+					std::unique_lock<std::mutex> l(m_Mutex);
+					numCached = std::min ((size_t)num, m_MaxNumBlocks - m_Blocks.size ());
+					m_Blocks.insert (m_Blocks.end (), magazine.blocks + magazine.num - numCached, magazine.blocks + magazine.num);
+				}
+				magazine.num -= numCached;
+				for (int i = numCached; i < num; i++) // depot is full
+					::operator delete (magazine.blocks[--magazine.num]);
+			}
+
+			void FlushStats (I2NPBuffersMagazine& magazine)
+			{
+				m_NumAllocations += magazine.numAllocated;
+				m_NumFreed += magazine.numFreed;
+				magazine.numAllocated = 0;
+				magazine.numFreed = 0;
+			}
+
+			void UpdateStats (uint64_t ts)
+			{
+				std::unique_lock<std::mutex> l(m_Mutex);
+				uint64_t numAllocations = m_NumAllocations;
+				if (m_LastUpdateTime && ts > m_LastUpdateTime)
+					m_AllocationRate = (numAllocations - m_LastNumAllocations)*1000/(ts - m_LastUpdateTime);
+				m_LastUpdateTime = ts;
+				m_LastNumAllocations = numAllocations;
+			}
+
+			void GetStats (I2NPBuffersStats& stats)
+			{
+				std::unique_lock<std::mutex> l(m_Mutex);
+				stats.numAllocations = m_NumAllocations;
+				stats.numHeapAllocations = m_NumHeapAllocations;
+				uint64_t numFreed = m_NumFreed;
+				stats.numInUse = stats.numAllocations > numFreed ? stats.numAllocations - numFreed : 0; // approximate
+				stats.numCached = m_Blocks.size ();
+				stats.allocationRate = m_AllocationRate;
+			}
+
+		private:
+
+			void Refill (I2NPBuffersMagazine& magazine)
+			{
+				std::unique_lock<std::mutex> l(m_Mutex);
+				int num = std::min ((size_t)m_MagazineSize, m_Blocks.size ());
+				std::copy (m_Blocks.end () - num, m_Blocks.end (), magazine.blocks);
+				m_Blocks.resize (m_Blocks.size () - num);
+				magazine.num = num;
+			}
+
+		private:
+
+			size_t m_BlockSize, m_MaxNumBlocks;
+			int m_MagazineSize;
+			std::mutex m_Mutex;
+			std::vector<void *> m_Blocks;
+			std::atomic<uint64_t> m_NumAllocations, m_NumFreed, m_NumHeapAllocations;
+			uint64_t m_LastNumAllocations, m_LastUpdateTime, m_AllocationRate;
+	};
+
+	static I2NPBuffersDepot * GetI2NPBuffersDepots ()
+	{
+		// never deleted, messages might be released by destructors of other globals
+		static I2NPBuffersDepot * depots = []()
+			{
+				auto depots = new I2NPBuffersDepot[eNumI2NPBufferSizeClasses];
+				for (int i = 0; i < eNumI2NPBufferSizeClasses; i++)
+					depots[i].Init (i);
+				return depots;
+			}();
+		return depots;
+	}
+
+	static thread_local bool isI2NPBuffersCacheFinished = false;
+	class I2NPBuffersCache
+	{
+		public:
+
+			~I2NPBuffersCache ()
+			{
+				auto depots = GetI2NPBuffersDepots ();
+				for (int i = 0; i < eNumI2NPBufferSizeClasses; i++)
+				{
+					depots[i].Return (m_Magazines[i], m_Magazines[i].num);
+					depots[i].FlushStats (m_Magazines[i]);
+				}
+				isI2NPBuffersCacheFinished = true;
+			}
+
+			I2NPBuffersMagazine * GetMagazine (int sizeClass)
+			{
+				return isI2NPBuffersCacheFinished ? nullptr : m_Magazines + sizeClass;
+			}
+
+		private:
+
+			I2NPBuffersMagazine m_Magazines[eNumI2NPBufferSizeClasses] = {};
+	};
+	static thread_local I2NPBuffersCache i2npBuffersCache; // returns blocks to depots when thread finishes
+
+	template<typename T, int sizeClass>
+	struct I2NPBuffersAllocator
+	{
+		typedef T value_type;
+		template<typename U> struct rebind { typedef I2NPBuffersAllocator<U, sizeClass> other; };
+
+		I2NPBuffersAllocator () {}
+		template<typename U> I2NPBuffersAllocator (const I2NPBuffersAllocator<U, sizeClass>&) {}
+
+		T * allocate (size_t n) // called by allocate_shared for one control block with message
+		{
+			static_assert (sizeof (T) <= I2NP_BUFFER_SIZES[sizeClass] + I2NP_BUFFER_OVERHEAD, "I2NP buffer overhead is too small");
+			return static_cast<T *>(GetI2NPBuffersDepots ()[sizeClass].Allocate (i2npBuffersCache.GetMagazine (sizeClass)));
+		}
+
+		void deallocate (T * p, size_t n)
+		{
+			GetI2NPBuffersDepots ()[sizeClass].Free (i2npBuffersCache.GetMagazine (sizeClass), p);
+		}
+
+		template<typename U> bool operator== (const I2NPBuffersAllocator<U, sizeClass>&) const { return true; }
+		template<typename U> bool operator!= (const I2NPBuffersAllocator<U, sizeClass>&) const { return false; }
+	};
+
+	template<int sizeClass>
+	static std::shared_ptr<I2NPMessage> NewI2NPMessageFromBuffers ()
+	{
+		typedef I2NPMessageBuffer<I2NP_BUFFER_SIZES[sizeClass]> Buffer;
+		return std::allocate_shared<Buffer> (I2NPBuffersAllocator<Buffer, sizeClass> ());
+	}
+
+	std::vector<I2NPBuffersStats> GetI2NPBuffersStats ()
+	{
+		std::vector<I2NPBuffersStats> stats (eNumI2NPBufferSizeClasses);
+		auto depots = GetI2NPBuffersDepots ();
+		for (int i = 0; i < eNumI2NPBufferSizeClasses; i++)
+		{
+			stats[i].size = I2NP_BUFFER_SIZES[i];
+			depots[i].GetStats (stats[i]);
+		}
+		return stats;
+	}
+
+	void UpdateI2NPBuffersStats ()
+	{
+		auto ts = i2p::util::GetMillisecondsSinceEpoch ();
+		auto depots = GetI2NPBuffersDepots ();
+		for (int i = 0; i < eNumI2NPBufferSizeClasses; i++)
+			depots[i].UpdateStats (ts);
+	}
+
 	std::shared_ptr<I2NPMessage> NewI2NPMessage ()
 	{
-		return std::make_shared<I2NPMessageBuffer<I2NP_MAX_MESSAGE_SIZE> >();
+		return NewI2NPMessageFromBuffers<eI2NPBuffer64K> ();
 	}
 
 	std::shared_ptr<I2NPMessage> NewI2NPShortMessage ()
 	{
-		return std::make_shared<I2NPMessageBuffer<I2NP_MAX_SHORT_MESSAGE_SIZE> >();
+		return NewI2NPMessageFromBuffers<eI2NPBuffer4K> ();
 	}
 
 	std::shared_ptr<I2NPMessage> NewI2NPTunnelMessage (bool endpoint)
@@ -43,13 +293,17 @@ namespace i2p
 
 	std::shared_ptr<I2NPMessage> NewI2NPMessage (size_t len)
 	{
-		return (len < I2NP_MAX_SHORT_MESSAGE_SIZE - I2NP_HEADER_SIZE - 2) ? NewI2NPShortMessage () : NewI2NPMessage ();
+		len += I2NP_BUFFER_HEADROOM;
+		if (len <= I2NP_BUFFER_SIZES[eI2NPBuffer2K]) return NewI2NPMessageFromBuffers<eI2NPBuffer2K> ();
+		if (len <= I2NP_BUFFER_SIZES[eI2NPBuffer4K]) return NewI2NPMessageFromBuffers<eI2NPBuffer4K> ();
+		if (len <= I2NP_BUFFER_SIZES[eI2NPBuffer16K]) return NewI2NPMessageFromBuffers<eI2NPBuffer16K> ();
+		return NewI2NPMessageFromBuffers<eI2NPBuffer64K> ();
 	}
 
 	void I2NPMessage::FillI2NPMessageHeader (I2NPMessageType msgType, uint32_t replyMsgID, bool checksum)
 	{
 		SetTypeID (msgType);
-		if (!replyMsgID) RAND_bytes ((uint8_t *)&replyMsgID, 4);
+		if (!replyMsgID) replyMsgID = i2p::crypto::RandUInt32 ();
 		SetMsgID (replyMsgID);
 		SetExpiration (i2p::util::GetMillisecondsSinceEpoch () + I2NP_MESSAGE_EXPIRATION_TIMEOUT);
 		UpdateSize ();
@@ -59,7 +313,7 @@ namespace i2p
 	void I2NPMessage::RenewI2NPMessageHeader ()
 	{
 		uint32_t msgID;
-		RAND_bytes ((uint8_t *)&msgID, 4);
+		msgID = i2p::crypto::RandUInt32 ();
 		SetMsgID (msgID);
 		SetExpiration (i2p::util::GetMillisecondsSinceEpoch () + I2NP_MESSAGE_EXPIRATION_TIMEOUT);
 	}
@@ -82,7 +336,7 @@ namespace i2p
 
 	std::shared_ptr<I2NPMessage> CreateI2NPMessage (const uint8_t * buf, size_t len, std::shared_ptr<i2p::tunnel::InboundTunnel> from)
 	{
-		auto msg = NewI2NPMessage ();
+		auto msg = NewI2NPMessage (len);
 		if (msg->offset + len < msg->maxLen)
 		{
 			memcpy (msg->GetBuffer (), buf, len);
@@ -114,7 +368,7 @@ namespace i2p
 		}
 		else // for SSU establishment
 		{
-			RAND_bytes ((uint8_t *)&msgID, 4);
+			msgID = i2p::crypto::RandUInt32 ();
 			htobe32buf (buf + DELIVERY_STATUS_MSGID_OFFSET, msgID);
 			htobe64buf (buf + DELIVERY_STATUS_TIMESTAMP_OFFSET, i2p::context.GetNetID ());
 		}
@@ -254,11 +508,16 @@ namespace i2p
 			LogPrint (eLogError, "I2NP: Invalid RouterInfo buffer for DatabaseStore");
 			return nullptr;
 		}
+		return CreateDatabaseStoreMsg (router->GetIdentHash (), router->GetBuffer (), router->GetBufferLen (), replyToken, replyTunnel);
+	}
 
+	std::shared_ptr<I2NPMessage> CreateDatabaseStoreMsg (const i2p::data::IdentHash& ident, const uint8_t * routerInfo, size_t routerInfoLen,
+		uint32_t replyToken, std::shared_ptr<const i2p::tunnel::InboundTunnel> replyTunnel)
+	{
 		auto m = NewI2NPShortMessage ();
 		uint8_t * payload = m->GetPayload ();
 
-		memcpy (payload + DATABASE_STORE_KEY_OFFSET, router->GetIdentHash (), 32);
+		memcpy (payload + DATABASE_STORE_KEY_OFFSET, ident, 32);
 		payload[DATABASE_STORE_TYPE_OFFSET] = 0; // RouterInfo
 		htobe32buf (payload + DATABASE_STORE_REPLY_TOKEN_OFFSET, replyToken);
 		uint8_t * buf = payload + DATABASE_STORE_HEADER_SIZE;
@@ -284,12 +543,12 @@ namespace i2p
 		buf += 2;
 		m->len += (buf - payload); // payload size
 		size_t size = 0;
-		if (router->GetBufferLen () + (buf - payload) <= 940) // fits one tunnel message
-			size = i2p::data::GzipNoCompression (router->GetBuffer (), router->GetBufferLen (), buf, m->maxLen -m->len);
+		if (routerInfoLen + (buf - payload) <= 940) // fits one tunnel message
+			size = i2p::data::GzipNoCompression (routerInfo, routerInfoLen, buf, m->maxLen -m->len);
 		else
 		{
 			i2p::data::GzipDeflator deflator;
-			size = deflator.Deflate (router->GetBuffer (), router->GetBufferLen (), buf, m->maxLen -m->len);
+			size = deflator.Deflate (routerInfo, routerInfoLen, buf, m->maxLen -m->len);
 		}
 		if (size)
 		{
@@ -368,7 +627,16 @@ namespace i2p
 		return g_MaxNumTransitTunnels;
 	}
 
-	static bool HandleBuildRequestRecords (int num, uint8_t * records, uint8_t * clearText)
+	static bool AcceptsTransitTunnel ()
+	{
+		return i2p::context.AcceptsTunnels () &&
+			i2p::tunnel::tunnels.CountTransitTunnels () <= g_MaxNumTransitTunnels &&
+			!i2p::transport::transports.IsBandwidthExceeded () &&
+			!i2p::transport::transports.IsTransitBandwidthExceeded ();
+	}
+
+	static bool HandleBuildRequestRecords (int num, uint8_t * records, uint8_t * clearText, bool reject,
+		i2p::crypto::CryptoKeyDecryptor * decryptor, std::chrono::steady_clock::time_point& start)
 	{
 		for (int i = 0; i < num; i++)
 		{
@@ -376,13 +644,12 @@ namespace i2p
 			if (!memcmp (record + BUILD_REQUEST_RECORD_TO_PEER_OFFSET, (const uint8_t *)i2p::context.GetRouterInfo ().GetIdentHash (), 16))
 			{
 				LogPrint (eLogDebug, "I2NP: Build request record ", i, " is ours");
-				if (!i2p::context.DecryptTunnelBuildRecord (record + BUILD_REQUEST_RECORD_ENCRYPTED_OFFSET, clearText)) return false;
+				i2p::crypto::NoiseSymmetricState noiseState;
+				if (!i2p::context.DecryptTunnelBuildRecord (record + BUILD_REQUEST_RECORD_ENCRYPTED_OFFSET, clearText, noiseState, decryptor)) return false;
+				i2p::tunnel::tunnels.AddTunnelBuildStageTime (i2p::tunnel::eTunnelBuildStageDecrypt, start);
 				uint8_t retCode = 0;
 				// replace record to reply
-				if (i2p::context.AcceptsTunnels () &&
-					i2p::tunnel::tunnels.GetTransitTunnels ().size () <= g_MaxNumTransitTunnels &&
-					!i2p::transport::transports.IsBandwidthExceeded () &&
-					!i2p::transport::transports.IsTransitBandwidthExceeded ())
+				if (!reject && AcceptsTransitTunnel ())
 				{
 					auto transitTunnel = i2p::tunnel::CreateTransitTunnel (
 							bufbe32toh (clearText + ECIES_BUILD_REQUEST_RECORD_RECEIVE_TUNNEL_OFFSET),
@@ -396,6 +663,8 @@ namespace i2p
 				}
 				else
 					retCode = 30; // always reject with bandwidth reason (30)
+				i2p::tunnel::tunnels.AddTunnelBuildResult (!retCode);
+				i2p::tunnel::tunnels.AddTunnelBuildStageTime (i2p::tunnel::eTunnelBuildStageAccept, start);
 
 				memset (record + ECIES_BUILD_RESPONSE_RECORD_OPTIONS_OFFSET, 0, 2); // no options
 				record[ECIES_BUILD_RESPONSE_RECORD_RET_OFFSET] = retCode;
@@ -408,7 +677,6 @@ namespace i2p
 					{
 						uint8_t nonce[12];
 						memset (nonce, 0, 12);
-						auto& noiseState = i2p::context.GetCurrentNoiseState ();
 						if (!i2p::crypto::AEADChaCha20Poly1305 (reply, TUNNEL_BUILD_RECORD_SIZE - 16,
 							noiseState.m_H, 32, noiseState.m_CK, nonce, reply, TUNNEL_BUILD_RECORD_SIZE, true)) // encrypt
 						{
@@ -429,52 +697,66 @@ namespace i2p
 		return false;
 	}
 
-	static void HandleVariableTunnelBuildMsg (uint32_t replyMsgID, uint8_t * buf, size_t len)
+	static bool HandleInboundTunnelBuildReply (uint32_t replyMsgID, uint8_t * buf, size_t len)
 	{
-		int num = buf[0];
-		LogPrint (eLogDebug, "I2NP: VariableTunnelBuild ", num, " records");
-		if (len < num*TUNNEL_BUILD_RECORD_SIZE + 1)
+		auto tunnel = i2p::tunnel::tunnels.GetPendingInboundTunnel (replyMsgID);
+		if (!tunnel) return false;
+		// endpoint of inbound tunnel
+		LogPrint (eLogDebug, "I2NP: TunnelBuild reply for tunnel ", tunnel->GetTunnelID ());
+		if (tunnel->HandleTunnelBuildResponse (buf, len))
 		{
-			LogPrint (eLogError, "I2NP: VaribleTunnelBuild message of ", num, " records is too short ", len);
-			return;
+			LogPrint (eLogInfo, "I2NP: Inbound tunnel ", tunnel->GetTunnelID (), " has been created");
+			tunnel->SetState (i2p::tunnel::eTunnelStateEstablished);
+			i2p::tunnel::tunnels.AddInboundTunnel (tunnel);
 		}
+		else
+		{
+			LogPrint (eLogInfo, "I2NP: Inbound tunnel ", tunnel->GetTunnelID (), " has been declined");
+			tunnel->SetState (i2p::tunnel::eTunnelStateBuildFailed);
+		}
+		return true;
+	}
 
-		auto tunnel = i2p::tunnel::tunnels.GetPendingInboundTunnel (replyMsgID);
-		if (tunnel)
+	static void HandleVariableTunnelBuildRequest (uint8_t * buf, size_t len, bool reject, i2p::crypto::CryptoKeyDecryptor * decryptor)
+	{
+		auto start = std::chrono::steady_clock::now ();
+		int num = buf[0];
+		uint8_t clearText[ECIES_BUILD_REQUEST_RECORD_CLEAR_TEXT_SIZE];
+		if (HandleBuildRequestRecords (num, buf + 1, clearText, reject, decryptor, start))
 		{
-			// endpoint of inbound tunnel
-			LogPrint (eLogDebug, "I2NP: VariableTunnelBuild reply for tunnel ", tunnel->GetTunnelID ());
-			if (tunnel->HandleTunnelBuildResponse (buf, len))
+			if (clearText[ECIES_BUILD_REQUEST_RECORD_FLAG_OFFSET] & TUNNEL_BUILD_RECORD_ENDPOINT_FLAG) // we are endpoint of outboud tunnel
 			{
-				LogPrint (eLogInfo, "I2NP: Inbound tunnel ", tunnel->GetTunnelID (), " has been created");
-				tunnel->SetState (i2p::tunnel::eTunnelStateEstablished);
-				i2p::tunnel::tunnels.AddInboundTunnel (tunnel);
+				// so we send it to reply tunnel
+				transports.SendMessage (clearText + ECIES_BUILD_REQUEST_RECORD_NEXT_IDENT_OFFSET,
+					CreateTunnelGatewayMsg (bufbe32toh (clearText + ECIES_BUILD_REQUEST_RECORD_NEXT_TUNNEL_OFFSET),
+						eI2NPVariableTunnelBuildReply, buf, len,
+						bufbe32toh (clearText + ECIES_BUILD_REQUEST_RECORD_SEND_MSG_ID_OFFSET)));
 			}
 			else
-			{
-				LogPrint (eLogInfo, "I2NP: Inbound tunnel ", tunnel->GetTunnelID (), " has been declined");
-				tunnel->SetState (i2p::tunnel::eTunnelStateBuildFailed);
-			}
+				transports.SendMessage (clearText + ECIES_BUILD_REQUEST_RECORD_NEXT_IDENT_OFFSET,
+					CreateI2NPMessage (eI2NPVariableTunnelBuild, buf, len,
+						bufbe32toh (clearText + ECIES_BUILD_REQUEST_RECORD_SEND_MSG_ID_OFFSET)));
+			i2p::tunnel::tunnels.AddTunnelBuildStageTime (i2p::tunnel::eTunnelBuildStageReply, start);
 		}
-		else
+	}
+
+	static bool CheckVariableTunnelBuildMsgLength (uint8_t * buf, size_t len)
+	{
+		int num = buf[0];
+		LogPrint (eLogDebug, "I2NP: VariableTunnelBuild ", num, " records");
+		if (len < num*TUNNEL_BUILD_RECORD_SIZE + 1)
 		{
-			uint8_t clearText[ECIES_BUILD_REQUEST_RECORD_CLEAR_TEXT_SIZE];
-			if (HandleBuildRequestRecords (num, buf + 1, clearText))
-			{
-				if (clearText[ECIES_BUILD_REQUEST_RECORD_FLAG_OFFSET] & TUNNEL_BUILD_RECORD_ENDPOINT_FLAG) // we are endpoint of outboud tunnel
-				{
-					// so we send it to reply tunnel
-					transports.SendMessage (clearText + ECIES_BUILD_REQUEST_RECORD_NEXT_IDENT_OFFSET,
-						CreateTunnelGatewayMsg (bufbe32toh (clearText + ECIES_BUILD_REQUEST_RECORD_NEXT_TUNNEL_OFFSET),
-							eI2NPVariableTunnelBuildReply, buf, len,
-							bufbe32toh (clearText + ECIES_BUILD_REQUEST_RECORD_SEND_MSG_ID_OFFSET)));
-				}
-				else
-					transports.SendMessage (clearText + ECIES_BUILD_REQUEST_RECORD_NEXT_IDENT_OFFSET,
-						CreateI2NPMessage (eI2NPVariableTunnelBuild, buf, len,
-							bufbe32toh (clearText + ECIES_BUILD_REQUEST_RECORD_SEND_MSG_ID_OFFSET)));
-			}
+			LogPrint (eLogError, "I2NP: VaribleTunnelBuild message of ", num, " records is too short ", len);
+			return false;
 		}
+		return true;
+	}
+
+	static void HandleVariableTunnelBuildMsg (uint32_t replyMsgID, uint8_t * buf, size_t len)
+	{
+		if (!CheckVariableTunnelBuildMsgLength (buf, len)) return;
+		if (!HandleInboundTunnelBuildReply (replyMsgID, buf, len))
+			HandleVariableTunnelBuildRequest (buf, len, false, nullptr);
 	}
 
 	static void HandleTunnelBuildMsg (uint8_t * buf, size_t len)
@@ -513,33 +795,10 @@ namespace i2p
 			LogPrint (eLogWarning, "I2NP: Pending tunnel for message ", replyMsgID, " not found");
 	}
 
-	static void HandleShortTunnelBuildMsg (uint32_t replyMsgID, uint8_t * buf, size_t len)
+	static void HandleShortTunnelBuildRequest (uint8_t * buf, size_t len, bool reject, i2p::crypto::CryptoKeyDecryptor * decryptor)
 	{
+		auto start = std::chrono::steady_clock::now ();
 		int num = buf[0];
-		LogPrint (eLogDebug, "I2NP: ShortTunnelBuild ", num, " records");
-		if (len < num*SHORT_TUNNEL_BUILD_RECORD_SIZE + 1)
-		{
-			LogPrint (eLogError, "I2NP: ShortTunnelBuild message of ", num, " records is too short ", len);
-			return;
-		}
-		auto tunnel = i2p::tunnel::tunnels.GetPendingInboundTunnel (replyMsgID);
-		if (tunnel)
-		{
-			// endpoint of inbound tunnel
-			LogPrint (eLogDebug, "I2NP: ShortTunnelBuild reply for tunnel ", tunnel->GetTunnelID ());
-			if (tunnel->HandleTunnelBuildResponse (buf, len))
-			{
-				LogPrint (eLogInfo, "I2NP: Inbound tunnel ", tunnel->GetTunnelID (), " has been created");
-				tunnel->SetState (i2p::tunnel::eTunnelStateEstablished);
-				i2p::tunnel::tunnels.AddInboundTunnel (tunnel);
-			}
-			else
-			{
-				LogPrint (eLogInfo, "I2NP: Inbound tunnel ", tunnel->GetTunnelID (), " has been declined");
-				tunnel->SetState (i2p::tunnel::eTunnelStateBuildFailed);
-			}
-			return;
-		}
 		const uint8_t * record = buf + 1;
 		for (int i = 0; i < num; i++)
 		{
@@ -547,7 +806,8 @@ namespace i2p
 			{
 				LogPrint (eLogDebug, "I2NP: Short request record ", i, " is ours");
 				uint8_t clearText[SHORT_REQUEST_RECORD_CLEAR_TEXT_SIZE];
-				if (!i2p::context.DecryptTunnelShortRequestRecord (record + SHORT_REQUEST_RECORD_ENCRYPTED_OFFSET, clearText))
+				i2p::crypto::NoiseSymmetricState noiseState;
+				if (!i2p::context.DecryptTunnelShortRequestRecord (record + SHORT_REQUEST_RECORD_ENCRYPTED_OFFSET, clearText, noiseState, decryptor))
 				{
 					LogPrint (eLogWarning, "I2NP: Can't decrypt short request record ", i);
 					return;
@@ -557,7 +817,6 @@ namespace i2p
 					LogPrint (eLogWarning, "I2NP: Unknown layer encryption type ", clearText[SHORT_REQUEST_RECORD_LAYER_ENCRYPTION_TYPE], " in short request record");
 					return;
 				}
-				auto& noiseState = i2p::context.GetCurrentNoiseState ();
 				uint8_t replyKey[32], layerKey[32], ivKey[32];
 				i2p::crypto::HKDF (noiseState.m_CK, nullptr, 0, "SMTunnelReplyKey", noiseState.m_CK);
 				memcpy (replyKey, noiseState.m_CK + 32, 32);
@@ -571,14 +830,12 @@ namespace i2p
 				}
 				else
 					memcpy (ivKey, noiseState.m_CK , 32);
+				i2p::tunnel::tunnels.AddTunnelBuildStageTime (i2p::tunnel::eTunnelBuildStageDecrypt, start);
 
 				// check if we accept this tunnel
 				uint8_t retCode = 0;
-				if (!i2p::context.AcceptsTunnels () ||
-					i2p::tunnel::tunnels.GetTransitTunnels ().size () > g_MaxNumTransitTunnels ||
-					i2p::transport::transports.IsBandwidthExceeded () ||
-					i2p::transport::transports.IsTransitBandwidthExceeded ())
-						retCode = 30;
+				if (reject || !AcceptsTransitTunnel ())
+					retCode = 30;
 				if (!retCode)
 				{
 					// create new transit tunnel
@@ -591,6 +848,8 @@ namespace i2p
 						clearText[SHORT_REQUEST_RECORD_FLAG_OFFSET] & TUNNEL_BUILD_RECORD_ENDPOINT_FLAG);
 					i2p::tunnel::tunnels.AddTransitTunnel (transitTunnel);
 				}
+				i2p::tunnel::tunnels.AddTunnelBuildResult (!retCode);
+				i2p::tunnel::tunnels.AddTunnelBuildStageTime (i2p::tunnel::eTunnelBuildStageAccept, start);
 
 				// encrypt reply
 				uint8_t nonce[12];
@@ -620,6 +879,7 @@ namespace i2p
 					auto replyMsg = NewI2NPShortMessage ();
 					replyMsg->Concat (buf, len);
 					replyMsg->FillI2NPMessageHeader (eI2NPShortTunnelBuildReply, bufbe32toh (clearText + SHORT_REQUEST_RECORD_SEND_MSG_ID_OFFSET));
+					uint32_t tunnelID = bufbe32toh (clearText + SHORT_REQUEST_RECORD_NEXT_TUNNEL_OFFSET);
 					if (memcmp ((const uint8_t *)i2p::context.GetIdentHash (),
 						clearText + SHORT_REQUEST_RECORD_NEXT_IDENT_OFFSET, 32)) // reply IBGW is not local?
 					{
@@ -628,30 +888,64 @@ namespace i2p
 						memcpy (&tag, noiseState.m_CK, 8);
 						// we send it to reply tunnel
 						transports.SendMessage (clearText + SHORT_REQUEST_RECORD_NEXT_IDENT_OFFSET,
-						CreateTunnelGatewayMsg (bufbe32toh (clearText + SHORT_REQUEST_RECORD_NEXT_TUNNEL_OFFSET),
+						CreateTunnelGatewayMsg (tunnelID,
 							i2p::garlic::WrapECIESX25519Message (replyMsg,  noiseState.m_CK + 32, tag)));
 					}
 					else
-					{
-						// IBGW is local
-						uint32_t tunnelID = bufbe32toh (clearText + SHORT_REQUEST_RECORD_NEXT_TUNNEL_OFFSET);
-						auto tunnel = i2p::tunnel::tunnels.GetTunnel (tunnelID);
-						if (tunnel)
-							tunnel->SendTunnelDataMsg (replyMsg);
-						else
-							LogPrint (eLogWarning, "I2NP: Tunnel ", tunnelID, " not found for short tunnel build reply");
-					}
+						// IBGW is local, tunnels might be handled by other thread
+						i2p::tunnel::tunnels.PostTunnelData (CreateTunnelGatewayMsg (tunnelID, replyMsg));
 				}
 				else
 					transports.SendMessage (clearText + SHORT_REQUEST_RECORD_NEXT_IDENT_OFFSET,
 						CreateI2NPMessage (eI2NPShortTunnelBuild, buf, len,
 							bufbe32toh (clearText + SHORT_REQUEST_RECORD_SEND_MSG_ID_OFFSET)));
+				i2p::tunnel::tunnels.AddTunnelBuildStageTime (i2p::tunnel::eTunnelBuildStageReply, start);
 				return;
 			}
 			record += SHORT_TUNNEL_BUILD_RECORD_SIZE;
 		}
 	}
 
+	static bool CheckShortTunnelBuildMsgLength (uint8_t * buf, size_t len)
+	{
+		int num = buf[0];
+		LogPrint (eLogDebug, "I2NP: ShortTunnelBuild ", num, " records");
+		if (len < num*SHORT_TUNNEL_BUILD_RECORD_SIZE + 1)
+		{
+			LogPrint (eLogError, "I2NP: ShortTunnelBuild message of ", num, " records is too short ", len);
+			return false;
+		}
+		return true;
+	}
+
+	static void HandleShortTunnelBuildMsg (uint32_t replyMsgID, uint8_t * buf, size_t len)
+	{
+		if (!CheckShortTunnelBuildMsgLength (buf, len)) return;
+		if (!HandleInboundTunnelBuildReply (replyMsgID, buf, len))
+			HandleShortTunnelBuildRequest (buf, len, false, nullptr);
+	}
+
+	void HandleTunnelBuildI2NPMessage (std::shared_ptr<I2NPMessage> msg)
+	{
+		if (!msg) return;
+		uint8_t * buf = msg->GetPayload ();
+		size_t len = msg->GetPayloadLength ();
+		bool isShort = msg->GetTypeID () == eI2NPShortTunnelBuild;
+		if (!(isShort ? CheckShortTunnelBuildMsgLength (buf, len) : CheckVariableTunnelBuildMsgLength (buf, len))) return;
+		// replies for our inbound tunnels are handled right away, requests go to build workers
+		if (!HandleInboundTunnelBuildReply (msg->GetMsgID (), buf, len))
+			i2p::tunnel::tunnels.PostTunnelBuildRequest (msg);
+	}
+
+	void HandleTunnelBuildRequestMsg (std::shared_ptr<I2NPMessage> msg, bool reject, i2p::crypto::CryptoKeyDecryptor * decryptor)
+	{
+		if (!msg) return;
+		if (msg->GetTypeID () == eI2NPShortTunnelBuild)
+			HandleShortTunnelBuildRequest (msg->GetPayload (), msg->GetPayloadLength (), reject, decryptor);
+		else
+			HandleVariableTunnelBuildRequest (msg->GetPayload (), msg->GetPayloadLength (), reject, decryptor);
+	}
+
 	std::shared_ptr<I2NPMessage> CreateTunnelDataMsg (const uint8_t * buf)
 	{
 		auto msg = NewI2NPTunnelMessage (false);
@@ -1,5 +1,5 @@
 /*
-* Copyright (c) 2013-2021, The PurpleI2P Project
+* Copyright (c) 2013-2022, The PurpleI2P Project
 *
 * This file is part of Purple i2pd project and licensed under BSD3
 *
@@ -12,6 +12,7 @@
 #include <inttypes.h>
 #include <string.h>
 #include <set>
+#include <vector>
 #include <memory>
 #include "Crypto.h"
 #include "I2PEndian.h"
@@ -260,6 +261,32 @@ namespace tunnel
 		uint8_t m_Buffer[sz + 32]; // 16 alignment + 16 padding
 	};
 
+	// I2NP messages buffers are allocated by size classes and cached by threads
+	enum I2NPBufferSizeClass
+	{
+		eI2NPBuffer2K = 0,
+		eI2NPBuffer4K,
+		eI2NPBuffer16K,
+		eI2NPBuffer64K,
+		eNumI2NPBufferSizeClasses
+	};
+	constexpr size_t I2NP_BUFFER_SIZES[eNumI2NPBufferSizeClasses] = { 2048, I2NP_MAX_SHORT_MESSAGE_SIZE, 16384, I2NP_MAX_MESSAGE_SIZE };
+	const size_t I2NP_BUFFER_OVERHEAD = 256; // shared_ptr control block and I2NPMessage fields
+	const size_t I2NP_BUFFER_HEADROOM = 64; // for headers and offsets added to payload
+	const size_t I2NP_BUFFERS_MAGAZINE_SIZE = 128*1024; // in bytes, per thread and size class
+	const size_t I2NP_BUFFERS_MAX_CACHED_SIZE = 4*1024*1024; // in bytes, per size class, the rest is returned to heap
+	const int I2NP_BUFFERS_STATS_FLUSH_INTERVAL = 64; // allocations and frees per thread
+
+	struct I2NPBuffersStats
+	{
+		size_t size; // max message length
+		uint64_t numAllocations, numHeapAllocations; // total
+		size_t numInUse, numCached;
+		uint64_t allocationRate; // per second
+	};
+	std::vector<I2NPBuffersStats> GetI2NPBuffersStats ();
+	void UpdateI2NPBuffersStats (); // calculate rate
+
 	std::shared_ptr<I2NPMessage> NewI2NPMessage ();
 	std::shared_ptr<I2NPMessage> NewI2NPShortMessage ();
 	std::shared_ptr<I2NPMessage> NewI2NPTunnelMessage (bool endpoint);
@@ -279,6 +306,8 @@ namespace tunnel
 	std::shared_ptr<I2NPMessage> CreateDatabaseSearchReply (const i2p::data::IdentHash& ident, std::vector<i2p::data::IdentHash> routers);
 
 	std::shared_ptr<I2NPMessage> CreateDatabaseStoreMsg (std::shared_ptr<const i2p::data::RouterInfo> router = nullptr, uint32_t replyToken = 0, std::shared_ptr<const i2p::tunnel::InboundTunnel> replyTunnel = nullptr);
+	std::shared_ptr<I2NPMessage> CreateDatabaseStoreMsg (const i2p::data::IdentHash& ident, const uint8_t * routerInfo, size_t routerInfoLen,
+		uint32_t replyToken = 0, std::shared_ptr<const i2p::tunnel::InboundTunnel> replyTunnel = nullptr); // RouterInfo from buffer
 	std::shared_ptr<I2NPMessage> CreateDatabaseStoreMsg (const i2p::data::IdentHash& storeHash, std::shared_ptr<const i2p::data::LeaseSet> leaseSet); // for floodfill only
 	std::shared_ptr<I2NPMessage> CreateDatabaseStoreMsg (std::shared_ptr<const i2p::data::LocalLeaseSet> leaseSet, uint32_t replyToken = 0, std::shared_ptr<const i2p::tunnel::InboundTunnel> replyTunnel = nullptr);
 	bool IsRouterInfoMsg (std::shared_ptr<I2NPMessage> msg);
@@ -295,6 +324,9 @@ namespace tunnel
 	size_t GetI2NPMessageLength (const uint8_t * msg, size_t len);
 	void HandleI2NPMessage (uint8_t * msg, size_t len);
 	void HandleI2NPMessage (std::shared_ptr<I2NPMessage> msg);
+	void HandleTunnelBuildI2NPMessage (std::shared_ptr<I2NPMessage> msg); // in tunnels thread
+	void HandleTunnelBuildRequestMsg (std::shared_ptr<I2NPMessage> msg, bool reject,
+		i2p::crypto::CryptoKeyDecryptor * decryptor = nullptr); // in build worker, rejects with code 30 if reject
 
 	class I2NPMessagesHandler
 	{
@@ -183,11 +183,13 @@ namespace log {
 		i2p::util::SetThreadName("Logging");
 
 		Reopen ();
+		std::vector<std::shared_ptr<LogMsg> > msgs;
 		while (m_IsRunning)
 		{
-			std::shared_ptr<LogMsg> msg;
-			while ((msg = m_Queue.Get ()))
-				Process (msg);
+			m_Queue.GetAll (msgs);
+			for (auto& it: msgs)
+				Process (it);
+			msgs.clear ();
 			if (m_LogStream) m_LogStream->flush();
 			if (m_IsRunning)
 				m_Queue.Wait ();
@@ -110,9 +110,9 @@ namespace transport
 	void NTCP2Establisher::CreateSessionRequestMessage ()
 	{
 		// create buffer and fill padding
-		auto paddingLength = rand () % (NTCP2_SESSION_REQUEST_MAX_SIZE - 64); // message length doesn't exceed 287 bytes
+		auto paddingLength = i2p::crypto::RandUInt32 () % (NTCP2_SESSION_REQUEST_MAX_SIZE - 64); // message length doesn't exceed 287 bytes
 		m_SessionRequestBufferLen = paddingLength + 64;
-		RAND_bytes (m_SessionRequestBuffer + 64, paddingLength);
+		i2p::crypto::RandBytes (m_SessionRequestBuffer + 64, paddingLength);
 		// encrypt X
 		i2p::crypto::CBCEncryption encryption;
 		encryption.SetKey (m_RemoteIdentHash);
@@ -149,9 +149,9 @@ namespace transport
 
 	void NTCP2Establisher::CreateSessionCreatedMessage ()
 	{
-		auto paddingLen = rand () % (NTCP2_SESSION_CREATED_MAX_SIZE - 64);
+		auto paddingLen = i2p::crypto::RandUInt32 () % (NTCP2_SESSION_CREATED_MAX_SIZE - 64);
 		m_SessionCreatedBufferLen = paddingLen + 64;
-		RAND_bytes (m_SessionCreatedBuffer + 64, paddingLen);
+		i2p::crypto::RandBytes (m_SessionCreatedBuffer + 64, paddingLen);
 		// encrypt Y
 		i2p::crypto::CBCEncryption encryption;
 		encryption.SetKey (i2p::context.GetIdentHash ());
@@ -1094,7 +1094,7 @@ namespace transport
 		{
 			if (m_NextPaddingSize >= 16)
 			{
-				RAND_bytes ((uint8_t *)m_PaddingSizes, sizeof (m_PaddingSizes));
+				i2p::crypto::RandBytes ((uint8_t *)m_PaddingSizes, sizeof (m_PaddingSizes));
 				m_NextPaddingSize = 0;
 			}
 			paddingSize = m_PaddingSizes[m_NextPaddingSize++] % paddingSize;
@@ -9,6 +9,7 @@
 #include <string.h>
 #include <fstream>
 #include <vector>
+#include <chrono>
 #include <boost/asio.hpp>
 #include <stdexcept>
 
@@ -36,7 +37,9 @@ namespace data
 {
 	NetDb netdb;
 
-	NetDb::NetDb (): m_IsRunning (false), m_Thread (nullptr), m_Reseeder (nullptr), m_Storage("netDb", "r", "routerInfo-", "dat"), m_PersistProfiles (true), m_HiddenMode(false)
+	NetDb::NetDb (): m_IsRouterIndexDirty (false), m_LastRouterIndexRebuild (0), m_LoadTime (0), m_NumLoadedRouters (0),
+		m_UseSnapshot (false), m_IsLoadedFromSnapshot (false),
+		m_IsRunning (false), m_Thread (nullptr), m_Reseeder (nullptr), m_Storage("netDb", "r", "routerInfo-", "dat"), m_PersistProfiles (true), m_HiddenMode(false)
 	{
 	}
 
@@ -52,6 +55,9 @@ namespace data
 		m_Storage.Init(i2p::data::GetBase64SubstitutionTable(), 64);
 		InitProfilesStorage ();
 		m_Families.LoadCertificates ();
+		i2p::config::GetOption("persist.netdbsnapshot", m_UseSnapshot);
+		if (!m_UseSnapshot)
+			i2p::fs::Remove (i2p::fs::DataDirPath (NETDB_SNAPSHOT_FILENAME)); // would be stale next time
 		Load ();
 
 		uint16_t threshold; i2p::config::GetOption("reseed.threshold", threshold);
@@ -59,20 +65,25 @@ namespace data
 		{
 			Reseed ();
 		}
-		else if (!GetRandomRouter (i2p::context.GetSharedRouterInfo (), false))
-			Reseed (); // we don't have a router we can connect to. Trying to reseed
+		else
+		{
+			RebuildRouterIndex ();
+			if (!GetRandomRouter (i2p::context.GetSharedRouterInfo (), false))
+				Reseed (); // we don't have a router we can connect to. Trying to reseed
+		}
 
 		auto it = m_RouterInfos.find (i2p::context.GetIdentHash ());
 		if (it != m_RouterInfos.end ())
 		{
 			// remove own router
-			m_Floodfills.remove (it->second);
+			m_Floodfills.Remove (it->first);
 			m_RouterInfos.erase (it);
 		}
 		// insert own router
 		m_RouterInfos.emplace (i2p::context.GetIdentHash (), i2p::context.GetSharedRouterInfo ());
 		if (i2p::context.IsFloodfill ())
-			m_Floodfills.push_back (i2p::context.GetSharedRouterInfo ());
+			m_Floodfills.Insert (i2p::context.GetSharedRouterInfo ());
+		RebuildRouterIndex ();
 
 		i2p::config::GetOption("persist.profiles", m_PersistProfiles);
 
@@ -89,7 +100,8 @@ namespace data
 					it.second->SaveProfile ();
 			DeleteObsoleteProfiles ();
 			m_RouterInfos.clear ();
-			m_Floodfills.clear ();
+			m_Floodfills.Clear ();
+			m_RouterIndex.Clear ();
 			if (m_Thread)
 			{
 				m_IsRunning = false;
@@ -99,6 +111,7 @@ namespace data
 				m_Thread = 0;
 			}
 			m_LeaseSets.clear();
+			m_Snapshot.Close ();
 			m_Requests.Stop ();
 		}
 	}
@@ -112,17 +125,26 @@ namespace data
 		{
 			try
 			{
-				auto msg = m_Queue.GetNextWithTimeout (15000); // 15 sec
+				auto msg = m_Queue.GetNextWithTimeout (m_IsRouterIndexDirty ? NETDB_ROUTER_INDEX_REBUILD_INTERVAL*1000 : 15000); // 15 sec
 				if (msg)
 				{
-					int numMsgs = 0;
+					std::vector<std::shared_ptr<const I2NPMessage> > msgs;
 					while (msg)
 					{
+						msgs.push_back (msg);
+						if (msgs.size () > NETDB_MAX_MSGS_BATCH_SIZE) break;
+						msg = m_Queue.Get ();
+					}
+					std::vector<Tag<32> > verifiedKeys;
+					VerifyDatabaseStores (msgs, verifiedKeys);
+					for (size_t i = 0; i < msgs.size (); i++)
+					{
+						msg = msgs[i];
 						LogPrint(eLogDebug, "NetDb: Got request with type ", (int) msg->GetTypeID ());
 						switch (msg->GetTypeID ())
 						{
 							case eI2NPDatabaseStore:
-								HandleDatabaseStoreMsg (msg);
+								HandleDatabaseStoreMsg (msg, verifiedKeys[i].IsZero () ? nullptr : verifiedKeys[i].data ());
 							break;
 							case eI2NPDatabaseSearchReply:
 								HandleDatabaseSearchReplyMsg (msg);
@@ -141,15 +163,14 @@ namespace data
 								LogPrint (eLogError, "NetDb: Unexpected message type ", (int) msg->GetTypeID ());
 								//i2p::HandleI2NPMessage (msg);
 						}
-						if (numMsgs > 100) break;
-						msg = m_Queue.Get ();
-						numMsgs++;
 					}
 				}
 				if (!m_IsRunning) break;
+				uint64_t ts = i2p::util::GetSecondsSinceEpoch ();
+				if (m_IsRouterIndexDirty && ts >= m_LastRouterIndexRebuild + NETDB_ROUTER_INDEX_REBUILD_INTERVAL)
+					RebuildRouterIndex ();
 				if (!i2p::transport::transports.IsOnline ()) continue; // don't manage netdb when offline
 
-				uint64_t ts = i2p::util::GetSecondsSinceEpoch ();
 				if (ts - lastManageRequest >= 15) // manage requests every 15 seconds
 				{
 					m_Requests.ManageRequests ();
@@ -250,7 +271,14 @@ namespace data
 		return updated;
 	}
 
-	std::shared_ptr<const RouterInfo> NetDb::AddRouterInfo (const IdentHash& ident, const uint8_t * buf, int len, bool& updated)
+	static bool IsVerifiedBy (const IdentityEx& identity, const uint8_t * verifiedKey)
+	{
+		// signature verified by batch is valid for the same Ed25519 key only
+		return verifiedKey && identity.GetSigningKeyType () == SIGNING_KEY_TYPE_EDDSA_SHA512_ED25519 &&
+			!memcmp (identity.GetSigningPublicKeyBuffer (), verifiedKey, i2p::crypto::EDDSA25519_PUBLIC_KEY_LENGTH);
+	}
+
+	std::shared_ptr<const RouterInfo> NetDb::AddRouterInfo (const IdentHash& ident, const uint8_t * buf, int len, bool& updated, const uint8_t * verifiedKey)
 	{
 		updated = true;
 		auto r = FindRouter (ident);
@@ -259,16 +287,17 @@ namespace data
 			if (r->IsNewer (buf, len))
 			{
 				bool wasFloodfill = r->IsFloodfill ();
-				r->Update (buf, len);
+				r->Update (buf, len, !IsVerifiedBy (*r->GetRouterIdentity (), verifiedKey));
+				m_IsRouterIndexDirty = true; // caps or addresses might change
 				LogPrint (eLogInfo, "NetDb: RouterInfo updated: ", ident.ToBase64());
 				if (wasFloodfill != r->IsFloodfill ()) // if floodfill status updated
 				{
 					LogPrint (eLogDebug, "NetDb: RouterInfo floodfill status updated: ", ident.ToBase64());
 					std::unique_lock<std::mutex> l(m_FloodfillsMutex);
 					if (wasFloodfill)
-						m_Floodfills.remove (r);
+						m_Floodfills.Remove (r->GetIdentHash ());
 					else if (r->IsEligibleFloodfill ())
-						m_Floodfills.push_back (r);
+						m_Floodfills.Insert (r);
 				}
 			}
 			else
@@ -279,7 +308,14 @@ namespace data
 		}
 		else
 		{
-			r = std::make_shared<RouterInfo> (buf, len);
+			if (verifiedKey)
+			{
+				r = std::make_shared<RouterInfo> (buf, len, false);
+				auto identity = r->GetRouterIdentity ();
+				if (!identity || identity->GetIdentHash () != ident || !IsVerifiedBy (*identity, verifiedKey))
+					r = nullptr; // verified for other key, verify again
+			}
+			if (!r) r = std::make_shared<RouterInfo> (buf, len);
 			if (!r->IsUnreachable () && r->HasValidAddresses ())
 			{
 				bool inserted = false;
@@ -290,10 +326,11 @@ namespace data
 				if (inserted)
 				{
 					LogPrint (eLogInfo, "NetDb: RouterInfo added: ", ident.ToBase64());
+					m_IsRouterIndexDirty = true;
 					if (r->IsFloodfill () && r->IsEligibleFloodfill ())
 					{
 						std::unique_lock<std::mutex> l(m_FloodfillsMutex);
-						m_Floodfills.push_back (r);
+						m_Floodfills.Insert (r);
 					}
 				}
 				else
@@ -348,10 +385,16 @@ namespace data
 		return updated;
 	}
 
-	bool NetDb::AddLeaseSet2 (const IdentHash& ident, const uint8_t * buf, int len, uint8_t storeType)
+	bool NetDb::AddLeaseSet2 (const IdentHash& ident, const uint8_t * buf, int len, uint8_t storeType, const uint8_t * verifiedKey)
 	{
 		std::unique_lock<std::mutex> lock(m_LeaseSetsMutex);
-		auto leaseSet = std::make_shared<LeaseSet2> (storeType, buf, len, false); // we don't need leases in netdb
+		auto leaseSet = std::make_shared<LeaseSet2> (storeType, buf, len, false, CRYPTO_KEY_TYPE_ELGAMAL, !verifiedKey); // we don't need leases in netdb
+		if (verifiedKey)
+		{
+			auto identity = leaseSet->GetIdentity ();
+			if (!identity || identity->GetIdentHash () != ident || !IsVerifiedBy (*identity, verifiedKey))
+				leaseSet = std::make_shared<LeaseSet2> (storeType, buf, len, false, CRYPTO_KEY_TYPE_ELGAMAL); // verified for other key, verify again
+		}
 		if (leaseSet->IsValid ())
 		{
 			auto it = m_LeaseSets.find(ident);
@@ -472,25 +515,18 @@ namespace data
 		i2p::transport::transports.SendMessages(ih, requests);
 	}
 
-	bool NetDb::LoadRouterInfo (const std::string& path, uint64_t ts)
+	std::shared_ptr<RouterInfo> NetDb::LoadRouterInfo (const std::string& path, uint64_t ts)
 	{
 		auto r = std::make_shared<RouterInfo>(path);
 		if (r->GetRouterIdentity () && !r->IsUnreachable () && r->HasValidAddresses () &&
 		    ts < r->GetTimestamp () + 24*60*60*NETDB_MAX_OFFLINE_EXPIRATION_TIMEOUT*1000LL)
 		{
-			r->DeleteBuffer ();
-			if (m_RouterInfos.emplace (r->GetIdentHash (), r).second)
-			{
-				if (r->IsFloodfill () && r->IsEligibleFloodfill ())
-					m_Floodfills.push_back (r);
-			}
-		}
-		else
-		{
-			LogPrint(eLogWarning, "NetDb: RI from ", path, " is invalid or too old. Delete");
-			i2p::fs::Remove(path);
+			if (!m_UseSnapshot) r->DeleteBuffer (); // otherwise snapshot is created from buffers
+			return r;
 		}
-		return true;
+		LogPrint(eLogWarning, "NetDb: RI from ", path, " is invalid or too old. Delete");
+		i2p::fs::Remove(path);
+		return nullptr;
 	}
 
 	void NetDb::VisitLeaseSets(LeaseSetVisitor v)
@@ -518,63 +554,110 @@ namespace data
 
 	size_t NetDb::VisitRandomRouterInfos(RouterInfoFilter filter, RouterInfoVisitor v, size_t n)
 	{
-		std::vector<std::shared_ptr<const RouterInfo> > found;
-		const size_t max_iters_per_cyle = 3;
-		size_t iters = max_iters_per_cyle;
-		while(n > 0)
-		{
-			std::unique_lock<std::mutex> lock(m_RouterInfosMutex);
-			uint32_t idx = rand () % m_RouterInfos.size ();
-			uint32_t i = 0;
-			for (const auto & it : m_RouterInfos) {
-				if(i >= idx) // are we at the random start point?
-				{
-					// yes, check if we want this one
-					if(filter(it.second))
-					{
-						// we have a match
-						--n;
-						found.push_back(it.second);
-						// reset max iterations per cycle
-						iters = max_iters_per_cyle;
-						break;
-					}
-				}
-				else // not there yet
-					++i;
-			}
-			// we have enough
-			if(n == 0) break;
-			--iters;
-			// have we tried enough this cycle ?
-			if(!iters) {
-				// yes let's try the next cycle
-				--n;
-				iters = max_iters_per_cyle;
-			}
-		}
-		// visit the ones we found
-		size_t visited = 0;
-		for(const auto & ri : found ) {
-			v(ri);
-			++visited;
-		}
-		return visited;
+		return m_RouterIndex.VisitRandom (eRouterIndexAll, filter, v, n);
 	}
 
 	void NetDb::Load ()
 	{
 		// make sure we cleanup netDb from previous attempts
 		m_RouterInfos.clear ();
-		m_Floodfills.clear ();
+		m_Floodfills.Clear ();
 
+		auto start = std::chrono::steady_clock::now ();
 		uint64_t ts = i2p::util::GetMillisecondsSinceEpoch();
-		std::vector<std::string> files;
-		m_Storage.Traverse(files);
-		for (const auto& path : files)
-			LoadRouterInfo (path, ts);
+		// traverse, read and parse in parallel, every thread takes own part of storage
+		int numThreads = std::thread::hardware_concurrency ();
+		if (numThreads < 1) numThreads = 1;
+		if (numThreads > NETDB_MAX_LOAD_THREADS) numThreads = NETDB_MAX_LOAD_THREADS;
+		std::vector<std::vector<std::shared_ptr<RouterInfo> > > loaded (numThreads);
+		m_IsLoadedFromSnapshot = m_UseSnapshot && m_Snapshot.Open (i2p::fs::DataDirPath (NETDB_SNAPSHOT_FILENAME));
+		std::vector<std::thread> threads;
+		for (int i = 1; i < numThreads; i++)
+			threads.emplace_back (&NetDb::LoadRouterInfos, this, std::ref (loaded[i]), ts, i, numThreads, m_IsLoadedFromSnapshot);
+		LoadRouterInfos (loaded[0], ts, 0, numThreads, m_IsLoadedFromSnapshot);
+		for (auto& it: threads) it.join ();
+		// merge
+		for (const auto& it: loaded)
+			for (const auto& r: it)
+				if (m_RouterInfos.emplace (r->GetIdentHash (), r).second)
+				{
+					if (r->IsFloodfill () && r->IsEligibleFloodfill ())
+						m_Floodfills.Insert (r);
+				}
+		m_IsRouterIndexDirty = true;
+		if (m_UseSnapshot)
+		{
+			// create if loaded from files, compact if some records were dropped
+			if (!m_IsLoadedFromSnapshot || m_Snapshot.GetNumRecords () != m_RouterInfos.size ())
+				CreateSnapshot ();
+			if (!m_IsLoadedFromSnapshot)
+				for (auto& it: m_RouterInfos)
+					it.second->DeleteBuffer ();
+		}
+		m_LoadTime = std::chrono::duration_cast<std::chrono::milliseconds> (std::chrono::steady_clock::now () - start).count ();
+		m_NumLoadedRouters = m_RouterInfos.size ();
 
-		LogPrint (eLogInfo, "NetDb: ", m_RouterInfos.size(), " routers loaded (", m_Floodfills.size (), " floodfils)");
+		LogPrint (eLogInfo, "NetDb: ", m_RouterInfos.size(), " routers loaded (", m_Floodfills.size (), " floodfils) in ",
+			m_LoadTime, " ms, ", m_NumLoadedRouters*1000/(m_LoadTime ? m_LoadTime : 1), " routers/sec, ", numThreads, " threads", m_IsLoadedFromSnapshot ? ", from snapshot" : "");
+	}
+
+	void NetDb::LoadRouterInfos (std::vector<std::shared_ptr<RouterInfo> >& routers, uint64_t ts, int part, int numParts, bool fromSnapshot)
+	{
+		if (fromSnapshot)
+			m_Snapshot.Visit ([this, &routers, ts](const IdentHash& ident, const uint8_t * buf, size_t len)
+				{
+					// was verified when received
+					auto r = std::make_shared<RouterInfo>(buf, len, false);
+					if (r->GetRouterIdentity () && r->GetIdentHash () == ident && !r->IsUnreachable () && r->HasValidAddresses () &&
+						ts < r->GetTimestamp () + 24*60*60*NETDB_MAX_OFFLINE_EXPIRATION_TIMEOUT*1000LL)
+					{
+						r->SetUpdated (false);
+						r->DeleteBuffer ();
+						routers.push_back (r);
+					}
+					else
+					{
+						LogPrint(eLogWarning, "NetDb: RI ", ident.ToBase64 (), " from snapshot is invalid or too old. Delete");
+						m_Storage.Remove (ident.ToBase64 ());
+					}
+				}, part, numParts);
+		else
+			m_Storage.Iterate ([this, &routers, ts](const std::string& path)
+				{
+					auto r = LoadRouterInfo (path, ts);
+					if (r) routers.push_back (r);
+				}, part, numParts);
+	}
+
+	void NetDb::CreateSnapshot ()
+	{
+		std::vector<NetDbSnapshot::Record> records;
+		std::vector<std::shared_ptr<RouterInfo> > loaded; // buffers to delete after
+		records.reserve (m_RouterInfos.size ());
+		auto own = i2p::context.GetSharedRouterInfo ();
+		for (auto& it: m_RouterInfos)
+		{
+			if (it.second == own || it.second->IsUnreachable ()) continue;
+			if (it.second->GetBuffer ())
+				records.push_back ({it.first, it.second->GetBuffer (), it.second->GetBufferLen ()});
+			else
+			{
+				size_t len = 0;
+				auto buf = m_Snapshot.Find (it.first, len);
+				if (!buf)
+				{
+					it.second->LoadBuffer (m_Storage.Path (it.second->GetIdentHashBase64 ()));
+					if (!it.second->GetBuffer ()) continue;
+					loaded.push_back (it.second);
+					buf = it.second->GetBuffer (); len = it.second->GetBufferLen ();
+				}
+				records.push_back ({it.first, buf, len});
+			}
+		}
+		if (m_Snapshot.Create (i2p::fs::DataDirPath (NETDB_SNAPSHOT_FILENAME), records))
+			LogPrint (eLogInfo, "NetDb: Snapshot created with ", m_Snapshot.GetNumRecords (), " routers, ", m_Snapshot.GetFileSize (), " bytes");
+		for (auto& it: loaded)
+			it->DeleteBuffer ();
 	}
 
 	void NetDb::SaveUpdated ()
@@ -591,6 +674,9 @@ namespace data
 			expirationTimeout = i2p::context.IsFloodfill () ? NETDB_FLOODFILL_EXPIRATION_TIMEOUT*1000LL :
 				NETDB_MIN_EXPIRATION_TIMEOUT*1000LL + (NETDB_MAX_EXPIRATION_TIMEOUT - NETDB_MIN_EXPIRATION_TIMEOUT)*1000LL*NETDB_MIN_ROUTERS/total;
 
+		std::vector<NetDbSnapshot::Record> snapshotUpdated;
+		std::vector<std::shared_ptr<RouterInfo> > snapshotBuffers; // delete after append
+		std::vector<IdentHash> snapshotRemoved;
 		auto own = i2p::context.GetSharedRouterInfo ();
 		for (auto& it: m_RouterInfos)
 		{
@@ -601,7 +687,13 @@ namespace data
 				it.second->SaveToFile (m_Storage.Path(ident));
 				it.second->SetUpdated (false);
 				it.second->SetUnreachable (false);
-				it.second->DeleteBuffer ();
+				if (m_UseSnapshot && it.second->GetBuffer ())
+				{
+					snapshotUpdated.push_back ({it.first, it.second->GetBuffer (), it.second->GetBufferLen ()});
+					snapshotBuffers.push_back (it.second);
+				}
+				else
+					it.second->DeleteBuffer ();
 				updatedCount++;
 				continue;
 			}
@@ -624,11 +716,21 @@ namespace data
 				if (it.second->IsFloodfill ()) deletedFloodfillsCount++;
 				// delete RI file
 				m_Storage.Remove(ident);
+				if (m_UseSnapshot) snapshotRemoved.push_back (it.first);
 				deletedCount++;
 				if (total - deletedCount < NETDB_MIN_ROUTERS) checkForExpiration = false;
 			}
 		} // m_RouterInfos iteration
 
+		if (m_UseSnapshot)
+		{
+			// compact if more than half of file is garbage
+			if (!m_Snapshot.IsOpen () || !m_Snapshot.Append (snapshotUpdated, snapshotRemoved) ||
+				m_Snapshot.GetGarbageSize () > m_Snapshot.GetFileSize ()/2)
+				CreateSnapshot ();
+			for (auto& it: snapshotBuffers)
+				it->DeleteBuffer ();
+		}
 		m_RouterInfoBuffersPool.CleanUpMt ();
 			
 		if (updatedCount > 0)
@@ -645,6 +747,7 @@ namespace data
 					{
 						if (m_PersistProfiles) it->second->SaveProfile ();
 						it = m_RouterInfos.erase (it);
+						m_IsRouterIndexDirty = true;
 						continue;
 					}
 					++it;
@@ -653,11 +756,10 @@ namespace data
 			// clean up expired floodfills or not floodfills anymore
 			{
 				std::unique_lock<std::mutex> l(m_FloodfillsMutex);
-				for (auto it = m_Floodfills.begin (); it != m_Floodfills.end ();)
-					if ((*it)->IsUnreachable () || !(*it)->IsFloodfill ())
-						it = m_Floodfills.erase (it);
-					else
-						++it;
+				m_Floodfills.RemoveIf ([](const std::shared_ptr<RouterInfo>& r)->bool
+					{
+						return r->IsUnreachable () || !r->IsFloodfill ();
+					});
 			}
 		}	
 	}
@@ -726,7 +828,7 @@ namespace data
 		}
 	}
 
-	void NetDb::HandleDatabaseStoreMsg (std::shared_ptr<const I2NPMessage> m)
+	void NetDb::HandleDatabaseStoreMsg (std::shared_ptr<const I2NPMessage> m, const uint8_t * verifiedKey)
 	{
 		const uint8_t * buf = m->GetPayload ();
 		size_t len = m->GetSize ();
@@ -778,7 +880,7 @@ namespace data
 				else // all others are considered as LeaseSet2
 				{
 					LogPrint (eLogDebug, "NetDb: Store request: LeaseSet2 of type ", storeType, " for ", ident.ToBase32());
-					updated = AddLeaseSet2 (ident, buf + offset, len - offset, storeType);
+					updated = AddLeaseSet2 (ident, buf + offset, len - offset, storeType, verifiedKey);
 				}
 			}
 		}
@@ -795,7 +897,7 @@ namespace data
 			uint8_t uncompressed[MAX_RI_BUFFER_SIZE];
 			size_t uncompressedSize = m_Inflator.Inflate (buf + offset, size, uncompressed, MAX_RI_BUFFER_SIZE);
 			if (uncompressedSize && uncompressedSize < MAX_RI_BUFFER_SIZE)
-				updated = AddRouterInfo (ident, uncompressed, uncompressedSize);
+				AddRouterInfo (ident, uncompressed, uncompressedSize, updated, verifiedKey);
 			else
 			{
 				LogPrint (eLogInfo, "NetDb: Decompression failed ", uncompressedSize);
@@ -823,6 +925,74 @@ namespace data
 		}
 	}
 
+	void NetDb::VerifyDatabaseStores (const std::vector<std::shared_ptr<const I2NPMessage> >& msgs, std::vector<Tag<32> >& verifiedKeys)
+	{
+		// Ed25519 signatures of RouterInfos and LeaseSets2 are verified together, others as usual later
+		verifiedKeys.assign (msgs.size (), Tag<32> ()); // zero if not verified
+		m_BatchVerifier.Clear ();
+		std::vector<size_t> indices;
+		std::vector<Tag<32> > keys;
+		std::vector<uint8_t> signedData;
+		uint8_t uncompressed[MAX_RI_BUFFER_SIZE];
+		IdentityEx identity;
+		for (size_t i = 0; i < msgs.size (); i++)
+		{
+			const auto& m = msgs[i];
+			if (m->GetTypeID () != eI2NPDatabaseStore) continue;
+			const uint8_t * buf = m->GetPayload ();
+			size_t len = m->GetSize (), offset = DATABASE_STORE_HEADER_SIZE;
+			if (bufbe32toh (buf + DATABASE_STORE_REPLY_TOKEN_OFFSET)) offset += 36; // tunnelID + gateway
+			if (offset + 2 >= len) continue;
+			uint8_t storeType = buf[DATABASE_STORE_TYPE_OFFSET];
+			if (!storeType) // RouterInfo
+			{
+				size_t size = bufbe16toh (buf + offset);
+				offset += 2;
+				if (size > MAX_RI_BUFFER_SIZE || size > len - offset) continue;
+				size_t uncompressedSize = m_Inflator.Inflate (buf + offset, size, uncompressed, MAX_RI_BUFFER_SIZE);
+				if (!uncompressedSize || uncompressedSize >= MAX_RI_BUFFER_SIZE) continue;
+				auto r = FindRouter (IdentHash (buf + DATABASE_STORE_KEY_OFFSET));
+				if (r && !r->IsNewer (uncompressed, uncompressedSize)) continue; // will be dropped anyway
+				// existing RouterInfo is verified by known identity
+				const IdentityEx * ident = r ? r->GetRouterIdentity ().get () : nullptr;
+				if (!ident)
+				{
+					if (!identity.FromBuffer (uncompressed, uncompressedSize)) continue;
+					ident = &identity;
+				}
+				if (ident->GetSigningKeyType () != SIGNING_KEY_TYPE_EDDSA_SHA512_ED25519 ||
+					uncompressedSize < ident->GetFullLen () + i2p::crypto::EDDSA25519_SIGNATURE_LENGTH) continue;
+				size_t l = uncompressedSize - i2p::crypto::EDDSA25519_SIGNATURE_LENGTH;
+				m_BatchVerifier.Add (ident->GetSigningPublicKeyBuffer (), uncompressed, l, uncompressed + l);
+				indices.push_back (i);
+				keys.emplace_back (ident->GetSigningPublicKeyBuffer ());
+			}
+			else if (storeType == NETDB_STORE_TYPE_STANDARD_LEASESET2 && !m->from)
+			{
+				size_t fullLen = identity.FromBuffer (buf + offset, len - offset);
+				if (!fullLen || identity.GetSigningKeyType () != SIGNING_KEY_TYPE_EDDSA_SHA512_ED25519 ||
+					len < offset + fullLen + 8 + i2p::crypto::EDDSA25519_SIGNATURE_LENGTH) continue;
+				if (bufbe16toh (buf + offset + fullLen + 6) & LEASESET2_FLAG_OFFLINE_KEYS) continue; // signed by transient key
+				// store type is signed too
+				size_t l = len - offset - i2p::crypto::EDDSA25519_SIGNATURE_LENGTH;
+				signedData.resize (l + 1);
+				signedData[0] = storeType;
+				memcpy (signedData.data () + 1, buf + offset, l);
+				m_BatchVerifier.Add (identity.GetSigningPublicKeyBuffer (), signedData.data (), signedData.size (), buf + offset + l);
+				indices.push_back (i);
+				keys.emplace_back (identity.GetSigningPublicKeyBuffer ());
+			}
+		}
+		if (indices.empty ()) return;
+		std::vector<bool> results;
+		if (!m_BatchVerifier.Verify (results))
+			LogPrint (eLogInfo, "NetDb: Batch of ", indices.size (), " signatures contains invalid");
+		for (size_t i = 0; i < indices.size (); i++)
+			if (results[i]) // not verified are handled as usual
+				verifiedKeys[indices[i]] = keys[i];
+		m_BatchVerifier.Clear ();
+	}
+
 	void NetDb::HandleDatabaseSearchReplyMsg (std::shared_ptr<const I2NPMessage> msg)
 	{
 		const uint8_t * buf = msg->GetPayload ();
@@ -964,10 +1134,17 @@ namespace data
 				if (router)
 				{
 					LogPrint (eLogDebug, "NetDb: Requested RouterInfo ", key, " found");
-					if (!router->GetBuffer ())
-						router->LoadBuffer (m_Storage.Path (router->GetIdentHashBase64 ()));
-					if (router->GetBuffer ())
-						replyMsg = CreateDatabaseStoreMsg (router);
+					size_t len = 0;
+					const uint8_t * stored = router->GetBuffer () ? nullptr : m_Snapshot.Find (ident, len);
+					if (stored)
+						replyMsg = CreateDatabaseStoreMsg (ident, stored, len); // directly from mapped snapshot
+					else
+					{
+						if (!router->GetBuffer ())
+							router->LoadBuffer (m_Storage.Path (router->GetIdentHashBase64 ()));
+						if (router->GetBuffer ())
+							replyMsg = CreateDatabaseStoreMsg (router);
+					}
 				}
 			}
 
@@ -1067,7 +1244,7 @@ namespace data
 		LogPrint (eLogInfo, "NetDb: Exploring new ", numDestinations, " routers ...");
 		for (int i = 0; i < numDestinations; i++)
 		{
-			RAND_bytes (randomHash, 32);
+			i2p::crypto::RandBytes (randomHash, 32);
 			auto dest = m_Requests.CreateRequest (randomHash, true); // exploratory
 			if (!dest)
 			{
@@ -1118,7 +1295,7 @@ namespace data
 		if (floodfill)
 		{
 			uint32_t replyToken;
-			RAND_bytes ((uint8_t *)&replyToken, 4);
+			replyToken = i2p::crypto::RandUInt32 ();
 			LogPrint (eLogInfo, "NetDb: Publishing our RouterInfo to ", i2p::data::GetIdentHashAbbreviation(floodfill->GetIdentHash ()), ". reply token=", replyToken);
 			m_PublishExcluded.insert (floodfill->GetIdentHash ());
 			m_PublishReplyToken = replyToken;
@@ -1161,7 +1338,7 @@ namespace data
 
 	std::shared_ptr<const RouterInfo> NetDb::GetRandomRouter () const
 	{
-		return GetRandomRouter (
+		return GetRandomRouter (eRouterIndexAll,
 			[](std::shared_ptr<const RouterInfo> router)->bool
 			{
 				return !router->IsHidden ();
@@ -1170,7 +1347,7 @@ namespace data
 
 	std::shared_ptr<const RouterInfo> NetDb::GetRandomRouter (std::shared_ptr<const RouterInfo> compatibleWith, bool reverse) const
 	{
-		return GetRandomRouter (
+		return GetRandomRouter (eRouterIndexECIES,
 			[compatibleWith, reverse](std::shared_ptr<const RouterInfo> router)->bool
 			{
 				return !router->IsHidden () && router != compatibleWith &&
@@ -1182,7 +1359,7 @@ namespace data
 
 	std::shared_ptr<const RouterInfo> NetDb::GetRandomPeerTestRouter (bool v4, const std::set<IdentHash>& excluded) const
 	{
-		return GetRandomRouter (
+		return GetRandomRouter (v4 ? eRouterIndexPeerTestV4 : eRouterIndexPeerTestV6,
 			[v4, &excluded](std::shared_ptr<const RouterInfo> router)->bool
 			{
 				return !router->IsHidden () && router->IsECIES () &&
@@ -1192,7 +1369,7 @@ namespace data
 
 	std::shared_ptr<const RouterInfo> NetDb::GetRandomSSUV6Router () const
 	{
-		return GetRandomRouter (
+		return GetRandomRouter (eRouterIndexSSUV6,
 			[](std::shared_ptr<const RouterInfo> router)->bool
 			{
 				return !router->IsHidden () && router->IsECIES () && router->IsSSUV6 ();
@@ -1201,7 +1378,7 @@ namespace data
 
 	std::shared_ptr<const RouterInfo> NetDb::GetRandomIntroducer (bool v4, const std::set<IdentHash>& excluded) const
 	{
-		return GetRandomRouter (
+		return GetRandomRouter (v4 ? eRouterIndexIntroducerV4 : eRouterIndexIntroducerV6,
 			[v4, &excluded](std::shared_ptr<const RouterInfo> router)->bool
 			{
 				return !router->IsHidden () && router->IsECIES () && !router->IsFloodfill () && // floodfills don't send relay tag
@@ -1211,7 +1388,7 @@ namespace data
 
 	std::shared_ptr<const RouterInfo> NetDb::GetHighBandwidthRandomRouter (std::shared_ptr<const RouterInfo> compatibleWith, bool reverse) const
 	{
-		return GetRandomRouter (
+		return GetRandomRouter (eRouterIndexHighBandwidth,
 			[compatibleWith, reverse](std::shared_ptr<const RouterInfo> router)->bool
 			{
 				return !router->IsHidden () && router != compatibleWith &&
@@ -1224,61 +1401,55 @@ namespace data
 	}
 
 	template<typename Filter>
-	std::shared_ptr<const RouterInfo> NetDb::GetRandomRouter (Filter filter) const
+	std::shared_ptr<const RouterInfo> NetDb::GetRandomRouter (RouterIndexPartition partition, Filter filter) const
 	{
-		if (m_RouterInfos.empty())
-			return 0;
-		uint16_t inds[3];
-		RAND_bytes ((uint8_t *)inds, sizeof (inds));
-		std::unique_lock<std::mutex> l(m_RouterInfosMutex);
-		inds[0] %= m_RouterInfos.size ();
-		auto it = m_RouterInfos.begin ();
-		std::advance (it, inds[0]);
-		// try random router
-		if (it != m_RouterInfos.end () && !it->second->IsUnreachable () && filter (it->second))
-			return it->second;
-		// try some routers around
-		auto it1 = m_RouterInfos.begin ();
-		if (inds[0])
-		{
-			// before
-			inds[1] %= inds[0];
-			std::advance (it1, (inds[1] + inds[0])/2);
-		}
-		else
-			it1 = it;
-		auto it2 = it;
-		if (inds[0] < m_RouterInfos.size () - 1)
-		{
-			// after
-			inds[2] %= (m_RouterInfos.size () - 1 - inds[0]); inds[2] /= 2;
-			std::advance (it2, inds[2]);
-		}
-		// it1 - from, it2 - to
-		it = it1;
-		while (it != it2 && it != m_RouterInfos.end ())
-		{
-			if (!it->second->IsUnreachable () && filter (it->second))
-				return it->second;
-			it++;
-		}
-		// still not found, try from the beginning
-		it = m_RouterInfos.begin ();
-		while (it != it1 && it != m_RouterInfos.end ())
+		// index might be slightly behind m_RouterInfos, so check everything again
+		return m_RouterIndex.GetRandom (partition,
+			[&filter](std::shared_ptr<const RouterInfo> router)->bool
+			{
+				return !router->IsUnreachable () && filter (router);
+			});
+	}
+
+	uint32_t NetDb::GetRouterIndexPartitions (const RouterInfo& r)
+	{
+		uint32_t partitions = 1 << eRouterIndexAll;
+		if (r.IsHidden () || !r.IsECIES ()) return partitions;
+		partitions |= 1 << eRouterIndexECIES;
+		if ((r.GetCaps () & RouterInfo::eHighBandwidth) && r.GetVersion () >= NETDB_MIN_HIGHBANDWIDTH_VERSION)
+			partitions |= 1 << eRouterIndexHighBandwidth;
+		if (r.IsFloodfill ()) partitions |= 1 << eRouterIndexFloodfill;
+		if (r.IsSSU ()) partitions |= 1 << eRouterIndexSSUV4;
+		if (r.IsSSUV6 ()) partitions |= 1 << eRouterIndexSSUV6;
+		if (r.IsNTCP2 ()) partitions |= 1 << eRouterIndexNTCP2V4;
+		if (r.IsNTCP2V6 ()) partitions |= 1 << eRouterIndexNTCP2V6;
+		if (r.IsPeerTesting (true)) partitions |= 1 << eRouterIndexPeerTestV4;
+		if (r.IsPeerTesting (false)) partitions |= 1 << eRouterIndexPeerTestV6;
+		if (!r.IsFloodfill ()) // floodfills don't send relay tag
 		{
-			if (!it->second->IsUnreachable () && filter (it->second))
-				return it->second;
-			it++;
+			if (r.IsIntroducer (true)) partitions |= 1 << eRouterIndexIntroducerV4;
+			if (r.IsIntroducer (false)) partitions |= 1 << eRouterIndexIntroducerV6;
 		}
-		// still not found, try to the beginning
-		it = it2;
-		while (it != m_RouterInfos.end ())
+		return partitions;
+	}
+
+	void NetDb::RebuildRouterIndex ()
+	{
+		m_IsRouterIndexDirty = false;
+		std::vector<std::shared_ptr<RouterInfo> > routers;
 		{
-			if (!it->second->IsUnreachable () && filter (it->second))
-				return it->second;
-			it++;
+			std::unique_lock<std::mutex> l(m_RouterInfosMutex);
+			routers.reserve (m_RouterInfos.size ());
+			for (const auto& it: m_RouterInfos)
+				routers.push_back (it.second);
 		}
-		return nullptr; // seems we have too few routers
+		// classify without holding the mutex
+		PartitionedIndex<RouterInfo, eNumRouterIndexPartitions>::Builder builder (routers.size ());
+		for (const auto& it: routers)
+			builder.Add (it, GetRouterIndexPartitions (*it));
+		m_RouterIndex.Publish (builder);
+		m_LastRouterIndexRebuild = i2p::util::GetSecondsSinceEpoch ();
+		LogPrint (eLogDebug, "NetDb: Router index rebuilt with ", routers.size (), " routers");
 	}
 
 	void NetDb::PostI2NPMsg (std::shared_ptr<const I2NPMessage> msg)
@@ -1290,82 +1461,46 @@ namespace data
 		const std::set<IdentHash>& excluded, bool closeThanUsOnly) const
 	{
 		std::shared_ptr<const RouterInfo> r;
-		XORMetric minMetric;
+		XORMetric ourMetric;
 		IdentHash destKey = CreateRoutingKey (destination);
-		if (closeThanUsOnly)
-			minMetric = destKey ^ i2p::context.GetIdentHash ();
-		else
-			minMetric.SetMax ();
+		if (closeThanUsOnly) ourMetric = destKey ^ i2p::context.GetIdentHash ();
 		std::unique_lock<std::mutex> l(m_FloodfillsMutex);
-		for (const auto& it: m_Floodfills)
-		{
-			if (!it->IsUnreachable ())
+		m_Floodfills.VisitClosest (destKey,
+			[&](const std::shared_ptr<RouterInfo>& it)->bool
 			{
-				XORMetric m = destKey ^ it->GetIdentHash ();
-				if (m < minMetric && !excluded.count (it->GetIdentHash ()))
-				{
-					minMetric = m;
-					r = it;
-				}
-			}
-		}
+				if (closeThanUsOnly && !((destKey ^ it->GetIdentHash ()) < ourMetric)) return false;
+				if (it->IsUnreachable () || excluded.count (it->GetIdentHash ())) return true; // next
+				r = it;
+				return false;
+			});
 		return r;
 	}
 
 	std::vector<IdentHash> NetDb::GetClosestFloodfills (const IdentHash& destination, size_t num,
 		std::set<IdentHash>& excluded, bool closeThanUsOnly) const
 	{
-		struct Sorted
-		{
-			std::shared_ptr<const RouterInfo> r;
-			XORMetric metric;
-			bool operator< (const Sorted& other) const { return metric < other.metric; };
-		};
-
-		std::set<Sorted> sorted;
+		std::vector<IdentHash> res;
+		if (!num) return res;
 		IdentHash destKey = CreateRoutingKey (destination);
 		XORMetric ourMetric;
 		if (closeThanUsOnly) ourMetric = destKey ^ i2p::context.GetIdentHash ();
-		{
-			std::unique_lock<std::mutex> l(m_FloodfillsMutex);
-			for (const auto& it: m_Floodfills)
-			{
-				if (!it->IsUnreachable ())
-				{
-					XORMetric m = destKey ^ it->GetIdentHash ();
-					if (closeThanUsOnly && ourMetric < m) continue;
-					if (sorted.size () < num)
-						sorted.insert ({it, m});
-					else if (m < sorted.rbegin ()->metric)
-					{
-						sorted.insert ({it, m});
-						sorted.erase (std::prev (sorted.end ()));
-					}
-				}
-			}
-		}
-
-		std::vector<IdentHash> res;
 		size_t i = 0;
-		for (const auto& it: sorted)
-		{
-			if (i < num)
+		std::unique_lock<std::mutex> l(m_FloodfillsMutex);
+		m_Floodfills.VisitClosest (destKey,
+			[&](const std::shared_ptr<RouterInfo>& it)->bool
 			{
-				const auto& ident = it.r->GetIdentHash ();
-				if (!excluded.count (ident))
-				{
-					res.push_back (ident);
-					i++;
-				}
-			}
-			else
-				break;
-		}
+				if (closeThanUsOnly && ourMetric < (destKey ^ it->GetIdentHash ())) return false;
+				if (it->IsUnreachable ()) return true; // next
+				// excluded routers are counted within num closest, but not returned
+				const auto& ident = it->GetIdentHash ();
+				if (!excluded.count (ident)) res.push_back (ident);
+				return ++i < num;
+			});
 		return res;
 	}
 
 	std::shared_ptr<const RouterInfo> NetDb::GetRandomRouterInFamily(const std::string & fam) const {
-		return GetRandomRouter(
+		return GetRandomRouter(eRouterIndexAll,
 			[fam](std::shared_ptr<const RouterInfo> router)->bool
 		{
 			return router->IsFamily(fam);
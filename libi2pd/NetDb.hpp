@@ -12,10 +12,10 @@
 #include <inttypes.h>
 #include <set>
 #include <unordered_map>
-#include <list>
 #include <string>
 #include <thread>
 #include <mutex>
+#include <atomic>
 
 #include "Base.h"
 #include "Gzip.h"
@@ -28,6 +28,9 @@
 #include "TunnelPool.h"
 #include "Reseed.h"
 #include "NetDbRequests.h"
+#include "NetDbIndex.h"
+#include "NetDbSnapshot.h"
+#include "Ed25519Batch.h"
 #include "Family.h"
 #include "version.h"
 #include "util.h"
@@ -49,6 +52,27 @@ namespace data
 	const int NETDB_MIN_HIGHBANDWIDTH_VERSION = MAKE_VERSION_NUMBER(0, 9, 36); // 0.9.36
 	const int NETDB_MIN_FLOODFILL_VERSION = MAKE_VERSION_NUMBER(0, 9, 38); // 0.9.38
 	const int NETDB_MIN_SHORT_TUNNEL_BUILD_VERSION = MAKE_VERSION_NUMBER(0, 9, 51); // 0.9.51
+	const int NETDB_ROUTER_INDEX_REBUILD_INTERVAL = 1; // in seconds
+	const int NETDB_MAX_LOAD_THREADS = 8;
+	const char NETDB_SNAPSHOT_FILENAME[] = "netDb.snapshot";
+	const size_t NETDB_MAX_MSGS_BATCH_SIZE = 100; // messages handled and verified together
+
+	enum RouterIndexPartition
+	{
+		eRouterIndexAll = 0,
+		eRouterIndexECIES, // not hidden
+		eRouterIndexHighBandwidth,
+		eRouterIndexFloodfill,
+		eRouterIndexSSUV4,
+		eRouterIndexSSUV6,
+		eRouterIndexNTCP2V4,
+		eRouterIndexNTCP2V6,
+		eRouterIndexPeerTestV4,
+		eRouterIndexPeerTestV6,
+		eRouterIndexIntroducerV4,
+		eRouterIndexIntroducerV6,
+		eNumRouterIndexPartitions
+	};
 
 	/** function for visiting a leaseset stored in a floodfill */
 	typedef std::function<void(const IdentHash, std::shared_ptr<LeaseSet>)> LeaseSetVisitor;
@@ -72,7 +96,7 @@ namespace data
 			bool AddRouterInfo (const uint8_t * buf, int len);
 			bool AddRouterInfo (const IdentHash& ident, const uint8_t * buf, int len);
 			bool AddLeaseSet (const IdentHash& ident, const uint8_t * buf, int len);
-			bool AddLeaseSet2 (const IdentHash& ident, const uint8_t * buf, int len, uint8_t storeType);
+			bool AddLeaseSet2 (const IdentHash& ident, const uint8_t * buf, int len, uint8_t storeType, const uint8_t * verifiedKey = nullptr);
 			std::shared_ptr<RouterInfo> FindRouter (const IdentHash& ident) const;
 			std::shared_ptr<LeaseSet> FindLeaseSet (const IdentHash& destination) const;
 			std::shared_ptr<RouterProfile> FindRouterProfile (const IdentHash& ident) const;
@@ -80,7 +104,7 @@ namespace data
 			void RequestDestination (const IdentHash& destination, RequestedDestination::RequestComplete requestComplete = nullptr, bool direct = true);
 			void RequestDestinationFrom (const IdentHash& destination, const IdentHash & from, bool exploritory, RequestedDestination::RequestComplete requestComplete = nullptr);
 
-			void HandleDatabaseStoreMsg (std::shared_ptr<const I2NPMessage> msg);
+			void HandleDatabaseStoreMsg (std::shared_ptr<const I2NPMessage> msg, const uint8_t * verifiedKey = nullptr); // signature is verified for this Ed25519 key already if set
 			void HandleDatabaseSearchReplyMsg (std::shared_ptr<const I2NPMessage> msg);
 			void HandleDatabaseLookupMsg (std::shared_ptr<const I2NPMessage> msg);
 			void HandleNTCP2RouterInfoMsg (std::shared_ptr<const I2NPMessage> m);
@@ -111,6 +135,9 @@ namespace data
 			int GetNumRouters () const { return m_RouterInfos.size (); };
 			int GetNumFloodfills () const { return m_Floodfills.size (); };
 			int GetNumLeaseSets () const { return m_LeaseSets.size (); };
+			uint64_t GetLoadTime () const { return m_LoadTime; }; // in milliseconds
+			size_t GetNumLoadedRouters () const { return m_NumLoadedRouters; };
+			bool IsLoadedFromSnapshot () const { return m_IsLoadedFromSnapshot; };
 
 			/** visit all lease sets we currently store */
 			void VisitLeaseSets(LeaseSetVisitor v);
@@ -121,7 +148,7 @@ namespace data
 			/** visit N random router that match using filter, then visit them with a visitor, return number of RouterInfos that were visited */
 			size_t VisitRandomRouterInfos(RouterInfoFilter f, RouterInfoVisitor v, size_t n);
 
-			void ClearRouterInfos () { m_RouterInfos.clear (); };
+			void ClearRouterInfos () { m_RouterInfos.clear (); m_RouterIndex.Clear (); };
 			std::shared_ptr<RouterInfo::Buffer> NewRouterInfoBuffer () { return m_RouterInfoBuffersPool.AcquireSharedMt (); };
 			
 			uint32_t GetPublishReplyToken () const { return m_PublishReplyToken; };
@@ -129,7 +156,9 @@ namespace data
 		private:
 
 			void Load ();
-			bool LoadRouterInfo (const std::string& path, uint64_t ts);
+			std::shared_ptr<RouterInfo> LoadRouterInfo (const std::string& path, uint64_t ts); // nullptr if invalid
+			void LoadRouterInfos (std::vector<std::shared_ptr<RouterInfo> >& routers, uint64_t ts, int part, int numParts, bool fromSnapshot);
+			void CreateSnapshot (); // from current RouterInfos, compacts existing
 			void SaveUpdated ();
 			void Run (); // exploratory thread
 			void Explore (int numDestinations);
@@ -141,10 +170,13 @@ namespace data
 			void ReseedFromFloodfill(const RouterInfo & ri, int numRouters = 40, int numFloodfills = 20);
 
 			std::shared_ptr<const RouterInfo> AddRouterInfo (const uint8_t * buf, int len, bool& updated);
-			std::shared_ptr<const RouterInfo> AddRouterInfo (const IdentHash& ident, const uint8_t * buf, int len, bool& updated);
+			std::shared_ptr<const RouterInfo> AddRouterInfo (const IdentHash& ident, const uint8_t * buf, int len, bool& updated, const uint8_t * verifiedKey = nullptr);
+			void VerifyDatabaseStores (const std::vector<std::shared_ptr<const I2NPMessage> >& msgs, std::vector<Tag<32> >& verifiedKeys);
 
 			template<typename Filter>
-			std::shared_ptr<const RouterInfo> GetRandomRouter (Filter filter) const;
+			std::shared_ptr<const RouterInfo> GetRandomRouter (RouterIndexPartition partition, Filter filter) const;
+			void RebuildRouterIndex ();
+			static uint32_t GetRouterIndexPartitions (const RouterInfo& r); // bitmask of RouterIndexPartition
 
 		private:
 
@@ -153,13 +185,21 @@ namespace data
 			mutable std::mutex m_RouterInfosMutex;
 			std::unordered_map<IdentHash, std::shared_ptr<RouterInfo> > m_RouterInfos;
 			mutable std::mutex m_FloodfillsMutex;
-			std::list<std::shared_ptr<RouterInfo> > m_Floodfills;
+			KademliaIndex<RouterInfo> m_Floodfills;
+			PartitionedIndex<RouterInfo, eNumRouterIndexPartitions> m_RouterIndex; // snapshot of m_RouterInfos for random selection
+			std::atomic<bool> m_IsRouterIndexDirty;
+			uint64_t m_LastRouterIndexRebuild;
+			uint64_t m_LoadTime; // in milliseconds
+			size_t m_NumLoadedRouters;
+			NetDbSnapshot m_Snapshot;
+			bool m_UseSnapshot, m_IsLoadedFromSnapshot;
 
 			bool m_IsRunning;
 			std::thread * m_Thread;
-			i2p::util::Queue<std::shared_ptr<const I2NPMessage> > m_Queue; // of I2NPDatabaseStoreMsg
+			i2p::util::MPSCQueue<std::shared_ptr<const I2NPMessage> > m_Queue; // of I2NPDatabaseStoreMsg
 
 			GzipInflator m_Inflator;
+			i2p::crypto::EDDSA25519BatchVerifier m_BatchVerifier;
 			Reseeder * m_Reseeder;
 			Families m_Families;
 			i2p::fs::HashedStorage m_Storage;
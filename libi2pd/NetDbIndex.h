@@ -0,0 +1,238 @@
+/*
+* Copyright (c) 2013-2022, The PurpleI2P Project
+*
+* This file is part of Purple i2pd project and licensed under BSD3
+*
+* See full license text in LICENSE file at top of project tree
+*/
+
+#ifndef NETDB_INDEX_H__
+#define NETDB_INDEX_H__
+
+#include <inttypes.h>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <boost/shared_ptr.hpp>
+#include <boost/make_shared.hpp>
+#include "Crypto.h"
+#include "Tag.h"
+
+namespace i2p
+{
+namespace data
+{
+	const int PARTITIONED_INDEX_NUM_RANDOM_ATTEMPTS = 8;
+
+	/** immutable snapshot of elements partitioned by class, rebuilt by writer and swapped atomically.
+	 *  readers sample random elements of a partition without locking,
+	 *  elements may belong to several partitions */
+	template<typename T, int NumPartitions>
+	class PartitionedIndex
+	{
+		public:
+
+			typedef std::vector<std::shared_ptr<T> > Partition;
+
+		private:
+
+			struct Snapshot
+			{
+				Partition partitions[NumPartitions];
+			};
+
+		public:
+
+			class Builder
+			{
+				public:
+
+					Builder (size_t expectedSize = 0): m_Snapshot (boost::make_shared<Snapshot> ())
+					{
+						if (expectedSize) m_Snapshot->partitions[0].reserve (expectedSize);
+					}
+
+					void Add (std::shared_ptr<T> element, uint32_t partitions) // bitmask of partitions
+					{
+						for (int i = 0; i < NumPartitions; i++)
+							if (partitions & (1 << i))
+								m_Snapshot->partitions[i].push_back (element);
+					}
+
+				private:
+
+					friend class PartitionedIndex;
+					boost::shared_ptr<Snapshot> m_Snapshot;
+			};
+
+			void Publish (Builder& builder)
+			{
+				boost::shared_ptr<const Snapshot> s = builder.m_Snapshot;
+				boost::atomic_store (&m_Snapshot, s);
+				builder.m_Snapshot = nullptr;
+			}
+
+			void Clear ()
+			{
+				boost::atomic_store (&m_Snapshot, boost::shared_ptr<const Snapshot>());
+			}
+
+			size_t GetSize (int partition) const
+			{
+				auto s = boost::atomic_load (&m_Snapshot);
+				return s ? s->partitions[partition].size () : 0;
+			}
+
+			template<typename Filter>
+			std::shared_ptr<T> GetRandom (int partition, Filter filter) const
+			{
+				auto s = boost::atomic_load (&m_Snapshot);
+				if (!s) return nullptr;
+				const auto& p = s->partitions[partition];
+				if (p.empty ()) return nullptr;
+				uint32_t inds[PARTITIONED_INDEX_NUM_RANDOM_ATTEMPTS];
+				i2p::crypto::RandBytes ((uint8_t *)inds, sizeof (inds));
+				// try random elements first, they are likely to match
+				for (int i = 0; i < PARTITIONED_INDEX_NUM_RANDOM_ATTEMPTS; i++)
+				{
+					auto& element = p[inds[i] % p.size ()];
+					if (filter (element)) return element;
+				}
+				// too few matches in this partition, scan it from random position
+				size_t start = inds[0] % p.size ();
+				for (size_t i = start + 1; i < p.size (); i++)
+					if (filter (p[i])) return p[i];
+				for (size_t i = 0; i < start; i++)
+					if (filter (p[i])) return p[i];
+				return nullptr;
+			}
+
+			template<typename Filter, typename Visitor>
+			size_t VisitRandom (int partition, Filter filter, Visitor v, size_t n) const
+			{
+				auto s = boost::atomic_load (&m_Snapshot);
+				if (!s) return 0;
+				const auto& p = s->partitions[partition];
+				if (p.empty ()) return 0;
+				size_t visited = 0;
+				std::vector<uint32_t> inds (n*PARTITIONED_INDEX_NUM_RANDOM_ATTEMPTS);
+				i2p::crypto::RandBytes ((uint8_t *)inds.data (), inds.size ()*sizeof (uint32_t));
+				for (auto ind: inds)
+				{
+					auto& element = p[ind % p.size ()];
+					if (filter (element))
+					{
+						v (element);
+						if (++visited >= n) break;
+					}
+				}
+				return visited;
+			}
+
+		private:
+
+			boost::shared_ptr<const Snapshot> m_Snapshot;
+	};
+
+	/** elements sorted by ident hash, that is a flattened binary trie.
+	 *  every subtree is a contiguous range, so elements can be visited in order of XOR distance to a key
+	 *  by descending to the subtree matching key's bit first.
+	 *  not thread safe */
+	template<typename T>
+	class KademliaIndex
+	{
+		public:
+
+			typedef std::vector<std::shared_ptr<T> > Elements;
+
+			bool Insert (std::shared_ptr<T> element)
+			{
+				auto it = LowerBound (element->GetIdentHash ());
+				if (it != m_Elements.end () && (*it)->GetIdentHash () == element->GetIdentHash ())
+					return false;
+				m_Elements.insert (it, element);
+				return true;
+			}
+
+			bool Remove (const Tag<32>& ident)
+			{
+				auto it = LowerBound (ident);
+				if (it == m_Elements.end () || (*it)->GetIdentHash () != ident)
+					return false;
+				m_Elements.erase (it);
+				return true;
+			}
+
+			template<typename Predicate>
+			void RemoveIf (Predicate p)
+			{
+				m_Elements.erase (std::remove_if (m_Elements.begin (), m_Elements.end (), p), m_Elements.end ());
+			}
+
+			void Clear () { m_Elements.clear (); };
+			size_t size () const { return m_Elements.size (); };
+			bool empty () const { return m_Elements.empty (); };
+			typename Elements::const_iterator begin () const { return m_Elements.begin (); };
+			typename Elements::const_iterator end () const { return m_Elements.end (); };
+
+			/** visit elements in increasing XOR distance to key until visitor returns false */
+			template<typename Visitor>
+			void VisitClosest (const Tag<32>& key, Visitor v) const
+			{
+				if (!m_Elements.empty ())
+					VisitClosest (key, 0, m_Elements.size (), 0, v);
+			}
+
+		private:
+
+			typename Elements::iterator LowerBound (const Tag<32>& ident)
+			{
+				return std::lower_bound (m_Elements.begin (), m_Elements.end (), ident,
+					[](const std::shared_ptr<T>& element, const Tag<32>& i)->bool
+					{
+						return element->GetIdentHash () < i;
+					});
+			}
+
+			static bool GetBit (const uint8_t * buf, int bit)
+			{
+				return buf[bit >> 3] & (0x80 >> (bit & 0x07));
+			}
+
+			// all elements in [from, to) have the same first depth bits
+			template<typename Visitor>
+			bool VisitClosest (const Tag<32>& key, size_t from, size_t to, int depth, Visitor& v) const
+			{
+				while (to - from > 1 && depth < 256)
+				{
+					// first element with bit set
+					auto mid = std::partition_point (m_Elements.begin () + from, m_Elements.begin () + to,
+						[depth](const std::shared_ptr<T>& element)->bool
+						{
+							return !GetBit (element->GetIdentHash (), depth);
+						}) - m_Elements.begin ();
+					if (mid != (ptrdiff_t)from && mid != (ptrdiff_t)to)
+					{
+						// both subtrees are not empty, closer first
+						if (GetBit (key, depth))
+							return VisitClosest (key, mid, to, depth + 1, v) &&
+								VisitClosest (key, from, mid, depth + 1, v);
+						else
+							return VisitClosest (key, from, mid, depth + 1, v) &&
+								VisitClosest (key, mid, to, depth + 1, v);
+					}
+					depth++;
+				}
+				for (size_t i = from; i < to; i++)
+					if (!v (m_Elements[i])) return false;
+				return true;
+			}
+
+		private:
+
+			Elements m_Elements;
+	};
+}
+}
+
+#endif
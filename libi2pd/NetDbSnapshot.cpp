@@ -0,0 +1,292 @@
+/*
+* Copyright (c) 2013-2022, The PurpleI2P Project
+*
+* This file is part of Purple i2pd project and licensed under BSD3
+*
+* See full license text in LICENSE file at top of project tree
+*/
+
+#include <string.h>
+#include <fstream>
+#include <algorithm>
+#include <unordered_set>
+#include <boost/filesystem.hpp>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include "I2PEndian.h"
+#include "Log.h"
+#include "NetDbSnapshot.h"
+
+namespace i2p
+{
+namespace data
+{
+	NetDbSnapshot::NetDbSnapshot (): m_Data (nullptr), m_Size (0),
+		m_IndexOffset (0), m_NumEntries (0), m_LiveSize (0)
+	{
+	}
+
+	NetDbSnapshot::~NetDbSnapshot ()
+	{
+		Close ();
+	}
+
+	bool NetDbSnapshot::Open (const std::string& path)
+	{
+		Close ();
+		m_Path = path;
+		if (!Map (path)) return false;
+		bool valid = false;
+		if (m_Size >= NETDB_SNAPSHOT_HEADER_SIZE + NETDB_SNAPSHOT_TRAILER_SIZE &&
+			!memcmp (m_Data, NETDB_SNAPSHOT_MAGIC, 8) &&
+			!memcmp (m_Data + m_Size - 8, NETDB_SNAPSHOT_MAGIC, 8))
+		{
+			const uint8_t * trailer = m_Data + m_Size - NETDB_SNAPSHOT_TRAILER_SIZE;
+			m_IndexOffset = bufbe64toh (trailer);
+			m_NumEntries = bufbe32toh (trailer + 8);
+			if (m_IndexOffset >= NETDB_SNAPSHOT_HEADER_SIZE &&
+				m_IndexOffset + m_NumEntries*NETDB_SNAPSHOT_INDEX_ENTRY_SIZE + NETDB_SNAPSHOT_TRAILER_SIZE == m_Size)
+			{
+				valid = true;
+				m_LiveSize = NETDB_SNAPSHOT_HEADER_SIZE + m_NumEntries*NETDB_SNAPSHOT_INDEX_ENTRY_SIZE + NETDB_SNAPSHOT_TRAILER_SIZE;
+				for (size_t i = 0; i < m_NumEntries; i++)
+				{
+					auto entry = ReadIndexEntry (i);
+					if (entry.offset < NETDB_SNAPSHOT_HEADER_SIZE + NETDB_SNAPSHOT_RECORD_HEADER_SIZE ||
+						entry.offset + entry.len > m_IndexOffset ||
+						(i > 0 && memcmp (GetIndexEntry (i - 1), GetIndexEntry (i), 32) >= 0))
+					{
+						valid = false;
+						break;
+					}
+					m_LiveSize += NETDB_SNAPSHOT_RECORD_HEADER_SIZE + entry.len;
+				}
+			}
+		}
+		if (!valid)
+		{
+			LogPrint (eLogError, "NetDbSnapshot: ", path, " is malformed");
+			Close ();
+			return false;
+		}
+		return true;
+	}
+
+	void NetDbSnapshot::Close ()
+	{
+		Unmap ();
+		m_IndexOffset = 0; m_NumEntries = 0; m_LiveSize = 0;
+	}
+
+	size_t NetDbSnapshot::GetGarbageSize () const
+	{
+		return m_Size > m_LiveSize ? m_Size - m_LiveSize : 0;
+	}
+
+	NetDbSnapshot::IndexEntry NetDbSnapshot::ReadIndexEntry (size_t i) const
+	{
+		IndexEntry entry;
+		auto buf = GetIndexEntry (i);
+		memcpy (entry.ident, buf, 32);
+		entry.offset = bufbe64toh (buf + 32);
+		entry.len = bufbe16toh (buf + 40);
+		return entry;
+	}
+
+	const uint8_t * NetDbSnapshot::Find (const IdentHash& ident, size_t& len) const
+	{
+		if (!m_Data) return nullptr;
+		// binary search in index
+		size_t first = 0, last = m_NumEntries;
+		while (first < last)
+		{
+			size_t mid = first + (last - first)/2;
+			int cmp = memcmp (GetIndexEntry (mid), ident, 32);
+			if (!cmp)
+			{
+				auto entry = ReadIndexEntry (mid);
+				len = entry.len;
+				return m_Data + entry.offset;
+			}
+			if (cmp < 0)
+				first = mid + 1;
+			else
+				last = mid;
+		}
+		return nullptr;
+	}
+
+	void NetDbSnapshot::Visit (RecordVisitor v, int part, int numParts) const
+	{
+		if (!m_Data) return;
+		for (size_t i = part; i < m_NumEntries; i += numParts)
+		{
+			auto entry = ReadIndexEntry (i);
+			v (entry.ident, m_Data + entry.offset, entry.len);
+		}
+	}
+
+	bool NetDbSnapshot::Append (const std::vector<Record>& updated, const std::vector<IdentHash>& removed)
+	{
+		if (!m_Data) return false;
+		if (updated.empty () && removed.empty ()) return true;
+		std::unordered_set<IdentHash> excluded;
+		for (const auto& it: updated) excluded.insert (it.ident);
+		for (const auto& it: removed) excluded.insert (it);
+		std::vector<IndexEntry> entries;
+		entries.reserve (m_NumEntries + updated.size ());
+		for (size_t i = 0; i < m_NumEntries; i++)
+		{
+			auto entry = ReadIndexEntry (i);
+			if (!excluded.count (entry.ident))
+				entries.push_back (entry);
+		}
+		bool written = false;
+		{
+			std::ofstream s (m_Path, std::ofstream::binary | std::ofstream::in | std::ofstream::out);
+			s.seekp (0, std::ios::end);
+			if (s.is_open () && (uint64_t)s.tellp () == m_Size && WriteRecords (s, m_Size, updated, entries))
+			{
+				SortIndex (entries);
+				uint64_t indexOffset = m_Size;
+				for (const auto& it: updated) indexOffset += NETDB_SNAPSHOT_RECORD_HEADER_SIZE + it.len;
+				written = WriteIndex (s, indexOffset, entries);
+			}
+		}
+		if (!written)
+		{
+			// file is not valid anymore
+			LogPrint (eLogError, "NetDbSnapshot: Can't append to ", m_Path);
+			Close ();
+			return false;
+		}
+		return Open (m_Path);
+	}
+
+	bool NetDbSnapshot::Create (const std::string& path, const std::vector<Record>& records)
+	{
+		std::string tmp = path + ".tmp";
+		std::vector<IndexEntry> entries;
+		entries.reserve (records.size ());
+		{
+			std::ofstream s (tmp, std::ofstream::binary | std::ofstream::out | std::ofstream::trunc);
+			if (!s.is_open ())
+			{
+				LogPrint (eLogError, "NetDbSnapshot: Can't create ", tmp);
+				return false;
+			}
+			uint8_t header[NETDB_SNAPSHOT_HEADER_SIZE];
+			memcpy (header, NETDB_SNAPSHOT_MAGIC, 8);
+			memset (header + 8, 0, 8);
+			s.write ((const char *)header, NETDB_SNAPSHOT_HEADER_SIZE);
+			if (!WriteRecords (s, NETDB_SNAPSHOT_HEADER_SIZE, records, entries)) return false;
+			SortIndex (entries);
+			uint64_t indexOffset = NETDB_SNAPSHOT_HEADER_SIZE;
+			for (const auto& r: records) indexOffset += NETDB_SNAPSHOT_RECORD_HEADER_SIZE + r.len;
+			if (!WriteIndex (s, indexOffset, entries)) return false;
+		}
+		Close (); // records are not used anymore
+		boost::system::error_code ec;
+		boost::filesystem::rename (tmp, path, ec);
+		if (ec)
+		{
+			LogPrint (eLogError, "NetDbSnapshot: Can't rename ", tmp, " to ", path, ": ", ec.message ());
+			return false;
+		}
+		return Open (path);
+	}
+
+	void NetDbSnapshot::SortIndex (std::vector<IndexEntry>& entries)
+	{
+		std::stable_sort (entries.begin (), entries.end ());
+		// if the same router is presented more than once, keep the latest
+		auto it = std::unique (entries.rbegin (), entries.rend (),
+			[](const IndexEntry& e1, const IndexEntry& e2) { return e1.ident == e2.ident; });
+		entries.erase (entries.begin (), it.base ());
+	}
+
+	bool NetDbSnapshot::WriteRecords (std::ostream& s, uint64_t offset, const std::vector<Record>& records, std::vector<IndexEntry>& entries)
+	{
+		for (const auto& it: records)
+		{
+			uint8_t header[NETDB_SNAPSHOT_RECORD_HEADER_SIZE];
+			memcpy (header, it.ident, 32);
+			htobe16buf (header + 32, it.len);
+			s.write ((const char *)header, NETDB_SNAPSHOT_RECORD_HEADER_SIZE);
+			s.write ((const char *)it.buf, it.len);
+			offset += NETDB_SNAPSHOT_RECORD_HEADER_SIZE;
+			entries.push_back ({it.ident, offset, (uint16_t)it.len});
+			offset += it.len;
+		}
+		return s.good ();
+	}
+
+	bool NetDbSnapshot::WriteIndex (std::ostream& s, uint64_t indexOffset, const std::vector<IndexEntry>& entries)
+	{
+		for (const auto& it: entries)
+		{
+			uint8_t buf[NETDB_SNAPSHOT_INDEX_ENTRY_SIZE];
+			memcpy (buf, it.ident, 32);
+			htobe64buf (buf + 32, it.offset);
+			htobe16buf (buf + 40, it.len);
+			s.write ((const char *)buf, NETDB_SNAPSHOT_INDEX_ENTRY_SIZE);
+		}
+		uint8_t trailer[NETDB_SNAPSHOT_TRAILER_SIZE];
+		htobe64buf (trailer, indexOffset);
+		htobe32buf (trailer + 8, entries.size ());
+		memset (trailer + 12, 0, 4);
+		memcpy (trailer + 16, NETDB_SNAPSHOT_MAGIC, 8);
+		s.write ((const char *)trailer, NETDB_SNAPSHOT_TRAILER_SIZE);
+		s.flush ();
+		return s.good ();
+	}
+
+	bool NetDbSnapshot::Map (const std::string& path)
+	{
+#ifndef _WIN32
+		int fd = open (path.c_str (), O_RDONLY);
+		if (fd < 0) return false;
+		struct stat st;
+		if (fstat (fd, &st) < 0 || !st.st_size)
+		{
+			close (fd);
+			return false;
+		}
+		void * data = mmap (nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		close (fd); // mapping stays
+		if (data == MAP_FAILED)
+		{
+			LogPrint (eLogError, "NetDbSnapshot: Can't map ", path);
+			return false;
+		}
+		m_Data = (const uint8_t *)data;
+		m_Size = st.st_size;
+#else
+		std::ifstream s (path, std::ifstream::binary);
+		if (!s.is_open ()) return false;
+		m_Buffer.assign ((std::istreambuf_iterator<char>(s)), std::istreambuf_iterator<char>());
+		if (m_Buffer.empty ()) return false;
+		m_Data = m_Buffer.data ();
+		m_Size = m_Buffer.size ();
+#endif
+		return true;
+	}
+
+	void NetDbSnapshot::Unmap ()
+	{
+		if (!m_Data) return;
+#ifndef _WIN32
+		munmap ((void *)m_Data, m_Size);
+#else
+		m_Buffer.clear ();
+		m_Buffer.shrink_to_fit ();
+#endif
+		m_Data = nullptr;
+		m_Size = 0;
+	}
+}
+}
@@ -0,0 +1,95 @@
+/*
+* Copyright (c) 2013-2022, The PurpleI2P Project
+*
+* This file is part of Purple i2pd project and licensed under BSD3
+*
+* See full license text in LICENSE file at top of project tree
+*/
+
+#ifndef NETDB_SNAPSHOT_H__
+#define NETDB_SNAPSHOT_H__
+
+#include <inttypes.h>
+#include <string>
+#include <vector>
+#include <functional>
+#include <iostream>
+#include "Identity.h"
+
+namespace i2p
+{
+namespace data
+{
+	const uint8_t NETDB_SNAPSHOT_MAGIC[8] = { 'i', '2', 'p', 'd', 'n', 'd', 'b', '1' };
+	const size_t NETDB_SNAPSHOT_HEADER_SIZE = 16;
+	const size_t NETDB_SNAPSHOT_RECORD_HEADER_SIZE = 34;
+	const size_t NETDB_SNAPSHOT_INDEX_ENTRY_SIZE = 42;
+	const size_t NETDB_SNAPSHOT_TRAILER_SIZE = 24;
+
+	/** single file with RouterInfos, memory-mapped when opened
+	 *  header: magic (8), reserved (8)
+	 *  records: ident hash (32), length (2), RouterInfo buffer
+	 *  index, sorted by ident hash: ident hash (32), offset of RouterInfo buffer (8), length (2)
+	 *  trailer: offset of index (8), number of index entries (4), reserved (4), magic (8)
+	 *  updates are appended as new records followed by new index and trailer, previous ones become garbage */
+	class NetDbSnapshot
+	{
+		public:
+
+			typedef std::function<void(const IdentHash& ident, const uint8_t * buf, size_t len)> RecordVisitor;
+			struct Record
+			{
+				IdentHash ident;
+				const uint8_t * buf;
+				size_t len;
+			};
+
+			NetDbSnapshot ();
+			~NetDbSnapshot ();
+
+			bool Open (const std::string& path);
+			void Close ();
+			bool IsOpen () const { return m_Data != nullptr; };
+			size_t GetNumRecords () const { return m_NumEntries; };
+			size_t GetFileSize () const { return m_Size; };
+			size_t GetGarbageSize () const; // bytes not referenced by index
+
+			const uint8_t * Find (const IdentHash& ident, size_t& len) const; // points to mapped file, nullptr if not found
+			void Visit (RecordVisitor v, int part = 0, int numParts = 1) const; // every numParts-th record starting from part
+			/** append updated records and remove removed from index, then remap */
+			bool Append (const std::vector<Record>& updated, const std::vector<IdentHash>& removed);
+			/** write new file with records only and reopen, records may point to this snapshot */
+			bool Create (const std::string& path, const std::vector<Record>& records);
+
+		private:
+
+			struct IndexEntry
+			{
+				IdentHash ident;
+				uint64_t offset;
+				uint16_t len;
+				bool operator< (const IndexEntry& other) const { return ident < other.ident; };
+			};
+
+			const uint8_t * GetIndexEntry (size_t i) const { return m_Data + m_IndexOffset + i*NETDB_SNAPSHOT_INDEX_ENTRY_SIZE; };
+			IndexEntry ReadIndexEntry (size_t i) const;
+			bool Map (const std::string& path);
+			void Unmap ();
+			static void SortIndex (std::vector<IndexEntry>& entries);
+			static bool WriteRecords (std::ostream& s, uint64_t offset, const std::vector<Record>& records, std::vector<IndexEntry>& entries);
+			static bool WriteIndex (std::ostream& s, uint64_t indexOffset, const std::vector<IndexEntry>& entries);
+
+		private:
+
+			std::string m_Path;
+			const uint8_t * m_Data;
+			size_t m_Size;
+			size_t m_IndexOffset, m_NumEntries, m_LiveSize;
+#ifdef _WIN32
+			std::vector<uint8_t> m_Buffer; // no mmap, file is read
+#endif
+	};
+}
+}
+
+#endif
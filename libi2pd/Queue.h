@@ -1,5 +1,5 @@
 /*
-* Copyright (c) 2013-2020, The PurpleI2P Project
+* Copyright (c) 2013-2022, The PurpleI2P Project
 *
 * This file is part of Purple i2pd project and licensed under BSD3
 *
@@ -13,6 +13,8 @@
 #include <vector>
 #include <mutex>
 #include <thread>
+#include <atomic>
+#include <memory>
 #include <condition_variable>
 #include <functional>
 #include <utility>
@@ -127,6 +129,255 @@ namespace util
 			std::mutex m_QueueMutex;
 			std::condition_variable m_NonEmpty;
 	};
+
+	/**
+	 * Multiple producers, single consumer queue with the same interface as Queue.
+	 * Elements go to a fixed size lock-free ring (Vyukov's sequence cells), if it's full
+	 * to an unbounded locked list, to keep Put non-blocking. Overflow is taken only after the ring is empty,
+	 * and producers stay in overflow until it's drained, that keeps element order per producer.
+	 * Producers signal only if consumer is waiting.
+	 * Get, GetNext, GetAll and Peek must be called from consumer's thread only.
+	 */
+	template<typename Element, size_t Size = 8192>
+	class MPSCQueue
+	{
+		static_assert (Size >= 2 && !(Size & (Size - 1)), "MPSCQueue size must be power of 2");
+
+		struct Cell
+		{
+			std::atomic<size_t> sequence;
+			Element data;
+		};
+
+		public:
+
+			MPSCQueue (): m_Cells (new Cell[Size]), m_EnqueuePos (0), m_DequeuePos (0),
+				m_NumOverflow (0), m_IsWaiting (false)
+			{
+				for (size_t i = 0; i < Size; i++)
+					m_Cells[i].sequence.store (i, std::memory_order_relaxed);
+			}
+
+			void Put (Element e)
+			{
+				Push (std::move (e));
+				Notify ();
+			}
+
+			template<template<typename, typename...>class Container, typename... R>
+			void Put (const Container<Element, R...>& vec)
+			{
+				if (!vec.empty ())
+				{
+					for (const auto& it: vec)
+						Push (it);
+					Notify ();
+				}
+			}
+
+			Element GetNext ()
+			{
+				auto el = Get ();
+				if (!el)
+				{
+					std::unique_lock<std::mutex> l(m_WaitMutex);
+					m_IsWaiting.store (true);
+					if (IsEmpty ())
+						m_NonEmpty.wait (l);
+					m_IsWaiting.store (false);
+					l.unlock ();
+					WaitPublished ();
+					el = Get ();
+				}
+				return el;
+			}
+
+			Element GetNextWithTimeout (int usec)
+			{
+				auto el = Get ();
+				if (!el)
+				{
+					std::unique_lock<std::mutex> l(m_WaitMutex);
+					m_IsWaiting.store (true);
+					if (IsEmpty ())
+						m_NonEmpty.wait_for (l, std::chrono::milliseconds (usec));
+					m_IsWaiting.store (false);
+					l.unlock ();
+					WaitPublished ();
+					el = Get ();
+				}
+				return el;
+			}
+
+			void Wait ()
+			{
+				{
+					std::unique_lock<std::mutex> l(m_WaitMutex);
+					m_IsWaiting.store (true);
+					if (IsEmpty ())
+						m_NonEmpty.wait (l);
+					m_IsWaiting.store (false);
+				}
+				WaitPublished ();
+			}
+
+			bool Wait (int sec, int usec)
+			{
+				bool ret;
+				{
+					std::unique_lock<std::mutex> l(m_WaitMutex);
+					m_IsWaiting.store (true);
+					ret = !IsEmpty () ||
+						m_NonEmpty.wait_for (l, std::chrono::seconds (sec) + std::chrono::milliseconds (usec)) != std::cv_status::timeout;
+					m_IsWaiting.store (false);
+				}
+				if (ret) WaitPublished ();
+				return ret;
+			}
+
+			bool IsEmpty () const // false if a producer has claimed a cell but not published it yet
+			{
+				return m_EnqueuePos.load () == m_DequeuePos.load () && !m_NumOverflow.load ();
+			}
+
+			int GetSize () const // approximate if called from non-consumer thread
+			{
+				return (int)(m_EnqueuePos.load (std::memory_order_relaxed) - m_DequeuePos.load (std::memory_order_relaxed)) +
+					m_NumOverflow.load (std::memory_order_relaxed);
+			}
+
+			void WakeUp ()
+			{
+				std::unique_lock<std::mutex> l(m_WaitMutex);
+				m_NonEmpty.notify_all ();
+			}
+
+			Element Get ()
+			{
+				Element el = nullptr;
+				if (!Pop (el) && m_NumOverflow.load ())
+				{
+					std::unique_lock<std::mutex> l(m_OverflowMutex);
+					// elements in the ring, published or not, came before overflow of the same producer
+					if (!m_Overflow.empty () && IsRingEmpty ())
+					{
+						el = std::move (m_Overflow.front ());
+						m_Overflow.pop ();
+						m_NumOverflow--;
+					}
+				}
+				return el;
+			}
+
+			Element Peek ()
+			{
+				auto& cell = m_Cells[m_DequeuePos.load (std::memory_order_relaxed) & (Size - 1)];
+				if (cell.sequence.load (std::memory_order_acquire) == m_DequeuePos.load (std::memory_order_relaxed) + 1)
+					return cell.data;
+				if (m_NumOverflow.load ())
+				{
+					std::unique_lock<std::mutex> l(m_OverflowMutex);
+					if (!m_Overflow.empty () && IsRingEmpty ())
+						return m_Overflow.front ();
+				}
+				return nullptr;
+			}
+
+			void GetAll (std::vector<Element>& elements) // append everything available
+			{
+				Element el;
+				while ((el = Get ()))
+					elements.push_back (std::move (el));
+			}
+
+		private:
+
+			void Push (Element e)
+			{
+				// once overflow is used we stay there until consumer drains it
+				if (!m_NumOverflow.load () && TryPush (e)) return;
+				std::unique_lock<std::mutex> l(m_OverflowMutex);
+				m_Overflow.push (std::move (e));
+				m_NumOverflow++;
+			}
+
+			bool TryPush (Element& e)
+			{
+				size_t pos = m_EnqueuePos.load (std::memory_order_relaxed);
+				Cell * cell;
+				for (;;)
+				{
+					cell = &m_Cells[pos & (Size - 1)];
+					size_t seq = cell->sequence.load (std::memory_order_acquire);
+					intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+					if (!diff)
+					{
+						if (m_EnqueuePos.compare_exchange_weak (pos, pos + 1, std::memory_order_relaxed))
+							break;
+					}
+					else if (diff < 0)
+						return false; // full
+					else
+						pos = m_EnqueuePos.load (std::memory_order_relaxed);
+				}
+				cell->data = std::move (e);
+				cell->sequence.store (pos + 1, std::memory_order_release);
+				return true;
+			}
+
+			bool Pop (Element& e)
+			{
+				size_t pos = m_DequeuePos.load (std::memory_order_relaxed);
+				auto& cell = m_Cells[pos & (Size - 1)];
+				if (cell.sequence.load (std::memory_order_acquire) != pos + 1)
+					return false; // empty or not published yet
+				e = std::move (cell.data);
+				cell.data = nullptr;
+				cell.sequence.store (pos + Size, std::memory_order_release);
+				m_DequeuePos.store (pos + 1, std::memory_order_relaxed);
+				return true;
+			}
+
+			bool IsRingEmpty () const
+			{
+				return m_EnqueuePos.load () == m_DequeuePos.load (std::memory_order_relaxed);
+			}
+
+			void WaitPublished () const
+			{
+				// cell at head is claimed, producer is about to publish it
+				for (;;)
+				{
+					size_t pos = m_DequeuePos.load (std::memory_order_relaxed);
+					if (pos == m_EnqueuePos.load () ||
+						m_Cells[pos & (Size - 1)].sequence.load (std::memory_order_acquire) == pos + 1)
+						break;
+					std::this_thread::yield ();
+				}
+			}
+
+			void Notify ()
+			{
+				// pairs with m_IsWaiting set and IsEmpty check under m_WaitMutex in consumer
+				std::atomic_thread_fence (std::memory_order_seq_cst);
+				if (m_IsWaiting.load ())
+				{
+					std::unique_lock<std::mutex> l(m_WaitMutex);
+					m_NonEmpty.notify_one ();
+				}
+			}
+
+		private:
+
+			std::unique_ptr<Cell[]> m_Cells;
+			std::atomic<size_t> m_EnqueuePos, m_DequeuePos;
+			std::queue<Element> m_Overflow;
+			std::mutex m_OverflowMutex;
+			std::atomic<int> m_NumOverflow;
+			std::mutex m_WaitMutex;
+			std::condition_variable m_NonEmpty;
+			std::atomic<bool> m_IsWaiting;
+	};
 }
 }
 
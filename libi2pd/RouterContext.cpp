@@ -957,39 +957,43 @@ namespace i2p
 		return m_Decryptor ? m_Decryptor->Decrypt (encrypted, data) : false;
 	}
 
-	bool RouterContext::DecryptTunnelBuildRecord (const uint8_t * encrypted, uint8_t * data)
+	bool RouterContext::DecryptTunnelBuildRecord (const uint8_t * encrypted, uint8_t * data,
+		i2p::crypto::NoiseSymmetricState& noiseState, i2p::crypto::CryptoKeyDecryptor * decryptor)
 	{
-		return DecryptECIESTunnelBuildRecord (encrypted, data, ECIES_BUILD_REQUEST_RECORD_CLEAR_TEXT_SIZE);
+		return DecryptECIESTunnelBuildRecord (encrypted, data, ECIES_BUILD_REQUEST_RECORD_CLEAR_TEXT_SIZE, noiseState, decryptor);
 	}
 
-	bool RouterContext::DecryptECIESTunnelBuildRecord (const uint8_t * encrypted, uint8_t * data, size_t clearTextSize)
+	bool RouterContext::DecryptECIESTunnelBuildRecord (const uint8_t * encrypted, uint8_t * data, size_t clearTextSize,
+		i2p::crypto::NoiseSymmetricState& noiseState, i2p::crypto::CryptoKeyDecryptor * decryptor)
 	{
+		if (!decryptor) decryptor = m_TunnelDecryptor.get ();
 		// m_InitialNoiseState is h = SHA256(h || hepk)
-		m_CurrentNoiseState = m_InitialNoiseState;
-		m_CurrentNoiseState.MixHash (encrypted, 32); // h = SHA256(h || sepk)
+		noiseState = m_InitialNoiseState;
+		noiseState.MixHash (encrypted, 32); // h = SHA256(h || sepk)
 		uint8_t sharedSecret[32];
-		if (!m_TunnelDecryptor->Decrypt (encrypted, sharedSecret))
+		if (!decryptor->Decrypt (encrypted, sharedSecret))
 		{
 			LogPrint (eLogWarning, "Router: Incorrect ephemeral public key");
 			return false;
 		}
-		m_CurrentNoiseState.MixKey (sharedSecret);
+		noiseState.MixKey (sharedSecret);
 		encrypted += 32;
 		uint8_t nonce[12];
 		memset (nonce, 0, 12);
-		if (!i2p::crypto::AEADChaCha20Poly1305 (encrypted, clearTextSize, m_CurrentNoiseState.m_H, 32,
-			m_CurrentNoiseState.m_CK + 32, nonce, data, clearTextSize, false)) // decrypt
+		if (!i2p::crypto::AEADChaCha20Poly1305 (encrypted, clearTextSize, noiseState.m_H, 32,
+			noiseState.m_CK + 32, nonce, data, clearTextSize, false)) // decrypt
 		{
 			LogPrint (eLogWarning, "Router: Tunnel record AEAD decryption failed");
 			return false;
 		}
-		m_CurrentNoiseState.MixHash (encrypted, clearTextSize + 16); // h = SHA256(h || ciphertext)
+		noiseState.MixHash (encrypted, clearTextSize + 16); // h = SHA256(h || ciphertext)
 		return true;
 	}
 
-	bool RouterContext::DecryptTunnelShortRequestRecord (const uint8_t * encrypted, uint8_t * data)
+	bool RouterContext::DecryptTunnelShortRequestRecord (const uint8_t * encrypted, uint8_t * data,
+		i2p::crypto::NoiseSymmetricState& noiseState, i2p::crypto::CryptoKeyDecryptor * decryptor)
 	{
-		return DecryptECIESTunnelBuildRecord (encrypted, data, SHORT_REQUEST_RECORD_CLEAR_TEXT_SIZE);
+		return DecryptECIESTunnelBuildRecord (encrypted, data, SHORT_REQUEST_RECORD_CLEAR_TEXT_SIZE, noiseState, decryptor);
 	}
 
 	i2p::crypto::X25519Keys& RouterContext::GetNTCP2StaticKeys ()
@@ -109,8 +109,12 @@ namespace garlic
 			void SetStatusV6 (RouterStatus status);
 			int GetNetID () const { return m_NetID; };
 			void SetNetID (int netID) { m_NetID = netID; };
-			bool DecryptTunnelBuildRecord (const uint8_t * encrypted, uint8_t * data);
-			bool DecryptTunnelShortRequestRecord (const uint8_t * encrypted, uint8_t * data);
+			// router's tunnel decryptor is not thread safe, other threads pass own one
+			bool DecryptTunnelBuildRecord (const uint8_t * encrypted, uint8_t * data,
+				i2p::crypto::NoiseSymmetricState& noiseState, i2p::crypto::CryptoKeyDecryptor * decryptor = nullptr);
+			bool DecryptTunnelShortRequestRecord (const uint8_t * encrypted, uint8_t * data,
+				i2p::crypto::NoiseSymmetricState& noiseState, i2p::crypto::CryptoKeyDecryptor * decryptor = nullptr);
+			std::shared_ptr<i2p::crypto::CryptoKeyDecryptor> CreateTunnelDecryptor () const { return m_Keys.CreateDecryptor (nullptr); };
 
 			void UpdatePort (int port); // called from Daemon
 			void UpdateAddress (const boost::asio::ip::address& host); // called from SSU or Daemon
@@ -138,7 +142,6 @@ namespace garlic
 			void SetSupportsV6 (bool supportsV6);
 			void SetSupportsV4 (bool supportsV4);
 			void SetSupportsMesh (bool supportsmesh, const boost::asio::ip::address_v6& host);
-			i2p::crypto::NoiseSymmetricState& GetCurrentNoiseState () { return m_CurrentNoiseState; };
 
 			void UpdateNTCP2V6Address (const boost::asio::ip::address& host); // called from Daemon. TODO: remove
 			void UpdateStats ();
@@ -175,7 +178,8 @@ namespace garlic
 			bool Load ();
 			void SaveKeys ();
 
-			bool DecryptECIESTunnelBuildRecord (const uint8_t * encrypted, uint8_t * data, size_t clearTextSize);
+			bool DecryptECIESTunnelBuildRecord (const uint8_t * encrypted, uint8_t * data, size_t clearTextSize,
+				i2p::crypto::NoiseSymmetricState& noiseState, i2p::crypto::CryptoKeyDecryptor * decryptor);
 
 		private:
 
@@ -196,7 +200,7 @@ namespace garlic
 			std::unique_ptr<SSU2PrivateKeys> m_SSU2Keys;
 			std::unique_ptr<i2p::crypto::X25519Keys> m_NTCP2StaticKeys, m_SSU2StaticKeys;
 			// for ECIESx25519
-			i2p::crypto::NoiseSymmetricState m_InitialNoiseState, m_CurrentNoiseState;
+			i2p::crypto::NoiseSymmetricState m_InitialNoiseState;
 	};
 
 	extern RouterContext context;
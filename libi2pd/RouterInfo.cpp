@@ -74,11 +74,31 @@ namespace data
 	{
 	}		
 
+	RouterInfo::RouterInfo (const uint8_t * buf, size_t len, bool verifySignature):
+		m_IsUpdated (true), m_IsUnreachable (false), m_SupportedTransports (0),
+		m_ReachableTransports (0), m_Caps (0), m_Version (0)
+	{
+		m_Addresses = boost::make_shared<Addresses>(); // create empty list
+		if (len <= MAX_RI_BUFFER_SIZE)
+		{
+			m_Buffer = NewBuffer ();
+			memcpy (m_Buffer->data (), buf, len);
+			m_BufferLen = len;
+			ReadFromBuffer (verifySignature);
+		}
+		else
+		{
+			LogPrint (eLogError, "RouterInfo: Buffer is too long ", len, ". Ignored");
+			m_Buffer = nullptr;
+			m_IsUnreachable = true;
+		}
+	}
+
 	RouterInfo::~RouterInfo ()
 	{
 	}
 
-	void RouterInfo::Update (const uint8_t * buf, size_t len)
+	void RouterInfo::Update (const uint8_t * buf, size_t len, bool verifySignature)
 	{
 		if (len > MAX_RI_BUFFER_SIZE)
 		{
@@ -88,7 +108,7 @@ namespace data
 		}
 		// verify signature since we have identity already
 		int l = len - m_RouterIdentity->GetSignatureLen ();
-		if (m_RouterIdentity->Verify (buf, l, buf + l))
+		if (!verifySignature || m_RouterIdentity->Verify (buf, l, buf + l))
 		{
 			// clean up
 			m_IsUpdated = true;
@@ -96,15 +116,18 @@ namespace data
 			m_SupportedTransports = 0;
 			m_ReachableTransports = 0;
 			m_Caps = 0;
-			// don't clean up m_Addresses, it will be replaced in ReadFromStream
+			// don't clean up m_Addresses, it will be replaced in ReadFromBuffer
 			ClearProperties ();
 			// copy buffer
 			UpdateBuffer (buf, len);
 			// skip identity
 			size_t identityLen = m_RouterIdentity->GetFullLen ();
 			// read new RI
-			std::stringstream str (std::string ((char *)m_Buffer->data () + identityLen, m_BufferLen - identityLen));
-			ReadFromStream (str);
+			if (!ReadFromBuffer (m_Buffer->data () + identityLen, m_BufferLen - identityLen))
+			{
+				LogPrint (eLogError, "RouterInfo: Malformed message");
+				m_IsUnreachable = true;
+			}
 			// don't delete buffer until saved to the file
 		}
 		else
@@ -188,38 +211,36 @@ namespace data
 			m_RouterIdentity->DropVerifier ();
 		}
 		// parse RI
-		std::stringstream str;
-		str.write ((const char *)m_Buffer->data () + identityLen, m_BufferLen - identityLen);
-		ReadFromStream (str);
-		if (!str)
+		if (!ReadFromBuffer (m_Buffer->data () + identityLen, m_BufferLen - identityLen))
 		{
 			LogPrint (eLogError, "RouterInfo: Malformed message");
 			m_IsUnreachable = true;
 		}
 	}
 
-	void RouterInfo::ReadFromStream (std::istream& s)
+	bool RouterInfo::ReadFromBuffer (const uint8_t * buf, size_t len)
 	{
-		if (!s) return;
+		if (len < 9) return false;
 		m_Caps = 0;
-		s.read ((char *)&m_Timestamp, sizeof (m_Timestamp));
-		m_Timestamp = be64toh (m_Timestamp);
+		m_Timestamp = bufbe64toh (buf);
+		size_t offset = 8;
 		// read addresses
 		auto addresses = boost::make_shared<Addresses>();
-		uint8_t numAddresses;
-		s.read ((char *)&numAddresses, sizeof (numAddresses));
+		uint8_t numAddresses = buf[offset]; offset++;
 		addresses->reserve (numAddresses);
 		for (int i = 0; i < numAddresses; i++)
 		{
 			uint8_t supportedTransports = 0;
 			auto address = std::make_shared<Address> ();
-			uint8_t cost; // ignore
-			s.read ((char *)&cost, sizeof (cost));
-			s.read ((char *)&address->date, sizeof (address->date));
+			if (offset + 9 > len) return false;
+			offset++; // cost, ignore
+			memcpy (&address->date, buf + offset, sizeof (address->date)); offset += sizeof (address->date);
 			bool isHost = false, isIntroKey = false, isStaticKey = false, isV2 = false;
 			Tag<32> iV2; // for 'i' field in SSU, TODO: remove later
 			char transportStyle[6];
-			ReadString (transportStyle, 6, s);
+			auto l = ReadString (transportStyle, 6, buf + offset, len - offset);
+			if (!l) return false;
+			offset += l;
 			if (!strncmp (transportStyle, "NTCP", 4)) // NTCP or NTCP2
 				address->transportStyle = eTransportNTCP;
 			else if (!strncmp (transportStyle, "SSU", 3)) // SSU or SSU2
@@ -232,23 +253,17 @@ namespace data
 				address->transportStyle = eTransportUnknown;
 			address->caps = 0;
 			address->port = 0;
-			uint16_t size, r = 0;
-			s.read ((char *)&size, sizeof (size)); if (!s) return;
-			size = be16toh (size);
-			if (address->transportStyle == eTransportUnknown)
-			{
-				// skip unknown address
-				s.seekg (size, std::ios_base::cur);
-				if (s) continue; else return;
-			}	
+			if (offset + 2 > len) return false;
+			size_t size = bufbe16toh (buf + offset); offset += 2;
+			if (offset + size > len) return false;
+			const uint8_t * options = buf + offset;
+			offset += size;
+			if (address->transportStyle == eTransportUnknown) continue; // skip unknown address
+			size_t r = 0;
 			while (r < size)
 			{
 				char key[255], value[255];
-				r += ReadString (key, 255, s);
-				s.seekg (1, std::ios_base::cur); r++; // =
-				r += ReadString (value, 255, s);
-				s.seekg (1, std::ios_base::cur); r++; // ;
-				if (!s) return;
+				if (!ReadOption (key, value, options, size, r)) return false;
 				if (!strcmp (key, "host"))
 				{
 					boost::system::error_code ecode;
@@ -311,7 +326,7 @@ namespace data
 					if (index > 9)
 					{
 						LogPrint (eLogError, "RouterInfo: Unexpected introducer's index ", index, " skipped");
-						if (s) continue; else return;
+						continue;
 					}
 					if (index >= address->ssu->introducers.size ())
 					{
@@ -334,7 +349,6 @@ namespace data
 					else if (!strcmp (key, "iexp"))
 						introducer.iExp = boost::lexical_cast<uint32_t>(value);
 				}
-				if (!s) return;
 			}
 			if (address->transportStyle == eTransportNTCP)
 			{
@@ -436,23 +450,21 @@ namespace data
 		m_Addresses = addresses; // race condition
 #endif
 		// read peers
-		uint8_t numPeers;
-		s.read ((char *)&numPeers, sizeof (numPeers)); if (!s) return;
-		s.seekg (numPeers*32, std::ios_base::cur); // TODO: read peers
+		if (offset + 1 > len) return false;
+		uint8_t numPeers = buf[offset]; offset++;
+		offset += numPeers*32; // TODO: read peers
 		// read properties
 		m_Version = 0;
 		bool isNetId = false;
-		uint16_t size, r = 0;
-		s.read ((char *)&size, sizeof (size)); if (!s) return;
-		size = be16toh (size);
+		if (offset + 2 > len) return false;
+		size_t size = bufbe16toh (buf + offset); offset += 2;
+		if (offset + size > len) return false;
+		const uint8_t * properties = buf + offset;
+		size_t r = 0;
 		while (r < size)
 		{
 			char key[255], value[255];
-			r += ReadString (key, 255, s);
-			s.seekg (1, std::ios_base::cur); r++; // =
-			r += ReadString (value, 255, s);
-			s.seekg (1, std::ios_base::cur); r++; // ;
-			if (!s) return;
+			if (!ReadOption (key, value, properties, size, r)) return false;
 			SetProperty (key, value);
 
 			// extract caps
@@ -497,12 +509,11 @@ namespace data
 					m_Family.clear ();
 				}
 			}
-
-			if (!s) return;
 		}
 
 		if (!m_SupportedTransports || !isNetId || !m_Version)
 			SetUnreachable (true);
+		return true;
 	}
 
 	bool RouterInfo::IsFamily(const std::string & fam) const
@@ -605,25 +616,37 @@ namespace data
 		return true;
 	}
 
-	size_t RouterInfo::ReadString (char * str, size_t len, std::istream& s) const
+	size_t RouterInfo::ReadString (char * str, size_t len, const uint8_t * buf, size_t bufLen) const
 	{
-		uint8_t l;
-		s.read ((char *)&l, 1);
+		if (!bufLen) return 0;
+		uint8_t l = buf[0];
+		if ((size_t)l + 1 > bufLen) return 0; // out of buffer
 		if (l < len)
 		{
-			s.read (str, l);
-			if (!s) l = 0; // failed, return empty string
+			memcpy (str, buf + 1, l);
 			str[l] = 0;
 		}
 		else
 		{
 			LogPrint (eLogWarning, "RouterInfo: String length ", (int)l, " exceeds buffer size ", len);
-			s.seekg (l, std::ios::cur); // skip
-			str[0] = 0;
+			str[0] = 0; // skip
 		}
 		return l+1;
 	}
 
+	bool RouterInfo::ReadOption (char * key, char * value, const uint8_t * buf, size_t len, size_t& offset) const
+	{
+		// key=value;
+		auto l = ReadString (key, 255, buf + offset, len - offset);
+		if (!l) return false;
+		offset += l + 1; // =
+		if (offset >= len) return false;
+		l = ReadString (value, 255, buf + offset, len - offset);
+		if (!l) return false;
+		offset += l + 1; // ;
+		return offset <= len;
+	}
+
 
 	void RouterInfo::AddSSUAddress (const char * host, int port, const uint8_t * key, int mtu)
 	{
@@ -895,6 +918,16 @@ namespace data
 			});
 	}
 
+	std::shared_ptr<const RouterInfo::Address> RouterInfo::GetSSU2AddressWithStaticKey (const uint8_t * key) const
+	{
+		if (!key) return nullptr;
+		return GetAddress (
+			[key](std::shared_ptr<const RouterInfo::Address> address)->bool
+			{
+				return address->IsSSU2 () && !memcmp (address->s, key, 32);
+			});
+	}
+
 	std::shared_ptr<const RouterInfo::Address> RouterInfo::GetPublishedNTCP2V4Address () const
 	{
 		return GetAddress (
@@ -28,29 +28,43 @@ namespace i2p
 namespace transport
 {
 	SSUServer::SSUServer (int port):
-		m_IsRunning(false), m_Thread (nullptr),
-		m_ReceiversThread (nullptr), m_ReceiversThreadV6 (nullptr), m_Work (m_Service),
-		m_ReceiversWork (m_ReceiversService), m_ReceiversWorkV6 (m_ReceiversServiceV6),
+		m_IsRunning(false), m_Thread (nullptr), m_Work (m_Service),
 		m_Endpoint (boost::asio::ip::udp::v4 (), port), m_EndpointV6 (boost::asio::ip::udp::v6 (), port),
-		m_Socket (m_ReceiversService), m_SocketV6 (m_ReceiversServiceV6),
 		m_IntroducersUpdateTimer (m_Service), m_IntroducersUpdateTimerV6 (m_Service),
-		m_PeerTestsCleanupTimer (m_Service), m_TerminationTimer (m_Service), m_TerminationTimerV6 (m_Service),
-		m_IsSyncClockFromPeers (true)
+		m_PeerTestsCleanupTimer (m_Service), m_IsSyncClockFromPeers (true)
 	{
+		uint16_t numThreads; i2p::config::GetOption("limits.ssuthreads", numThreads);
+		if (!numThreads) numThreads = 1;
+		if (numThreads > SSU_MAX_NUM_THREADS) numThreads = SSU_MAX_NUM_THREADS;
+#ifndef SO_REUSEPORT
+		if (numThreads > 1)
+		{
+			LogPrint (eLogWarning, "SSU: SO_REUSEPORT is not supported, use one thread");
+			numThreads = 1;
+		}
+#endif
+		for (int i = 0; i < numThreads; i++)
+		{
+			m_Receivers.emplace_back (new Receiver (m_PacketsPool));
+			m_ReceiversV6.emplace_back (new Receiver (m_PacketsPool));
+			m_Shards.emplace_back (new SSUShard (i ? nullptr : &m_Service, m_Receivers[i]->socket, m_ReceiversV6[i]->socket));
+		}
 	}
 
 	SSUServer::~SSUServer ()
 	{
 	}
 
-	void SSUServer::OpenSocket ()
+	void SSUServer::OpenSocket (Receiver& receiver)
 	{
+		auto& socket = receiver.socket;
 		try
 		{
-			m_Socket.open (boost::asio::ip::udp::v4());
-			m_Socket.set_option (boost::asio::socket_base::receive_buffer_size (SSU_SOCKET_RECEIVE_BUFFER_SIZE));
-			m_Socket.set_option (boost::asio::socket_base::send_buffer_size (SSU_SOCKET_SEND_BUFFER_SIZE));
-			m_Socket.bind (m_Endpoint);
+			socket.open (boost::asio::ip::udp::v4());
+			socket.set_option (boost::asio::socket_base::receive_buffer_size (SSU_SOCKET_RECEIVE_BUFFER_SIZE));
+			socket.set_option (boost::asio::socket_base::send_buffer_size (SSU_SOCKET_SEND_BUFFER_SIZE));
+			if (m_Shards.size () > 1) SetReusePort (socket);
+			socket.bind (m_Endpoint);
 			LogPrint (eLogInfo, "SSU: Start listening v4 port ", m_Endpoint.port());
 		}
 		catch ( std::exception & ex )
@@ -60,14 +74,15 @@ namespace transport
 		}
 	}
 
-	void SSUServer::OpenSocketV6 ()
+	void SSUServer::OpenSocketV6 (Receiver& receiver)
 	{
+		auto& socket = receiver.socket;
 		try
 		{
-			m_SocketV6.open (boost::asio::ip::udp::v6());
-			m_SocketV6.set_option (boost::asio::ip::v6_only (true));
-			m_SocketV6.set_option (boost::asio::socket_base::receive_buffer_size (SSU_SOCKET_RECEIVE_BUFFER_SIZE));
-			m_SocketV6.set_option (boost::asio::socket_base::send_buffer_size (SSU_SOCKET_SEND_BUFFER_SIZE));
+			socket.open (boost::asio::ip::udp::v6());
+			socket.set_option (boost::asio::ip::v6_only (true));
+			socket.set_option (boost::asio::socket_base::receive_buffer_size (SSU_SOCKET_RECEIVE_BUFFER_SIZE));
+			socket.set_option (boost::asio::socket_base::send_buffer_size (SSU_SOCKET_SEND_BUFFER_SIZE));
 #ifdef __linux__
 			if (m_EndpointV6.address() == boost::asio::ip::address().from_string("::")) // only if not binded to address
 			{
@@ -77,10 +92,11 @@ namespace transport
 #else
 				typedef boost::asio::detail::socket_option::integer<IPPROTO_IPV6, IPV6_ADDR_PREFERENCES> ipv6PreferAddr;
 #endif
-				m_SocketV6.set_option (ipv6PreferAddr(IPV6_PREFER_SRC_PUBLIC | IPV6_PREFER_SRC_HOME | IPV6_PREFER_SRC_NONCGA));
+				socket.set_option (ipv6PreferAddr(IPV6_PREFER_SRC_PUBLIC | IPV6_PREFER_SRC_HOME | IPV6_PREFER_SRC_NONCGA));
 			}
 #endif
-			m_SocketV6.bind (m_EndpointV6);
+			if (m_Shards.size () > 1) SetReusePort (socket);
+			socket.bind (m_EndpointV6);
 			LogPrint (eLogInfo, "SSU: Start listening v6 port ", m_EndpointV6.port());
 		}
 		catch ( std::exception & ex )
@@ -90,25 +106,49 @@ namespace transport
 		}
 	}
 
+	void SSUServer::SetReusePort (boost::asio::ip::udp::socket& socket)
+	{
+#ifdef SO_REUSEPORT
+#if (BOOST_VERSION >= 105500)
+		typedef boost::asio::detail::socket_option::boolean<BOOST_ASIO_OS_DEF(SOL_SOCKET), SO_REUSEPORT> reusePort;
+#else
+		typedef boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT> reusePort;
+#endif
+		socket.set_option (reusePort (true));
+#endif
+	}
+
 	void SSUServer::Start ()
 	{
 		i2p::config::GetOption("nettime.frompeers", m_IsSyncClockFromPeers);
 		m_IsRunning = true;
 		m_Thread = new std::thread (std::bind (&SSUServer::Run, this));
+		for (size_t i = 1; i < m_Shards.size (); i++)
+			m_Shards[i]->thread = new std::thread (std::bind (&SSUServer::RunShard, this, m_Shards[i].get ()));
+		if (m_Shards.size () > 1)
+			LogPrint (eLogInfo, "SSU: Using ", m_Shards.size (), " threads and sockets per address");
 		if (context.SupportsV4 ())
 		{
-			OpenSocket ();
-			m_ReceiversThread = new std::thread (std::bind (&SSUServer::RunReceivers, this));
-			m_ReceiversService.post (std::bind (&SSUServer::Receive, this));
-			ScheduleTermination ();
+			for (auto& it: m_Receivers)
+			{
+				OpenSocket (*it);
+				it->thread = new std::thread (std::bind (&SSUServer::RunReceiver, this, it.get (), true));
+				it->service.post (std::bind (&SSUServer::Receive, this, it.get (), true));
+			}
+			for (auto& it: m_Shards)
+				ScheduleTermination (it.get (), true);
 			ScheduleIntroducersUpdateTimer (); // wait for 30 seconds and decide if we need introducers
 		}
 		if (context.SupportsV6 ())
 		{
-			OpenSocketV6 ();
-			m_ReceiversThreadV6 = new std::thread (std::bind (&SSUServer::RunReceiversV6, this));
-			m_ReceiversServiceV6.post (std::bind (&SSUServer::ReceiveV6, this));
-			ScheduleTerminationV6 ();
+			for (auto& it: m_ReceiversV6)
+			{
+				OpenSocketV6 (*it);
+				it->thread = new std::thread (std::bind (&SSUServer::RunReceiver, this, it.get (), false));
+				it->service.post (std::bind (&SSUServer::Receive, this, it.get (), false));
+			}
+			for (auto& it: m_Shards)
+				ScheduleTermination (it.get (), false);
 			ScheduleIntroducersUpdateTimerV6 (); // wait for 30 seconds and decide if we need introducers
 		}
 		SchedulePeerTestsCleanupTimer ();
@@ -116,29 +156,35 @@ namespace transport
 
 	void SSUServer::Stop ()
 	{
+		m_IsRunning = false; // send directly from now
 		DeleteAllSessions ();
-		m_IsRunning = false;
-		m_TerminationTimer.cancel ();
-		m_TerminationTimerV6.cancel ();
 		m_IntroducersUpdateTimer.cancel ();
 		m_IntroducersUpdateTimerV6.cancel ();
-		m_Service.stop ();
-		m_Socket.close ();
-		m_SocketV6.close ();
-		m_ReceiversService.stop ();
-		m_ReceiversServiceV6.stop ();
-		if (m_ReceiversThread)
+		for (auto& it: m_Shards)
 		{
-			m_ReceiversThread->join ();
-			delete m_ReceiversThread;
-			m_ReceiversThread = nullptr;
-		}
-		if (m_ReceiversThreadV6)
-		{
-			m_ReceiversThreadV6->join ();
-			delete m_ReceiversThreadV6;
-			m_ReceiversThreadV6 = nullptr;
+			it->terminationTimer.cancel ();
+			it->terminationTimerV6.cancel ();
+			it->service.stop (); // server's service for shard 0
 		}
+		for (auto receivers: { &m_Receivers, &m_ReceiversV6 })
+			for (auto& it: *receivers)
+			{
+				it->socket.close ();
+				it->service.stop ();
+				if (it->thread)
+				{
+					it->thread->join ();
+					delete it->thread;
+					it->thread = nullptr;
+				}
+			}
+		for (auto& it: m_Shards)
+			if (it->thread)
+			{
+				it->thread->join ();
+				delete it->thread;
+				it->thread = nullptr;
+			}
 		if (m_Thread)
 		{
 			m_Thread->join ();
@@ -164,48 +210,43 @@ namespace transport
 		}
 	}
 
-	void SSUServer::RunReceivers ()
+	void SSUServer::RunShard (SSUShard * shard)
 	{
-		i2p::util::SetThreadName("SSUv4");
+		i2p::util::SetThreadName("SSUShard");
 
+		boost::asio::io_service::work work (shard->service);
 		while (m_IsRunning)
 		{
 			try
 			{
-				m_ReceiversService.run ();
+				shard->service.run ();
 			}
 			catch (std::exception& ex)
 			{
-				LogPrint (eLogError, "SSU: Receivers runtime exception: ", ex.what ());
-				if (m_IsRunning)
-				{
-					// restart socket
-					m_Socket.close ();
-					OpenSocket ();
-					Receive ();
-				}
+				LogPrint (eLogError, "SSU: Shard runtime exception: ", ex.what ());
 			}
 		}
 	}
 
-	void SSUServer::RunReceiversV6 ()
+	void SSUServer::RunReceiver (Receiver * receiver, bool v4)
 	{
-		i2p::util::SetThreadName("SSUv6");
+		i2p::util::SetThreadName(v4 ? "SSUv4" : "SSUv6");
 
 		while (m_IsRunning)
 		{
 			try
 			{
-				m_ReceiversServiceV6.run ();
+				receiver->service.run ();
 			}
 			catch (std::exception& ex)
 			{
-				LogPrint (eLogError, "SSU: v6 receivers runtime exception: ", ex.what ());
+				LogPrint (eLogError, "SSU: Receivers runtime exception: ", ex.what ());
 				if (m_IsRunning)
 				{
-					m_SocketV6.close ();
-					OpenSocketV6 ();
-					ReceiveV6 ();
+					// restart socket
+					receiver->socket.close ();
+					if (v4) OpenSocket (*receiver); else OpenSocketV6 (*receiver);
+					Receive (receiver, v4);
 				}
 			}
 		}
@@ -242,13 +283,25 @@ namespace transport
 		return nullptr;
 	}
 
-	void SSUServer::Send (const uint8_t * buf, size_t len, const boost::asio::ip::udp::endpoint& to)
+	void SSUServer::Send (const uint8_t * buf, size_t len, const boost::asio::ip::udp::endpoint& to, SSUShard& shard)
 	{
+		bool v4 = to.protocol () == boost::asio::ip::udp::v4();
+		if (m_IsRunning) // called from shard's thread
+		{
+			auto& batch = v4 ? shard.sendBatch : shard.sendBatchV6;
+			if (batch.IsEmpty ())
+				shard.service.post (std::bind (&SSUServer::FlushSendBatch, this, std::ref (batch)));
+			if (batch.Add (buf, len, to))
+			{
+				if (batch.IsFull ()) FlushSendBatch (batch);
+				return;
+			}
+		}
 		boost::system::error_code ec;
-		if (to.protocol () == boost::asio::ip::udp::v4())
-			m_Socket.send_to (boost::asio::buffer (buf, len), to, 0, ec);
+		if (v4)
+			shard.socket.send_to (boost::asio::buffer (buf, len), to, 0, ec);
 		else
-			m_SocketV6.send_to (boost::asio::buffer (buf, len), to, 0, ec);
+			shard.socketV6.send_to (boost::asio::buffer (buf, len), to, 0, ec);
 
 		if (ec)
 		{
@@ -256,24 +309,27 @@ namespace transport
 		}
 	}
 
-	void SSUServer::Receive ()
+	void SSUServer::FlushSendBatch (UDPBatchSender& batch)
 	{
-		SSUPacket * packet = m_PacketsPool.AcquireMt ();
-		m_Socket.async_receive_from (boost::asio::buffer (packet->buf, SSU_MTU_V4), packet->from,
-			std::bind (&SSUServer::HandleReceivedFrom, this, std::placeholders::_1, std::placeholders::_2, packet));
+		if (batch.IsEmpty ()) return;
+		boost::system::error_code ec;
+		batch.Flush (ec);
+		if (ec)
+			LogPrint (eLogError, "SSU: Send exception: ", ec.message ());
 	}
 
-	void SSUServer::ReceiveV6 ()
+	void SSUServer::Receive (Receiver * receiver, bool v4)
 	{
 		SSUPacket * packet = m_PacketsPool.AcquireMt ();
-		m_SocketV6.async_receive_from (boost::asio::buffer (packet->buf, SSU_MTU_V6), packet->from,
-			std::bind (&SSUServer::HandleReceivedFromV6, this, std::placeholders::_1, std::placeholders::_2, packet));
+		receiver->socket.async_receive_from (boost::asio::buffer (packet->buf, v4 ? SSU_MTU_V4 : SSU_MTU_V6), packet->from,
+			std::bind (&SSUServer::HandleReceivedFrom, this, std::placeholders::_1, std::placeholders::_2, packet, receiver, v4));
 	}
 
-	void SSUServer::HandleReceivedFrom (const boost::system::error_code& ecode, std::size_t bytes_transferred, SSUPacket * packet)
+	bool SSUServer::IsIgnoredReceiveError (const boost::system::error_code& ecode)
 	{
-		if (!ecode
-		    || ecode == boost::asio::error::connection_refused
+		// just try continue reading when received ICMP response otherwise socket can crash,
+		// but better to find out which host were sent it and mark that router as unreachable
+		return ecode == boost::asio::error::connection_refused
 		    || ecode == boost::asio::error::connection_reset
 		    || ecode == boost::asio::error::network_unreachable
 		    || ecode == boost::asio::error::host_unreachable
@@ -282,116 +338,54 @@ namespace transport
 		    || ecode.value() == boost::winapi::ERROR_NETWORK_UNREACHABLE_
 		    || ecode.value() == boost::winapi::ERROR_HOST_UNREACHABLE_
 #endif
-		)
-		// just try continue reading when received ICMP response otherwise socket can crash,
-		// but better to find out which host were sent it and mark that router as unreachable
-		{
-			packet->len = bytes_transferred;
-			std::vector<SSUPacket *> packets;
-			packets.push_back (packet);
-
-			boost::system::error_code ec;
-			size_t moreBytes = m_Socket.available(ec);
-			if (!ec)
-			{
-				while (moreBytes && packets.size () < 25)
-				{
-					packet = m_PacketsPool.AcquireMt ();
-					packet->len = m_Socket.receive_from (boost::asio::buffer (packet->buf, SSU_MTU_V4), packet->from, 0, ec);
-					if (!ec)
-					{
-						packets.push_back (packet);
-						moreBytes = m_Socket.available(ec);
-						if (ec) break;
-					}
-					else
-					{
-						LogPrint (eLogError, "SSU: receive_from error: code ", ec.value(), ": ", ec.message ());
-						m_PacketsPool.ReleaseMt (packet);
-						break;
-					}
-				}
-			}
-
-			m_Service.post (std::bind (&SSUServer::HandleReceivedPackets, this, packets, &m_Sessions));
-			Receive ();
-		}
-		else
-		{
-			m_PacketsPool.ReleaseMt (packet);
-			if (ecode != boost::asio::error::operation_aborted)
-			{
-				LogPrint (eLogError, "SSU: Receive error: code ", ecode.value(), ": ", ecode.message ());
-				m_Socket.close ();
-				OpenSocket ();
-				Receive ();
-			}
-		}
+		;
 	}
 
-	void SSUServer::HandleReceivedFromV6 (const boost::system::error_code& ecode, std::size_t bytes_transferred, SSUPacket * packet)
+	void SSUServer::HandleReceivedFrom (const boost::system::error_code& ecode, std::size_t bytes_transferred,
+		SSUPacket * packet, Receiver * receiver, bool v4)
 	{
-		if (!ecode
-		    || ecode == boost::asio::error::connection_refused
-		    || ecode == boost::asio::error::connection_reset
-		    || ecode == boost::asio::error::network_unreachable
-		    || ecode == boost::asio::error::host_unreachable
-#ifdef _WIN32 // windows can throw WinAPI error, which is not handled by ASIO
-		    || ecode.value() == boost::winapi::ERROR_CONNECTION_REFUSED_
-		    || ecode.value() == boost::winapi::ERROR_NETWORK_UNREACHABLE_
-		    || ecode.value() == boost::winapi::ERROR_HOST_UNREACHABLE_
-#endif
-		)
-		// just try continue reading when received ICMP response otherwise socket can crash,
-		// but better to find out which host were sent it and mark that router as unreachable
+		if (!ecode || IsIgnoredReceiveError (ecode))
 		{
 			packet->len = bytes_transferred;
 			std::vector<SSUPacket *> packets;
 			packets.push_back (packet);
 
 			boost::system::error_code ec;
-			size_t moreBytes = m_SocketV6.available (ec);
-			if (!ec)
+			receiver->batch.Receive (receiver->socket, v4 ? SSU_MTU_V4 : SSU_MTU_V6, UDP_MAX_BATCH_SIZE, packets, ec);
+			if (ec)
+				LogPrint (eLogError, "SSU: ", v4 ? "" : "v6 ", "receive_from error: code ", ec.value(), ": ", ec.message ());
+
+			if (m_Shards.size () > 1)
 			{
-				while (moreBytes && packets.size () < 25)
-				{
-					packet = m_PacketsPool.AcquireMt ();
-					packet->len = m_SocketV6.receive_from (boost::asio::buffer (packet->buf, SSU_MTU_V6), packet->from, 0, ec);
-					if (!ec)
-					{
-						packets.push_back (packet);
-						moreBytes = m_SocketV6.available(ec);
-						if (ec) break;
-					}
-					else
-					{
-						LogPrint (eLogError, "SSU: v6 receive_from error: code ", ec.value(), ": ", ec.message ());
-						m_PacketsPool.ReleaseMt (packet);;
-						break;
-					}
-				}
+				// kernel's choice of socket is not known for outgoing sessions, pass packets to shards of their endpoints
+				std::vector<std::vector<SSUPacket *> > shards (m_Shards.size ());
+				for (auto it: packets)
+					shards[GetShardIndex (it->from)].push_back (it);
+				for (size_t i = 0; i < shards.size (); i++)
+					if (!shards[i].empty ())
+						m_Shards[i]->service.post (std::bind (&SSUServer::HandleReceivedPackets, this, shards[i], m_Shards[i].get (), v4));
 			}
-
-			m_Service.post (std::bind (&SSUServer::HandleReceivedPackets, this, packets, &m_SessionsV6));
-			ReceiveV6 ();
+			else
+				m_Service.post (std::bind (&SSUServer::HandleReceivedPackets, this, packets, m_Shards[0].get (), v4));
+			Receive (receiver, v4);
 		}
 		else
 		{
 			m_PacketsPool.ReleaseMt (packet);
 			if (ecode != boost::asio::error::operation_aborted)
 			{
-				LogPrint (eLogError, "SSU: v6 receive error: code ", ecode.value(), ": ", ecode.message ());
-				m_SocketV6.close ();
-				OpenSocketV6 ();
-				ReceiveV6 ();
+				LogPrint (eLogError, "SSU: ", v4 ? "" : "v6 ", "receive error: code ", ecode.value(), ": ", ecode.message ());
+				receiver->socket.close ();
+				if (v4) OpenSocket (*receiver); else OpenSocketV6 (*receiver);
+				Receive (receiver, v4);
 			}
 		}
 	}
 
-	void SSUServer::HandleReceivedPackets (std::vector<SSUPacket *> packets,
-		std::map<boost::asio::ip::udp::endpoint, std::shared_ptr<SSUSession> > * sessions)
+	void SSUServer::HandleReceivedPackets (std::vector<SSUPacket *> packets, SSUShard * shard, bool v4)
 	{
 		if (!m_IsRunning) return;
+		auto& sessions = v4 ? shard->sessions : shard->sessionsV6;
 		std::shared_ptr<SSUSession> session;
 		for (auto& packet: packets)
 		{
@@ -404,14 +398,14 @@ namespace transport
 						session->FlushData ();
 						session = nullptr;
 					}
-					auto it = sessions->find (packet->from);
-					if (it != sessions->end ())
+					auto it = sessions.find (packet->from);
+					if (it != sessions.end ())
 						session = it->second;
 					if (!session && packet->len > 0)
 					{
-						session = std::make_shared<SSUSession> (*this, packet->from);
+						session = std::make_shared<SSUSession> (*this, *shard, packet->from);
 						session->WaitForConnect ();
-						(*sessions)[packet->from] = session;
+						AddSession (session);
 						LogPrint (eLogDebug, "SSU: New session from ", packet->from.address ().to_string (), ":", packet->from.port (), " created");
 					}
 				}
@@ -429,9 +423,40 @@ namespace transport
 		if (session) session->FlushData ();
 	}
 
+	size_t SSUServer::GetShardIndex (const boost::asio::ip::udp::endpoint& ep) const
+	{
+		if (m_Shards.size () < 2) return 0;
+		uint64_t h = ep.port ();
+		if (ep.address ().is_v4 ())
+			h ^= (uint64_t)ep.address ().to_v4 ().to_ulong () << 16;
+		else
+		{
+			auto bytes = ep.address ().to_v6 ().to_bytes ();
+			for (size_t i = 0; i < bytes.size (); i += 8)
+			{
+				uint64_t b; memcpy (&b, bytes.data () + i, 8);
+				h ^= b;
+			}
+		}
+		return ((h*0x9E3779B97F4A7C15ULL) >> 32) % m_Shards.size ();
+	}
+
+	void SSUServer::AddSession (std::shared_ptr<SSUSession> session)
+	{
+		auto& ep = session->GetRemoteEndpoint ();
+		auto& shard = GetShard (ep);
+		std::unique_lock<std::mutex> l(shard.sessionsMutex);
+		if (ep.address ().is_v6 ())
+			shard.sessionsV6[ep] = session;
+		else
+			shard.sessions[ep] = session;
+	}
+
 	std::shared_ptr<SSUSession> SSUServer::FindSession (const boost::asio::ip::udp::endpoint& e) const
 	{
-		auto& sessions = e.address ().is_v6 () ? m_SessionsV6 : m_Sessions;
+		auto& shard = GetShard (e);
+		std::unique_lock<std::mutex> l(shard.sessionsMutex);
+		auto& sessions = e.address ().is_v6 () ? shard.sessionsV6 : shard.sessions;
 		auto it = sessions.find (e);
 		if (it != sessions.end ())
 			return it->second;
@@ -460,7 +485,7 @@ namespace transport
 			{
 				if (address->host.is_unspecified () || !address->port) return false;
 				boost::asio::ip::udp::endpoint remoteEndpoint (address->host, address->port);
-				m_Service.post (std::bind (&SSUServer::CreateDirectSession, this, router, remoteEndpoint, peerTest));
+				CreateDirectSession (router, remoteEndpoint, peerTest);
 			}
 		}
 		else
@@ -470,7 +495,13 @@ namespace transport
 
 	void SSUServer::CreateDirectSession (std::shared_ptr<const i2p::data::RouterInfo> router, boost::asio::ip::udp::endpoint remoteEndpoint, bool peerTest)
 	{
-		auto& sessions = remoteEndpoint.address ().is_v6 () ? m_SessionsV6 : m_Sessions;
+		GetShard (remoteEndpoint).service.post (std::bind (&SSUServer::HandleCreateDirectSession, this, router, remoteEndpoint, peerTest));
+	}
+
+	void SSUServer::HandleCreateDirectSession (std::shared_ptr<const i2p::data::RouterInfo> router, boost::asio::ip::udp::endpoint remoteEndpoint, bool peerTest)
+	{
+		auto& shard = GetShard (remoteEndpoint);
+		auto& sessions = remoteEndpoint.address ().is_v6 () ? shard.sessionsV6 : shard.sessions;
 		auto it = sessions.find (remoteEndpoint);
 		if (it != sessions.end ())
 		{
@@ -481,8 +512,8 @@ namespace transport
 		else
 		{
 			// otherwise create new session
-			auto session = std::make_shared<SSUSession> (*this, remoteEndpoint, router, peerTest);
-			sessions[remoteEndpoint] = session;
+			auto session = std::make_shared<SSUSession> (*this, shard, remoteEndpoint, router, peerTest);
+			AddSession (session);
 
 			// connect
 			LogPrint (eLogDebug, "SSU: Creating new session to [", i2p::data::GetIdentHashAbbreviation (router->GetIdentHash ()), "] ",
@@ -501,15 +532,13 @@ namespace transport
 			if (!address->host.is_unspecified () && address->port)
 			{
 				// we rarely come here
-				auto& sessions = address->host.is_v6 () ? m_SessionsV6 : m_Sessions;
 				boost::asio::ip::udp::endpoint remoteEndpoint (address->host, address->port);
-				auto it = sessions.find (remoteEndpoint);
+				auto session = FindSession (remoteEndpoint);
 				// check if session is presented already
-				if (it != sessions.end ())
+				if (session)
 				{
-					auto session = it->second;
 					if (peerTest && session->GetState () == eSessionStateEstablished)
-						session->SendPeerTest ();
+						CreateDirectSession (router, remoteEndpoint, true); // sends peer test in session's thread
 					return;
 				}
 			}
@@ -528,25 +557,11 @@ namespace transport
 					if (!intr->iPort) continue; // skip invalid introducer
 					if (intr->iExp > 0 && ts > intr->iExp) continue; // skip expired introducer
 					boost::asio::ip::udp::endpoint ep (intr->iHost, intr->iPort);
-					if (ep.address ().is_v4 () && address->IsV4 ()) // ipv4
+					if ((ep.address ().is_v4 () && address->IsV4 ()) || (ep.address ().is_v6 () && address->IsV6 ()))
 					{
 						if (!introducer) introducer = intr;
-						auto it = m_Sessions.find (ep);
-						if (it != m_Sessions.end ())
-						{
-							introducerSession = it->second;
-							break;
-						}
-					}
-					if (ep.address ().is_v6 () && address->IsV6 ()) // ipv6
-					{
-						if (!introducer) introducer = intr;
-						auto it = m_SessionsV6.find (ep);
-						if (it != m_SessionsV6.end ())
-						{
-							introducerSession = it->second;
-							break;
-						}
+						introducerSession = FindSession (ep);
+						if (introducerSession) break;
 					}
 				}
 				if (!introducer)
@@ -557,38 +572,48 @@ namespace transport
 
 				if (introducerSession) // session found
 					LogPrint (eLogWarning, "SSU: Session to introducer already exists");
-				else // create new
-				{
-					LogPrint (eLogDebug, "SSU: Creating new session to introducer ", introducer->iHost);
-					boost::asio::ip::udp::endpoint introducerEndpoint (introducer->iHost, introducer->iPort);
-					introducerSession = std::make_shared<SSUSession> (*this, introducerEndpoint, router);
-					if (introducerEndpoint.address ().is_v4 ())
-						m_Sessions[introducerEndpoint] = introducerSession;
-					else if (introducerEndpoint.address ().is_v6 ())
-						m_SessionsV6[introducerEndpoint] = introducerSession;
-				}
 				if (!address->host.is_unspecified () && address->port)
 				{
-					// create session
+					// create session in its thread
 					boost::asio::ip::udp::endpoint remoteEndpoint (address->host, address->port);
-					auto session = std::make_shared<SSUSession> (*this, remoteEndpoint, router, peerTest);
-					if (address->host.is_v4 ())
-						m_Sessions[remoteEndpoint] = session;
-					else if (address->host.is_v6 ())
-						m_SessionsV6[remoteEndpoint] = session;
-
-					// introduce
 					LogPrint (eLogInfo, "SSU: Introduce new session to [", i2p::data::GetIdentHashAbbreviation (router->GetIdentHash ()),
 							"] through introducer ", introducer->iHost, ":", introducer->iPort);
-					session->WaitForIntroduction ();
-					if ((address->host.is_v4 () && i2p::context.GetStatus () == eRouterStatusFirewalled) ||
-					    (address->host.is_v6 () && i2p::context.GetStatusV6 () == eRouterStatusFirewalled))
-					{
-						uint8_t buf[1];
-						Send (buf, 0, remoteEndpoint); // send HolePunch
-					}
+					auto& shard = GetShard (remoteEndpoint);
+					shard.service.post ([this, &shard, router, remoteEndpoint, peerTest]()
+						{
+							auto session = std::make_shared<SSUSession> (*this, shard, remoteEndpoint, router, peerTest);
+							AddSession (session);
+							session->WaitForIntroduction ();
+							if ((remoteEndpoint.address ().is_v4 () && i2p::context.GetStatus () == eRouterStatusFirewalled) ||
+							    (remoteEndpoint.address ().is_v6 () && i2p::context.GetStatusV6 () == eRouterStatusFirewalled))
+							{
+								uint8_t buf[1];
+								Send (buf, 0, remoteEndpoint, shard); // send HolePunch
+							}
+						});
 				}
-				introducerSession->Introduce (*introducer, router);
+				// introduce in introducer session's thread
+				auto intr = *introducer;
+				boost::asio::ip::udp::endpoint introducerEndpoint (intr.iHost, intr.iPort);
+				auto& shard = GetShard (introducerEndpoint);
+				shard.service.post ([this, &shard, introducerSession, introducerEndpoint, intr, router]()
+					{
+						auto session = introducerSession;
+						if (!session)
+						{
+							auto& sessions = introducerEndpoint.address ().is_v6 () ? shard.sessionsV6 : shard.sessions;
+							auto it = sessions.find (introducerEndpoint);
+							if (it != sessions.end ())
+								session = it->second;
+							else // create new
+							{
+								LogPrint (eLogDebug, "SSU: Creating new session to introducer ", intr.iHost);
+								session = std::make_shared<SSUSession> (*this, shard, introducerEndpoint, router);
+								AddSession (session);
+							}
+						}
+						session->Introduce (intr, router);
+					});
 			}
 			else
 				LogPrint (eLogWarning, "SSU: Can't connect to unreachable router and no introducers present");
@@ -601,30 +626,64 @@ namespace transport
 		{
 			session->Close ();
 			auto& ep = session->GetRemoteEndpoint ();
+			auto& shard = GetShard (ep);
+			std::unique_lock<std::mutex> l(shard.sessionsMutex);
 			if (ep.address ().is_v6 ())
-				m_SessionsV6.erase (ep);
+				shard.sessionsV6.erase (ep);
 			else
-				m_Sessions.erase (ep);
+				shard.sessions.erase (ep);
 		}
 	}
 
 	void SSUServer::DeleteAllSessions ()
 	{
-		for (auto& it: m_Sessions)
-			it.second->Close ();
-		m_Sessions.clear ();
+		for (auto& shard: m_Shards)
+		{
+			decltype(SSUShard::sessions) sessions, sessionsV6;
+			{
+				std::unique_lock<std::mutex> l(shard->sessionsMutex);
+				sessions.swap (shard->sessions);
+				sessionsV6.swap (shard->sessionsV6);
+			}
+			for (auto& it: sessions)
+				it.second->Close ();
+			for (auto& it: sessionsV6)
+				it.second->Close ();
+		}
+	}
 
-		for (auto& it: m_SessionsV6)
-			it.second->Close ();
-		m_SessionsV6.clear ();
+	decltype(SSUShard::sessions) SSUServer::GetSessions () const
+	{
+		decltype(SSUShard::sessions) sessions;
+		for (auto& shard: m_Shards)
+		{
+			std::unique_lock<std::mutex> l(shard->sessionsMutex);
+			sessions.insert (shard->sessions.begin (), shard->sessions.end ());
+		}
+		return sessions;
+	}
+
+	decltype(SSUShard::sessionsV6) SSUServer::GetSessionsV6 () const
+	{
+		decltype(SSUShard::sessionsV6) sessions;
+		for (auto& shard: m_Shards)
+		{
+			std::unique_lock<std::mutex> l(shard->sessionsMutex);
+			sessions.insert (shard->sessionsV6.begin (), shard->sessionsV6.end ());
+		}
+		return sessions;
 	}
 
 	template<typename Filter>
 	std::shared_ptr<SSUSession> SSUServer::GetRandomV4Session (Filter filter) // v4 only
 	{
 		std::vector<std::shared_ptr<SSUSession> > filteredSessions;
-		for (const auto& s :m_Sessions)
-			if (filter (s.second)) filteredSessions.push_back (s.second);
+		for (auto& shard: m_Shards)
+		{
+			std::unique_lock<std::mutex> l(shard->sessionsMutex);
+			for (const auto& s: shard->sessions)
+				if (filter (s.second)) filteredSessions.push_back (s.second);
+		}
 		if (filteredSessions.size () > 0)
 		{
 			auto ind = rand () % filteredSessions.size ();
@@ -647,8 +706,12 @@ namespace transport
 	std::shared_ptr<SSUSession> SSUServer::GetRandomV6Session (Filter filter) // v6 only
 	{
 		std::vector<std::shared_ptr<SSUSession> > filteredSessions;
-		for (const auto& s :m_SessionsV6)
-			if (filter (s.second)) filteredSessions.push_back (s.second);
+		for (auto& shard: m_Shards)
+		{
+			std::unique_lock<std::mutex> l(shard->sessionsMutex);
+			for (const auto& s: shard->sessionsV6)
+				if (filter (s.second)) filteredSessions.push_back (s.second);
+		}
 		if (filteredSessions.size () > 0)
 		{
 			auto ind = rand () % filteredSessions.size ();
@@ -672,14 +735,18 @@ namespace transport
 	{
 		uint32_t ts = i2p::util::GetSecondsSinceEpoch ();
 		std::list<std::shared_ptr<SSUSession> > ret;
-		const auto& sessions = v4 ? m_Sessions : m_SessionsV6;
-		for (const auto& s : sessions)
+		for (auto& shard: m_Shards)
 		{
-			if (s.second->GetRelayTag () && s.second->GetState () == eSessionStateEstablished &&
-			    ts < s.second->GetCreationTime () + SSU_TO_INTRODUCER_SESSION_EXPIRATION)
-				ret.push_back (s.second);
-			else if (s.second->GetRemoteIdentity ())
-				excluded.insert (s.second->GetRemoteIdentity ()->GetIdentHash ());
+			std::unique_lock<std::mutex> l(shard->sessionsMutex);
+			const auto& sessions = v4 ? shard->sessions : shard->sessionsV6;
+			for (const auto& s : sessions)
+			{
+				if (s.second->GetRelayTag () && s.second->GetState () == eSessionStateEstablished &&
+				    ts < s.second->GetCreationTime () + SSU_TO_INTRODUCER_SESSION_EXPIRATION)
+					ret.push_back (s.second);
+				else if (s.second->GetRemoteIdentity ())
+					excluded.insert (s.second->GetRemoteIdentity ()->GetIdentHash ());
+			}
 		}
 		if ((int)ret.size () > maxNumIntroducers)
 		{
@@ -779,7 +846,7 @@ namespace transport
 				if (session)
 				{
 					if (ts < session->GetCreationTime () + SSU_TO_INTRODUCER_SESSION_EXPIRATION)
-						session->SendKeepAlive ();
+						GetShard (it).service.post (std::bind (&SSUSession::SendKeepAlive, session));
 					if (ts < session->GetCreationTime () + SSU_TO_INTRODUCER_SESSION_DURATION)
 					{
 						newList.push_back (it);
@@ -923,65 +990,42 @@ namespace transport
 			if (numDeleted > 0)
 				LogPrint (eLogDebug, "SSU: ", numDeleted, " peer tests have been expired");
 			// some cleaups. TODO: use separate timer
-			m_FragmentsPool.CleanUp ();
-			m_IncompleteMessagesPool.CleanUp ();
-			m_SentMessagesPool.CleanUp ();
+			for (auto& it: m_Shards)
+			{
+				auto shard = it.get ();
+				shard->service.post ([shard]()
+					{
+						shard->fragmentsPool.CleanUp ();
+						shard->incompleteMessagesPool.CleanUp ();
+						shard->sentMessagesPool.CleanUp ();
+					});
+			}
 
 			SchedulePeerTestsCleanupTimer ();
 		}
 	}
 
-	void SSUServer::ScheduleTermination ()
-	{
-		uint64_t timeout = SSU_TERMINATION_CHECK_TIMEOUT + (rand () % SSU_TERMINATION_CHECK_TIMEOUT)/5;
-		m_TerminationTimer.expires_from_now (boost::posix_time::seconds(timeout));
-		m_TerminationTimer.async_wait (std::bind (&SSUServer::HandleTerminationTimer,
-			this, std::placeholders::_1));
-	}
-
-	void SSUServer::HandleTerminationTimer (const boost::system::error_code& ecode)
-	{
-		if (ecode != boost::asio::error::operation_aborted)
-		{
-			auto ts = i2p::util::GetSecondsSinceEpoch ();
-			for (auto& it: m_Sessions)
-				if (it.second->IsTerminationTimeoutExpired (ts))
-				{
-					auto session = it.second;
-					if (it.first != session->GetRemoteEndpoint ())
-						LogPrint (eLogWarning, "SSU: Remote endpoint ", session->GetRemoteEndpoint (), " doesn't match key ", it.first, " adjusted");
-					m_Service.post ([session]
-						{
-							LogPrint (eLogWarning, "SSU: No activity with ", session->GetRemoteEndpoint (), " for ", session->GetTerminationTimeout (), " seconds");
-							session->Failed ();
-						});
-				}
-				else
-					it.second->CleanUp (ts);
-			ScheduleTermination ();
-		}
-	}
-
-	void SSUServer::ScheduleTerminationV6 ()
+	void SSUServer::ScheduleTermination (SSUShard * shard, bool v4)
 	{
 		uint64_t timeout = SSU_TERMINATION_CHECK_TIMEOUT + (rand () % SSU_TERMINATION_CHECK_TIMEOUT)/5;
-		m_TerminationTimerV6.expires_from_now (boost::posix_time::seconds(timeout));
-		m_TerminationTimerV6.async_wait (std::bind (&SSUServer::HandleTerminationTimerV6,
-			this, std::placeholders::_1));
+		auto& timer = v4 ? shard->terminationTimer : shard->terminationTimerV6;
+		timer.expires_from_now (boost::posix_time::seconds(timeout));
+		timer.async_wait (std::bind (&SSUServer::HandleTerminationTimer,
+			this, std::placeholders::_1, shard, v4));
 	}
 
-	void SSUServer::HandleTerminationTimerV6 (const boost::system::error_code& ecode)
+	void SSUServer::HandleTerminationTimer (const boost::system::error_code& ecode, SSUShard * shard, bool v4)
 	{
 		if (ecode != boost::asio::error::operation_aborted)
 		{
 			auto ts = i2p::util::GetSecondsSinceEpoch ();
-			for (auto& it: m_SessionsV6)
+			for (auto& it: v4 ? shard->sessions : shard->sessionsV6)
 				if (it.second->IsTerminationTimeoutExpired (ts))
 				{
 					auto session = it.second;
 					if (it.first != session->GetRemoteEndpoint ())
 						LogPrint (eLogWarning, "SSU: Remote endpoint ", session->GetRemoteEndpoint (), " doesn't match key ", it.first);
-					m_Service.post ([session]
+					shard->service.post ([session]
 						{
 							LogPrint (eLogWarning, "SSU: No activity with ", session->GetRemoteEndpoint (), " for ", session->GetTerminationTimeout (), " seconds");
 							session->Failed ();
@@ -989,7 +1033,7 @@ namespace transport
 				}
 				else
 					it.second->CleanUp (ts);
-			ScheduleTerminationV6 ();
+			ScheduleTermination (shard, v4);
 		}
 	}
 }
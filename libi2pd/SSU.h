@@ -14,6 +14,8 @@
 #include <map>
 #include <list>
 #include <set>
+#include <vector>
+#include <memory>
 #include <thread>
 #include <mutex>
 #include <boost/asio.hpp>
@@ -24,6 +26,7 @@
 #include "RouterInfo.h"
 #include "I2NPProtocol.h"
 #include "SSUSession.h"
+#include "UDPBatch.h"
 
 namespace i2p
 {
@@ -37,6 +40,7 @@ namespace transport
 	const size_t SSU_MAX_NUM_INTRODUCERS = 3;
 	const size_t SSU_SOCKET_RECEIVE_BUFFER_SIZE = 0x1FFFF; // 128K
 	const size_t SSU_SOCKET_SEND_BUFFER_SIZE = 0x1FFFF; // 128K
+	const int SSU_MAX_NUM_THREADS = 16;
 
 	struct SSUPacket
 	{
@@ -45,8 +49,44 @@ namespace transport
 		size_t len;
 	};
 
+	/** sessions of remote endpoints with the same hash, handled by one thread.
+	 *  Shard 0 is handled by server's thread */
+	struct SSUShard
+	{
+		SSUShard (boost::asio::io_service * s, boost::asio::ip::udp::socket& sock, boost::asio::ip::udp::socket& sockV6): // own service if s is nullptr
+			ownService (s ? nullptr : new boost::asio::io_service ()), service (s ? *s : *ownService), thread (nullptr),
+			terminationTimer (service), terminationTimerV6 (service), socket (sock), socketV6 (sockV6),
+			sendBatch (sock), sendBatchV6 (sockV6) {};
+
+		std::unique_ptr<boost::asio::io_service> ownService;
+		boost::asio::io_service& service;
+		std::thread * thread; // nullptr for server's thread
+		std::mutex sessionsMutex; // shard's thread changes sessions under it and reads them without it
+		std::map<boost::asio::ip::udp::endpoint, std::shared_ptr<SSUSession> > sessions, sessionsV6;
+		boost::asio::deadline_timer terminationTimer, terminationTimerV6;
+		i2p::util::MemoryPool<Fragment> fragmentsPool;
+		i2p::util::MemoryPool<IncompleteMessage> incompleteMessagesPool;
+		i2p::util::MemoryPool<SentMessage> sentMessagesPool;
+		boost::asio::ip::udp::socket& socket, & socketV6; // to send from
+		UDPBatchSender sendBatch, sendBatchV6; // flushed after current handler
+	};
+
 	class SSUServer
 	{
+		/** socket bound to the same port with SO_REUSEPORT if more than one, and its own thread.
+		 *  Kernel keeps packets from the same peer on the same socket */
+		struct Receiver
+		{
+			Receiver (i2p::util::MemoryPoolMt<SSUPacket>& pool):
+				work (service), socket (service), batch (pool), thread (nullptr) {};
+
+			boost::asio::io_service service;
+			boost::asio::io_service::work work;
+			boost::asio::ip::udp::socket socket;
+			UDPBatchReceiver<SSUPacket> batch;
+			std::thread * thread;
+		};
+
 		public:
 
 			SSUServer (int port);
@@ -56,23 +96,22 @@ namespace transport
 			bool CreateSession (std::shared_ptr<const i2p::data::RouterInfo> router, bool peerTest = false, bool v4only = false);
 			bool CreateSession (std::shared_ptr<const i2p::data::RouterInfo> router,
 				std::shared_ptr<const i2p::data::RouterInfo::Address> address, bool peerTest = false);
-			void CreateDirectSession (std::shared_ptr<const i2p::data::RouterInfo> router, boost::asio::ip::udp::endpoint remoteEndpoint, bool peerTest);
-			std::shared_ptr<SSUSession> FindSession (const boost::asio::ip::udp::endpoint& e) const;
+			void CreateDirectSession (std::shared_ptr<const i2p::data::RouterInfo> router, boost::asio::ip::udp::endpoint remoteEndpoint, bool peerTest); // from any thread
+			std::shared_ptr<SSUSession> FindSession (const boost::asio::ip::udp::endpoint& e) const; // from any thread
 			std::shared_ptr<SSUSession> GetRandomEstablishedV4Session (std::shared_ptr<const SSUSession> excluded);
 			std::shared_ptr<SSUSession> GetRandomEstablishedV6Session (std::shared_ptr<const SSUSession> excluded);
-			void DeleteSession (std::shared_ptr<SSUSession> session);
+			void DeleteSession (std::shared_ptr<SSUSession> session); // from session's thread
 			void DeleteAllSessions ();
 
-			boost::asio::io_service& GetService () { return m_Service; };
-			i2p::util::MemoryPool<Fragment>& GetFragmentsPool () { return m_FragmentsPool; };
-			i2p::util::MemoryPool<IncompleteMessage>& GetIncompleteMessagesPool () { return m_IncompleteMessagesPool; };
-			i2p::util::MemoryPool<SentMessage>& GetSentMessagesPool () { return m_SentMessagesPool; };
+			boost::asio::io_service& GetService () { return m_Service; }; // relays, peer tests and introducers
 
 			uint16_t GetPort () const { return m_Endpoint.port (); };
 			bool IsSyncClockFromPeers () const { return m_IsSyncClockFromPeers; };
 			void SetLocalAddress (const boost::asio::ip::address& localAddress);
 
-			void Send (const uint8_t * buf, size_t len, const boost::asio::ip::udp::endpoint& to);
+			void Send (const uint8_t * buf, size_t len, const boost::asio::ip::udp::endpoint& to, SSUShard& shard); // from shard's thread
+
+			// server's thread only
 			void AddRelay (uint32_t tag, std::shared_ptr<SSUSession> relay);
 			void RemoveRelay (uint32_t tag);
 			std::shared_ptr<SSUSession> FindRelaySession (uint32_t tag);
@@ -87,17 +126,23 @@ namespace transport
 
 		private:
 
-			void OpenSocket ();
-			void OpenSocketV6 ();
+			void OpenSocket (Receiver& receiver);
+			void OpenSocketV6 (Receiver& receiver);
+			void SetReusePort (boost::asio::ip::udp::socket& socket);
 			void Run ();
-			void RunReceivers ();
-			void RunReceiversV6 ();
-			void Receive ();
-			void ReceiveV6 ();
-			void HandleReceivedFrom (const boost::system::error_code& ecode, std::size_t bytes_transferred, SSUPacket * packet);
-			void HandleReceivedFromV6 (const boost::system::error_code& ecode, std::size_t bytes_transferred, SSUPacket * packet);
-			void HandleReceivedPackets (std::vector<SSUPacket *> packets,
-				std::map<boost::asio::ip::udp::endpoint, std::shared_ptr<SSUSession> >* sessions);
+			void RunShard (SSUShard * shard);
+			void RunReceiver (Receiver * receiver, bool v4);
+			void Receive (Receiver * receiver, bool v4);
+			static bool IsIgnoredReceiveError (const boost::system::error_code& ecode);
+			void HandleReceivedFrom (const boost::system::error_code& ecode, std::size_t bytes_transferred,
+				SSUPacket * packet, Receiver * receiver, bool v4);
+			void HandleReceivedPackets (std::vector<SSUPacket *> packets, SSUShard * shard, bool v4);
+			void FlushSendBatch (UDPBatchSender& batch);
+
+			size_t GetShardIndex (const boost::asio::ip::udp::endpoint& ep) const;
+			SSUShard& GetShard (const boost::asio::ip::udp::endpoint& ep) const { return *m_Shards[GetShardIndex (ep)]; };
+			void AddSession (std::shared_ptr<SSUSession> session); // from shard's thread
+			void HandleCreateDirectSession (std::shared_ptr<const i2p::data::RouterInfo> router, boost::asio::ip::udp::endpoint remoteEndpoint, bool peerTest);
 
 			void CreateSessionThroughIntroducer (std::shared_ptr<const i2p::data::RouterInfo> router,
 				std::shared_ptr<const i2p::data::RouterInfo::Address> address, bool peerTest = false);
@@ -115,10 +160,8 @@ namespace transport
 			void HandlePeerTestsCleanupTimer (const boost::system::error_code& ecode);
 
 			// timer
-			void ScheduleTermination ();
-			void HandleTerminationTimer (const boost::system::error_code& ecode);
-			void ScheduleTerminationV6 ();
-			void HandleTerminationTimerV6 (const boost::system::error_code& ecode);
+			void ScheduleTermination (SSUShard * shard, bool v4);
+			void HandleTerminationTimer (const boost::system::error_code& ecode, SSUShard * shard, bool v4);
 
 		private:
 
@@ -130,28 +173,25 @@ namespace transport
 			};
 
 			volatile bool m_IsRunning;
-			std::thread * m_Thread, * m_ReceiversThread, * m_ReceiversThreadV6;
-			boost::asio::io_service m_Service, m_ReceiversService, m_ReceiversServiceV6;
-			boost::asio::io_service::work m_Work, m_ReceiversWork, m_ReceiversWorkV6;
+			std::thread * m_Thread;
+			boost::asio::io_service m_Service;
+			boost::asio::io_service::work m_Work;
 			boost::asio::ip::udp::endpoint m_Endpoint, m_EndpointV6;
-			boost::asio::ip::udp::socket m_Socket, m_SocketV6;
 			boost::asio::deadline_timer m_IntroducersUpdateTimer, m_IntroducersUpdateTimerV6,
-				m_PeerTestsCleanupTimer, m_TerminationTimer, m_TerminationTimerV6;
+				m_PeerTestsCleanupTimer;
 			bool m_IsSyncClockFromPeers;
 			std::list<boost::asio::ip::udp::endpoint> m_Introducers, m_IntroducersV6; // introducers we are connected to
-			std::map<boost::asio::ip::udp::endpoint, std::shared_ptr<SSUSession> > m_Sessions, m_SessionsV6;
 			std::map<uint32_t, std::shared_ptr<SSUSession> > m_Relays; // we are introducer
 			std::map<uint32_t, PeerTest> m_PeerTests; // nonce -> creation time in milliseconds
 
-			i2p::util::MemoryPool<Fragment> m_FragmentsPool;
-			i2p::util::MemoryPool<IncompleteMessage> m_IncompleteMessagesPool;
-			i2p::util::MemoryPool<SentMessage> m_SentMessagesPool;
 			i2p::util::MemoryPoolMt<SSUPacket> m_PacketsPool;
+			std::vector<std::unique_ptr<Receiver> > m_Receivers, m_ReceiversV6; // one per shard
+			std::vector<std::unique_ptr<SSUShard> > m_Shards; // by remote endpoint
 
 		public:
 			// for HTTP only
-			const decltype(m_Sessions)& GetSessions () const { return m_Sessions; };
-			const decltype(m_SessionsV6)& GetSessionsV6 () const { return m_SessionsV6; };
+			decltype(SSUShard::sessions) GetSessions () const;
+			decltype(SSUShard::sessionsV6) GetSessionsV6 () const;
 	};
 }
 }
@@ -7,10 +7,13 @@
 */
 
 #include <string.h>
+#include <cmath>
+#include <algorithm>
 #include <openssl/rand.h>
 #include "Log.h"
 #include "RouterContext.h"
 #include "Transports.h"
+#include "NetDb.hpp"
 #include "Config.h"
 #include "SSU2.h"
 
@@ -24,20 +27,47 @@ namespace transport
 		i2p::crypto::ChaCha20 ((uint8_t *)&data, 8, kh, nonce, (uint8_t *)&data);
 		return data;
 	}	
-	
+
+	static void CreateNonce (uint64_t seqn, uint8_t * nonce)
+	{
+		memset (nonce, 0, 4);
+		htole64buf (nonce + 4, seqn);
+	}
+
+	void SSU2IncompleteMessage::AttachNextFragment (const uint8_t * fragment, size_t fragmentSize, bool isLast)
+	{
+		if (msg->len + fragmentSize > msg->maxLen)
+		{
+			LogPrint (eLogInfo, "SSU2: I2NP message size ", msg->maxLen, " is not enough");
+			auto newMsg = NewI2NPMessage (msg->len + fragmentSize);
+			*newMsg = *msg;
+			msg = newMsg;
+		}
+		if (msg->Concat (fragment, fragmentSize) < fragmentSize)
+			LogPrint (eLogError, "SSU2: I2NP buffer overflow ", msg->maxLen);
+		nextFragmentNum++;
+		if (isLast) isComplete = true;
+	}
+
 	SSU2Session::SSU2Session (SSU2Server& server, std::shared_ptr<const i2p::data::RouterInfo> in_RemoteRouter,
 		std::shared_ptr<const i2p::data::RouterInfo::Address> addr, bool peerTest):
 		TransportSession (in_RemoteRouter, SSU2_CONNECT_TIMEOUT),
-		m_Server (server), m_Address (addr), m_DestConnID (0), m_SourceConnID (0)
+		m_Server (server), m_State (eSSU2SessionStateUnknown), m_Address (addr),
+		m_DestConnID (0), m_SourceConnID (0), m_MaxPayloadSize (SSU2_MAX_PACKET_SIZE_V6 - 32),
+		m_SendPacketNum (0), m_SendingOffset (0), m_SendingFragmentNum (0),
+		m_ReceivePacketNum (0), m_IsAckRequired (false),
+		m_RTT (-1), m_RTTVar (0), m_RTO (SSU2_INITIAL_RTO),
+		m_WindowSize (SSU2_MIN_WINDOW_SIZE), m_SlowStartThreshold (SSU2_MAX_WINDOW_SIZE), m_WindowIncrement (0),
+		m_RecoveryPacketNum (0)
 	{
 		m_NoiseState.reset (new i2p::crypto::NoiseSymmetricState);
 		if (in_RemoteRouter && m_Address)
 		{
 			// outgoing
 			InitNoiseXKState1 (*m_NoiseState, m_Address->s);
-			m_RemoteEndpoint = boost::asio::ip::udp::endpoint (m_Address->host, m_Address->port);
-			RAND_bytes ((uint8_t *)&m_DestConnID, 8);
-			RAND_bytes ((uint8_t *)&m_SourceConnID, 8); 
+			SetRemoteEndpoint (boost::asio::ip::udp::endpoint (m_Address->host, m_Address->port));
+			i2p::crypto::RandBytes ((uint8_t *)&m_DestConnID, 8);
+			i2p::crypto::RandBytes ((uint8_t *)&m_SourceConnID, 8);
 		}	
 		else
 		{
@@ -50,10 +80,303 @@ namespace transport
 	{	
 	}
 
+	void SSU2Session::SetRemoteEndpoint (const boost::asio::ip::udp::endpoint& ep)
+	{
+		m_RemoteEndpoint = ep;
+		m_MaxPayloadSize = (ep.address ().is_v6 () ? SSU2_MAX_PACKET_SIZE_V6 : SSU2_MAX_PACKET_SIZE_V4) - 32; // header and MAC
+	}
+
 	void SSU2Session::Connect ()
 	{
 		SendSessionRequest ();
 	}	
+
+	void SSU2Session::Terminate ()
+	{
+		if (m_State != eSSU2SessionStateTerminated)
+		{
+			m_State = eSSU2SessionStateTerminated;
+			transports.PeerDisconnected (shared_from_this ());
+			m_Server.RemoveSession (m_SourceConnID);
+			m_SendQueue.clear ();
+			m_SendingMessage = nullptr;
+			m_SentPackets.clear ();
+			m_SessionConfirmedPacket = nullptr;
+			m_IncompleteMessages.clear ();
+			m_ReceivedI2NPMsgIDs.clear ();
+			LogPrint (eLogDebug, "SSU2: Session terminated");
+		}
+	}
+
+	void SSU2Session::RequestTermination (SSU2TerminationReason reason)
+	{
+		if (m_State == eSSU2SessionStateEstablished)
+		{
+			uint8_t payload[32];
+			payload[0] = eSSU2BlkTermination;
+			htobe16buf (payload + 1, 9);
+			htobe64buf (payload + 3, m_ReceivePacketNum); // valid frames received
+			payload[11] = (uint8_t)reason;
+			size_t payloadSize = 12;
+			payloadSize += CreatePaddingBlock (payload + payloadSize, 32 - payloadSize);
+			SendData (payload, payloadSize);
+		}
+		Terminate ();
+	}
+
+	void SSU2Session::Done ()
+	{
+		m_Server.GetService ().post (std::bind (&SSU2Session::Terminate, shared_from_this ()));
+	}
+
+	void SSU2Session::Established ()
+	{
+		m_State = eSSU2SessionStateEstablished;
+		m_EphemeralKeys = nullptr;
+		m_NoiseState.reset (nullptr);
+		m_SessionConfirmedPacket = nullptr;
+		SetTerminationTimeout (SSU2_TERMINATION_TIMEOUT);
+		m_LastActivityTimestamp = i2p::util::GetSecondsSinceEpoch ();
+		transports.PeerConnected (shared_from_this ());
+	}
+
+	void SSU2Session::SendI2NPMessages (const std::vector<std::shared_ptr<I2NPMessage> >& msgs)
+	{
+		m_Server.GetService ().post (std::bind (&SSU2Session::PostI2NPMessages, shared_from_this (), msgs));
+	}
+
+	void SSU2Session::PostI2NPMessages (std::vector<std::shared_ptr<I2NPMessage> > msgs)
+	{
+		if (m_State == eSSU2SessionStateTerminated) return;
+		for (auto it: msgs)
+			if (it) m_SendQueue.push_back (it);
+		SendQueue ();
+		if (m_SendQueue.size () > SSU2_MAX_OUTGOING_QUEUE_SIZE)
+		{
+			LogPrint (eLogWarning, "SSU2: Outgoing messages queue size to ",
+				GetIdentHashBase64(), " exceeds ", SSU2_MAX_OUTGOING_QUEUE_SIZE);
+			RequestTermination (eSSU2TerminationReasonNormalClose);
+		}
+	}
+
+	bool SSU2Session::SendQueue ()
+	{
+		if (m_State != eSSU2SessionStateEstablished) return false;
+		bool isSent = false;
+		while ((m_SendingMessage || !m_SendQueue.empty ()) && m_SentPackets.size () < m_WindowSize)
+		{
+			auto packet = m_Server.GetSentPacketsPool ().AcquireSharedMt ();
+			size_t ackBlockSize = CreateAckBlock (packet->payload, m_MaxPayloadSize);
+			packet->payloadSize = ackBlockSize;
+			while (packet->payloadSize < m_MaxPayloadSize)
+			{
+				if (!m_SendingMessage)
+				{
+					if (m_SendQueue.empty ()) break;
+					m_SendingMessage = m_SendQueue.front ();
+					m_SendQueue.pop_front ();
+					m_SendingMessage->ToNTCP2 (); // same short header
+					m_SendingOffset = 0;
+					m_SendingFragmentNum = 0;
+				}
+				const uint8_t * msgBuf = m_SendingMessage->GetNTCP2Header ();
+				size_t msgLen = m_SendingMessage->GetNTCP2Length ();
+				uint8_t * buf = packet->payload + packet->payloadSize;
+				size_t remaining = m_MaxPayloadSize - packet->payloadSize;
+				if (!m_SendingFragmentNum)
+				{
+					if (msgLen + 3 <= remaining)
+					{
+						// whole message
+						buf[0] = eSSU2BlkI2NPMessage;
+						htobe16buf (buf + 1, msgLen);
+						memcpy (buf + 3, msgBuf, msgLen);
+						packet->payloadSize += msgLen + 3;
+						m_SendingMessage = nullptr;
+						continue;
+					}
+					if (packet->payloadSize > ackBlockSize && msgLen + 3 + ackBlockSize <= m_MaxPayloadSize)
+						break; // fits whole into next packet
+					if (remaining < SSU2_MIN_FIRST_FRAGMENT_SIZE + 3)
+						break;
+					size_t size = remaining - 3;
+					buf[0] = eSSU2BlkFirstFragment;
+					htobe16buf (buf + 1, size);
+					memcpy (buf + 3, msgBuf, size);
+					packet->payloadSize += size + 3;
+					m_SendingOffset = size;
+					m_SendingFragmentNum = 1;
+					break; // packet is full
+				}
+				else
+				{
+					if (remaining < 9) break;
+					size_t size = std::min (msgLen - m_SendingOffset, remaining - 8);
+					bool isLast = m_SendingOffset + size == msgLen;
+					buf[0] = eSSU2BlkFollowOnFragment;
+					htobe16buf (buf + 1, size + 5);
+					buf[3] = (m_SendingFragmentNum << 1) | (isLast ? 0x01 : 0);
+					memcpy (buf + 4, msgBuf + I2NP_HEADER_MSGID_OFFSET, 4); // msgID
+					memcpy (buf + 8, msgBuf + m_SendingOffset, size);
+					packet->payloadSize += size + 8;
+					if (isLast)
+						m_SendingMessage = nullptr;
+					else
+					{
+						m_SendingOffset += size;
+						m_SendingFragmentNum++;
+						break; // packet is full
+					}
+				}
+			}
+			if (packet->payloadSize == ackBlockSize) break; // nothing fits
+			packet->payloadSize += CreatePaddingBlock (packet->payload + packet->payloadSize, m_MaxPayloadSize - packet->payloadSize);
+			if (ackBlockSize) m_IsAckRequired = false;
+			auto packetNum = SendData (packet->payload, packet->payloadSize);
+			packet->sendTime = i2p::util::GetMillisecondsSinceEpoch ();
+			m_SentPackets.emplace (packetNum, packet);
+			isSent = true;
+		}
+		return isSent;
+	}
+
+	void SSU2Session::ScheduleAck ()
+	{
+		if (!m_IsAckRequired)
+		{
+			m_IsAckRequired = true;
+			// after current batch of received packets
+			m_Server.GetService ().post (std::bind (&SSU2Session::SendQuickAck, shared_from_this ()));
+		}
+	}
+
+	void SSU2Session::SendQuickAck ()
+	{
+		if (!m_IsAckRequired || m_State != eSSU2SessionStateEstablished) return;
+		SendQueue ();
+		if (!m_IsAckRequired) return; // sent with data
+		uint8_t payload[SSU2_MTU];
+		size_t payloadSize = CreateAckBlock (payload, m_MaxPayloadSize);
+		if (!payloadSize) return;
+		payloadSize += CreatePaddingBlock (payload + payloadSize, m_MaxPayloadSize - payloadSize);
+		SendData (payload, payloadSize);
+		m_IsAckRequired = false;
+	}
+
+	uint32_t SSU2Session::SendData (const uint8_t * buf, size_t len)
+	{
+		// len >= 8, every payload has at least one block with padding or ACK
+		Header header;
+		header.h.connID = m_DestConnID;
+		htobe32buf (header.h.packetNum, m_SendPacketNum);
+		header.h.type = eSSU2Data;
+		memset (header.h.flags, 0, 3);
+		uint8_t nonce[12];
+		CreateNonce (m_SendPacketNum, nonce);
+		uint8_t payload[SSU2_MTU];
+		i2p::crypto::AEADChaCha20Poly1305 (buf, len, header.buf, 16, m_KeyDataSend, nonce, payload, SSU2_MTU, true);
+		header.ll[0] ^= CreateHeaderMask (m_Address->i, payload + (len - 8));
+		header.ll[1] ^= CreateHeaderMask (m_KeyDataSend + 32, payload + (len + 4));
+		m_Server.Send (header.buf, 16, payload, len + 16, m_RemoteEndpoint);
+		m_NumSentBytes += len + 32;
+		i2p::transport::transports.UpdateSentBytes (len + 32);
+		return m_SendPacketNum++;
+	}
+
+	void SSU2Session::Resend (uint64_t ts)
+	{
+		if (m_SessionConfirmedPacket && ts >= m_SessionConfirmedPacket->sendTime + (m_RTO << m_SessionConfirmedPacket->numResends))
+		{
+			if (m_SessionConfirmedPacket->numResends >= SSU2_MAX_NUM_RESENDS)
+			{
+				LogPrint (eLogInfo, "SSU2: SessionConfirmed was not acknowledged after ", SSU2_MAX_NUM_RESENDS, " attempts");
+				m_Server.GetService ().post (std::bind (&SSU2Session::Terminate, shared_from_this ()));
+				return;
+			}
+			m_Server.Send (m_SessionConfirmedPacket->payload, 16, m_SessionConfirmedPacket->payload + 16,
+				m_SessionConfirmedPacket->payloadSize - 16, m_RemoteEndpoint);
+			m_SessionConfirmedPacket->sendTime = ts;
+			m_SessionConfirmedPacket->numResends++;
+		}
+		if (m_SentPackets.empty ()) return;
+		std::vector<std::shared_ptr<SSU2SentPacket> > resentPackets;
+		for (auto it = m_SentPackets.begin (); it != m_SentPackets.end ();)
+			if (ts >= it->second->sendTime + (m_RTO << it->second->numResends))
+			{
+				OnPacketLost (it->first, true);
+				resentPackets.push_back (it->second);
+				it = m_SentPackets.erase (it);
+			}
+			else
+				it++;
+		ResendPackets (resentPackets, ts);
+	}
+
+	void SSU2Session::ResendPackets (std::vector<std::shared_ptr<SSU2SentPacket> >& packets, uint64_t ts)
+	{
+		for (auto& it: packets)
+		{
+			if (it->numResends >= SSU2_MAX_NUM_RESENDS)
+			{
+				LogPrint (eLogInfo, "SSU2: Packet was not acknowledged after ", SSU2_MAX_NUM_RESENDS, " attempts, terminate session");
+				m_Server.GetService ().post (std::bind (&SSU2Session::Terminate, shared_from_this ()));
+				return;
+			}
+			// same blocks in new packet, packet numbers are never reused
+			it->numResends++;
+			it->sendTime = ts;
+			m_SentPackets.emplace (SendData (it->payload, it->payloadSize), it);
+		}
+	}
+
+	void SSU2Session::OnPacketLost (uint32_t packetNum, bool timeout)
+	{
+		if (packetNum < m_RecoveryPacketNum) return; // sent before last reduction
+		m_SlowStartThreshold = std::max (m_WindowSize/2, SSU2_MIN_WINDOW_SIZE);
+		m_WindowSize = timeout ? SSU2_MIN_WINDOW_SIZE : m_SlowStartThreshold;
+		m_WindowIncrement = 0;
+		m_RecoveryPacketNum = m_SendPacketNum;
+		LogPrint (eLogDebug, "SSU2: Packet ", packetNum, " lost", timeout ? " by timeout" : "", ", window ", m_WindowSize);
+	}
+
+	void SSU2Session::UpdateRTT (uint64_t rtt)
+	{
+		// RFC 6298
+		if (m_RTT < 0)
+		{
+			m_RTT = rtt;
+			m_RTTVar = rtt/2.0;
+		}
+		else
+		{
+			m_RTTVar = (1 - SSU2_RTTVAR_EWMA_BETA)*m_RTTVar + SSU2_RTTVAR_EWMA_BETA*std::fabs (m_RTT - rtt);
+			m_RTT = (1 - SSU2_RTT_EWMA_ALPHA)*m_RTT + SSU2_RTT_EWMA_ALPHA*rtt;
+		}
+		m_RTO = m_RTT + std::max ((double)SSU2_RESEND_CHECK_TIMEOUT, 4*m_RTTVar);
+		if (m_RTO < SSU2_MIN_RTO) m_RTO = SSU2_MIN_RTO;
+		if (m_RTO > SSU2_MAX_RTO) m_RTO = SSU2_MAX_RTO;
+	}
+
+	void SSU2Session::CleanUp (uint64_t ts)
+	{
+		for (auto it = m_IncompleteMessages.begin (); it != m_IncompleteMessages.end ();)
+		{
+			if (ts > it->second->lastFragmentInsertTime + SSU2_INCOMPLETE_MESSAGES_CLEANUP_TIMEOUT)
+			{
+				LogPrint (eLogWarning, "SSU2: message ", it->first, " was not completed in ", SSU2_INCOMPLETE_MESSAGES_CLEANUP_TIMEOUT, " seconds, deleted");
+				it = m_IncompleteMessages.erase (it);
+			}
+			else
+				it++;
+		}
+		for (auto it = m_ReceivedI2NPMsgIDs.begin (); it != m_ReceivedI2NPMsgIDs.end ();)
+		{
+			if (ts > it->second + SSU2_RECEIVED_I2NP_MSGIDS_CLEANUP_TIMEOUT)
+				it = m_ReceivedI2NPMsgIDs.erase (it);
+			else
+				it++;
+		}
+	}
 		
 	void SSU2Session::SendSessionRequest (uint64_t token)
 	{
@@ -77,7 +400,7 @@ namespace transport
 		htobe16buf (payload + 1, 4);
 		htobe32buf (payload + 3, i2p::util::GetSecondsSinceEpoch ());
 		size_t payloadSize = 7;
-		uint8_t paddingSize = (rand () & 0x0F) + 1; // 1 - 16
+		uint8_t paddingSize = (i2p::crypto::RandUInt32 () & 0x0F) + 1; // 1 - 16
 		payload[payloadSize] = eSSU2BlkPadding;
 		htobe16buf (payload + payloadSize + 1, paddingSize);
 		payloadSize += paddingSize + 3;
@@ -98,6 +421,7 @@ namespace transport
 		// send
 		m_Server.AddPendingOutgoingSession (m_RemoteEndpoint, shared_from_this ());
 		m_Server.Send (header.buf, 16, headerX, 48, payload, payloadSize, m_RemoteEndpoint);
+		m_State = eSSU2SessionStateSessionRequestSent;
 	}	
 
 	void SSU2Session::ProcessSessionRequest (uint64_t connID, uint8_t * buf, size_t len)
@@ -155,15 +479,15 @@ namespace transport
 		header.h.flags[1] = (uint8_t)i2p::context.GetNetID (); // netID 
 		header.h.flags[2] = 0; // flag
 		memcpy (headerX, &m_SourceConnID, 8); // source id
-		RAND_bytes (headerX + 8, 8); // token
+		i2p::crypto::RandBytes (headerX + 8, 8); // token
 		memcpy (headerX + 16, m_EphemeralKeys->GetPublicKey (), 32); // Y
 		// payload
 		payload[0] = eSSU2BlkDateTime;
 		htobe16buf (payload + 1, 4);
 		htobe32buf (payload + 3, i2p::util::GetSecondsSinceEpoch ());
 		size_t payloadSize = 7;
-		payloadSize += CreateAddressBlock (m_RemoteEndpoint, payload, 57);
-		uint8_t paddingSize = rand () & 0x0F; // 0 - 15
+		payloadSize += CreateAddressBlock (m_RemoteEndpoint, payload + payloadSize, 64 - payloadSize);
+		uint8_t paddingSize = i2p::crypto::RandUInt32 () & 0x0F; // 0 - 15
 		if (paddingSize)
 		{	
 			payload[payloadSize] = eSSU2BlkPadding;
@@ -171,6 +495,8 @@ namespace transport
 			payloadSize += paddingSize + 3;
 		}	
 		// KDF for SessionCreated
+		uint8_t kh2[32];
+		i2p::crypto::HKDF (m_NoiseState->m_CK, nullptr, 0, "SessCreateHeader", kh2, 32); // k_header_2 = HKDF(chainKey, ZEROLEN, "SessCreateHeader", 32)
 		m_NoiseState->MixHash ( { {header.buf, 16}, {headerX, 16} } ); // h = SHA256(h || header) 
 		m_NoiseState->MixHash (headerX + 16, 32); // h = SHA256(h || bepk);
 		uint8_t sharedSecret[32];
@@ -181,12 +507,12 @@ namespace transport
 		i2p::crypto::AEADChaCha20Poly1305 (payload, payloadSize, m_NoiseState->m_H, 32, m_NoiseState->m_CK + 32, nonce, payload, payloadSize + 16, true);
 		payloadSize += 16;
 		header.ll[0] ^= CreateHeaderMask (i2p::context.GetSSU2IntroKey (), payload + (payloadSize - 24));
-		uint8_t kh2[32];
-		i2p::crypto::HKDF (m_NoiseState->m_CK, nullptr, 0, "SessCreateHeader", kh2, 32); // k_header_2 = HKDF(chainKey, ZEROLEN, "SessCreateHeader", 32)
 		header.ll[1] ^= CreateHeaderMask (kh2, payload + (payloadSize - 12));
 		i2p::crypto::ChaCha20 (headerX, 48, kh2, nonce, headerX);
+		m_NoiseState->MixHash (payload, payloadSize); // h = SHA256(h || encrypted payload from SessionCreated) for SessionConfirmed
 		// send
 		m_Server.Send (header.buf, 16, headerX, 48, payload, payloadSize, m_RemoteEndpoint);
+		m_State = eSSU2SessionStateSessionCreatedSent;
 	}	
 		
 	bool SSU2Session::ProcessSessionCreated (uint8_t * buf, size_t len)
@@ -214,19 +540,254 @@ namespace transport
 		m_NoiseState->MixKey (sharedSecret);
 		// decrypt
 		uint8_t * payload = buf + 64;
-		if (!i2p::crypto::AEADChaCha20Poly1305 (payload, len - 80, m_NoiseState->m_H, 32, m_NoiseState->m_CK + 32, nonce, payload, len - 80, false))
+		std::vector<uint8_t> decryptedPayload(len - 80);
+		if (!i2p::crypto::AEADChaCha20Poly1305 (payload, len - 80, m_NoiseState->m_H, 32, m_NoiseState->m_CK + 32, nonce,
+			decryptedPayload.data (), decryptedPayload.size (), false))
 		{
 			LogPrint (eLogWarning, "SSU2: SessionCreated AEAD verification failed ");
 			return false;
 		}	
+		m_NoiseState->MixHash (payload, len - 64); // h = SHA256(h || encrypted payload from SessionCreated) for SessionConfirmed
 		// payload
-		HandlePayload (payload, len - 80);
+		HandlePayload (decryptedPayload.data (), decryptedPayload.size ());
 		
 		m_Server.AddSession (m_SourceConnID, shared_from_this ());
+		SendSessionConfirmed (headerX + 16);
 		
 		return true;
 	}	
 
+	void SSU2Session::SendSessionConfirmed (const uint8_t * Y)
+	{
+		// we are Alice
+		uint8_t kh2[32];
+		i2p::crypto::HKDF (m_NoiseState->m_CK, nullptr, 0, "SessionConfirmed", kh2, 32); // k_header_2 = HKDF(chainKey, ZEROLEN, "SessionConfirmed", 32)
+		// fill packet
+		Header header;
+		header.h.connID = m_DestConnID; // dest id
+		memset (header.h.packetNum, 0, 4); // always zero
+		header.h.type = eSSU2SessionConfirmed;
+		memset (header.h.flags, 0, 3);
+		header.h.flags[0] = 1; // frag, total fragments always 1
+		// payload
+		uint8_t payload[SSU2_MTU];
+		size_t maxPayloadSize = m_MaxPayloadSize - 48; // part 1
+		size_t payloadSize = CreateRouterInfoBlock (payload, maxPayloadSize);
+		if (!payloadSize)
+		{
+			LogPrint (eLogError, "SSU2: RouterInfo is too long for SessionConfirmed");
+			return;
+		}
+		payloadSize += CreatePaddingBlock (payload + payloadSize, maxPayloadSize - payloadSize);
+		// KDF for SessionConfirmed part 1
+		m_NoiseState->MixHash (header.buf, 16); // h = SHA256(h || header)
+		// encrypt part 1
+		uint8_t part1[48], nonce[12];
+		CreateNonce (1, nonce);
+		i2p::crypto::AEADChaCha20Poly1305 (i2p::context.GetSSU2StaticPublicKey (), 32, m_NoiseState->m_H, 32, m_NoiseState->m_CK + 32, nonce, part1, 48, true);
+		m_NoiseState->MixHash (part1, 48); // h = SHA256(h || ciphertext)
+		// KDF for SessionConfirmed part 2
+		uint8_t sharedSecret[32];
+		i2p::context.GetSSU2StaticKeys ().Agree (Y, sharedSecret);
+		m_NoiseState->MixKey (sharedSecret);
+		// encrypt part 2
+		memset (nonce, 0, 12);
+		i2p::crypto::AEADChaCha20Poly1305 (payload, payloadSize, m_NoiseState->m_H, 32, m_NoiseState->m_CK + 32, nonce, payload, payloadSize + 16, true);
+		payloadSize += 16;
+		m_NoiseState->MixHash (payload, payloadSize); // h = SHA256(h || ciphertext)
+		header.ll[0] ^= CreateHeaderMask (m_Address->i, payload + (payloadSize - 24));
+		header.ll[1] ^= CreateHeaderMask (kh2, payload + (payloadSize - 12));
+		// keep whole packet until Bob replies
+		m_SessionConfirmedPacket = m_Server.GetSentPacketsPool ().AcquireSharedMt ();
+		memcpy (m_SessionConfirmedPacket->payload, header.buf, 16);
+		memcpy (m_SessionConfirmedPacket->payload + 16, part1, 48);
+		memcpy (m_SessionConfirmedPacket->payload + 64, payload, payloadSize);
+		m_SessionConfirmedPacket->payloadSize = payloadSize + 64;
+		m_SessionConfirmedPacket->sendTime = i2p::util::GetMillisecondsSinceEpoch ();
+		// send
+		m_Server.Send (header.buf, 16, part1, 48, payload, payloadSize, m_RemoteEndpoint);
+		m_State = eSSU2SessionStateSessionConfirmedSent;
+		m_SendPacketNum = 1; // SessionConfirmed is 0
+		KDFDataPhase (m_KeyDataSend, m_KeyDataReceive);
+	}
+
+	bool SSU2Session::ProcessSessionConfirmed (uint8_t * buf, size_t len)
+	{
+		// we are Bob
+		Header header;
+		memcpy (header.buf, buf, 16);
+		header.ll[0] ^= CreateHeaderMask (i2p::context.GetSSU2IntroKey (), buf + (len - 24));
+		uint8_t kh2[32];
+		i2p::crypto::HKDF (m_NoiseState->m_CK, nullptr, 0, "SessionConfirmed", kh2, 32); // k_header_2 = HKDF(chainKey, ZEROLEN, "SessionConfirmed", 32)
+		header.ll[1] ^= CreateHeaderMask (kh2, buf + (len - 12));
+		if (header.h.type != eSSU2SessionConfirmed)
+		{
+			LogPrint (eLogWarning, "SSU2: Unexpected message type  ", (int)header.h.type);
+			return false;
+		}
+		if (len < 88) // header, part 1, at least one block and MAC
+		{
+			LogPrint (eLogWarning, "SSU2: SessionConfirmed is too short ", len);
+			return false;
+		}
+		// KDF for SessionConfirmed part 1
+		// forged or corrupted packet must not change the state, Alice resends SessionConfirmed
+		i2p::crypto::NoiseSymmetricState noiseState (*m_NoiseState);
+		noiseState.MixHash (header.buf, 16); // h = SHA256(h || header)
+		// decrypt part 1
+		uint8_t S[32], nonce[12];
+		CreateNonce (1, nonce);
+		if (!i2p::crypto::AEADChaCha20Poly1305 (buf + 16, 32, noiseState.m_H, 32, noiseState.m_CK + 32, nonce, S, 32, false))
+		{
+			LogPrint (eLogWarning, "SSU2: SessionConfirmed part 1 AEAD verification failed ");
+			return false;
+		}
+		noiseState.MixHash (buf + 16, 48); // h = SHA256(h || ciphertext)
+		// KDF for SessionConfirmed part 2
+		uint8_t sharedSecret[32];
+		m_EphemeralKeys->Agree (S, sharedSecret);
+		noiseState.MixKey (sharedSecret);
+		// decrypt part 2
+		memset (nonce, 0, 12);
+		uint8_t * payload = buf + 64;
+		std::vector<uint8_t> decryptedPayload(len - 80);
+		if (!i2p::crypto::AEADChaCha20Poly1305 (payload, len - 80, noiseState.m_H, 32, noiseState.m_CK + 32, nonce,
+			decryptedPayload.data (), decryptedPayload.size (), false))
+		{
+			LogPrint (eLogWarning, "SSU2: SessionConfirmed part 2 AEAD verification failed ");
+			return false;
+		}
+		noiseState.MixHash (payload, len - 64); // h = SHA256(h || ciphertext)
+		*m_NoiseState = noiseState;
+		// RouterInfo block must be first
+		if (decryptedPayload[0] != eSSU2BlkRouterInfo)
+		{
+			LogPrint (eLogWarning, "SSU2: Unexpected block ", (int)decryptedPayload[0], " in SessionConfirmed");
+			return false;
+		}
+		size_t size = bufbe16toh (decryptedPayload.data () + 1);
+		if (size + 3 > decryptedPayload.size () || !HandleRouterInfoBlock (decryptedPayload.data () + 3, size, S))
+			return false;
+		KDFDataPhase (m_KeyDataReceive, m_KeyDataSend);
+		HandlePayload (decryptedPayload.data () + size + 3, decryptedPayload.size () - size - 3);
+		m_ReceivePacketNum = 1; // SessionConfirmed is 0
+		Established ();
+		ScheduleAck (); // Alice resends SessionConfirmed until she gets it
+		return true;
+	}
+
+	void SSU2Session::KDFDataPhase (uint8_t * keydata_ab, uint8_t * keydata_ba)
+	{
+		uint8_t keydata[64];
+		i2p::crypto::HKDF (m_NoiseState->m_CK, nullptr, 0, "", keydata); // keydata = HKDF(chainKey, ZEROLEN, "", 64)
+		// ab
+		i2p::crypto::HKDF (keydata, nullptr, 0, "HKDFSSU2DataKeys", keydata_ab); // keydata_ab = HKDF(keydata, ZEROLEN, "HKDFSSU2DataKeys", 64)
+		// ba
+		i2p::crypto::HKDF (keydata + 32, nullptr, 0, "HKDFSSU2DataKeys", keydata_ba); // keydata_ba = HKDF(keydata + 32, ZEROLEN, "HKDFSSU2DataKeys", 64)
+	}
+
+	bool SSU2Session::HandleRouterInfoBlock (const uint8_t * buf, size_t size, const uint8_t * staticKey)
+	{
+		// flag, frag, RouterInfo
+		if (size < 2 || buf[1] != 1 || (buf[0] & SSU2_ROUTER_INFO_FLAG_GZIP))
+		{
+			LogPrint (eLogWarning, "SSU2: Fragmented or compressed RouterInfo is not supported");
+			return false;
+		}
+		if (staticKey)
+		{
+			// from SessionConfirmed
+			i2p::data::RouterInfo ri (buf + 2, size - 2);
+			if (ri.IsUnreachable ())
+			{
+				LogPrint (eLogError, "SSU2: Signature verification failed in SessionConfirmed");
+				return false;
+			}
+			if (i2p::util::GetMillisecondsSinceEpoch () > ri.GetTimestamp () + i2p::data::NETDB_MIN_EXPIRATION_TIMEOUT*1000LL) // 90 minutes
+			{
+				LogPrint (eLogError, "SSU2: RouterInfo is too old in SessionConfirmed");
+				return false;
+			}
+			auto addr = ri.GetSSU2AddressWithStaticKey (staticKey);
+			if (!addr)
+			{
+				LogPrint (eLogError, "SSU2: No SSU2 address with static key found in SessionConfirmed");
+				return false;
+			}
+			m_Address = addr;
+			auto existing = i2p::data::netdb.FindRouter (ri.GetRouterIdentity ()->GetIdentHash ()); // check if exists already
+			SetRemoteIdentity (existing ? existing->GetRouterIdentity () : ri.GetRouterIdentity ());
+		}
+		// flag + RouterInfo as from NTCP2
+		auto msg = CreateI2NPMessage (eI2NPDummyMsg, buf + 1, size - 1);
+		msg->GetPayload ()[0] = buf[0] & SSU2_ROUTER_INFO_FLAG_REQUEST_FLOOD;
+		i2p::data::netdb.PostI2NPMsg (msg); // TODO: should insert ri and not parse it twice
+		return true;
+	}
+
+	void SSU2Session::ProcessData (uint8_t * buf, size_t len)
+	{
+		Header header;
+		header.ll[0] = m_SourceConnID;
+		memcpy (header.buf + 8, buf + 8, 8);
+		header.ll[1] ^= CreateHeaderMask (m_KeyDataReceive + 32, buf + (len - 12));
+		uint32_t packetNum = bufbe32toh (header.h.packetNum);
+		uint8_t payload[SSU2_MTU], nonce[12];
+		CreateNonce (packetNum, nonce);
+		size_t payloadSize = len - 32;
+		if (header.h.type != eSSU2Data ||
+			!i2p::crypto::AEADChaCha20Poly1305 (buf + 16, payloadSize, header.buf, 16, m_KeyDataReceive, nonce, payload, payloadSize, false))
+		{
+			if (!IsOutgoing () && m_ReceivePacketNum == 1 && m_OutOfSequencePackets.empty ())
+			{
+				// most likely SessionConfirmed again, our ACK was lost
+				m_IsAckRequired = false;
+				ScheduleAck ();
+			}
+			else
+				LogPrint (eLogWarning, "SSU2: Data AEAD verification failed ");
+			return;
+		}
+		m_LastActivityTimestamp = i2p::util::GetSecondsSinceEpoch ();
+		m_NumReceivedBytes += len;
+		i2p::transport::transports.UpdateReceivedBytes (len);
+		if (m_State == eSSU2SessionStateSessionConfirmedSent)
+			Established (); // Bob got SessionConfirmed
+		if (!UpdateReceivePacketNum (packetNum))
+		{
+			// duplicate, ACK might be lost
+			ScheduleAck ();
+			return;
+		}
+		if (HandlePayload (payload, payloadSize))
+			ScheduleAck ();
+		m_Handler.Flush ();
+	}
+
+	bool SSU2Session::UpdateReceivePacketNum (uint32_t packetNum)
+	{
+		if (packetNum < m_ReceivePacketNum) return false;
+		if (packetNum == m_ReceivePacketNum)
+		{
+			m_ReceivePacketNum++;
+			for (auto it = m_OutOfSequencePackets.begin (); it != m_OutOfSequencePackets.end () && *it == m_ReceivePacketNum;)
+			{
+				m_ReceivePacketNum++;
+				it = m_OutOfSequencePackets.erase (it);
+			}
+			return true;
+		}
+		if (!m_OutOfSequencePackets.insert (packetNum).second) return false;
+		if (packetNum - m_ReceivePacketNum > SSU2_MAX_NUM_ACK_PACKETS)
+		{
+			// packets of old gap were resent with other numbers, don't wait for them
+			m_ReceivePacketNum = *m_OutOfSequencePackets.begin ();
+			m_OutOfSequencePackets.erase (m_OutOfSequencePackets.begin ());
+			UpdateReceivePacketNum (m_ReceivePacketNum);
+		}
+		return true;
+	}
+
 	bool SSU2Session::ProcessRetry (uint8_t * buf, size_t len)
 	{
 		// we are Alice
@@ -248,8 +809,9 @@ namespace transport
 		return true;
 	}	
 		
-	void SSU2Session::HandlePayload (const uint8_t * buf, size_t len)
+	bool SSU2Session::HandlePayload (const uint8_t * buf, size_t len)
 	{
+		bool isAckRequired = false;
 		size_t offset = 0;
 		while (offset < len)
 		{
@@ -258,7 +820,7 @@ namespace transport
 			auto size = bufbe16toh (buf + offset);
 			offset += 2;
 			LogPrint (eLogDebug, "SSU2: Block type ", (int)blk, " of size ", size);
-			if (size > len)
+			if (offset + size > len)
 			{
 				LogPrint (eLogError, "SSU2: Unexpected block length ", size);
 				break;
@@ -272,14 +834,54 @@ namespace transport
 					LogPrint (eLogDebug, "SSU2: Options");
 				break;
 				case eSSU2BlkRouterInfo:
+					LogPrint (eLogDebug, "SSU2: RouterInfo");
+					HandleRouterInfoBlock (buf + offset, size, nullptr);
+					isAckRequired = true;
 				break;	
 				case eSSU2BlkI2NPMessage:
-				break;	
+				{
+					LogPrint (eLogDebug, "SSU2: I2NP message");
+					isAckRequired = true;
+					if (size < I2NP_NTCP2_HEADER_SIZE || size > I2NP_MAX_MESSAGE_SIZE)
+					{
+						LogPrint (eLogError, "SSU2: Unexpected I2NP block size ", size);
+						break;
+					}
+					uint32_t msgID = bufbe32toh (buf + offset + I2NP_HEADER_MSGID_OFFSET);
+					if (!IsNewI2NPMsgID (msgID)) break; // resent
+					auto nextMsg = (buf[offset] == eI2NPTunnelData) ? NewI2NPTunnelMessage (true) : NewI2NPMessage (size);
+					nextMsg->len = nextMsg->offset + size + 7; // 7 more bytes for full I2NP header
+					if (nextMsg->len <= nextMsg->maxLen)
+					{
+						memcpy (nextMsg->GetNTCP2Header (), buf + offset, size);
+						nextMsg->FromNTCP2 ();
+						m_ReceivedI2NPMsgIDs.emplace (msgID, m_LastActivityTimestamp);
+						m_Handler.PutNextMessage (std::move (nextMsg));
+					}
+					else
+						LogPrint (eLogError, "SSU2: I2NP block is too long for I2NP message");
+					break;
+				}
 				case eSSU2BlkFirstFragment:
+					HandleFirstFragment (buf + offset, size);
+					isAckRequired = true;
 				break;	
 				case eSSU2BlkFollowOnFragment:
+					HandleFollowOnFragment (buf + offset, size);
+					isAckRequired = true;
 				break;	
 				case eSSU2BlkTermination:
+					if (size >= 9)
+					{
+						LogPrint (eLogDebug, "SSU2: Termination reason=", (int)buf[offset + 8]);
+						if (buf[offset + 8] != eSSU2TerminationReasonTerminationReceived)
+							RequestTermination (eSSU2TerminationReasonTerminationReceived);
+						else
+							Terminate ();
+						return false;
+					}
+					else
+						LogPrint (eLogWarning, "SSU2: Unexpected termination block size ", size);
 				break;	
 				case eSSU2BlkRelayRequest:
 				break;	
@@ -292,6 +894,7 @@ namespace transport
 				case eSSU2BlkNextNonce:
 				break;	
 				case eSSU2BlkAck:
+					HandleAck (buf + offset, size);
 				break;	
 				case eSSU2BlkAddress:
 				{
@@ -322,8 +925,126 @@ namespace transport
 			}	
 			offset += size;
 		}	
+		return isAckRequired;
 	}	
 
+	void SSU2Session::HandleAck (const uint8_t * buf, size_t len)
+	{
+		if (len < 5) return;
+		// ack through, ack count, NACK and ACK ranges below
+		uint32_t ackThrough = bufbe32toh (buf);
+		uint32_t firstPacketNum = ackThrough > buf[4] ? ackThrough - buf[4] : 0;
+		if (m_SentPackets.empty () || ackThrough >= m_SendPacketNum) return;
+		uint64_t ts = i2p::util::GetMillisecondsSinceEpoch (), rttSampleTime = 0;
+		size_t numSentPackets = m_SentPackets.size ();
+		HandleAckRange (firstPacketNum, ackThrough, ts, rttSampleTime);
+		size_t offset = 5;
+		while (offset + 1 < len && firstPacketNum)
+		{
+			uint32_t numNacks = buf[offset], numAcks = buf[offset + 1];
+			offset += 2;
+			if (numNacks + numAcks > firstPacketNum) break;
+			firstPacketNum -= numNacks + numAcks;
+			if (numAcks)
+				HandleAckRange (firstPacketNum, firstPacketNum + numAcks - 1, ts, rttSampleTime);
+		}
+		if (rttSampleTime) UpdateRTT (ts - rttSampleTime);
+		// packets with later ones acknowledged are lost
+		std::vector<std::shared_ptr<SSU2SentPacket> > lostPackets;
+		for (auto it = m_SentPackets.begin (); it != m_SentPackets.end () && it->first + SSU2_FAST_RETRANSMIT_THRESHOLD <= ackThrough;)
+		{
+			OnPacketLost (it->first, false);
+			lostPackets.push_back (it->second);
+			it = m_SentPackets.erase (it);
+		}
+		ResendPackets (lostPackets, ts);
+		if (m_SentPackets.size () < numSentPackets)
+			SendQueue (); // window is open
+	}
+
+	void SSU2Session::HandleAckRange (uint32_t firstPacketNum, uint32_t lastPacketNum, uint64_t ts, uint64_t& rttSampleTime)
+	{
+		auto it = m_SentPackets.lower_bound (firstPacketNum);
+		while (it != m_SentPackets.end () && it->first <= lastPacketNum)
+		{
+			// numbers are never reused, every sample is unambiguous
+			if (it->second->sendTime > rttSampleTime) rttSampleTime = it->second->sendTime;
+			// slow start or congestion avoidance
+			if (m_WindowSize < m_SlowStartThreshold)
+				m_WindowSize++;
+			else if (++m_WindowIncrement >= m_WindowSize)
+			{
+				m_WindowSize++;
+				m_WindowIncrement = 0;
+			}
+			if (m_WindowSize > SSU2_MAX_WINDOW_SIZE) m_WindowSize = SSU2_MAX_WINDOW_SIZE;
+			it = m_SentPackets.erase (it);
+		}
+	}
+
+	void SSU2Session::HandleFirstFragment (const uint8_t * buf, size_t len)
+	{
+		if (len < I2NP_NTCP2_HEADER_SIZE) return;
+		uint32_t msgID = bufbe32toh (buf + I2NP_HEADER_MSGID_OFFSET);
+		if (!IsNewI2NPMsgID (msgID)) return; // resent
+		auto& m = m_IncompleteMessages[msgID];
+		if (!m) m = std::make_shared<SSU2IncompleteMessage> ();
+		else if (m->msg) return; // duplicate
+		auto msg = NewI2NPShortMessage ();
+		msg->len = msg->offset + len + 7; // 7 more bytes for full I2NP header
+		if (msg->len > msg->maxLen)
+		{
+			LogPrint (eLogError, "SSU2: First fragment is too long ", len);
+			m_IncompleteMessages.erase (msgID);
+			return;
+		}
+		memcpy (msg->GetNTCP2Header (), buf, len);
+		m->msg = msg;
+		m->nextFragmentNum = 1;
+		m->lastFragmentInsertTime = m_LastActivityTimestamp;
+		ProcessIncompleteMessage (msgID, m);
+	}
+
+	void SSU2Session::HandleFollowOnFragment (const uint8_t * buf, size_t len)
+	{
+		if (len < 5) return;
+		int fragmentNum = buf[0] >> 1;
+		bool isLast = buf[0] & 0x01;
+		uint32_t msgID = bufbe32toh (buf + 1);
+		if (!fragmentNum || !IsNewI2NPMsgID (msgID)) return;
+		auto& m = m_IncompleteMessages[msgID];
+		if (!m) m = std::make_shared<SSU2IncompleteMessage> (); // first fragment is not received yet
+		if (fragmentNum < m->nextFragmentNum) return; // duplicate
+		m->lastFragmentInsertTime = m_LastActivityTimestamp;
+		m->outOfSequenceFragments.emplace (fragmentNum,
+			SSU2IncompleteMessage::Fragment{ std::vector<uint8_t>(buf + 5, buf + len), isLast });
+		ProcessIncompleteMessage (msgID, m);
+	}
+
+	void SSU2Session::ProcessIncompleteMessage (uint32_t msgID, std::shared_ptr<SSU2IncompleteMessage> m)
+	{
+		if (!m->msg) return;
+		while (!m->isComplete && !m->outOfSequenceFragments.empty () &&
+			m->outOfSequenceFragments.begin ()->first == m->nextFragmentNum)
+		{
+			const auto& fragment = m->outOfSequenceFragments.begin ()->second;
+			m->AttachNextFragment (fragment.buf.data (), fragment.buf.size (), fragment.isLast);
+			m->outOfSequenceFragments.erase (m->outOfSequenceFragments.begin ());
+		}
+		if (m->isComplete)
+		{
+			m->msg->FromNTCP2 ();
+			m_ReceivedI2NPMsgIDs.emplace (msgID, m_LastActivityTimestamp);
+			m_Handler.PutNextMessage (std::move (m->msg));
+			m_IncompleteMessages.erase (msgID);
+		}
+	}
+
+	bool SSU2Session::IsNewI2NPMsgID (uint32_t msgID) const
+	{
+		return !m_ReceivedI2NPMsgIDs.count (msgID);
+	}
+
 	bool SSU2Session::ExtractEndpoint (const uint8_t * buf, size_t size, boost::asio::ip::udp::endpoint& ep)
 	{
 		if (size < 2) return false;
@@ -373,10 +1094,79 @@ namespace transport
 		htobe16buf (buf + 1, size);
 		return size + 3;	
 	}	
+
+	size_t SSU2Session::CreateRouterInfoBlock (uint8_t * buf, size_t len)
+	{
+		auto& ri = i2p::context.GetRouterInfo ();
+		size_t riLen = ri.GetBufferLen ();
+		if (riLen + 5 > len) return 0;
+		buf[0] = eSSU2BlkRouterInfo;
+		htobe16buf (buf + 1, riLen + 2); // flag + frag + RI
+		buf[3] = 0; // flag
+		buf[4] = 1; // frag, total fragments always 1
+		memcpy (buf + 5, ri.GetBuffer (), riLen); // TODO: own RI should be protected by mutex
+		return riLen + 5;
+	}
+
+	size_t SSU2Session::CreateAckBlock (uint8_t * buf, size_t len)
+	{
+		if (len < 8 || (!m_ReceivePacketNum && m_OutOfSequencePackets.empty ())) return 0;
+		// received runs from the highest, first is highest number, second is lowest
+		std::vector<std::pair<uint32_t, uint32_t> > runs;
+		for (auto it = m_OutOfSequencePackets.rbegin (); it != m_OutOfSequencePackets.rend (); it++)
+		{
+			if (!runs.empty () && runs.back ().second == *it + 1)
+				runs.back ().second = *it;
+			else
+				runs.emplace_back (*it, *it);
+		}
+		if (m_ReceivePacketNum) runs.emplace_back (m_ReceivePacketNum - 1, 0);
+		buf[0] = eSSU2BlkAck;
+		uint32_t ackThrough = runs[0].first;
+		htobe32buf (buf + 3, ackThrough);
+		uint32_t numAcks = std::min (ackThrough - runs[0].second, (uint32_t)255);
+		buf[7] = numAcks;
+		uint32_t lowest = ackThrough - numAcks; // lowest acked or nacked so far
+		size_t size = 5, numRanges = 0, i = 0;
+		while (size + 5 <= len && numRanges < SSU2_MAX_NUM_ACK_RANGES)
+		{
+			while (i < runs.size () && runs[i].second >= lowest) i++; // covered already
+			if (i >= runs.size ()) break;
+			uint32_t highest = std::min (runs[i].first, lowest - 1);
+			uint32_t numNacks = lowest - 1 - highest;
+			numAcks = highest - runs[i].second + 1;
+			if (numNacks > 255)
+			{
+				numNacks = 255;
+				numAcks = 0;
+			}
+			else if (numAcks > 255)
+				numAcks = 255;
+			buf[size + 3] = numNacks;
+			buf[size + 4] = numAcks;
+			size += 2;
+			lowest -= numNacks + numAcks;
+			numRanges++;
+		}
+		htobe16buf (buf + 1, size);
+		return size + 3;
+	}
+
+	size_t SSU2Session::CreatePaddingBlock (uint8_t * buf, size_t len)
+	{
+		size_t paddingSize = i2p::crypto::RandUInt32 () & 0x0F; // 0 - 15
+		if (!paddingSize || len < paddingSize + 3) return 0;
+		buf[0] = eSSU2BlkPadding;
+		htobe16buf (buf + 1, paddingSize);
+		memset (buf + 3, 0, paddingSize);
+		return paddingSize + 3;
+	}
 		
 	SSU2Server::SSU2Server ():
 		RunnableServiceWithWork ("SSU2"), m_Socket (GetService ()), m_SocketV6 (GetService ()),
-		m_TerminationTimer (GetService ())
+		m_ReceiveBatch (m_PacketsPool), m_ReceiveBatchV6 (m_PacketsPool),
+		m_SendBatch (m_Socket), m_SendBatchV6 (m_SocketV6), m_TerminationTimer (GetService ()),
+		m_ResendTimer (GetService ())
 	{
 	}
 
@@ -414,15 +1204,21 @@ namespace transport
 				}
 			}
 			ScheduleTermination ();
+			ScheduleResend ();
 		}	
 	}
 		
 	void SSU2Server::Stop ()
 	{
 		if (IsRunning ())
+		{
 			m_TerminationTimer.cancel ();
+			m_ResendTimer.cancel ();
+		}
 		
 		StopIOService ();
+		m_Sessions.clear ();
+		m_PendingOutgoingSessions.clear ();
 	}	
 
 	boost::asio::ip::udp::socket& SSU2Server::OpenSocket (const boost::asio::ip::udp::endpoint& localEndpoint)
@@ -437,6 +1233,15 @@ namespace transport
 			socket.set_option (boost::asio::socket_base::send_buffer_size (SSU2_SOCKET_SEND_BUFFER_SIZE));
 			socket.bind (localEndpoint);
 			LogPrint (eLogInfo, "SSU2: Start listening on ", localEndpoint);
+			bool offload = false; i2p::config::GetOption ("ssu2.offload", offload);
+			if (offload)
+			{
+				bool v6 = localEndpoint.address ().is_v6 ();
+				bool gso = (v6 ? m_SendBatchV6 : m_SendBatch).EnableSegmentationOffload ();
+				bool gro = (v6 ? m_ReceiveBatchV6 : m_ReceiveBatch).EnableReceiveOffload (socket);
+				LogPrint (eLogInfo, "SSU2: Segmentation offload ", gso ? "enabled" : "not supported",
+					", receive offload ", gro ? "enabled" : "not supported", " on ", localEndpoint);
+			}
 		}
 		catch (std::exception& ex )
 		{
@@ -448,6 +1253,13 @@ namespace transport
 		
 	void SSU2Server::Receive (boost::asio::ip::udp::socket& socket)
 	{
+		if ((&socket == &m_Socket ? m_ReceiveBatch : m_ReceiveBatchV6).IsReceiveOffload ())
+		{
+			// wait until readable, coalesced datagrams don't fit Packet
+			socket.async_receive (boost::asio::null_buffers (),
+				std::bind (&SSU2Server::HandleReceivedFrom, this, std::placeholders::_1, std::placeholders::_2, nullptr, std::ref (socket)));
+			return;
+		}
 		Packet * packet = m_PacketsPool.AcquireMt ();
 		socket.async_receive_from (boost::asio::buffer (packet->buf, SSU2_MTU), packet->from,
 			std::bind (&SSU2Server::HandleReceivedFrom, this, std::placeholders::_1, std::placeholders::_2, packet, std::ref (socket)));
@@ -458,9 +1270,20 @@ namespace transport
 	{
 		if (!ecode)
 		{
-			packet->len = bytes_transferred;
-			ProcessNextPacket (packet->buf, packet->len, packet->from);
-			m_PacketsPool.ReleaseMt (packet);
+			std::vector<Packet *> packets;
+			if (packet) // otherwise all are read by batch
+			{
+				packet->len = bytes_transferred;
+				packets.push_back (packet);
+			}
+			boost::system::error_code ec;
+			auto& batch = &socket == &m_Socket ? m_ReceiveBatch : m_ReceiveBatchV6;
+			batch.Receive (socket, SSU2_MTU, UDP_MAX_BATCH_SIZE, packets, ec);
+			if (ec)
+				LogPrint (eLogError, "SSU2: receive_from error: code ", ec.value(), ": ", ec.message ());
+			for (auto it: packets)
+				ProcessNextPacket (it->buf, it->len, it->from);
+			m_PacketsPool.ReleaseMt (packets);
 			Receive (socket);
 		}
 		else
@@ -482,6 +1305,11 @@ namespace transport
 		m_Sessions.emplace (connID, session);
 	}	
 
+	void SSU2Server::RemoveSession (uint64_t connID)
+	{
+		m_Sessions.erase (connID);
+	}
+
 	void SSU2Server::AddPendingOutgoingSession (const boost::asio::ip::udp::endpoint& ep, std::shared_ptr<SSU2Session> session)
 	{
 		m_PendingOutgoingSessions.emplace (ep, session);
@@ -489,12 +1317,30 @@ namespace transport
 		
 	void SSU2Server::ProcessNextPacket (uint8_t * buf, size_t len, const boost::asio::ip::udp::endpoint& senderEndpoint)
 	{
+		if (len < 40) // header, 8 bytes of payload, MAC
+		{
+			LogPrint (eLogWarning, "SSU2: Packet is too short ", len);
+			return;
+		}
 		uint64_t connID;
 		memcpy (&connID, buf, 8);
 		connID ^= CreateHeaderMask (i2p::context.GetSSU2IntroKey (), buf + (len - 24));
 		auto it = m_Sessions.find (connID);
 		if (it != m_Sessions.end ())
 		{
+			auto session = it->second; // might be removed from m_Sessions
+			switch (session->GetState ())
+			{
+				case eSSU2SessionStateEstablished:
+				case eSSU2SessionStateSessionConfirmedSent:
+					session->ProcessData (buf, len);
+				break;
+				case eSSU2SessionStateSessionCreatedSent:
+					session->ProcessSessionConfirmed (buf, len);
+				break;
+				default:
+					LogPrint (eLogWarning, "SSU2: Unexpected packet for session in state ", (int)session->GetState ());
+			}
 		}	
 		else 
 		{
@@ -525,6 +1371,14 @@ namespace transport
 			boost::asio::buffer (headerX, headerXLen),
 			boost::asio::buffer (payload, payloadLen)
 		};
+		auto& batch = to.address ().is_v6 () ? m_SendBatchV6 : m_SendBatch;
+		if (batch.IsEmpty ())
+			GetService ().post (std::bind (&SSU2Server::FlushSendBatch, this, std::ref (batch)));
+		if (batch.Add (bufs, to))
+		{
+			if (batch.IsFull ()) FlushSendBatch (batch);
+			return;
+		}
 		boost::system::error_code ec;
 		if (to.address ().is_v6 ())
 			m_SocketV6.send_to (bufs, to, 0, ec);
@@ -532,6 +1386,38 @@ namespace transport
 			m_Socket.send_to (bufs, to, 0, ec);
 	}	
 
+	void SSU2Server::Send (const uint8_t * header, size_t headerLen, const uint8_t * payload, size_t payloadLen,
+		const boost::asio::ip::udp::endpoint& to)
+	{
+		std::vector<boost::asio::const_buffer> bufs
+		{
+			boost::asio::buffer (header, headerLen),
+			boost::asio::buffer (payload, payloadLen)
+		};
+		auto& batch = to.address ().is_v6 () ? m_SendBatchV6 : m_SendBatch;
+		if (batch.IsEmpty ())
+			GetService ().post (std::bind (&SSU2Server::FlushSendBatch, this, std::ref (batch)));
+		if (batch.Add (bufs, to))
+		{
+			if (batch.IsFull ()) FlushSendBatch (batch);
+			return;
+		}
+		boost::system::error_code ec;
+		if (to.address ().is_v6 ())
+			m_SocketV6.send_to (bufs, to, 0, ec);
+		else	
+			m_Socket.send_to (bufs, to, 0, ec);
+	}
+
+	void SSU2Server::FlushSendBatch (UDPBatchSender& batch)
+	{
+		if (batch.IsEmpty ()) return;
+		boost::system::error_code ec;
+		batch.Flush (ec);
+		if (ec)
+			LogPrint (eLogError, "SSU2: Send exception: ", ec.message ());
+	}
+
 	bool SSU2Server::CreateSession (std::shared_ptr<const i2p::data::RouterInfo> router,
 		std::shared_ptr<const i2p::data::RouterInfo::Address> address)
 	{
@@ -563,7 +1449,7 @@ namespace transport
 			{
 				if (it->second->IsTerminationTimeoutExpired (ts))
 				{
-					//it->second->Terminate ();
+					it->second->Terminate ();
 					it = m_PendingOutgoingSessions.erase (it); 
 				}
 				else
@@ -572,17 +1458,39 @@ namespace transport
 
 			for (auto it = m_Sessions.begin (); it != m_Sessions.end ();)
 			{
-				if (it->second->IsTerminationTimeoutExpired (ts))
+				auto session = it->second;
+				it++; // session removes itself
+				if (session->IsTerminationTimeoutExpired (ts))
 				{
-					//it->second->Terminate ();
-					it = m_Sessions.erase (it); 
+					if (session->IsEstablished ())
+						session->RequestTermination (eSSU2TerminationReasonIdleTimeout);
+					else
+						session->Terminate ();
 				}
 				else
-					it++;
+					session->CleanUp (ts);
 			}
 			
 			ScheduleTermination ();
 		}
 	}	
+
+	void SSU2Server::ScheduleResend ()
+	{
+		m_ResendTimer.expires_from_now (boost::posix_time::milliseconds(SSU2_RESEND_CHECK_TIMEOUT));
+		m_ResendTimer.async_wait (std::bind (&SSU2Server::HandleResendTimer,
+			this, std::placeholders::_1));
+	}
+
+	void SSU2Server::HandleResendTimer (const boost::system::error_code& ecode)
+	{
+		if (ecode != boost::asio::error::operation_aborted)
+		{
+			auto ts = i2p::util::GetMillisecondsSinceEpoch ();
+			for (auto& it: m_Sessions)
+				it.second->Resend (ts);
+			ScheduleResend ();
+		}
+	}
 }
 }
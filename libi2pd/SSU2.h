@@ -11,11 +11,16 @@
 
 #include <memory>
 #include <map>
+#include <set>
+#include <list>
+#include <vector>
 #include <unordered_map>
 #include <boost/asio.hpp>
 #include "Crypto.h"
 #include "RouterInfo.h"
+#include "I2NPProtocol.h"
 #include "TransportSession.h"
+#include "UDPBatch.h"
 
 namespace i2p
 {
@@ -27,11 +32,32 @@ namespace transport
 	const size_t SSU2_SOCKET_RECEIVE_BUFFER_SIZE = 0x1FFFF; // 128K
 	const size_t SSU2_SOCKET_SEND_BUFFER_SIZE = 0x1FFFF; // 128K
 	const size_t SSU2_MTU = 1488;
-	
+	const size_t SSU2_MAX_PACKET_SIZE_V4 = 1472; // 1500 - 28
+	const size_t SSU2_MAX_PACKET_SIZE_V6 = 1452; // 1500 - 48
+	const int SSU2_RESEND_CHECK_TIMEOUT = 40; // in milliseconds
+	const int SSU2_MAX_NUM_RESENDS = 5;
+	const int SSU2_INITIAL_RTO = 1000; // in milliseconds
+	const int SSU2_MIN_RTO = 100; // in milliseconds
+	const int SSU2_MAX_RTO = 2500; // in milliseconds
+	const double SSU2_RTT_EWMA_ALPHA = 0.125;
+	const double SSU2_RTTVAR_EWMA_BETA = 0.25;
+	const size_t SSU2_MIN_WINDOW_SIZE = 16; // in packets
+	const size_t SSU2_MAX_WINDOW_SIZE = 256; // in packets
+	const uint32_t SSU2_FAST_RETRANSMIT_THRESHOLD = 3; // lost if that many later packets are acked
+	const size_t SSU2_MAX_NUM_ACK_RANGES = 32; // NACK/ACK pairs in ACK block
+	const uint32_t SSU2_MAX_NUM_ACK_PACKETS = 2*SSU2_MAX_WINDOW_SIZE; // older gaps are never filled
+	const size_t SSU2_MIN_FIRST_FRAGMENT_SIZE = 64;
+	const int SSU2_MAX_NUM_FRAGMENTS = 128; // 7 bits
+	const size_t SSU2_MAX_OUTGOING_QUEUE_SIZE = 500; // in messages
+	const int SSU2_INCOMPLETE_MESSAGES_CLEANUP_TIMEOUT = 30; // in seconds
+	const int SSU2_RECEIVED_I2NP_MSGIDS_CLEANUP_TIMEOUT = 10; // in seconds
+
 	enum SSU2MessageType
 	{
 		eSSU2SessionRequest = 0,
 		eSSU2SessionCreated = 1,
+		eSSU2SessionConfirmed = 2,
+		eSSU2Data = 6,
 		eSSU2Retry = 9
 	};
 
@@ -60,7 +86,54 @@ namespace transport
 		eSSU2BlkFirstPacketNumber, // 20
 		eSSU2BlkPadding = 254
 	};
-	
+
+	enum SSU2SessionState
+	{
+		eSSU2SessionStateUnknown,
+		eSSU2SessionStateSessionRequestSent,
+		eSSU2SessionStateSessionCreatedSent,
+		eSSU2SessionStateSessionConfirmedSent,
+		eSSU2SessionStateEstablished,
+		eSSU2SessionStateTerminated
+	};
+
+	enum SSU2TerminationReason
+	{
+		eSSU2TerminationReasonNormalClose = 0,
+		eSSU2TerminationReasonTerminationReceived = 1,
+		eSSU2TerminationReasonIdleTimeout = 2,
+		eSSU2TerminationReasonRouterShutdown = 3,
+		eSSU2TerminationReasonDataPhaseAEADFailure = 4
+	};
+
+	const uint8_t SSU2_ROUTER_INFO_FLAG_REQUEST_FLOOD = 0x01;
+	const uint8_t SSU2_ROUTER_INFO_FLAG_GZIP = 0x02;
+
+	struct SSU2IncompleteMessage
+	{
+		struct Fragment
+		{
+			std::vector<uint8_t> buf;
+			bool isLast;
+		};
+
+		std::shared_ptr<I2NPMessage> msg; // null until first fragment
+		int nextFragmentNum = 0;
+		bool isComplete = false;
+		uint32_t lastFragmentInsertTime = 0; // in seconds
+		std::map<int, Fragment> outOfSequenceFragments;
+
+		void AttachNextFragment (const uint8_t * fragment, size_t fragmentSize, bool isLast);
+	};
+
+	struct SSU2SentPacket
+	{
+		uint8_t payload[SSU2_MTU];
+		size_t payloadSize = 0;
+		uint64_t sendTime = 0; // in milliseconds
+		int numResends = 0;
+	};
+
 	class SSU2Server;
 	class SSU2Session: public TransportSession, public std::enable_shared_from_this<SSU2Session>
 	{
@@ -83,33 +156,92 @@ namespace transport
 				std::shared_ptr<const i2p::data::RouterInfo::Address> addr = nullptr, bool peerTest = false);
 			~SSU2Session ();
 
-			void SetRemoteEndpoint (const boost::asio::ip::udp::endpoint& ep) { m_RemoteEndpoint = ep; };
+			void SetRemoteEndpoint (const boost::asio::ip::udp::endpoint& ep);
 
 			void Connect ();
-			void Done () override {};
-			void SendI2NPMessages (const std::vector<std::shared_ptr<I2NPMessage> >& msgs) override {};
-			
+			void Terminate ();
+			void RequestTermination (SSU2TerminationReason reason);
+			void Done () override;
+			void SendI2NPMessages (const std::vector<std::shared_ptr<I2NPMessage> >& msgs) override;
+			void Resend (uint64_t ts); // ts in milliseconds
+			void CleanUp (uint64_t ts); // ts in seconds
+
+			SSU2SessionState GetState () const { return m_State; };
+			bool IsEstablished () const { return m_State == eSSU2SessionStateEstablished; };
+			double GetRTT () const { return m_RTT; }; // in milliseconds, negative if unknown
+			int GetRTO () const { return m_RTO; }; // in milliseconds
+			size_t GetWindowSize () const { return m_WindowSize; }; // in packets
+			size_t GetSendQueueSize () const { return m_SendQueue.size (); };
+
 			void ProcessSessionRequest (uint64_t connID, uint8_t * buf, size_t len);
 			bool ProcessSessionCreated (uint8_t * buf, size_t len);
+			bool ProcessSessionConfirmed (uint8_t * buf, size_t len);
 			bool ProcessRetry (uint8_t * buf, size_t len);
-			
+			void ProcessData (uint8_t * buf, size_t len);
+
 		private:
 
+			void Established ();
+			void PostI2NPMessages (std::vector<std::shared_ptr<I2NPMessage> > msgs);
+			bool SendQueue (); // returns true if at least one packet was sent
+			void ScheduleAck ();
+			void SendQuickAck ();
+			uint32_t SendData (const uint8_t * buf, size_t len); // returns packet number
+			void ResendPackets (std::vector<std::shared_ptr<SSU2SentPacket> >& packets, uint64_t ts);
+
 			void SendSessionRequest (uint64_t token = 0);
 			void SendSessionCreated (const uint8_t * X);
+			void SendSessionConfirmed (const uint8_t * Y);
+			void KDFDataPhase (uint8_t * keydata_ab, uint8_t * keydata_ba);
 
-			void HandlePayload (const uint8_t * buf, size_t len);
+			bool HandlePayload (const uint8_t * buf, size_t len); // returns true if ack is required
+			bool HandleRouterInfoBlock (const uint8_t * buf, size_t size, const uint8_t * staticKey);
+			void HandleAck (const uint8_t * buf, size_t len);
+			void HandleAckRange (uint32_t firstPacketNum, uint32_t lastPacketNum, uint64_t ts, uint64_t& rttSampleTime);
+			void HandleFirstFragment (const uint8_t * buf, size_t len);
+			void HandleFollowOnFragment (const uint8_t * buf, size_t len);
+			void ProcessIncompleteMessage (uint32_t msgID, std::shared_ptr<SSU2IncompleteMessage> m);
+			bool IsNewI2NPMsgID (uint32_t msgID) const;
+			bool UpdateReceivePacketNum (uint32_t packetNum); // returns false if duplicate
+			void UpdateRTT (uint64_t rtt);
+			void OnPacketLost (uint32_t packetNum, bool timeout);
 			bool ExtractEndpoint (const uint8_t * buf, size_t size, boost::asio::ip::udp::endpoint& ep);
 			size_t CreateAddressBlock (const boost::asio::ip::udp::endpoint& ep, uint8_t * buf, size_t len);
-			
+			size_t CreateRouterInfoBlock (uint8_t * buf, size_t len);
+			size_t CreateAckBlock (uint8_t * buf, size_t len);
+			size_t CreatePaddingBlock (uint8_t * buf, size_t len);
+
 		private:
 
 			SSU2Server& m_Server;
+			SSU2SessionState m_State;
 			std::shared_ptr<i2p::crypto::X25519Keys> m_EphemeralKeys;
 			std::unique_ptr<i2p::crypto::NoiseSymmetricState> m_NoiseState;
-			std::shared_ptr<const i2p::data::RouterInfo::Address> m_Address;
+			std::shared_ptr<const i2p::data::RouterInfo::Address> m_Address; // remote, intro key for header of sent packets
 			boost::asio::ip::udp::endpoint m_RemoteEndpoint;
 			uint64_t m_DestConnID, m_SourceConnID;
+			size_t m_MaxPayloadSize;
+			uint8_t m_KeyDataSend[64], m_KeyDataReceive[64]; // k_data || k_header_2
+			std::shared_ptr<SSU2SentPacket> m_SessionConfirmedPacket; // whole packet, until first data from Bob
+			// send
+			uint32_t m_SendPacketNum;
+			std::map<uint32_t, std::shared_ptr<SSU2SentPacket> > m_SentPackets; // packetNum -> packet, not acked yet
+			std::list<std::shared_ptr<I2NPMessage> > m_SendQueue;
+			std::shared_ptr<I2NPMessage> m_SendingMessage; // being fragmented
+			size_t m_SendingOffset;
+			int m_SendingFragmentNum;
+			// receive
+			uint32_t m_ReceivePacketNum; // all below are received
+			std::set<uint32_t> m_OutOfSequencePackets; // above m_ReceivePacketNum
+			bool m_IsAckRequired;
+			std::unordered_map<uint32_t, std::shared_ptr<SSU2IncompleteMessage> > m_IncompleteMessages; // msgID -> message
+			std::unordered_map<uint32_t, uint32_t> m_ReceivedI2NPMsgIDs; // msgID -> timestamp in seconds
+			i2p::I2NPMessagesHandler m_Handler;
+			// RTT and congestion control
+			double m_RTT, m_RTTVar; // in milliseconds
+			int m_RTO; // in milliseconds
+			size_t m_WindowSize, m_SlowStartThreshold, m_WindowIncrement; // in packets
+			uint32_t m_RecoveryPacketNum; // losses of packets sent before belong to the same congestion event
 	};
 
 	class SSU2Server:  private i2p::util::RunnableServiceWithWork
@@ -130,11 +262,17 @@ namespace transport
 			void Stop ();
 			boost::asio::io_service& GetService () { return GetIOService (); };
 			
+			i2p::util::MemoryPoolMt<SSU2SentPacket>& GetSentPacketsPool () { return m_SentPacketsPool; };
+
 			void AddSession (uint64_t connID, std::shared_ptr<SSU2Session> session);
+			void RemoveSession (uint64_t connID);
 			void AddPendingOutgoingSession (const boost::asio::ip::udp::endpoint& ep, std::shared_ptr<SSU2Session> session);
+			const std::unordered_map<uint64_t, std::shared_ptr<SSU2Session> >& GetSSU2Sessions () const { return m_Sessions; };
 
 			void Send (const uint8_t * header, size_t headerLen, const uint8_t * headerX, size_t headerXLen, 
 				const uint8_t * payload, size_t payloadLen, const boost::asio::ip::udp::endpoint& to);
+			void Send (const uint8_t * header, size_t headerLen, const uint8_t * payload, size_t payloadLen,
+				const boost::asio::ip::udp::endpoint& to);
 
 			bool CreateSession (std::shared_ptr<const i2p::data::RouterInfo> router,
 				std::shared_ptr<const i2p::data::RouterInfo::Address> address);
@@ -146,17 +284,23 @@ namespace transport
 			void HandleReceivedFrom (const boost::system::error_code& ecode, size_t bytes_transferred, 
 				Packet * packet, boost::asio::ip::udp::socket& socket);
 			void ProcessNextPacket (uint8_t * buf, size_t len, const boost::asio::ip::udp::endpoint& senderEndpoint);
+			void FlushSendBatch (UDPBatchSender& batch);
 
 			void ScheduleTermination ();
 			void HandleTerminationTimer (const boost::system::error_code& ecode);
-			
+			void ScheduleResend ();
+			void HandleResendTimer (const boost::system::error_code& ecode);
+
 		private:
 
 			boost::asio::ip::udp::socket m_Socket, m_SocketV6;
 			std::unordered_map<uint64_t, std::shared_ptr<SSU2Session> > m_Sessions;
 			std::map<boost::asio::ip::udp::endpoint, std::shared_ptr<SSU2Session> > m_PendingOutgoingSessions;
 			i2p::util::MemoryPoolMt<Packet> m_PacketsPool;
-			boost::asio::deadline_timer m_TerminationTimer;
+			i2p::util::MemoryPoolMt<SSU2SentPacket> m_SentPacketsPool;
+			UDPBatchReceiver<Packet> m_ReceiveBatch, m_ReceiveBatchV6;
+			UDPBatchSender m_SendBatch, m_SendBatchV6; // flushed after current handler
+			boost::asio::deadline_timer m_TerminationTimer, m_ResendTimer;
 	};	
 }
 }
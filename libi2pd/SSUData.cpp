@@ -7,6 +7,8 @@
 */
 
 #include <stdlib.h>
+#include <cmath>
+#include <algorithm>
 #include "Log.h"
 #include "Timestamp.h"
 #include "NetDb.hpp"
@@ -22,7 +24,7 @@ namespace transport
 		if (msg->len + fragmentSize > msg->maxLen)
 		{
 			LogPrint (eLogWarning, "SSU: I2NP message size ", msg->maxLen, " is not enough");
-			auto newMsg = NewI2NPMessage ();
+			auto newMsg = NewI2NPMessage (msg->len + fragmentSize);
 			*newMsg = *msg;
 			msg = newMsg;
 		}
@@ -32,9 +34,13 @@ namespace transport
 	}
 
 	SSUData::SSUData (SSUSession& session):
-		m_Session (session), m_ResendTimer (session.GetService ()),
+		m_Session (session), m_ResendTimer (session.GetService ()), m_NextResendTime (0),
 		m_MaxPacketSize (session.IsV6 () ? SSU_V6_MAX_PACKET_SIZE : SSU_V4_MAX_PACKET_SIZE),
-		m_PacketSize (m_MaxPacketSize), m_LastMessageReceivedTime (0)
+		m_PacketSize (m_MaxPacketSize), m_LastMessageReceivedTime (0),
+		m_RTT (-1), m_RTTVar (0), m_RTO (SSU_INITIAL_RTO),
+		m_CongestionWindow (SSU_INITIAL_CONGESTION_WINDOW*m_MaxPacketSize),
+		m_SlowStartThreshold (SSU_MAX_CONGESTION_WINDOW*m_MaxPacketSize),
+		m_BytesInFlight (0), m_RecoveryTime (0)
 	{
 	}
 
@@ -49,8 +55,11 @@ namespace transport
 	void SSUData::Stop ()
 	{
 		m_ResendTimer.cancel ();
+		m_NextResendTime = 0;
 		m_IncompleteMessages.clear ();
 		m_SentMessages.clear ();
+		m_SendQueue.clear ();
+		m_BytesInFlight = 0;
 		m_ReceivedMessages.clear ();
 	}
 
@@ -92,12 +101,97 @@ namespace transport
 		auto it = m_SentMessages.find (msgID);
 		if (it != m_SentMessages.end ())
 		{
+			if (!it->second->numResends) // Karn's algorithm, ACK of resent message is ambiguous
+				UpdateRTT (i2p::util::GetMillisecondsSinceEpoch () - it->second->sendTime);
+			size_t numBytes = 0;
+			for (const auto& f: it->second->fragments)
+				if (f) numBytes += f->len;
 			m_SentMessages.erase (it);
+			if (numBytes) OnBytesAcked (numBytes);
 			if (m_SentMessages.empty ())
+			{
 				m_ResendTimer.cancel ();
+				m_NextResendTime = 0;
+			}
 		}
 	}
 
+	void SSUData::ProcessFragmentsAck (std::shared_ptr<SentMessage> sentMessage, uint64_t bits)
+	{
+		auto& fragments = sentMessage->fragments;
+		size_t numBytes = 0;
+		int lastAcked = -1;
+		for (int i = 0; i < (int)fragments.size () && i < 64; i++)
+			if (bits & (uint64_t(0x01) << i))
+			{
+				if (fragments[i])
+				{
+					numBytes += fragments[i]->len;
+					fragments[i] = nullptr;
+				}
+				lastAcked = i;
+			}
+		if (numBytes) OnBytesAcked (numBytes);
+		// fast retransmit if fragments before acked one are still missing
+		if (sentMessage->numGapAcks < 0) return; // once until next resend
+		bool isGap = false;
+		for (int i = 0; i < lastAcked; i++)
+			if (fragments[i])
+			{
+				isGap = true;
+				break;
+			}
+		if (isGap && ++sentMessage->numGapAcks >= SSU_FAST_RETRANSMIT_THRESHOLD)
+		{
+			for (int i = 0; i < lastAcked; i++)
+				if (fragments[i]) SendFragment (*fragments[i]);
+			auto ts = i2p::util::GetMillisecondsSinceEpoch ();
+			sentMessage->numResends++;
+			sentMessage->numGapAcks = -1;
+			sentMessage->nextResendTime = ts + m_RTO;
+			OnMessageLost (ts, false);
+		}
+	}
+
+	void SSUData::UpdateRTT (uint64_t rtt)
+	{
+		// RFC 6298
+		if (m_RTT < 0)
+		{
+			m_RTT = rtt;
+			m_RTTVar = rtt/2.0;
+		}
+		else
+		{
+			m_RTTVar = (1 - SSU_RTTVAR_EWMA_BETA)*m_RTTVar + SSU_RTTVAR_EWMA_BETA*std::fabs (m_RTT - rtt);
+			m_RTT = (1 - SSU_RTT_EWMA_ALPHA)*m_RTT + SSU_RTT_EWMA_ALPHA*rtt;
+		}
+		m_RTO = m_RTT + 4*m_RTTVar;
+		if (m_RTO < SSU_MIN_RTO) m_RTO = SSU_MIN_RTO;
+		if (m_RTO > SSU_MAX_RTO) m_RTO = SSU_MAX_RTO;
+	}
+
+	void SSUData::OnBytesAcked (size_t numBytes)
+	{
+		m_BytesInFlight = m_BytesInFlight > numBytes ? m_BytesInFlight - numBytes : 0;
+		if (m_CongestionWindow < m_SlowStartThreshold)
+			m_CongestionWindow += numBytes; // slow start
+		else // congestion avoidance, one packet per window
+			m_CongestionWindow += std::max ((size_t)1, m_PacketSize*numBytes/m_CongestionWindow);
+		size_t maxWindow = SSU_MAX_CONGESTION_WINDOW*m_PacketSize;
+		if (m_CongestionWindow > maxWindow) m_CongestionWindow = maxWindow;
+	}
+
+	void SSUData::OnMessageLost (uint64_t ts, bool isTimeout)
+	{
+		if (ts < m_RecoveryTime) return; // same loss event
+		size_t minWindow = SSU_MIN_CONGESTION_WINDOW*m_PacketSize;
+		m_SlowStartThreshold = std::max (m_BytesInFlight/2, minWindow);
+		m_CongestionWindow = isTimeout ? minWindow : m_SlowStartThreshold;
+		m_RecoveryTime = ts + (m_RTT > 0 ? (uint64_t)m_RTT : m_RTO);
+		LogPrint (eLogDebug, "SSU: ", isTimeout ? "Resend timeout" : "Fast retransmit", ", congestion window ", m_CongestionWindow);
+	}
+
 	void SSUData::ProcessAcks (uint8_t *& buf, uint8_t flag)
 	{
 		if (flag & DATA_FLAG_EXPLICIT_ACKS_INCLUDED)
@@ -118,36 +212,26 @@ namespace transport
 			{
 				uint32_t msgID = bufbe32toh (buf);
 				buf += 4; // msgID
-				auto it = m_SentMessages.find (msgID);
-				// process individual Ack bitfields
+				// individual Ack bitfields
+				uint64_t bits = 0;
 				bool isNonLast = false;
 				int fragment = 0;
 				do
 				{
 					uint8_t bitfield = *buf;
 					isNonLast = bitfield & 0x80;
-					bitfield &= 0x7F; // clear MSB
-					if (bitfield && it != m_SentMessages.end ())
-					{
-						int numSentFragments = it->second->fragments.size ();
-						// process bits
-						uint8_t mask = 0x01;
-						for (int j = 0; j < 7; j++)
-						{
-							if (bitfield & mask)
-							{
-								if (fragment < numSentFragments)
-									it->second->fragments[fragment] = nullptr;
-							}
-							fragment++;
-							mask <<= 1;
-						}
-					}
+					if (fragment < 64)
+						bits |= uint64_t(bitfield & 0x7F) << fragment;
+					fragment += 7;
 					buf++;
 				}
 				while (isNonLast);
+				auto it = m_SentMessages.find (msgID);
+				if (bits && it != m_SentMessages.end ())
+					ProcessFragmentsAck (it->second, bits);
 			}
 		}
+		SendQueue (); // window might be open
 	}
 
 	void SSUData::ProcessFragments (uint8_t * buf)
@@ -179,7 +263,7 @@ namespace transport
 				auto msg = NewI2NPShortMessage ();
 				msg->len -= I2NP_SHORT_HEADER_SIZE;
 				it = m_IncompleteMessages.insert (std::make_pair (msgID,
-					m_Session.GetServer ().GetIncompleteMessagesPool ().AcquireShared (std::move (msg)))).first;
+					m_Session.GetShard ().incompleteMessagesPool.AcquireShared (std::move (msg)))).first;
 			}
 			auto& incompleteMessage = it->second;
 			// mark fragment as received
@@ -221,7 +305,7 @@ namespace transport
 				{
 					// missing fragment
 					LogPrint (eLogWarning, "SSU: Missing fragments from ", (int)incompleteMessage->nextFragmentNum, " to ", fragmentNum - 1, " of message ", msgID);
-					auto savedFragment = m_Session.GetServer ().GetFragmentsPool ().AcquireShared (fragmentNum, buf, fragmentSize, isLast);
+					auto savedFragment = m_Session.GetShard ().fragmentsPool.AcquireShared (fragmentNum, buf, fragmentSize, isLast);
 					if (incompleteMessage->savedFragments.insert (savedFragment).second)
 						incompleteMessage->lastFragmentInsertTime = i2p::util::GetSecondsSinceEpoch ();
 					else
@@ -300,6 +384,29 @@ namespace transport
 	}
 
 	void SSUData::Send (std::shared_ptr<i2p::I2NPMessage> msg)
+	{
+		if (!m_SendQueue.empty () || m_BytesInFlight >= m_CongestionWindow)
+		{
+			if (m_SendQueue.size () < MAX_OUTGOING_QUEUE_SIZE)
+				m_SendQueue.push_back (msg);
+			else
+				LogPrint (eLogWarning, "SSU: Outgoing messages queue exceeds ", MAX_OUTGOING_QUEUE_SIZE, ". Message dropped");
+		}
+		else
+			SendMessage (msg);
+	}
+
+	void SSUData::SendQueue ()
+	{
+		while (!m_SendQueue.empty () && m_BytesInFlight < m_CongestionWindow)
+		{
+			auto msg = m_SendQueue.front ();
+			m_SendQueue.pop_front ();
+			SendMessage (msg);
+		}
+	}
+
+	void SSUData::SendMessage (std::shared_ptr<i2p::I2NPMessage> msg)
 	{
 		uint32_t msgID = msg->ToSSU ();
 		if (m_SentMessages.find (msgID) != m_SentMessages.end())
@@ -307,15 +414,16 @@ namespace transport
 			LogPrint (eLogWarning, "SSU: message ", msgID, " already sent");
 			return;
 		}
-		if (m_SentMessages.empty ()) // schedule resend at first message only
-			ScheduleResend ();
-
-		auto ret = m_SentMessages.emplace (msgID, m_Session.GetServer ().GetSentMessagesPool ().AcquireShared ());
+		auto ret = m_SentMessages.emplace (msgID, m_Session.GetShard ().sentMessagesPool.AcquireShared ());
 		auto& sentMessage = ret.first->second;
 		if (ret.second)
 		{
-			sentMessage->nextResendTime = i2p::util::GetSecondsSinceEpoch () + RESEND_INTERVAL;
+			sentMessage->sendTime = i2p::util::GetMillisecondsSinceEpoch ();
+			sentMessage->nextResendTime = sentMessage->sendTime + m_RTO;
 			sentMessage->numResends = 0;
+			sentMessage->numGapAcks = 0;
+			if (!m_NextResendTime || sentMessage->nextResendTime < m_NextResendTime)
+				ScheduleResend (sentMessage->nextResendTime);
 		}
 		auto& fragments = sentMessage->fragments;
 		size_t payloadSize = m_PacketSize - sizeof (SSUHeader) - 9; // 9  =  flag + #frg(1) + messageID(4) + frag info (3)
@@ -325,7 +433,7 @@ namespace transport
 		uint32_t fragmentNum = 0;
 		while (len > 0 && fragmentNum <= 127)
 		{
-			auto fragment = m_Session.GetServer ().GetFragmentsPool ().AcquireShared ();
+			auto fragment = m_Session.GetShard ().fragmentsPool.AcquireShared ();
 			fragment->fragmentNum = fragmentNum;
 			uint8_t	* payload = fragment->buf + sizeof (SSUHeader);
 			*payload = DATA_FLAG_WANT_REPLY; // for compatibility
@@ -356,18 +464,8 @@ namespace transport
 			}
 			fragment->len = size;
 			fragments.push_back (fragment);
-
-			// encrypt message with session key
-			uint8_t buf[SSU_V4_MAX_PACKET_SIZE + 18];
-			m_Session.FillHeaderAndEncrypt (PAYLOAD_TYPE_DATA, fragment->buf, size, buf);
-			try
-			{
-				m_Session.Send (buf, size);
-			}
-			catch (boost::system::system_error& ec)
-			{
-				LogPrint (eLogWarning, "SSU: Can't send data fragment ", ec.what ());
-			}
+			m_BytesInFlight += size;
+			SendFragment (*fragment);
 			if (!isLast)
 			{
 				len -= payloadSize;
@@ -379,6 +477,21 @@ namespace transport
 		}
 	}
 
+	void SSUData::SendFragment (Fragment& fragment)
+	{
+		// encrypt message with session key
+		uint8_t buf[SSU_V4_MAX_PACKET_SIZE + 18];
+		m_Session.FillHeaderAndEncrypt (PAYLOAD_TYPE_DATA, fragment.buf, fragment.len, buf);
+		try
+		{
+			m_Session.Send (buf, fragment.len);
+		}
+		catch (boost::system::system_error& ec)
+		{
+			LogPrint (eLogWarning, "SSU: Can't send data fragment ", ec.what ());
+		}
+	}
+
 	void SSUData::SendMsgAck (uint32_t msgID)
 	{
 		uint8_t buf[48 + 18] = {0}; // actual length is 44 = 37 + 7 but pad it to multiple of 16
@@ -413,7 +526,7 @@ namespace transport
 		{
 			*payload = (bits & 0x7F); // next 7 bits
 			bits >>= 7;
-			if (bits) *payload &= 0x80; // 0x80 means non-last
+			if (bits) *payload |= 0x80; // 0x80 means non-last
 			payload++; len++;
 		}
 		*payload = 0; // number of fragments
@@ -423,10 +536,12 @@ namespace transport
 		m_Session.Send (buf, len);
 	}
 
-	void SSUData::ScheduleResend()
+	void SSUData::ScheduleResend (uint64_t nextResendTime)
 	{
+		m_NextResendTime = nextResendTime;
+		auto ts = i2p::util::GetMillisecondsSinceEpoch ();
 		m_ResendTimer.cancel ();
-		m_ResendTimer.expires_from_now (boost::posix_time::seconds(RESEND_INTERVAL));
+		m_ResendTimer.expires_from_now (boost::posix_time::milliseconds(nextResendTime > ts ? nextResendTime - ts : 0));
 		auto s = m_Session.shared_from_this();
 		m_ResendTimer.async_wait ([s](const boost::system::error_code& ecode)
 			{ s->m_Data.HandleResendTimer (ecode); });
@@ -436,51 +551,39 @@ namespace transport
 	{
 		if (ecode != boost::asio::error::operation_aborted)
 		{
-			uint8_t buf[SSU_V4_MAX_PACKET_SIZE + 18];
-			uint32_t ts = i2p::util::GetSecondsSinceEpoch ();
-			int numResent = 0;
+			m_NextResendTime = 0;
+			uint64_t ts = i2p::util::GetMillisecondsSinceEpoch (), nextResendTime = 0;
+			bool isLost = false;
 			for (auto it = m_SentMessages.begin (); it != m_SentMessages.end ();)
 			{
-				if (ts >= it->second->nextResendTime)
+				auto& sentMessage = it->second;
+				if (ts >= sentMessage->nextResendTime)
 				{
-					if (it->second->numResends < MAX_NUM_RESENDS)
+					if (sentMessage->numResends < MAX_NUM_RESENDS)
 					{
-						for (auto& f: it->second->fragments)
-							if (f)
-							{
-								try
-								{
-									m_Session.FillHeaderAndEncrypt (PAYLOAD_TYPE_DATA, f->buf, f->len, buf);
-									m_Session.Send (buf, f->len); // resend
-									numResent++;
-								}
-								catch (boost::system::system_error& ec)
-								{
-									LogPrint (eLogWarning, "SSU: Can't resend message ", it->first, " data fragment: ", ec.what ());
-								}
-							}
-
-						it->second->numResends++;
-						it->second->nextResendTime += it->second->numResends*RESEND_INTERVAL;
-						++it;
+						for (auto& f: sentMessage->fragments)
+							if (f) SendFragment (*f); // resend
+						sentMessage->numResends++;
+						sentMessage->numGapAcks = 0;
+						sentMessage->nextResendTime = ts + ((uint64_t)m_RTO << sentMessage->numResends); // exponential backoff
+						isLost = true;
 					}
 					else
 					{
 						LogPrint (eLogInfo, "SSU: message ", it->first, " has not been ACKed after ", MAX_NUM_RESENDS, " attempts, deleted");
+						for (auto& f: sentMessage->fragments)
+							if (f) m_BytesInFlight -= std::min (m_BytesInFlight, f->len);
 						it = m_SentMessages.erase (it);
+						continue;
 					}
 				}
-				else
-					++it;
-			}
-			if (m_SentMessages.empty ()) return; // nothing to resend
-			if (numResent < MAX_OUTGOING_WINDOW_SIZE)
-				ScheduleResend ();
-			else
-			{
-				LogPrint (eLogError, "SSU: resend window exceeds max size. Session terminated");
-				m_Session.Close ();
+				if (!nextResendTime || sentMessage->nextResendTime < nextResendTime)
+					nextResendTime = sentMessage->nextResendTime;
+				++it;
 			}
+			if (isLost) OnMessageLost (ts, true);
+			if (nextResendTime) ScheduleResend (nextResendTime);
+			SendQueue ();
 		}
 	}
 
@@ -13,6 +13,7 @@
 #include <string.h>
 #include <vector>
 #include <map>
+#include <list>
 #include <unordered_map>
 #include <memory>
 #include <boost/asio.hpp>
@@ -36,13 +37,21 @@ namespace transport
 	const size_t UDP_HEADER_SIZE = 8;
 	const size_t SSU_V4_MAX_PACKET_SIZE = SSU_MTU_V4 - IPV4_HEADER_SIZE - UDP_HEADER_SIZE; // 1456
 	const size_t SSU_V6_MAX_PACKET_SIZE = SSU_MTU_V6 - IPV6_HEADER_SIZE - UDP_HEADER_SIZE; // 1440
-	const int RESEND_INTERVAL = 3; // in seconds
 	const int MAX_NUM_RESENDS = 5;
+	const int SSU_INITIAL_RTO = 1000; // in milliseconds
+	const int SSU_MIN_RTO = 100; // in milliseconds
+	const int SSU_MAX_RTO = 3000; // in milliseconds
+	const double SSU_RTT_EWMA_ALPHA = 0.125;
+	const double SSU_RTTVAR_EWMA_BETA = 0.25;
+	const int SSU_FAST_RETRANSMIT_THRESHOLD = 3; // fragment ACKs with earlier fragments missing
+	const size_t SSU_MIN_CONGESTION_WINDOW = 4; // in packets
+	const size_t SSU_INITIAL_CONGESTION_WINDOW = 16; // in packets
+	const size_t SSU_MAX_CONGESTION_WINDOW = 512; // in packets
 	const int DECAY_INTERVAL = 20; // in seconds
 	const int INCOMPLETE_MESSAGES_CLEANUP_TIMEOUT = 30; // in seconds
 	const int RECEIVED_MESSAGES_CLEANUP_TIMEOUT = 40; // in seconds
 	const unsigned int MAX_NUM_RECEIVED_MESSAGES = 1000; // how many msgID we store for duplicates check
-	const int MAX_OUTGOING_WINDOW_SIZE = 200; // how many unacked message we can store
+	const size_t MAX_OUTGOING_QUEUE_SIZE = 500; // how many messages can wait for congestion window
 	// data flags
 	const uint8_t DATA_FLAG_EXTENDED_DATA_INCLUDED = 0x02;
 	const uint8_t DATA_FLAG_WANT_REPLY = 0x04;
@@ -86,9 +95,11 @@ namespace transport
 
 	struct SentMessage
 	{
-		std::vector<std::shared_ptr<Fragment> > fragments;
-		uint32_t nextResendTime; // in seconds
+		std::vector<std::shared_ptr<Fragment> > fragments; // nullptr if acked
+		uint64_t sendTime; // in milliseconds
+		uint64_t nextResendTime; // in milliseconds
 		int numResends;
+		int numGapAcks; // fragment ACKs with earlier fragments missing since last resend, -1 if retransmitted already
 	};
 
 	class SSUSession;
@@ -110,15 +121,27 @@ namespace transport
 			void AdjustPacketSize (std::shared_ptr<const i2p::data::RouterInfo> remoteRouter);
 			void UpdatePacketSize (const i2p::data::IdentHash& remoteIdent);
 
+			double GetRTT () const { return m_RTT; }; // in milliseconds, negative if not measured yet
+			int GetRTO () const { return m_RTO; };
+			size_t GetCongestionWindow () const { return m_CongestionWindow; }; // in bytes
+			size_t GetBytesInFlight () const { return m_BytesInFlight; };
+
 		private:
 
+			void SendMessage (std::shared_ptr<i2p::I2NPMessage> msg);
+			void SendQueue (); // while congestion window allows
+			void SendFragment (Fragment& fragment);
 			void SendMsgAck (uint32_t msgID);
 			void SendFragmentAck (uint32_t msgID, uint64_t bits);
 			void ProcessAcks (uint8_t *& buf, uint8_t flag);
 			void ProcessFragments (uint8_t * buf);
 			void ProcessSentMessageAck (uint32_t msgID);
+			void ProcessFragmentsAck (std::shared_ptr<SentMessage> sentMessage, uint64_t bits);
 
-			void ScheduleResend ();
+			void UpdateRTT (uint64_t rtt);
+			void OnBytesAcked (size_t numBytes);
+			void OnMessageLost (uint64_t ts, bool isTimeout);
+			void ScheduleResend (uint64_t nextResendTime);
 			void HandleResendTimer (const boost::system::error_code& ecode);
 
 		private:
@@ -126,11 +149,18 @@ namespace transport
 			SSUSession& m_Session;
 			std::map<uint32_t, std::shared_ptr<IncompleteMessage> > m_IncompleteMessages;
 			std::map<uint32_t, std::shared_ptr<SentMessage> > m_SentMessages;
+			std::list<std::shared_ptr<i2p::I2NPMessage> > m_SendQueue; // waiting for congestion window
 			std::unordered_map<uint32_t, uint64_t> m_ReceivedMessages; // msgID -> timestamp in seconds
 			boost::asio::deadline_timer m_ResendTimer;
+			uint64_t m_NextResendTime; // in milliseconds, 0 if not scheduled
 			int m_MaxPacketSize, m_PacketSize;
 			i2p::I2NPMessagesHandler m_Handler;
 			uint32_t m_LastMessageReceivedTime; // in second
+			// congestion control
+			double m_RTT, m_RTTVar; // in milliseconds
+			int m_RTO; // in milliseconds
+			size_t m_CongestionWindow, m_SlowStartThreshold, m_BytesInFlight; // in bytes
+			uint64_t m_RecoveryTime; // in milliseconds, window is not reduced again for messages lost before
 	};
 }
 }
@@ -20,10 +20,10 @@ namespace i2p
 {
 namespace transport
 {
-	SSUSession::SSUSession (SSUServer& server, boost::asio::ip::udp::endpoint& remoteEndpoint,
+	SSUSession::SSUSession (SSUServer& server, SSUShard& shard, const boost::asio::ip::udp::endpoint& remoteEndpoint,
 		std::shared_ptr<const i2p::data::RouterInfo> router, bool peerTest ):
 		TransportSession (router, SSU_TERMINATION_TIMEOUT),
-		m_Server (server), m_RemoteEndpoint (remoteEndpoint), m_ConnectTimer (GetService ()),
+		m_Server (server), m_Shard (shard), m_RemoteEndpoint (remoteEndpoint), m_ConnectTimer (GetService ()),
 		m_IsPeerTest (peerTest),m_State (eSessionStateUnknown), m_IsSessionKey (false),
 		m_RelayTag (0), m_SentRelayTag (0), m_Data (*this), m_IsDataReceived (false)
 	{
@@ -50,7 +50,7 @@ namespace transport
 
 	boost::asio::io_service& SSUSession::GetService ()
 	{
-		return m_Server.GetService ();
+		return m_Shard.service;
 	}
 
 	void SSUSession::CreateAESandMacKey (const uint8_t * pubKey)
@@ -411,9 +411,9 @@ namespace transport
 		}
 		// encrypt and send
 		uint8_t iv[16];
-		RAND_bytes (iv, 16); // random iv
+		i2p::crypto::RandBytes (iv, 16); // random iv
 		FillHeaderAndEncrypt (PAYLOAD_TYPE_SESSION_REQUEST, buf, isV4 ? 304 : 320, m_IntroKey, iv, m_IntroKey, flag);
-		m_Server.Send (buf, isV4 ? 304 : 320, m_RemoteEndpoint);
+		m_Server.Send (buf, isV4 ? 304 : 320, m_RemoteEndpoint, m_Shard);
 	}
 
 	void SSUSession::SendRelayRequest (const i2p::data::RouterInfo::Introducer& introducer, uint32_t nonce)
@@ -441,12 +441,12 @@ namespace transport
 		htobe32buf (payload, nonce); // nonce
 
 		uint8_t iv[16];
-		RAND_bytes (iv, 16); // random iv
+		i2p::crypto::RandBytes (iv, 16); // random iv
 		if (m_State == eSessionStateEstablished)
 			FillHeaderAndEncrypt (PAYLOAD_TYPE_RELAY_REQUEST, buf, 96, m_SessionKey, iv, m_MacKey);
 		else
 			FillHeaderAndEncrypt (PAYLOAD_TYPE_RELAY_REQUEST, buf, 96, introducer.iKey, iv, introducer.iKey);
-		m_Server.Send (buf, 96, m_RemoteEndpoint);
+		m_Server.Send (buf, 96, m_RemoteEndpoint, m_Shard);
 		LogPrint (eLogDebug, "SSU: Relay request sent");
 	}
 
@@ -495,7 +495,7 @@ namespace transport
 		s.Insert<uint16_t> (htobe16 (address->port)); // our port
 		if (sendRelayTag && i2p::context.GetRouterInfo ().IsIntroducer (!IsV6 ()))
 		{
-			RAND_bytes((uint8_t *)&m_SentRelayTag, 4);
+			m_SentRelayTag = i2p::crypto::RandUInt32 ();
 			if (!m_SentRelayTag) m_SentRelayTag = 1;
 		}
 		htobe32buf (payload, m_SentRelayTag);
@@ -510,14 +510,14 @@ namespace transport
 		s.Sign (i2p::context.GetPrivateKeys (), payload); // DSA signature
 
 		uint8_t iv[16];
-		RAND_bytes (iv, 16); // random iv
+		i2p::crypto::RandBytes (iv, 16); // random iv
 		// encrypt signature and padding with newly created session key
 		size_t signatureLen = i2p::context.GetIdentity ()->GetSignatureLen ();
 		size_t paddingSize = signatureLen & 0x0F; // %16
 		if (paddingSize > 0)
 		{
 			// fill random padding
-			RAND_bytes(payload + signatureLen, (16 - paddingSize));
+			i2p::crypto::RandBytes (payload + signatureLen, (16 - paddingSize));
 			signatureLen += (16 - paddingSize);
 		}
 		m_SessionKeyEncryption.SetIV (iv);
@@ -547,7 +547,7 @@ namespace transport
 		auto signatureLen = i2p::context.GetIdentity ()->GetSignatureLen ();
 		size_t paddingSize = ((payload - buf) + signatureLen)%16;
 		if (paddingSize > 0) paddingSize = 16 - paddingSize;
-		RAND_bytes(payload, paddingSize); // fill padding with random
+		i2p::crypto::RandBytes (payload, paddingSize); // fill padding with random
 		payload += paddingSize; // padding size
 		// signature
 		SignedData s; // x,y, our IP, our port, remote IP, remote port, relayTag, our signed on time
@@ -559,14 +559,14 @@ namespace transport
 		else
 			s.Insert (m_RemoteEndpoint.address ().to_v6 ().to_bytes ().data (), 16); // remote IP V6
 		s.Insert<uint16_t> (htobe16 (m_RemoteEndpoint.port ())); // remote port
-		s.Insert (htobe32 (m_RelayTag)); // relay tag
+		s.Insert (htobe32 (m_RelayTag.load ())); // relay tag
 		s.Insert (htobe32 (signedOnTime)); // signed on time
 		s.Sign (i2p::context.GetPrivateKeys (), payload); // DSA signature
 		payload += signatureLen;
 
 		size_t msgLen = payload - buf;
 		uint8_t iv[16];
-		RAND_bytes (iv, 16); // random iv
+		i2p::crypto::RandBytes (iv, 16); // random iv
 		// encrypt message with session key
 		FillHeaderAndEncrypt (PAYLOAD_TYPE_SESSION_CONFIRMED, buf, msgLen, m_SessionKey, iv, m_MacKey);
 		Send (buf, msgLen);
@@ -575,23 +575,30 @@ namespace transport
 	void SSUSession::ProcessRelayRequest (const uint8_t * buf, size_t len, const boost::asio::ip::udp::endpoint& from)
 	{
 		uint32_t relayTag = bufbe32toh (buf);
-		auto session = m_Server.FindRelaySession (relayTag);
-		if (session)
-		{
-			buf += 4; // relay tag
-			uint8_t size = *buf;
-			buf++; // size
-			buf += size; // address
-			buf += 2; // port
-			uint8_t challengeSize = *buf;
-			buf++; // challenge size
-			buf += challengeSize;
-			const uint8_t * introKey = buf;
-			buf += 32; // introkey
-			uint32_t nonce = bufbe32toh (buf);
-			SendRelayResponse (nonce, from, introKey, session->m_RemoteEndpoint);
-			SendRelayIntro (session, from);
-		}
+		buf += 4; // relay tag
+		uint8_t size = *buf;
+		buf++; // size
+		buf += size; // address
+		buf += 2; // port
+		uint8_t challengeSize = *buf;
+		buf++; // challenge size
+		buf += challengeSize;
+		i2p::data::RouterInfo::IntroKey introKey (buf);
+		buf += 32; // introkey
+		uint32_t nonce = bufbe32toh (buf);
+		// relays are in server's thread, Charlie's session might be in another shard
+		auto s = shared_from_this ();
+		m_Server.GetService ().post ([s, relayTag, nonce, introKey, from]()
+			{
+				auto session = s->m_Server.FindRelaySession (relayTag);
+				if (session)
+				{
+					auto to = session->GetRemoteEndpoint ();
+					s->GetService ().post ([s, nonce, from, introKey, to]()
+						{ s->SendRelayResponse (nonce, from, introKey, to); });
+					session->GetService ().post ([session, from]() { session->SendRelayIntro (from); });
+				}
+			});
 	}
 
 	void SSUSession::SendRelayResponse (uint32_t nonce, const boost::asio::ip::udp::endpoint& from,
@@ -652,18 +659,17 @@ namespace transport
 		{
 			// ecrypt with Alice's intro key
 			uint8_t iv[16];
-			RAND_bytes (iv, 16); // random iv
+			i2p::crypto::RandBytes (iv, 16); // random iv
 			FillHeaderAndEncrypt (PAYLOAD_TYPE_RELAY_RESPONSE, buf, isV4 ? 64 : 80, introKey, iv, introKey);
-			m_Server.Send (buf, isV4 ? 64 : 80, from);
+			m_Server.Send (buf, isV4 ? 64 : 80, from, m_Shard);
 		}
 		LogPrint (eLogDebug, "SSU: Relay response sent");
 	}
 
-	void SSUSession::SendRelayIntro (std::shared_ptr<SSUSession> session, const boost::asio::ip::udp::endpoint& from)
+	void SSUSession::SendRelayIntro (const boost::asio::ip::udp::endpoint& from)
 	{
-		if (!session) return;
 		bool isV4 = from.address ().is_v4 (); // Alice's
-		bool isV4C = session->m_RemoteEndpoint.address ().is_v4 (); // Charlie's
+		bool isV4C = m_RemoteEndpoint.address ().is_v4 (); // Charlie's
 		if ((isV4 && !isV4C) || (!isV4 && isV4C))
 		{
 			LogPrint (eLogWarning, "SSU: Charlie's IP and Alice's IP belong to different networks for relay intro");
@@ -689,9 +695,9 @@ namespace transport
 		payload += 2; // port
 		*payload = 0; // challenge size
 		uint8_t iv[16];
-		RAND_bytes (iv, 16); // random iv
-		FillHeaderAndEncrypt (PAYLOAD_TYPE_RELAY_INTRO, buf, isV4 ? 48 : 64, session->m_SessionKey, iv, session->m_MacKey);
-		m_Server.Send (buf, isV4 ? 48 : 64, session->m_RemoteEndpoint);
+		i2p::crypto::RandBytes (iv, 16); // random iv
+		FillHeaderAndEncrypt (PAYLOAD_TYPE_RELAY_INTRO, buf, isV4 ? 48 : 64, m_SessionKey, iv, m_MacKey);
+		m_Server.Send (buf, isV4 ? 48 : 64, m_RemoteEndpoint, m_Shard);
 		LogPrint (eLogDebug, "SSU: Relay intro sent");
 	}
 
@@ -737,7 +743,7 @@ namespace transport
 				LogPrint (eLogInfo, "SSU: RelayReponse connecting to endpoint ", remoteEndpoint);
 				if ((remoteIP.is_v4 () && i2p::context.GetStatus () == eRouterStatusFirewalled) ||
 					(remoteIP.is_v6 () && i2p::context.GetStatusV6 () == eRouterStatusFirewalled))
-					m_Server.Send (buf, 0, remoteEndpoint); // send HolePunch
+					m_Server.Send (buf, 0, remoteEndpoint, m_Shard); // send HolePunch
 				// we assume that HolePunch has been sent by this time and our SessionRequest will go through
 				m_Server.CreateDirectSession (it->second.first, remoteEndpoint, false);
 			}
@@ -757,7 +763,7 @@ namespace transport
 		ExtractIPAddressAndPort (buf, len, ip, port);
 		if (!ip.is_unspecified () && port)
 			// send hole punch of 0 bytes
-			m_Server.Send (buf, 0, boost::asio::ip::udp::endpoint (ip, port));
+			m_Server.Send (buf, 0, boost::asio::ip::udp::endpoint (ip, port), m_Shard);
 	}
 
 	void SSUSession::FillHeaderAndEncrypt (uint8_t payloadType, uint8_t * buf, size_t len,
@@ -798,7 +804,7 @@ namespace transport
 			return;
 		}
 		SSUHeader * header = (SSUHeader *)out;
-		RAND_bytes (header->iv, 16); // random iv
+		i2p::crypto::RandBytes (header->iv, 16); // random iv
 		m_SessionKeyEncryption.SetIV (header->iv);
 		SSUHeader * inHeader = (SSUHeader *)in;
 		inHeader->flag = payloadType << 4; // MSB is 0
@@ -913,7 +919,7 @@ namespace transport
 				shared_from_this (), std::placeholders::_1));
 		}
 		uint32_t nonce;
-		RAND_bytes ((uint8_t *)&nonce, 4);
+		nonce = i2p::crypto::RandUInt32 ();
 		auto ts = i2p::util::GetSecondsSinceEpoch ();
 		m_RelayRequests.emplace (nonce, std::make_pair (to, ts));
 		SendRelayRequest (introducer, nonce);
@@ -943,7 +949,10 @@ namespace transport
 		m_ConnectTimer.cancel ();
 		if (m_SentRelayTag)
 		{
-			m_Server.RemoveRelay (m_SentRelayTag); // relay tag is not valid anymore
+			// relay tag is not valid anymore
+			auto tag = m_SentRelayTag;
+			auto& server = m_Server;
+			m_Server.GetService ().post ([&server, tag]() { server.RemoveRelay (tag); });
 			m_SentRelayTag = 0;
 		}
 		m_DHKeysPair = nullptr;
@@ -966,7 +975,11 @@ namespace transport
 		if (m_IsPeerTest)
 			SendPeerTest ();
 		if (m_SentRelayTag)
-			m_Server.AddRelay (m_SentRelayTag, shared_from_this ());
+		{
+			auto s = shared_from_this ();
+			auto tag = m_SentRelayTag;
+			m_Server.GetService ().post ([s, tag]() { s->m_Server.AddRelay (tag, s); });
+		}
 		m_LastActivityTimestamp = i2p::util::GetSecondsSinceEpoch ();
 	}
 
@@ -1037,7 +1050,18 @@ namespace transport
 			LogPrint (eLogWarning, "SSU: Address of ", size - 3, " bytes not supported");
 			return;
 		}
-		const uint8_t * introKey = buf + 4 + size;
+		i2p::data::RouterInfo::IntroKey introKey (buf + 4 + size);
+		auto msg = std::make_shared<std::vector<uint8_t> > (buf, buf + len);
+		// peer tests are in server's thread
+		auto s = shared_from_this ();
+		m_Server.GetService ().post ([s, nonce, addr, port, introKey, msg, senderEndpoint]()
+			{ s->HandlePeerTest (nonce, addr, port, introKey, msg, senderEndpoint); });
+	}
+
+	void SSUSession::HandlePeerTest (uint32_t nonce, const boost::asio::ip::address& addr, uint16_t port,
+		const i2p::data::RouterInfo::IntroKey& introKey, std::shared_ptr<std::vector<uint8_t> > msg,
+		const boost::asio::ip::udp::endpoint& senderEndpoint)
+	{
 		switch (m_Server.GetPeerTestParticipant (nonce))
 		{
 			// existing test
@@ -1070,7 +1094,7 @@ namespace transport
 					else
 						i2p::context.SetStatus (eRouterStatusOK);
 					m_Server.UpdatePeerTest (nonce, ePeerTestParticipantAlice2);
-					SendPeerTest (nonce, senderEndpoint.address (), senderEndpoint.port (), introKey, true, false); // to Charlie
+					PostPeerTest (nonce, senderEndpoint.address (), senderEndpoint.port (), introKey, true, false); // to Charlie
 				}
 				break;
 			}
@@ -1097,7 +1121,7 @@ namespace transport
 				if (session && session->m_State == eSessionStateEstablished)
 				{
 					const auto& ep = session->GetRemoteEndpoint (); // Alice's endpoint as known to Bob
-					session->SendPeerTest (nonce, ep.address (), ep.port (), introKey, false, true); // send back to Alice
+					session->PostPeerTest (nonce, ep.address (), ep.port (), introKey, false, true); // send back to Alice
 				}
 				m_Server.RemovePeerTest (nonce); // nonce has been used
 				break;
@@ -1105,7 +1129,7 @@ namespace transport
 			case ePeerTestParticipantCharlie:
 			{
 				LogPrint (eLogDebug, "SSU: Peer test from Alice. We are Charlie");
-				SendPeerTest (nonce, senderEndpoint.address (), senderEndpoint.port (), introKey); // to Alice with her actual address
+				PostPeerTest (nonce, senderEndpoint.address (), senderEndpoint.port (), introKey); // to Alice with her actual address
 				m_Server.RemovePeerTest (nonce); // nonce has been used
 				break;
 			}
@@ -1118,11 +1142,12 @@ namespace transport
 					if (port)
 					{
 						LogPrint (eLogDebug, "SSU: Peer test from Bob. We are Charlie");
-						Send (PAYLOAD_TYPE_PEER_TEST, buf, len); // back to Bob
+						auto s = shared_from_this ();
+						GetService ().post ([s, msg]() { s->Send (PAYLOAD_TYPE_PEER_TEST, msg->data (), msg->size ()); }); // back to Bob
 						if (!addr.is_unspecified () && !i2p::util::net::IsInReservedRange(addr))
 						{
 							m_Server.NewPeerTest (nonce, ePeerTestParticipantCharlie);
-							SendPeerTest (nonce, addr, port, introKey); // to Alice with her address received from Bob
+							PostPeerTest (nonce, addr, port, introKey); // to Alice with her address received from Bob
 						}
 					}
 					else
@@ -1132,7 +1157,7 @@ namespace transport
 						if (session)
 						{
 							m_Server.NewPeerTest (nonce, ePeerTestParticipantBob, shared_from_this ());
-							session->SendPeerTest (nonce, senderEndpoint.address (), senderEndpoint.port (), introKey, false); // to Charlie with Alice's actual address
+							session->PostPeerTest (nonce, senderEndpoint.address (), senderEndpoint.port (), introKey, false); // to Charlie with Alice's actual address
 						}
 					}
 				}
@@ -1191,13 +1216,13 @@ namespace transport
 			memcpy (payload, introKey, 32); // intro key
 
 		// send
-		RAND_bytes (iv, 16); // random iv
+		i2p::crypto::RandBytes (iv, 16); // random iv
 		if (toAddress)
 		{
 			// encrypt message with specified intro key
 			FillHeaderAndEncrypt (PAYLOAD_TYPE_PEER_TEST, buf, 80, introKey, iv, introKey);
 			boost::asio::ip::udp::endpoint e (address, port);
-			m_Server.Send (buf, 80, e);
+			m_Server.Send (buf, 80, e, m_Shard);
 		}
 		else
 		{
@@ -1218,11 +1243,25 @@ namespace transport
 			return;
 		}
 		uint32_t nonce;
-		RAND_bytes ((uint8_t *)&nonce, 4);
+		nonce = i2p::crypto::RandUInt32 ();
 		if (!nonce) nonce = 1;
 		m_IsPeerTest = false;
-		m_Server.NewPeerTest (nonce, ePeerTestParticipantAlice1, shared_from_this ());
-		SendPeerTest (nonce, boost::asio::ip::address(), 0, address->i, false, false); // address and port always zero for Alice
+		auto s = shared_from_this ();
+		i2p::data::RouterInfo::IntroKey introKey (address->i);
+		m_Server.GetService ().post ([s, nonce, introKey]()
+			{
+				s->m_Server.NewPeerTest (nonce, ePeerTestParticipantAlice1, s);
+				s->PostPeerTest (nonce, boost::asio::ip::address(), 0, introKey, false, false); // address and port always zero for Alice
+			});
+	}
+
+	void SSUSession::PostPeerTest (uint32_t nonce, const boost::asio::ip::address& address, uint16_t port,
+		const uint8_t * introKey, bool toAddress, bool sendAddress)
+	{
+		auto s = shared_from_this ();
+		i2p::data::RouterInfo::IntroKey key (introKey);
+		GetService ().post ([s, nonce, address, port, key, toAddress, sendAddress]()
+			{ s->SendPeerTest (nonce, address, port, key, toAddress, sendAddress); });
 	}
 
 	void SSUSession::SendKeepAlive ()
@@ -1282,7 +1321,7 @@ namespace transport
 	{
 		m_NumSentBytes += size;
 		i2p::transport::transports.UpdateSentBytes (size);
-		m_Server.Send (buf, size, m_RemoteEndpoint);
+		m_Server.Send (buf, size, m_RemoteEndpoint, m_Shard);
 	}
 
 	size_t SSUSession::ExtractIPAddressAndPort (const uint8_t * buf, size_t len, boost::asio::ip::address& ip, uint16_t& port)
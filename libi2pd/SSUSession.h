@@ -12,6 +12,7 @@
 #include <inttypes.h>
 #include <set>
 #include <memory>
+#include <atomic>
 #include "Crypto.h"
 #include "I2NPProtocol.h"
 #include "TransportSession.h"
@@ -72,11 +73,12 @@ namespace transport
 	};
 
 	class SSUServer;
+	struct SSUShard;
 	class SSUSession: public TransportSession, public std::enable_shared_from_this<SSUSession>
 	{
 		public:
 
-			SSUSession (SSUServer& server, boost::asio::ip::udp::endpoint& remoteEndpoint,
+			SSUSession (SSUServer& server, SSUShard& shard, const boost::asio::ip::udp::endpoint& remoteEndpoint,
 				std::shared_ptr<const i2p::data::RouterInfo> router = nullptr, bool peerTest = false);
 			void ProcessNextMessage (uint8_t * buf, size_t len, const boost::asio::ip::udp::endpoint& senderEndpoint);
 			~SSUSession ();
@@ -91,6 +93,7 @@ namespace transport
 			void Failed ();
 			const boost::asio::ip::udp::endpoint& GetRemoteEndpoint () { return m_RemoteEndpoint; };
 			SSUServer& GetServer () { return m_Server; };
+			SSUShard& GetShard () { return m_Shard; };
 
 			bool IsV6 () const { return m_RemoteEndpoint.address ().is_v6 (); };
 			void SendI2NPMessages (const std::vector<std::shared_ptr<I2NPMessage> >& msgs);
@@ -99,6 +102,8 @@ namespace transport
 			SessionState GetState () const { return m_State; };
 			size_t GetNumSentBytes () const { return m_NumSentBytes; };
 			size_t GetNumReceivedBytes () const { return m_NumReceivedBytes; };
+			double GetRTT () const { return m_Data.GetRTT (); }; // in milliseconds
+			size_t GetCongestionWindow () const { return m_Data.GetCongestionWindow (); }; // in bytes
 
 			void SendKeepAlive ();
 			uint32_t GetRelayTag () const { return m_RelayTag; };
@@ -126,14 +131,17 @@ namespace transport
 			void ProcessRelayRequest (const uint8_t * buf, size_t len, const boost::asio::ip::udp::endpoint& from);
 			void SendRelayResponse (uint32_t nonce, const boost::asio::ip::udp::endpoint& from,
 				const uint8_t * introKey, const boost::asio::ip::udp::endpoint& to);
-			void SendRelayIntro (std::shared_ptr<SSUSession> session, const boost::asio::ip::udp::endpoint& from);
+			void SendRelayIntro (const boost::asio::ip::udp::endpoint& from); // to Charlie
 			void ProcessRelayResponse (const uint8_t * buf, size_t len);
 			void ProcessRelayIntro (const uint8_t * buf, size_t len);
 			void Established ();
 			void ScheduleConnectTimer ();
 			void HandleConnectTimer (const boost::system::error_code& ecode);
 			void ProcessPeerTest (const uint8_t * buf, size_t len, const boost::asio::ip::udp::endpoint& senderEndpoint);
+			void HandlePeerTest (uint32_t nonce, const boost::asio::ip::address& addr, uint16_t port, const i2p::data::RouterInfo::IntroKey& introKey,
+				std::shared_ptr<std::vector<uint8_t> > msg, const boost::asio::ip::udp::endpoint& senderEndpoint); // in server's thread
 			void SendPeerTest (uint32_t nonce, const boost::asio::ip::address& address, uint16_t port, const uint8_t * introKey, bool toAddress = true, bool sendAddress = true);
+			void PostPeerTest (uint32_t nonce, const boost::asio::ip::address& address, uint16_t port, const uint8_t * introKey, bool toAddress = true, bool sendAddress = true);
 			void ProcessData (uint8_t * buf, size_t len);
 			void SendSessionDestroyed ();
 			void Send (uint8_t type, const uint8_t * payload, size_t len); // with session key
@@ -155,19 +163,20 @@ namespace transport
 
 			friend class SSUData; // TODO: change in later
 			SSUServer& m_Server;
+			SSUShard& m_Shard;
 			const boost::asio::ip::udp::endpoint m_RemoteEndpoint;
 			boost::asio::deadline_timer m_ConnectTimer;
 			bool m_IsPeerTest;
-			SessionState m_State;
+			std::atomic<SessionState> m_State; // also read by server's thread
 			bool m_IsSessionKey;
-			uint32_t m_RelayTag; // received from peer
+			std::atomic<uint32_t> m_RelayTag; // received from peer
 			uint32_t m_SentRelayTag; // sent by us
 			i2p::crypto::CBCEncryption m_SessionKeyEncryption;
 			i2p::crypto::CBCDecryption m_SessionKeyDecryption;
 			i2p::crypto::AESKey m_SessionKey;
 			i2p::crypto::MACKey m_MacKey;
 			i2p::data::RouterInfo::IntroKey m_IntroKey;
-			uint32_t m_CreationTime; // seconds since epoch
+			std::atomic<uint32_t> m_CreationTime; // seconds since epoch
 			SSUData m_Data;
 			bool m_IsDataReceived;
 			std::unique_ptr<SignedData> m_SignedData; // we need it for SessionConfirmed only
@@ -19,9 +19,9 @@ namespace i2p
 {
 namespace stream
 {
-	void SendBufferQueue::Add (const uint8_t * buf, size_t len, SendHandler handler)
+	void SendBufferQueue::Add (const uint8_t * buf, size_t len, SendHandler handler, bool copy)
 	{
-		Add (std::make_shared<SendBuffer>(buf, len, handler));
+		Add (std::make_shared<SendBuffer>(buf, len, handler, copy));
 	}
 
 	void SendBufferQueue::Add (std::shared_ptr<SendBuffer> buf)
@@ -74,26 +74,27 @@ namespace stream
 	Stream::Stream (boost::asio::io_service& service, StreamingDestination& local,
 		std::shared_ptr<const i2p::data::LeaseSet> remote, int port): m_Service (service),
 		m_SendStreamID (0), m_SequenceNumber (0), m_LastReceivedSequenceNumber (-1),
-		m_Status (eStreamStatusNew), m_IsAckSendScheduled (false), m_LocalDestination (local),
+		m_Status (eStreamStatusNew), m_IsAckSendScheduled (false), m_IsPacingScheduled (false), m_LocalDestination (local),
 		m_RemoteLeaseSet (remote), m_ReceiveTimer (m_Service), m_ResendTimer (m_Service),
-		m_AckSendTimer (m_Service), m_NumSentBytes (0), m_NumReceivedBytes (0), m_Port (port),
-		m_WindowSize (MIN_WINDOW_SIZE), m_RTT (INITIAL_RTT), m_RTO (INITIAL_RTO),
-		m_AckDelay (local.GetOwner ()->GetStreamingAckDelay ()),
-		m_LastWindowSizeIncreaseTime (0), m_NumResendAttempts (0), m_MTU (STREAMING_MTU)
+		m_AckSendTimer (m_Service), m_PacingTimer (m_Service), m_NumSentBytes (0), m_NumReceivedBytes (0), m_Port (port),
+		m_RTT (INITIAL_RTT), m_RTTVar (0), m_RTO (INITIAL_RTO), m_AckDelay (local.GetOwner ()->GetStreamingAckDelay ()),
+		m_IsFirstRTTSample (true), m_NumResendAttempts (0), m_CongestionControl (CreateCongestionControl (local.GetOwner ()->GetStreamingCongestionControl ())),
+		m_NextSendTime (0), m_MTU (STREAMING_MTU)
 	{
-		RAND_bytes ((uint8_t *)&m_RecvStreamID, 4);
+		m_RecvStreamID = i2p::crypto::RandUInt32 ();
 		m_RemoteIdentity = remote->GetIdentity ();
 	}
 
 	Stream::Stream (boost::asio::io_service& service, StreamingDestination& local):
 		m_Service (service), m_SendStreamID (0), m_SequenceNumber (0), m_LastReceivedSequenceNumber (-1),
-		m_Status (eStreamStatusNew), m_IsAckSendScheduled (false), m_LocalDestination (local),
-		m_ReceiveTimer (m_Service), m_ResendTimer (m_Service), m_AckSendTimer (m_Service),
-		m_NumSentBytes (0), m_NumReceivedBytes (0), m_Port (0), m_WindowSize (MIN_WINDOW_SIZE),
-		m_RTT (INITIAL_RTT), m_RTO (INITIAL_RTO), m_AckDelay (local.GetOwner ()->GetStreamingAckDelay ()),
-		m_LastWindowSizeIncreaseTime (0), m_NumResendAttempts (0), m_MTU (STREAMING_MTU)
+		m_Status (eStreamStatusNew), m_IsAckSendScheduled (false), m_IsPacingScheduled (false), m_LocalDestination (local),
+		m_ReceiveTimer (m_Service), m_ResendTimer (m_Service), m_AckSendTimer (m_Service), m_PacingTimer (m_Service),
+		m_NumSentBytes (0), m_NumReceivedBytes (0), m_Port (0),
+		m_RTT (INITIAL_RTT), m_RTTVar (0), m_RTO (INITIAL_RTO), m_AckDelay (local.GetOwner ()->GetStreamingAckDelay ()),
+		m_IsFirstRTTSample (true), m_NumResendAttempts (0), m_CongestionControl (CreateCongestionControl (local.GetOwner ()->GetStreamingCongestionControl ())),
+		m_NextSendTime (0), m_MTU (STREAMING_MTU)
 	{
-		RAND_bytes ((uint8_t *)&m_RecvStreamID, 4);
+		m_RecvStreamID = i2p::crypto::RandUInt32 ();
 	}
 
 	Stream::~Stream ()
@@ -108,6 +109,7 @@ namespace stream
 		m_AckSendTimer.cancel ();
 		m_ReceiveTimer.cancel ();
 		m_ResendTimer.cancel ();
+		m_PacingTimer.cancel ();
 		//CleanUp (); /* Need to recheck - broke working on windows */
 		if (deleteFromDestination)
 			m_LocalDestination.DeleteStream (shared_from_this ());
@@ -407,6 +409,7 @@ namespace stream
 			return;
 		}
 		int nackCount = packet->GetNACKCount ();
+		std::vector<Packet *> lostPackets;
 		for (auto it = m_SentPackets.begin (); it != m_SentPackets.end ();)
 		{
 			auto seqn = (*it)->GetSeqn ();
@@ -424,6 +427,11 @@ namespace stream
 					if (nacked)
 					{
 						LogPrint (eLogDebug, "Streaming: Packet ", seqn, " NACK");
+						// later packet has been received, don't count if it was sent before resent one
+						if (ackThrough >= (*it)->nextSeqn) (*it)->numNACKs++;
+						if ((*it)->numNACKs >= FAST_RESEND_NUM_NACKS &&
+							ts >= (*it)->sendTime + m_RTT + m_RTT/4) // not reordered
+							lostPackets.push_back (*it);
 						++it;
 						continue;
 					}
@@ -435,24 +443,13 @@ namespace stream
 					LogPrint(eLogError, "Streaming: Packet ", seqn, "sent from the future, sendTime=", sentPacket->sendTime);
 					rtt = 1;
 				}
-				m_RTT = (m_RTT*seqn + rtt)/(seqn + 1);
-				m_RTO = m_RTT*1.5; // TODO: implement it better
+				if (!sentPacket->isResent) // Karn's algorithm
+					UpdateRTT (rtt);
 				LogPrint (eLogDebug, "Streaming: Packet ", seqn, " acknowledged rtt=", rtt, " sentTime=", sentPacket->sendTime);
+				m_CongestionControl->OnPacketAcked (seqn, ts, sentPacket->GetLength (), rtt, m_RTT);
 				m_SentPackets.erase (it++);
 				m_LocalDestination.DeletePacket (sentPacket);
 				acknowledged = true;
-				if (m_WindowSize < WINDOW_SIZE)
-					m_WindowSize++; // slow start
-				else
-				{
-					// linear growth
-					if (ts > m_LastWindowSizeIncreaseTime + m_RTT)
-					{
-						m_WindowSize++;
-						if (m_WindowSize > MAX_WINDOW_SIZE) m_WindowSize = MAX_WINDOW_SIZE;
-						m_LastWindowSizeIncreaseTime = ts;
-					}
-				}
 				if (!seqn && m_RoutingSession) // first message confirmed
 					m_RoutingSession->SetSharedRoutingPath (
 						std::make_shared<i2p::garlic::GarlicRoutingPath> (
@@ -461,6 +458,21 @@ namespace stream
 			else
 				break;
 		}
+		if (!lostPackets.empty ())
+		{
+			// resend packets reported missing by few ACKs without waiting for resend timer
+			for (auto it: lostPackets)
+			{
+				LogPrint (eLogDebug, "Streaming: Packet ", it->GetSeqn (), " is lost, fast resend");
+				m_CongestionControl->OnPacketLost (it->GetSeqn (), ts);
+				it->sendTime = ts;
+				it->nextSeqn = m_SequenceNumber;
+				it->numNACKs = 0;
+				it->isResent = true;
+				m_CongestionControl->OnPacketSent (it->GetSeqn (), ts, it->GetLength ());
+			}
+			SendPackets (lostPackets);
+		}
 		if (m_SentPackets.empty ())
 			m_ResendTimer.cancel ();
 		if (acknowledged)
@@ -474,6 +486,24 @@ namespace stream
 			Close (); // check is all outgoing messages have been sent and we can send close
 	}
 
+	void Stream::UpdateRTT (int rtt)
+	{
+		// RFC 6298
+		if (m_IsFirstRTTSample)
+		{
+			m_RTT = rtt;
+			m_RTTVar = rtt/2;
+			m_IsFirstRTTSample = false;
+		}
+		else
+		{
+			m_RTTVar = (3*m_RTTVar + std::abs (m_RTT - rtt))/4;
+			m_RTT = (7*m_RTT + rtt)/8;
+		}
+		m_RTO = m_RTT + std::max (4*m_RTTVar, MIN_RTO_VARIANCE);
+		if (m_RTO > MAX_RTO) m_RTO = MAX_RTO;
+	}
+
 	size_t Stream::Send (const uint8_t * buf, size_t len)
 	{
 		AsyncSend (buf, len, nullptr);
@@ -485,7 +515,7 @@ namespace stream
 		if (len > 0 && buf)
 		{
 			std::unique_lock<std::mutex> l(m_SendBufferMutex);
-			m_SendBuffer.Add (buf, len, handler);
+			m_SendBuffer.Add (buf, len, handler, !handler); // caller keeps buf until handler is called
 		}
 		else if (handler)
 			handler(boost::system::error_code ());
@@ -494,8 +524,25 @@ namespace stream
 
 	void Stream::SendBuffer ()
 	{
-		int numMsgs = m_WindowSize - m_SentPackets.size ();
+		int numMsgs = m_CongestionControl->GetWindowSize () - m_SentPackets.size ();
 		if (numMsgs <= 0) return; // window is full
+		auto pacingInterval = m_CongestionControl->GetPacingInterval ();
+		uint64_t pacingStart = 0;
+		if (pacingInterval && IsEstablished ())
+		{
+			auto ts = i2p::util::GetMonotonicMicroseconds ();
+			if (ts < m_NextSendTime)
+			{
+				SchedulePacing (m_NextSendTime - ts);
+				return;
+			}
+			// catch up with few packets if we are late
+			pacingStart = m_NextSendTime;
+			if (ts > pacingStart + (MAX_PACING_BURST - 1)*pacingInterval)
+				pacingStart = ts - (MAX_PACING_BURST - 1)*pacingInterval;
+			int numPaced = 1 + (ts - pacingStart)/pacingInterval;
+			if (numMsgs > numPaced) numMsgs = numPaced;
+		}
 
 		bool isNoAck = m_LastReceivedSequenceNumber < 0; // first packet
 		std::vector<Packet *> packets;
@@ -587,15 +634,44 @@ namespace stream
 			{
 				it->sendTime = ts;
 				m_SentPackets.insert (it);
+				m_CongestionControl->OnPacketSent (it->GetSeqn (), ts, it->GetLength ());
 			}
 			SendPackets (packets);
 			if (m_Status == eStreamStatusClosing && m_SendBuffer.IsEmpty ())
 				SendClose ();
 			if (isEmpty)
 				ScheduleResend ();
+			if (pacingInterval && IsEstablished ())
+			{
+				m_NextSendTime = pacingStart + packets.size ()*pacingInterval;
+				if (!m_SendBuffer.IsEmpty ()) // more to send later
+				{
+					// might be in the past if burst was limited by window
+					auto ts = i2p::util::GetMonotonicMicroseconds ();
+					SchedulePacing (ts < m_NextSendTime ? m_NextSendTime - ts : 0);
+				}
+			}
+		}
+	}
+
+	void Stream::SchedulePacing (uint64_t interval)
+	{
+		if (!m_IsPacingScheduled && m_Status != eStreamStatusTerminated)
+		{
+			m_IsPacingScheduled = true;
+			m_PacingTimer.expires_from_now (boost::posix_time::microseconds(interval));
+			m_PacingTimer.async_wait (std::bind (&Stream::HandlePacingTimer,
+				shared_from_this (), std::placeholders::_1));
 		}
 	}
 
+	void Stream::HandlePacingTimer (const boost::system::error_code& ecode)
+	{
+		m_IsPacingScheduled = false;
+		if (ecode != boost::asio::error::operation_aborted)
+			SendBuffer ();
+	}
+
 	void Stream::SendQuickAck ()
 	{
 		int32_t lastReceivedSeqn = m_LastReceivedSequenceNumber;
@@ -796,6 +872,7 @@ namespace stream
 			SendPackets (std::vector<Packet *> { packet });
 			bool isEmpty = m_SentPackets.empty ();
 			m_SentPackets.insert (packet);
+			m_CongestionControl->OnPacketSent (packet->GetSeqn (), i2p::util::GetMillisecondsSinceEpoch (), packet->GetLength ());
 			if (isEmpty)
 				ScheduleResend ();
 			return true;
@@ -825,8 +902,8 @@ namespace stream
 			{
 				m_CurrentOutboundTunnel = routingPath->outboundTunnel;
 				m_CurrentRemoteLease = routingPath->remoteLease;
-				m_RTT = routingPath->rtt;
-				m_RTO = m_RTT*1.5; // TODO: implement it better
+				m_IsFirstRTTSample = true; // estimate of another stream
+				UpdateRTT (routingPath->rtt);
 			}
 		}
 
@@ -855,7 +932,7 @@ namespace stream
 			for (const auto& it: packets)
 			{
 				auto msg = m_RoutingSession->WrapSingleMessage (m_LocalDestination.CreateDataMessage (
-					it->GetBuffer (), it->GetLength (), m_Port, !m_RoutingSession->IsRatchets ()));
+					it, m_Port, !m_RoutingSession->IsRatchets ()));
 				msgs.push_back (i2p::tunnel::TunnelMessageBlock
 					{
 						i2p::tunnel::eDeliveryTypeTunnel,
@@ -935,7 +1012,11 @@ namespace stream
 				if (ts >= it->sendTime + m_RTO)
 				{
 					it->sendTime = ts;
+					it->nextSeqn = m_SequenceNumber;
+					it->numNACKs = 0;
+					it->isResent = true;
 					packets.push_back (it);
+					m_CongestionControl->OnPacketSent (it->GetSeqn (), ts, it->GetLength ());
 				}
 			}
 
@@ -943,15 +1024,15 @@ namespace stream
 			if (packets.size () > 0)
 			{
 				m_NumResendAttempts++;
-				m_RTO *= 2;
+				m_RTO *= 2; // back off
+				if (m_RTO > MAX_RTO) m_RTO = MAX_RTO;
+				m_CongestionControl->OnResendTimeout (ts, m_NumResendAttempts);
 				switch (m_NumResendAttempts)
 				{
-					case 1: // congesion avoidance
-						m_WindowSize >>= 1; // /2
-						if (m_WindowSize < MIN_WINDOW_SIZE) m_WindowSize = MIN_WINDOW_SIZE;
-					break;
 					case 2:
-						m_RTO = INITIAL_RTO; // drop RTO to initial upon tunnels pair change first time
+						// drop RTO to initial upon tunnels pair change first time, estimate starts over
+						if (m_RTO > INITIAL_RTO) m_RTO = INITIAL_RTO;
+						m_IsFirstRTTSample = true;
 #if (__cplusplus >= 201703L) // C++ 17 or higher
 						[[fallthrough]];
 #endif
@@ -1386,5 +1467,24 @@ namespace stream
 		return msg;
 	}
 
+	std::shared_ptr<I2NPMessage> StreamingDestination::CreateDataMessage (Packet * packet, uint16_t toPort, bool checksum)
+	{
+		if (m_Gzip && m_Deflator)
+			return CreateDataMessage (packet->GetBuffer (), packet->GetLength (), toPort, checksum);
+		// build uncompressed message around the packet in place, message must be copied before packet is deleted
+		auto msg = std::make_shared<I2NPMessage> ();
+		msg->buf = packet->data;
+		msg->maxLen = sizeof (packet->data);
+		uint8_t * buf = msg->GetPayload () + 4; // gzip header, packet follows
+		size_t size = i2p::data::GzipNoCompressionInPlace (buf, packet->GetLength ());
+		htobe32buf (msg->GetPayload (), size); // length
+		htobe16buf (buf + 4, m_LocalPort); // source port
+		htobe16buf (buf + 6, toPort); // destination port
+		buf[9] = i2p::client::PROTOCOL_TYPE_STREAMING; // streaming protocol
+		msg->len += 4 + size;
+		msg->FillI2NPMessageHeader (eI2NPData, 0, checksum);
+		return msg;
+	}
+
 }
 }
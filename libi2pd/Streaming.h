@@ -1,5 +1,5 @@
 /*
-* Copyright (c) 2013-2021, The PurpleI2P Project
+* Copyright (c) 2013-2022, The PurpleI2P Project
 *
 * This file is part of Purple i2pd project and licensed under BSD3
 *
@@ -26,6 +26,7 @@
 #include "Garlic.h"
 #include "Tunnel.h"
 #include "util.h" // MemoryPool
+#include "StreamingCongestionControl.h"
 
 namespace i2p
 {
@@ -51,26 +52,36 @@ namespace stream
 	const size_t STREAMING_MTU = 1730;
 	const size_t STREAMING_MTU_RATCHETS = 1812;
 	const size_t MAX_PACKET_SIZE = 4096;
+	const size_t PACKET_HEADROOM = 2 + I2NP_HEADER_SIZE + 4 + 15; // I2NP data message with length and uncompressed gzip header
+	const size_t PACKET_TAILROOM = 8; // gzip CRC32 and size
 	const size_t COMPRESSION_THRESHOLD_SIZE = 66;
 	const int MAX_NUM_RESEND_ATTEMPTS = 6;
-	const int WINDOW_SIZE = 6; // in messages
-	const int MIN_WINDOW_SIZE = 1;
-	const int MAX_WINDOW_SIZE = 128;
 	const int INITIAL_RTT = 8000; // in milliseconds
 	const int INITIAL_RTO = 9000; // in milliseconds
+	const int MIN_RTO_VARIANCE = 200; // RTO exceeds RTT at least that much, delayed ACK and jitter, in milliseconds
+	const int MAX_RTO = 60000; // in milliseconds
+	const int FAST_RESEND_NUM_NACKS = 3; // ACKs reporting packet missing, as duplicate ACKs
 	const int MIN_SEND_ACK_TIMEOUT = 2; // in milliseconds
 	const int SYN_TIMEOUT = 200; // how long we wait for SYN after follow-on, in milliseconds
 	const size_t MAX_PENDING_INCOMING_BACKLOG = 128;
 	const int PENDING_INCOMING_TIMEOUT = 10; // in seconds
 	const int MAX_RECEIVE_TIMEOUT = 20; // in seconds
+	const int MAX_PACING_BURST = 4; // packets sent at once if paced
 
 	struct Packet
 	{
 		size_t len, offset;
-		uint8_t buf[MAX_PACKET_SIZE];
+		uint8_t data[PACKET_HEADROOM + MAX_PACKET_SIZE + PACKET_TAILROOM]; // uncompressed data message is built around buf
+		uint8_t * const buf;
 		uint64_t sendTime;
-
-		Packet (): len (0), offset (0), sendTime (0) {};
+		// scoreboard of sent packet
+		uint32_t nextSeqn; // sent after last send, NACKs in ACKs through earlier packets are outdated
+		int numNACKs; // since last send
+		bool isResent; // ACK doesn't give RTT
+
+		Packet (): len (0), offset (0), buf (data + PACKET_HEADROOM), sendTime (0), nextSeqn (0), numNACKs (0), isResent (false) {};
+		Packet (const Packet&) = delete;
+		Packet& operator= (const Packet&) = delete;
 		uint8_t * GetBuffer () { return buf + offset; };
 		size_t GetLength () const { return len - offset; };
 
@@ -105,21 +116,27 @@ namespace stream
 		uint8_t * buf;
 		size_t len, offset;
 		SendHandler handler;
+		bool isOwner; // false if buf is caller's, it must stay valid until handler is called
 
-		SendBuffer (const uint8_t * b, size_t l, SendHandler h):
-			len(l), offset (0), handler(h)
+		SendBuffer (const uint8_t * b, size_t l, SendHandler h, bool copy = true):
+			len(l), offset (0), handler(h), isOwner (copy)
 		{
-			buf = new uint8_t[len];
-			memcpy (buf, b, len);
+			if (copy)
+			{
+				buf = new uint8_t[len];
+				memcpy (buf, b, len);
+			}
+			else
+				buf = const_cast<uint8_t *>(b); // read only
 		}
 		SendBuffer (size_t l): // create empty buffer
-			len(l), offset (0)
+			len(l), offset (0), isOwner (true)
 		{
 			buf = new uint8_t[len];
 		}
 		~SendBuffer ()
 		{
-			delete[] buf;
+			if (isOwner) delete[] buf;
 			if (handler) handler(boost::system::error_code ());
 		}
 		size_t GetRemainingSize () const { return len - offset; };
@@ -134,7 +151,7 @@ namespace stream
 			SendBufferQueue (): m_Size (0) {};
 			~SendBufferQueue () { CleanUp (); };
 
-			void Add (const uint8_t * buf, size_t len, SendHandler handler);
+			void Add (const uint8_t * buf, size_t len, SendHandler handler, bool copy = true);
 			void Add (std::shared_ptr<SendBuffer> buf);
 			size_t Get (uint8_t * buf, size_t len);
 			size_t GetSize () const { return m_Size; };
@@ -178,8 +195,8 @@ namespace stream
 
 			void HandleNextPacket (Packet * packet);
 			void HandlePing (Packet * packet);
-			size_t Send (const uint8_t * buf, size_t len);
-			void AsyncSend (const uint8_t * buf, size_t len, SendHandler handler);
+			size_t Send (const uint8_t * buf, size_t len); // copies buf
+			void AsyncSend (const uint8_t * buf, size_t len, SendHandler handler); // buf is referenced until handler is called, copied if no handler
 			void SendPing ();
 
 			template<typename Buffer, typename ReceiveHandler>
@@ -197,7 +214,7 @@ namespace stream
 			size_t GetSendQueueSize () const { return m_SentPackets.size (); };
 			size_t GetReceiveQueueSize () const { return m_ReceiveQueue.size (); };
 			size_t GetSendBufferSize () const { return m_SendBuffer.GetSize (); };
-			int GetWindowSize () const { return m_WindowSize; };
+			int GetWindowSize () const { return m_CongestionControl->GetWindowSize (); };
 			int GetRTT () const { return m_RTT; };
 
 			void Terminate (bool deleteFromDestination = true);
@@ -217,6 +234,7 @@ namespace stream
 			void ProcessPacket (Packet * packet);
 			bool ProcessOptions (uint16_t flags, Packet * packet);
 			void ProcessAck (Packet * packet);
+			void UpdateRTT (int rtt);
 			size_t ConcatenatePackets (uint8_t * buf, size_t len);
 
 			void UpdateCurrentRemoteLease (bool expired = false);
@@ -227,6 +245,8 @@ namespace stream
 			void ScheduleResend ();
 			void HandleResendTimer (const boost::system::error_code& ecode);
 			void HandleAckSendTimer (const boost::system::error_code& ecode);
+			void SchedulePacing (uint64_t interval); // in microseconds
+			void HandlePacingTimer (const boost::system::error_code& ecode);
 
 		private:
 
@@ -234,7 +254,7 @@ namespace stream
 			uint32_t m_SendStreamID, m_RecvStreamID, m_SequenceNumber;
 			int32_t m_LastReceivedSequenceNumber;
 			StreamStatus m_Status;
-			bool m_IsAckSendScheduled;
+			bool m_IsAckSendScheduled, m_IsPacingScheduled;
 			StreamingDestination& m_LocalDestination;
 			std::shared_ptr<const i2p::data::IdentityEx> m_RemoteIdentity;
 			std::shared_ptr<const i2p::crypto::Verifier> m_TransientVerifier; // in case of offline key
@@ -245,15 +265,17 @@ namespace stream
 			std::queue<Packet *> m_ReceiveQueue;
 			std::set<Packet *, PacketCmp> m_SavedPackets;
 			std::set<Packet *, PacketCmp> m_SentPackets;
-			boost::asio::deadline_timer m_ReceiveTimer, m_ResendTimer, m_AckSendTimer;
+			boost::asio::deadline_timer m_ReceiveTimer, m_ResendTimer, m_AckSendTimer, m_PacingTimer;
 			size_t m_NumSentBytes, m_NumReceivedBytes;
 			uint16_t m_Port;
 
 			std::mutex m_SendBufferMutex;
 			SendBufferQueue m_SendBuffer;
-			int m_WindowSize, m_RTT, m_RTO, m_AckDelay;
-			uint64_t m_LastWindowSizeIncreaseTime;
+			int m_RTT, m_RTTVar, m_RTO, m_AckDelay;
+			bool m_IsFirstRTTSample;
 			int m_NumResendAttempts;
+			std::unique_ptr<CongestionControl> m_CongestionControl;
+			uint64_t m_NextSendTime; // if paced, in microseconds
 			size_t m_MTU;
 	};
 
@@ -285,6 +307,7 @@ namespace stream
 
 			void HandleDataMessagePayload (const uint8_t * buf, size_t len);
 			std::shared_ptr<I2NPMessage> CreateDataMessage (const uint8_t * payload, size_t len, uint16_t toPort, bool checksum = true);
+			std::shared_ptr<I2NPMessage> CreateDataMessage (Packet * packet, uint16_t toPort, bool checksum = true); // refers to packet if uncompressed
 
 			Packet * NewPacket () { return m_PacketsPool.Acquire(); }
 			void DeletePacket (Packet * p) { return m_PacketsPool.Release(p); }
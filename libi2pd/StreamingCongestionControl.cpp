@@ -0,0 +1,317 @@
+/*
+* Copyright (c) 2013-2022, The PurpleI2P Project
+*
+* This file is part of Purple i2pd project and licensed under BSD3
+*
+* See full license text in LICENSE file at top of project tree
+*/
+
+#include <stdlib.h>
+#include <algorithm>
+#include "Log.h"
+#include "StreamingCongestionControl.h"
+
+namespace i2p
+{
+namespace stream
+{
+	RenoCongestionControl::RenoCongestionControl ():
+		m_WindowSize (MIN_WINDOW_SIZE), m_LastWindowSizeIncreaseTime (0), m_NextSeqn (0), m_RecoverySeqn (0)
+	{
+	}
+
+	void RenoCongestionControl::OnPacketAcked (uint32_t seqn, uint64_t ts, size_t len, int rtt, int srtt)
+	{
+		if (m_WindowSize < WINDOW_SIZE)
+			m_WindowSize++; // slow start
+		else
+		{
+			// linear growth
+			if (ts > m_LastWindowSizeIncreaseTime + srtt)
+			{
+				m_WindowSize++;
+				if (m_WindowSize > MAX_WINDOW_SIZE) m_WindowSize = MAX_WINDOW_SIZE;
+				m_LastWindowSizeIncreaseTime = ts;
+			}
+		}
+	}
+
+	void RenoCongestionControl::OnPacketSent (uint32_t seqn, uint64_t ts, size_t len)
+	{
+		if (seqn >= m_NextSeqn) m_NextSeqn = seqn + 1;
+	}
+
+	void RenoCongestionControl::OnResendTimeout (uint64_t ts, int numResendAttempts)
+	{
+		if (numResendAttempts == 1) // congesion avoidance
+		{
+			m_WindowSize >>= 1; // /2
+			if (m_WindowSize < MIN_WINDOW_SIZE) m_WindowSize = MIN_WINDOW_SIZE;
+			m_RecoverySeqn = m_NextSeqn;
+		}
+	}
+
+	void RenoCongestionControl::OnPacketLost (uint32_t seqn, uint64_t ts)
+	{
+		if (seqn >= m_RecoverySeqn) // new congestion event
+		{
+			m_WindowSize >>= 1; // /2
+			if (m_WindowSize < MIN_WINDOW_SIZE) m_WindowSize = MIN_WINDOW_SIZE;
+			m_RecoverySeqn = m_NextSeqn;
+		}
+	}
+
+	BBRCongestionControl::BBRCongestionControl ():
+		m_State (eStateStartup), m_Delivered (0), m_DeliveredTime (0), m_FirstSentTime (0), m_BytesInFlight (0), m_PacketSize (1),
+		m_RoundCount (0), m_NextRoundDelivered (0), m_IsRoundStart (false), m_FullBandwidth (0),
+		m_FullBandwidthCount (0), m_IsFullPipe (false), m_MinRTT (-1), m_RoundMinRTT (-1), m_NumRoundRTTSamples (0), m_MinRTTTime (0), m_ProbeRTTDoneTime (0),
+		m_IsMinRTTExpired (false), m_PacingGain (BBR_HIGH_GAIN), m_WindowGain (BBR_STARTUP_WINDOW_GAIN), m_CycleIndex (0),
+		m_CycleTime (0), m_WindowSize (BBR_INITIAL_WINDOW_SIZE), m_IsRecovery (false)
+	{
+	}
+
+	int BBRCongestionControl::GetWindowSize () const
+	{
+		if (m_IsRecovery)
+			return std::min (m_WindowSize, BBR_MIN_WINDOW_SIZE);
+		if (m_State == eStateProbeRTT)
+		{
+			// half of BDP drains queue and keeps the pipe busy
+			int windowSize = GetBDP ()*BBR_PROBE_RTT_WINDOW_GAIN/m_PacketSize;
+			if (windowSize < BBR_MIN_WINDOW_SIZE) windowSize = BBR_MIN_WINDOW_SIZE;
+			return std::min (m_WindowSize, windowSize);
+		}
+		return m_WindowSize;
+	}
+
+	uint64_t BBRCongestionControl::GetPacingInterval () const
+	{
+		auto bandwidth = GetBandwidth ();
+		if (!bandwidth) return 0; // no estimate yet, sent by window
+		return m_PacketSize*1000000/(m_PacingGain*bandwidth);
+	}
+
+	uint64_t BBRCongestionControl::GetBandwidth () const
+	{
+		uint64_t bandwidth = 0;
+		for (const auto& it: m_BandwidthFilter)
+			if (it.second > bandwidth) bandwidth = it.second;
+		return bandwidth;
+	}
+
+	size_t BBRCongestionControl::GetBDP () const
+	{
+		if (m_MinRTT < 0) return 0;
+		return GetBandwidth ()*m_MinRTT/1000;
+	}
+
+	void BBRCongestionControl::OnPacketSent (uint32_t seqn, uint64_t ts, size_t len)
+	{
+		if (!m_BytesInFlight) m_DeliveredTime = m_FirstSentTime = ts; // start of new flight, idle time is not counted
+		auto it = m_SentPackets.find (seqn);
+		if (it == m_SentPackets.end ())
+		{
+			it = m_SentPackets.emplace (seqn, SentPacket{0, 0, 0, 0, len, false}).first;
+			m_BytesInFlight += len;
+			if (len > m_PacketSize) m_PacketSize = len;
+		}
+		else
+			it->second.isResent = true;
+		// resent packet measures delivery rate from now
+		it->second.sendTime = ts;
+		it->second.firstSentTime = m_FirstSentTime;
+		it->second.delivered = m_Delivered;
+		it->second.deliveredTime = m_DeliveredTime;
+	}
+
+	void BBRCongestionControl::OnPacketAcked (uint32_t seqn, uint64_t ts, size_t len, int rtt, int srtt)
+	{
+		auto it = m_SentPackets.find (seqn);
+		if (it == m_SentPackets.end ()) return;
+		auto packet = it->second;
+		m_SentPackets.erase (it);
+		m_BytesInFlight -= packet.len;
+		m_Delivered += packet.len;
+		m_DeliveredTime = ts;
+		m_FirstSentTime = packet.sendTime;
+		m_IsRecovery = false;
+		// round trip is over when a packet sent after its beginning is acknowledged
+		m_IsRoundStart = packet.delivered >= m_NextRoundDelivered;
+		if (m_IsRoundStart)
+		{
+			m_NextRoundDelivered = m_Delivered;
+			m_RoundCount++;
+		}
+		UpdateBandwidth (ts, packet);
+		if (!packet.isResent) UpdateMinRTT (ts, rtt);
+		UpdateState (ts);
+		if (!packet.isResent) UpdateRoundRTT (rtt);
+		UpdateWindowSize ();
+	}
+
+	void BBRCongestionControl::OnResendTimeout (uint64_t ts, int numResendAttempts)
+	{
+		// something is wrong with the path, keep minimal window until it's confirmed
+		m_IsRecovery = true;
+		// losses in startup mean queues are overflown already
+		if (m_State == eStateStartup && GetBandwidth ())
+		{
+			LogPrint (eLogDebug, "Streaming: BBR startup finished by resend, bandwidth=", GetBandwidth (), " B/s, minRTT=", m_MinRTT);
+			EnterDrain ();
+		}
+	}
+
+	void BBRCongestionControl::UpdateBandwidth (uint64_t ts, const SentPacket& packet)
+	{
+		// ACKs may come compressed, delivery can't be faster than sending
+		uint64_t interval = std::max (ts > packet.deliveredTime ? ts - packet.deliveredTime : 0,
+			packet.sendTime > packet.firstSentTime ? packet.sendTime - packet.firstSentTime : 0);
+		if (!interval) interval = 1;
+		uint64_t rate = (m_Delivered - packet.delivered)*1000/interval;
+		if (!m_BandwidthFilter.empty () && m_BandwidthFilter.back ().first == m_RoundCount)
+		{
+			if (rate > m_BandwidthFilter.back ().second)
+				m_BandwidthFilter.back ().second = rate;
+		}
+		else
+			m_BandwidthFilter.push_back ({ m_RoundCount, rate });
+		while (m_BandwidthFilter.front ().first + BBR_BANDWIDTH_FILTER_LENGTH <= m_RoundCount)
+			m_BandwidthFilter.pop_front ();
+	}
+
+	void BBRCongestionControl::UpdateMinRTT (uint64_t ts, int rtt)
+	{
+		m_IsMinRTTExpired = m_MinRTT >= 0 && ts > m_MinRTTTime + BBR_MIN_RTT_FILTER_LENGTH;
+		if (rtt >= 0 && (m_MinRTT < 0 || rtt <= m_MinRTT || m_IsMinRTTExpired))
+		{
+			m_MinRTT = rtt;
+			m_MinRTTTime = ts;
+		}
+	}
+
+	void BBRCongestionControl::UpdateRoundRTT (int rtt)
+	{
+		if (m_IsRoundStart)
+		{
+			m_RoundMinRTT = -1;
+			m_NumRoundRTTSamples = 0;
+		}
+		if (m_NumRoundRTTSamples >= BBR_STARTUP_RTT_SAMPLES) return;
+		if (m_RoundMinRTT < 0 || rtt < m_RoundMinRTT) m_RoundMinRTT = rtt;
+		m_NumRoundRTTSamples++;
+		// queue left from previous round means pipe is full already
+		if (m_State == eStateStartup && m_NumRoundRTTSamples == BBR_STARTUP_RTT_SAMPLES &&
+			m_RoundMinRTT > m_MinRTT*BBR_STARTUP_RTT_THRESHOLD)
+		{
+			LogPrint (eLogDebug, "Streaming: BBR startup finished by RTT ", m_RoundMinRTT, ", bandwidth=", GetBandwidth (), " B/s, minRTT=", m_MinRTT);
+			EnterDrain ();
+		}
+	}
+
+	void BBRCongestionControl::UpdateState (uint64_t ts)
+	{
+		switch (m_State)
+		{
+			case eStateStartup:
+				if (m_IsRoundStart)
+				{
+					// pipe is full if bandwidth doesn't grow for several rounds
+					auto bandwidth = GetBandwidth ();
+					if (bandwidth >= m_FullBandwidth*5/4)
+					{
+						m_FullBandwidth = bandwidth;
+						m_FullBandwidthCount = 0;
+					}
+					else if (++m_FullBandwidthCount >= BBR_FULL_BANDWIDTH_ROUNDS)
+					{
+						LogPrint (eLogDebug, "Streaming: BBR startup finished, bandwidth=", bandwidth, " B/s, minRTT=", m_MinRTT);
+						EnterDrain ();
+					}
+				}
+			break;
+			case eStateDrain:
+				if (m_BytesInFlight <= GetBDP ())
+					EnterProbeBW (ts);
+			break;
+			case eStateProbeBW:
+				if (m_MinRTT >= 0 && ts > m_CycleTime + m_MinRTT)
+				{
+					m_CycleIndex = (m_CycleIndex + 1) % BBR_PACING_GAIN_CYCLE_LENGTH;
+					m_CycleTime = ts;
+					m_PacingGain = BBR_PACING_GAIN_CYCLE[m_CycleIndex];
+				}
+			break;
+			case eStateProbeRTT:
+				if (ts >= m_ProbeRTTDoneTime)
+				{
+					m_MinRTTTime = ts;
+					if (m_IsFullPipe)
+						EnterProbeBW (ts);
+					else
+					{
+						m_State = eStateStartup;
+						m_PacingGain = BBR_HIGH_GAIN;
+						m_WindowGain = BBR_STARTUP_WINDOW_GAIN;
+					}
+				}
+			break;
+		}
+		if (m_IsMinRTTExpired && m_State != eStateProbeRTT)
+		{
+			// min RTT is not confirmed for long time, drain the queue to measure it again
+			m_State = eStateProbeRTT;
+			m_PacingGain = 1;
+			m_ProbeRTTDoneTime = ts + m_MinRTT + BBR_PROBE_RTT_DURATION; // drain and measure
+		}
+	}
+
+	void BBRCongestionControl::EnterDrain ()
+	{
+		m_IsFullPipe = true;
+		m_State = eStateDrain;
+		m_PacingGain = 1/BBR_HIGH_GAIN; // drain queue created in startup
+	}
+
+	void BBRCongestionControl::EnterProbeBW (uint64_t ts)
+	{
+		m_State = eStateProbeBW;
+		m_WindowGain = BBR_WINDOW_GAIN;
+		m_CycleIndex = 1 + rand () % (BBR_PACING_GAIN_CYCLE_LENGTH - 1); // any phase but probing up
+		m_CycleTime = ts;
+		m_PacingGain = BBR_PACING_GAIN_CYCLE[m_CycleIndex];
+	}
+
+	void BBRCongestionControl::UpdateWindowSize ()
+	{
+		int target = GetBDP ()*m_WindowGain/m_PacketSize;
+		if (target < BBR_MIN_WINDOW_SIZE) target = BBR_MIN_WINDOW_SIZE;
+		if (m_IsFullPipe)
+		{
+			m_WindowSize++;
+			if (m_WindowSize > target) m_WindowSize = target;
+		}
+		else if (m_WindowSize < target || m_Delivered < (uint64_t)BBR_INITIAL_WINDOW_SIZE*m_PacketSize)
+			m_WindowSize++; // grow by acknowledged in startup
+		if (m_WindowSize > BBR_MAX_WINDOW_SIZE) m_WindowSize = BBR_MAX_WINDOW_SIZE;
+	}
+
+	CongestionControlType GetCongestionControlType (const std::string& name)
+	{
+		if (name == "bbr") return eCongestionControlBBR;
+		if (name != "reno")
+			LogPrint (eLogWarning, "Streaming: Unknown congestion control ", name, ", reno is used");
+		return eCongestionControlReno;
+	}
+
+	std::unique_ptr<CongestionControl> CreateCongestionControl (CongestionControlType type)
+	{
+		switch (type)
+		{
+			case eCongestionControlBBR:
+				return std::unique_ptr<CongestionControl>(new BBRCongestionControl ());
+			default:
+				return std::unique_ptr<CongestionControl>(new RenoCongestionControl ());
+		}
+	}
+}
+}
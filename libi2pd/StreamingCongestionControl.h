@@ -0,0 +1,163 @@
+/*
+* Copyright (c) 2013-2022, The PurpleI2P Project
+*
+* This file is part of Purple i2pd project and licensed under BSD3
+*
+* See full license text in LICENSE file at top of project tree
+*/
+
+#ifndef STREAMING_CONGESTION_CONTROL_H__
+#define STREAMING_CONGESTION_CONTROL_H__
+
+#include <inttypes.h>
+#include <string>
+#include <deque>
+#include <unordered_map>
+#include <memory>
+
+namespace i2p
+{
+namespace stream
+{
+	const int WINDOW_SIZE = 6; // in messages
+	const int MIN_WINDOW_SIZE = 1;
+	const int MAX_WINDOW_SIZE = 128;
+
+	const int BBR_MIN_WINDOW_SIZE = 4; // in messages
+	const int BBR_INITIAL_WINDOW_SIZE = WINDOW_SIZE;
+	const int BBR_MAX_WINDOW_SIZE = 512;
+	const double BBR_HIGH_GAIN = 2.885; // 2/ln(2), doubles delivery rate every round in startup
+	const double BBR_STARTUP_WINDOW_GAIN = 2.0;
+	const double BBR_WINDOW_GAIN = 1.25; // queue of more than half of RTT triggers resend by RTO
+	const int BBR_PACING_GAIN_CYCLE_LENGTH = 8;
+	const double BBR_PACING_GAIN_CYCLE[BBR_PACING_GAIN_CYCLE_LENGTH] = { 1.25, 0.75, 1, 1, 1, 1, 1, 1 };
+	const int BBR_FULL_BANDWIDTH_ROUNDS = 3; // rounds without 25% growth to leave startup
+	const int BBR_STARTUP_RTT_SAMPLES = 8; // first in round
+	const double BBR_STARTUP_RTT_THRESHOLD = 1.25; // leave startup if RTT at round start exceeds min RTT that much
+	const uint64_t BBR_BANDWIDTH_FILTER_LENGTH = 10; // in rounds
+	const uint64_t BBR_MIN_RTT_FILTER_LENGTH = 10000; // in milliseconds
+	const int BBR_PROBE_RTT_DURATION = 200; // in milliseconds
+	const double BBR_PROBE_RTT_WINDOW_GAIN = 0.5;
+
+	enum CongestionControlType
+	{
+		eCongestionControlReno = 0,
+		eCongestionControlBBR
+	};
+
+	/** decides how many packets of a stream may be unacknowledged and how fast they are sent.
+	 *  Notified about every data packet sent, resent and acknowledged. Times are in milliseconds */
+	class CongestionControl
+	{
+		public:
+
+			virtual ~CongestionControl () {};
+
+			virtual const char * GetName () const = 0;
+			virtual int GetWindowSize () const = 0; // in packets
+			virtual uint64_t GetPacingInterval () const { return 0; }; // between packets in microseconds, 0 if not paced
+
+			virtual void OnPacketSent (uint32_t seqn, uint64_t ts, size_t len) {}; // also called for resent
+			virtual void OnPacketAcked (uint32_t seqn, uint64_t ts, size_t len, int rtt, int srtt) = 0; // rtt of this packet and smoothed
+			virtual void OnResendTimeout (uint64_t ts, int numResendAttempts) = 0;
+			virtual void OnPacketLost (uint32_t seqn, uint64_t ts) {}; // reported missing by NACKs, resent before timeout
+	};
+
+	/** window counted in messages, +1 per ACK in slow start and +1 per RTT after,
+	 *  halved on first resend and once per window of lost packets. Default */
+	class RenoCongestionControl: public CongestionControl
+	{
+		public:
+
+			RenoCongestionControl ();
+
+			const char * GetName () const { return "reno"; };
+			int GetWindowSize () const { return m_WindowSize; };
+
+			void OnPacketAcked (uint32_t seqn, uint64_t ts, size_t len, int rtt, int srtt);
+			void OnPacketSent (uint32_t seqn, uint64_t ts, size_t len);
+			void OnResendTimeout (uint64_t ts, int numResendAttempts);
+			void OnPacketLost (uint32_t seqn, uint64_t ts);
+
+		private:
+
+			int m_WindowSize;
+			uint64_t m_LastWindowSizeIncreaseTime;
+			uint32_t m_NextSeqn, m_RecoverySeqn; // losses of packets sent before window was reduced don't reduce it again
+	};
+
+	/** estimates bottleneck bandwidth as max delivery rate over last rounds and propagation delay as min RTT,
+	 *  keeps 1.25 of bandwidth-delay product in flight (twice in startup) and paces packets at estimated bandwidth.
+	 *  Loss doesn't shrink the window, tunnels drop packets regardless of congestion */
+	class BBRCongestionControl: public CongestionControl
+	{
+		enum State
+		{
+			eStateStartup = 0,
+			eStateDrain,
+			eStateProbeBW,
+			eStateProbeRTT
+		};
+
+		struct SentPacket
+		{
+			uint64_t sendTime, firstSentTime, delivered, deliveredTime;
+			size_t len;
+			bool isResent; // RTT is ambiguous
+		};
+
+		public:
+
+			BBRCongestionControl ();
+
+			const char * GetName () const { return "bbr"; };
+			int GetWindowSize () const;
+			uint64_t GetPacingInterval () const;
+
+			void OnPacketSent (uint32_t seqn, uint64_t ts, size_t len);
+			void OnPacketAcked (uint32_t seqn, uint64_t ts, size_t len, int rtt, int srtt);
+			void OnResendTimeout (uint64_t ts, int numResendAttempts);
+
+			uint64_t GetBandwidth () const; // bytes per second
+			int GetMinRTT () const { return m_MinRTT; };
+
+		private:
+
+			void UpdateBandwidth (uint64_t ts, const SentPacket& packet);
+			void UpdateMinRTT (uint64_t ts, int rtt);
+			void UpdateRoundRTT (int rtt);
+			void UpdateState (uint64_t ts);
+			void UpdateWindowSize ();
+			void EnterDrain ();
+			void EnterProbeBW (uint64_t ts);
+			size_t GetBDP () const; // in bytes
+
+		private:
+
+			State m_State;
+			std::unordered_map<uint32_t, SentPacket> m_SentPackets; // seqn -> delivery state at sending
+			uint64_t m_Delivered, m_DeliveredTime; // acknowledged bytes and time of last ACK
+			uint64_t m_FirstSentTime; // of last acknowledged packet
+			size_t m_BytesInFlight, m_PacketSize;
+			uint64_t m_RoundCount, m_NextRoundDelivered;
+			bool m_IsRoundStart;
+			std::deque<std::pair<uint64_t, uint64_t> > m_BandwidthFilter; // round -> max delivery rate in round
+			uint64_t m_FullBandwidth;
+			int m_FullBandwidthCount;
+			bool m_IsFullPipe;
+			int m_MinRTT, m_RoundMinRTT, m_NumRoundRTTSamples;
+			uint64_t m_MinRTTTime, m_ProbeRTTDoneTime;
+			bool m_IsMinRTTExpired;
+			double m_PacingGain, m_WindowGain;
+			int m_CycleIndex;
+			uint64_t m_CycleTime;
+			int m_WindowSize;
+			bool m_IsRecovery; // after resend timeout until next ACK
+	};
+
+	CongestionControlType GetCongestionControlType (const std::string& name); // "reno" or "bbr"
+	std::unique_ptr<CongestionControl> CreateCongestionControl (CongestionControlType type);
+}
+}
+
+#endif
@@ -1,5 +1,5 @@
 /*
-* Copyright (c) 2013-2021, The PurpleI2P Project
+* Copyright (c) 2013-2022, The PurpleI2P Project
 *
 * This file is part of Purple i2pd project and licensed under BSD3
 *
@@ -7,6 +7,7 @@
 */
 
 #include <string.h>
+#include <algorithm>
 #include "I2PEndian.h"
 #include "Log.h"
 #include "RouterContext.h"
@@ -33,17 +34,27 @@ namespace tunnel
 		i2p::transport::transports.UpdateTotalTransitTransmittedBytes (TUNNEL_DATA_MSG_SIZE);
 	}
 
+	void TransitTunnel::EncryptTunnelMsgs (const std::vector<std::shared_ptr<i2p::I2NPMessage> >& msgs)
+	{
+		// in place, independent messages are encrypted in parallel if CPU supports it
+		uint8_t * payloads[TUNNEL_ENCRYPTION_BATCH_SIZE];
+		for (size_t i = 0; i < msgs.size (); i += TUNNEL_ENCRYPTION_BATCH_SIZE)
+		{
+			size_t num = std::min (TUNNEL_ENCRYPTION_BATCH_SIZE, msgs.size () - i);
+			for (size_t j = 0; j < num; j++)
+				payloads[j] = msgs[i + j]->GetPayload () + 4;
+			m_Encryption.Encrypt (num, payloads, payloads);
+		}
+		i2p::transport::transports.UpdateTotalTransitTransmittedBytes (TUNNEL_DATA_MSG_SIZE*msgs.size ());
+	}
+
 	TransitTunnelParticipant::~TransitTunnelParticipant ()
 	{
 	}
 
 	void TransitTunnelParticipant::HandleTunnelDataMsg (std::shared_ptr<i2p::I2NPMessage>&& tunnelMsg)
 	{
-		EncryptTunnelMsg (tunnelMsg, tunnelMsg);
-
-		m_NumTransmittedBytes += tunnelMsg->GetLength ();
-		htobe32buf (tunnelMsg->GetPayload (), GetNextTunnelID ());
-		tunnelMsg->FillI2NPMessageHeader (eI2NPTunnelData);
+		// encrypted by FlushTunnelDataMsgs
 		m_TunnelDataMsgs.push_back (tunnelMsg);
 	}
 
@@ -54,6 +65,13 @@ namespace tunnel
 			auto num = m_TunnelDataMsgs.size ();
 			if (num > 1)
 				LogPrint (eLogDebug, "TransitTunnel: ", GetTunnelID (), "->", GetNextTunnelID (), " ", num);
+			EncryptTunnelMsgs (m_TunnelDataMsgs);
+			for (auto& it: m_TunnelDataMsgs)
+			{
+				m_NumTransmittedBytes += it->GetLength ();
+				htobe32buf (it->GetPayload (), GetNextTunnelID ());
+				it->FillI2NPMessageHeader (eI2NPTunnelData);
+			}
 			i2p::transport::transports.SendMessages (GetNextIdentHash (), m_TunnelDataMsgs);
 			m_TunnelDataMsgs.clear ();
 		}
@@ -1,5 +1,5 @@
 /*
-* Copyright (c) 2013-2021, The PurpleI2P Project
+* Copyright (c) 2013-2022, The PurpleI2P Project
 *
 * This file is part of Purple i2pd project and licensed under BSD3
 *
@@ -23,6 +23,8 @@ namespace i2p
 {
 namespace tunnel
 {
+	const size_t TUNNEL_ENCRYPTION_BATCH_SIZE = 8; // messages encrypted at once
+
 	class TransitTunnel: public TunnelBase
 	{
 		public:
@@ -37,6 +39,11 @@ namespace tunnel
 			void SendTunnelDataMsg (std::shared_ptr<i2p::I2NPMessage> msg);
 			void HandleTunnelDataMsg (std::shared_ptr<i2p::I2NPMessage>&& tunnelMsg);
 			void EncryptTunnelMsg (std::shared_ptr<const I2NPMessage> in, std::shared_ptr<I2NPMessage> out);
+
+		protected:
+
+			void EncryptTunnelMsgs (const std::vector<std::shared_ptr<i2p::I2NPMessage> >& msgs); // in place
+
 		private:
 
 			i2p::crypto::TunnelEncryption m_Encryption;
@@ -367,6 +367,7 @@ namespace transport
 		m_LastInBandwidthUpdateBytes = m_TotalReceivedBytes;
 		m_LastOutBandwidthUpdateBytes = m_TotalSentBytes;
 		m_LastTransitBandwidthUpdateBytes = m_TotalTransitTransmittedBytes;
+		i2p::UpdateI2NPBuffersStats ();
 	}
 
 	bool Transports::IsBandwidthExceeded () const
@@ -62,7 +62,7 @@ namespace tunnel
 		{
 			uint32_t msgID;
 			if (hop->next) // we set replyMsgID for last hop only
-				RAND_bytes ((uint8_t *)&msgID, 4);
+				msgID = i2p::crypto::RandUInt32 ();
 			else
 				msgID = replyMsgID;
 			hop->recordIndex = recordIndicies[i]; i++;
@@ -73,7 +73,7 @@ namespace tunnel
 		for (int i = numHops; i < numRecords; i++)
 		{
 			int idx = recordIndicies[i];
-			RAND_bytes (records + idx*recordSize, recordSize);
+			i2p::crypto::RandBytes (records + idx*recordSize, recordSize);
 		}
 
 		// decrypt real records
@@ -202,11 +202,21 @@ namespace tunnel
 	{
 		const uint8_t * inPayload = in->GetPayload () + 4;
 		uint8_t * outPayload = out->GetPayload () + 4;
-		for (auto& it: m_Hops)
+		int numHops = m_Hops.size ();
+		if (numHops > 1 && numHops <= i2p::crypto::MAX_NUM_FUSED_TUNNEL_LAYERS)
 		{
-			it.decryption.Decrypt (inPayload, outPayload);
-			inPayload = outPayload;
+			// all layers at once
+			i2p::crypto::TunnelDecryption * layers[i2p::crypto::MAX_NUM_FUSED_TUNNEL_LAYERS];
+			for (int i = 0; i < numHops; i++)
+				layers[i] = &m_Hops[i].decryption;
+			i2p::crypto::TunnelDecryption::Decrypt (numHops, layers, inPayload, outPayload);
 		}
+		else
+			for (auto& it: m_Hops)
+			{
+				it.decryption.Decrypt (inPayload, outPayload);
+				inPayload = outPayload;
+			}
 	}
 
 	void Tunnel::SendTunnelDataMsg (std::shared_ptr<i2p::I2NPMessage> msg)
@@ -356,11 +366,193 @@ namespace tunnel
 		s << GetTunnelID () << ":me &#8658; ";
 	}
 
+	TunnelsTable::Table::Table (size_t size):
+		mask (size - 1), shift (64), slots (new Slot[size]), tunnels (size)
+	{
+		for (size_t i = size; i > 1; i >>= 1) shift--;
+		for (size_t i = 0; i < size; i++)
+		{
+			slots[i].tunnelID.store (0, std::memory_order_relaxed);
+			slots[i].tunnel.store (nullptr, std::memory_order_relaxed);
+		}
+	}
+
+	TunnelsTable::TunnelsTable ():
+		m_Table (new Table (TUNNELS_TABLE_MIN_SIZE)), m_NumUsed (0), m_NumTunnels (0), m_Seed (0), m_Epoch (1)
+	{
+		RAND_bytes ((uint8_t *)&m_Seed, sizeof (m_Seed)); // tunnelIDs of transit tunnels are chosen by others
+		for (auto& it: m_Readers)
+			it.epoch.store (0);
+	}
+
+	TunnelsTable::~TunnelsTable ()
+	{
+		delete m_Table.load ();
+	}
+
+	TunnelsTable::Slot * TunnelsTable::FindSlot (Table * table, uint32_t tunnelID) const
+	{
+		for (size_t i = table->GetIndex (tunnelID, m_Seed);; i = (i + 1) & table->mask)
+		{
+			auto id = table->slots[i].tunnelID.load (std::memory_order_acquire);
+			if (id == tunnelID || !id) return table->slots.get () + i;
+		}
+		return nullptr; // never happens, table is never full
+	}
+
+	bool TunnelsTable::Add (std::shared_ptr<TunnelBase> tunnel, bool replace)
+	{
+		uint32_t tunnelID = tunnel->GetTunnelID ();
+		if (!tunnelID) return false; // reserved for empty slots
+		std::unique_lock<std::mutex> l(m_Mutex);
+		auto numRetired = m_Retired.size ();
+		auto table = m_Table.load (std::memory_order_relaxed);
+		auto slot = FindSlot (table, tunnelID);
+		if (!slot->tunnelID.load (std::memory_order_relaxed))
+		{
+			// new slot
+			if ((m_NumUsed + 1)*100 > (table->mask + 1)*TUNNELS_TABLE_MAX_LOAD)
+			{
+				Rehash ();
+				table = m_Table.load (std::memory_order_relaxed);
+				slot = FindSlot (table, tunnelID);
+			}
+			m_NumUsed++;
+		}
+		else if (slot->tunnel.load (std::memory_order_relaxed))
+		{
+			if (!replace) return false;
+			Retire (table->tunnels[slot - table->slots.get ()], nullptr);
+			m_NumTunnels--;
+		}
+		// slot of removed tunnel with same tunnelID is reused, slots of others are not
+		// because reader might see new tunnel with old tunnelID
+		table->tunnels[slot - table->slots.get ()] = tunnel;
+		slot->tunnel.store (tunnel.get (), std::memory_order_release);
+		slot->tunnelID.store (tunnelID, std::memory_order_release);
+		m_NumTunnels++;
+		bool isRetired = m_Retired.size () > numRetired;
+		l.unlock ();
+		if (isRetired) Reclaim ();
+		return true;
+	}
+
+	bool TunnelsTable::Remove (uint32_t tunnelID)
+	{
+		if (!tunnelID) return false;
+		std::unique_lock<std::mutex> l(m_Mutex);
+		auto table = m_Table.load (std::memory_order_relaxed);
+		auto slot = FindSlot (table, tunnelID);
+		if (!slot->tunnel.load (std::memory_order_relaxed)) return false;
+		slot->tunnel.store (nullptr, std::memory_order_release); // tunnelID stays for lookups of others
+		auto& tunnel = table->tunnels[slot - table->slots.get ()];
+		Retire (tunnel, nullptr);
+		tunnel = nullptr;
+		m_NumTunnels--;
+		l.unlock ();
+		Reclaim ();
+		return true;
+	}
+
+	std::shared_ptr<TunnelBase> TunnelsTable::Get (uint32_t tunnelID) const
+	{
+		if (!tunnelID) return nullptr;
+		std::unique_lock<std::mutex> l(m_Mutex);
+		auto table = m_Table.load (std::memory_order_relaxed);
+		auto slot = FindSlot (table, tunnelID);
+		return table->tunnels[slot - table->slots.get ()];
+	}
+
+	size_t TunnelsTable::GetSize () const
+	{
+		std::unique_lock<std::mutex> l(m_Mutex);
+		return m_NumTunnels;
+	}
+
+	void TunnelsTable::Rehash ()
+	{
+		// called by writer, removed tunnels are dropped, grows or shrinks to load of quarter
+		auto table = m_Table.load (std::memory_order_relaxed);
+		size_t size = TUNNELS_TABLE_MIN_SIZE;
+		while (size*TUNNELS_TABLE_MAX_LOAD < (m_NumTunnels + 1)*200) size <<= 1;
+		auto newTable = new Table (size);
+		for (size_t i = 0; i <= table->mask; i++)
+			if (table->tunnels[i])
+			{
+				uint32_t tunnelID = table->slots[i].tunnelID.load (std::memory_order_relaxed);
+				auto slot = FindSlot (newTable, tunnelID);
+				newTable->tunnels[slot - newTable->slots.get ()] = table->tunnels[i];
+				slot->tunnel.store (table->tunnels[i].get (), std::memory_order_relaxed);
+				slot->tunnelID.store (tunnelID, std::memory_order_relaxed);
+			}
+		m_NumUsed = m_NumTunnels;
+		m_Table.store (newTable, std::memory_order_release);
+		Retire (nullptr, table);
+	}
+
+	void TunnelsTable::Retire (std::shared_ptr<TunnelBase> tunnel, Table * table)
+	{
+		// called by writer after tunnel or table is not reachable from m_Table anymore
+		Retired retired;
+		retired.epoch = m_Epoch.fetch_add (1); // readers entered later can't see it
+		retired.tunnel = tunnel;
+		retired.table.reset (table);
+		m_Retired.push_back (std::move (retired));
+	}
+
+	void TunnelsTable::Reclaim ()
+	{
+		std::deque<Retired> reclaimed; // tunnels are deleted outside of lock
+		{
+			std::unique_lock<std::mutex> l(m_Mutex);
+			std::atomic_thread_fence (std::memory_order_seq_cst); // pairs with BeginRead
+			uint64_t minEpoch = UINT64_MAX;
+			for (auto& it: m_Readers)
+			{
+				auto epoch = it.epoch.load (std::memory_order_acquire); // 0 after reader's last access
+				if (epoch && epoch < minEpoch) minEpoch = epoch;
+			}
+			while (!m_Retired.empty () && m_Retired.front ().epoch < minEpoch)
+			{
+				reclaimed.push_back (std::move (m_Retired.front ()));
+				m_Retired.pop_front ();
+			}
+		}
+	}
+
+	void TunnelsTable::BeginRead (int reader)
+	{
+		m_Readers[reader].epoch.store (m_Epoch.load (std::memory_order_relaxed), std::memory_order_relaxed);
+		std::atomic_thread_fence (std::memory_order_seq_cst); // published before table is read
+	}
+
+	TunnelBase * TunnelsTable::Find (uint32_t tunnelID) const
+	{
+		if (!tunnelID) return nullptr;
+		auto table = m_Table.load (std::memory_order_acquire);
+		for (size_t i = table->GetIndex (tunnelID, m_Seed);; i = (i + 1) & table->mask)
+		{
+			auto& slot = table->slots[i];
+			auto id = slot.tunnelID.load (std::memory_order_acquire);
+			if (id == tunnelID) return slot.tunnel.load (std::memory_order_acquire);
+			if (!id) return nullptr;
+		}
+		return nullptr;
+	}
+
+	void TunnelsTable::EndRead (int reader)
+	{
+		m_Readers[reader].epoch.store (0, std::memory_order_release);
+	}
+
 	Tunnels tunnels;
 
-	Tunnels::Tunnels (): m_IsRunning (false), m_Thread (nullptr),
-		m_NumSuccesiveTunnelCreations (0), m_NumFailedTunnelCreations (0)
+	Tunnels::Tunnels (): m_IsRunning (false), m_Thread (nullptr), m_NumWorkers (0),
+		m_MaxNumBuildRequests (DEFAULT_MAX_NUM_TUNNEL_BUILD_REQUESTS), m_NumBuildRequests (0),
+		m_NumAcceptedBuildRequests (0), m_NumRejectedBuildRequests (0), m_NumQueueRejectedBuildRequests (0),
+		m_NumDroppedBuildRequests (0), m_NumSuccesiveTunnelCreations (0), m_NumFailedTunnelCreations (0)
 	{
+		for (auto& it: m_BuildStageTimes) it = 0;
 	}
 
 	Tunnels::~Tunnels ()
@@ -369,10 +561,7 @@ namespace tunnel
 
 	std::shared_ptr<TunnelBase> Tunnels::GetTunnel (uint32_t tunnelID)
 	{
-		auto it = m_Tunnels.find(tunnelID);
-		if (it != m_Tunnels.end ())
-			return it->second;
-		return nullptr;
+		return m_Tunnels.Get (tunnelID);
 	}
 
 	std::shared_ptr<InboundTunnel> Tunnels::GetPendingInboundTunnel (uint32_t replyMsgID)
@@ -462,8 +651,11 @@ namespace tunnel
 
 	void Tunnels::AddTransitTunnel (std::shared_ptr<TransitTunnel> tunnel)
 	{
-		if (m_Tunnels.emplace (tunnel->GetTunnelID (), tunnel).second)
+		if (m_Tunnels.Add (tunnel))
+		{
+			std::unique_lock<std::mutex> l(m_TransitTunnelsMutex);
 			m_TransitTunnels.push_back (tunnel);
+		}
 		else
 			LogPrint (eLogError, "Tunnel: Tunnel with id ", tunnel->GetTunnelID (), " already exists");
 	}
@@ -471,19 +663,59 @@ namespace tunnel
 	void Tunnels::Start ()
 	{
 		m_IsRunning = true;
+		if (m_Workers.empty ())
+		{
+			// workers are created once and never removed, transports might still post to them after Stop
+			uint16_t numWorkers; i2p::config::GetOption("limits.tunnelthreads", numWorkers);
+			if (numWorkers > MAX_NUM_TUNNEL_THREADS) numWorkers = MAX_NUM_TUNNEL_THREADS;
+			for (int i = 0; i < numWorkers; i++)
+				m_Workers.emplace_back (new TunnelsWorker ());
+			m_NumWorkers = m_Workers.size (); // PostTunnelData starts sharding from now
+			if (numWorkers)
+				LogPrint (eLogInfo, "Tunnel: Using ", (int)numWorkers, " threads for tunnel data");
+		}
+		uint16_t numBuildWorkers; i2p::config::GetOption("limits.tunnelbuildthreads", numBuildWorkers);
+		if (numBuildWorkers > MAX_NUM_TUNNEL_BUILD_THREADS) numBuildWorkers = MAX_NUM_TUNNEL_BUILD_THREADS;
+		uint16_t maxNumBuildRequests; i2p::config::GetOption("limits.tunnelbuildqueue", maxNumBuildRequests);
+		if (maxNumBuildRequests) m_MaxNumBuildRequests = maxNumBuildRequests;
+		for (int i = 0; i < numBuildWorkers; i++)
+			m_BuildWorkers.push_back (new std::thread (std::bind (&Tunnels::RunBuildWorker, this, i)));
+		if (numBuildWorkers)
+			LogPrint (eLogInfo, "Tunnel: Using ", (int)numBuildWorkers, " threads for tunnel build requests");
 		m_Thread = new std::thread (std::bind (&Tunnels::Run, this));
+		for (size_t i = 0; i < m_Workers.size (); i++)
+			m_Workers[i]->thread = new std::thread (std::bind (&Tunnels::RunWorker, this, i));
 	}
 
 	void Tunnels::Stop ()
 	{
 		m_IsRunning = false;
 		m_Queue.WakeUp ();
+		for (auto& it: m_Workers)
+		{
+			it->queue.WakeUp ();
+			if (it->thread)
+			{
+				it->thread->join ();
+				delete it->thread;
+				it->thread = nullptr;
+			}
+		}
 		if (m_Thread)
 		{
 			m_Thread->join ();
 			delete m_Thread;
 			m_Thread = 0;
 		}
+		// after tunnels thread, it posts build requests
+		m_BuildRequests.WakeUp ();
+		for (auto& it: m_BuildWorkers)
+		{
+			it->join ();
+			delete it;
+		}
+		m_BuildWorkers.clear ();
+		while (m_BuildRequests.Get ()); // drop not handled
 	}
 
 	void Tunnels::Run ()
@@ -491,72 +723,23 @@ namespace tunnel
 		i2p::util::SetThreadName("Tunnels");
 		std::this_thread::sleep_for (std::chrono::seconds(1)); // wait for other parts are ready
 
-		uint64_t lastTs = 0, lastPoolsTs = 0, lastMemoryPoolTs = 0;
+		uint64_t lastTs = 0, lastPoolsTs = 0, lastMemoryPoolTs = 0, lastWorkersTs = 0;
 		while (m_IsRunning)
 		{
 			try
 			{
 				auto msg = m_Queue.GetNextWithTimeout (1000); // 1 sec
 				if (msg)
-				{
-					uint32_t prevTunnelID = 0, tunnelID = 0;
-					std::shared_ptr<TunnelBase> prevTunnel;
-					do
-					{
-						std::shared_ptr<TunnelBase> tunnel;
-						uint8_t typeID = msg->GetTypeID ();
-						switch (typeID)
-						{
-							case eI2NPTunnelData:
-							case eI2NPTunnelGateway:
-							{
-								tunnelID = bufbe32toh (msg->GetPayload ());
-								if (tunnelID == prevTunnelID)
-									tunnel = prevTunnel;
-								else if (prevTunnel)
-									prevTunnel->FlushTunnelDataMsgs ();
-
-								if (!tunnel)
-									tunnel = GetTunnel (tunnelID);
-								if (tunnel)
-								{
-									if (typeID == eI2NPTunnelData)
-										tunnel->HandleTunnelDataMsg (std::move (msg));
-									else // tunnel gateway assumed
-										HandleTunnelGatewayMsg (tunnel, msg);
-								}
-								else
-									LogPrint (eLogWarning, "Tunnel: Tunnel not found, tunnelID=", tunnelID, " previousTunnelID=", prevTunnelID, " type=", (int)typeID);
-
-								break;
-							}
-							case eI2NPVariableTunnelBuild:
-							case eI2NPVariableTunnelBuildReply:
-							case eI2NPShortTunnelBuild:
-							case eI2NPShortTunnelBuildReply:
-							case eI2NPTunnelBuild:
-							case eI2NPTunnelBuildReply:
-								HandleI2NPMessage (msg->GetBuffer (), msg->GetLength ());
-							break;
-							default:
-								LogPrint (eLogWarning, "Tunnel: Unexpected message type ", (int) typeID);
-						}
+					HandleTunnelMessages (msg, m_Queue, 0);
 
-						msg = m_Queue.Get ();
-						if (msg)
-						{
-							prevTunnelID = tunnelID;
-							prevTunnel = tunnel;
-						}
-						else if (tunnel)
-							tunnel->FlushTunnelDataMsgs ();
-					}
-					while (msg);
+				uint64_t ts = i2p::util::GetSecondsSinceEpoch ();
+				if (m_NumWorkers && ts - lastWorkersTs >= TUNNEL_THREADS_CLEANUP_INTERVAL)
+				{
+					DistributeWorkerTunnels ();
+					lastWorkersTs = ts;
 				}
-
 				if (i2p::transport::transports.IsOnline())
 				{
-					uint64_t ts = i2p::util::GetSecondsSinceEpoch ();
 					if (ts - lastTs >= 15) // manage tunnels every 15 seconds
 					{
 						ManageTunnels ();
@@ -582,7 +765,160 @@ namespace tunnel
 		}
 	}
 
-	void Tunnels::HandleTunnelGatewayMsg (std::shared_ptr<TunnelBase> tunnel, std::shared_ptr<I2NPMessage> msg)
+	void Tunnels::RunWorker (size_t index)
+	{
+		std::string name = "Tunnels" + std::to_string (index);
+		i2p::util::SetThreadName(name.c_str ());
+		auto& queue = m_Workers[index]->queue;
+		uint64_t lastTs = i2p::util::GetSecondsSinceEpoch ();
+		while (m_IsRunning)
+		{
+			try
+			{
+				auto msg = queue.GetNextWithTimeout (1000); // 1 sec
+				if (msg)
+					HandleTunnelMessages (msg, queue, index + 1);
+
+				uint64_t ts = i2p::util::GetSecondsSinceEpoch ();
+				if (ts - lastTs >= TUNNEL_THREADS_CLEANUP_INTERVAL)
+				{
+					CleanupWorkerTunnels (index);
+					lastTs = ts;
+				}
+			}
+			catch (std::exception& ex)
+			{
+				LogPrint (eLogError, "Tunnel: Runtime exception in worker ", index, ": ", ex.what ());
+			}
+		}
+	}
+
+	void Tunnels::RunBuildWorker (int index)
+	{
+		std::string name = "TunnelBuild" + std::to_string (index);
+		i2p::util::SetThreadName(name.c_str ());
+		auto decryptor = i2p::context.CreateTunnelDecryptor (); // router's one is used by tunnels thread
+		while (m_IsRunning)
+		{
+			try
+			{
+				auto request = m_BuildRequests.GetNextWithTimeout (1000); // 1 sec
+				if (request)
+				{
+					AddTunnelBuildStageTime (eTunnelBuildStageQueue, request->queued);
+					HandleTunnelBuildRequestMsg (request->msg, request->reject, decryptor.get ());
+				}
+			}
+			catch (std::exception& ex)
+			{
+				LogPrint (eLogError, "Tunnel: Runtime exception in build worker ", index, ": ", ex.what ());
+			}
+		}
+	}
+
+	void Tunnels::HandleTunnelMessages (std::shared_ptr<I2NPMessage> msg, i2p::util::MPSCQueue<std::shared_ptr<I2NPMessage> >& queue,
+		int reader)
+	{
+		uint32_t prevTunnelID = 0, tunnelID = 0;
+		TunnelBase * prevTunnel = nullptr; // valid until EndRead
+		int numMsgs = 0;
+		m_Tunnels.BeginRead (reader);
+		do
+		{
+			TunnelBase * tunnel = nullptr;
+			uint8_t typeID = msg->GetTypeID ();
+			switch (typeID)
+			{
+				case eI2NPTunnelData:
+				case eI2NPTunnelGateway:
+				{
+					tunnelID = bufbe32toh (msg->GetPayload ());
+					if (tunnelID == prevTunnelID)
+						tunnel = prevTunnel;
+					else if (prevTunnel)
+						prevTunnel->FlushTunnelDataMsgs ();
+
+					if (!tunnel)
+						tunnel = m_Tunnels.Find (tunnelID);
+					if (tunnel)
+					{
+						if (typeID == eI2NPTunnelData)
+							tunnel->HandleTunnelDataMsg (std::move (msg));
+						else // tunnel gateway assumed
+							HandleTunnelGatewayMsg (tunnel, msg);
+					}
+					else
+						LogPrint (eLogWarning, "Tunnel: Tunnel not found, tunnelID=", tunnelID, " previousTunnelID=", prevTunnelID, " type=", (int)typeID);
+
+					break;
+				}
+				case eI2NPVariableTunnelBuild:
+				case eI2NPShortTunnelBuild:
+					HandleTunnelBuildI2NPMessage (msg); // requests are posted to build workers
+				break;
+				case eI2NPVariableTunnelBuildReply:
+				case eI2NPShortTunnelBuildReply:
+				case eI2NPTunnelBuild:
+				case eI2NPTunnelBuildReply:
+					HandleI2NPMessage (msg->GetBuffer (), msg->GetLength ());
+				break;
+				default:
+					LogPrint (eLogWarning, "Tunnel: Unexpected message type ", (int) typeID);
+			}
+
+			msg = queue.Get ();
+			if (msg)
+			{
+				if (++numMsgs < TUNNELS_TABLE_MAX_NUM_READ_MESSAGES)
+				{
+					prevTunnelID = tunnelID;
+					prevTunnel = tunnel;
+				}
+				else
+				{
+					// don't hold removed tunnels under constant load
+					if (tunnel) tunnel->FlushTunnelDataMsgs ();
+					prevTunnelID = 0; prevTunnel = nullptr;
+					m_Tunnels.EndRead (reader);
+					m_Tunnels.BeginRead (reader);
+					numMsgs = 0;
+				}
+			}
+			else if (tunnel)
+				tunnel->FlushTunnelDataMsgs ();
+		}
+		while (msg);
+		m_Tunnels.EndRead (reader);
+	}
+
+	void Tunnels::DistributeWorkerTunnels ()
+	{
+		// one pass over all tunnels, each worker gets its own ones
+		std::vector<std::vector<std::shared_ptr<TunnelBase> > > tunnels (m_NumWorkers);
+		m_Tunnels.ForEach ([this, &tunnels](uint32_t tunnelID, const std::shared_ptr<TunnelBase>& tunnel)
+			{
+				tunnels[GetWorkerIndex (tunnelID)].push_back (tunnel);
+			});
+		for (size_t i = 0; i < m_NumWorkers; i++)
+		{
+			std::unique_lock<std::mutex> l(m_Workers[i]->cleanupMutex);
+			m_Workers[i]->cleanupTunnels.swap (tunnels[i]);
+		} // previous lists not taken by workers are released here
+	}
+
+	void Tunnels::CleanupWorkerTunnels (size_t index)
+	{
+		// endpoints are not thread safe, cleanup them in the thread handling their data
+		std::vector<std::shared_ptr<TunnelBase> > tunnels;
+		{
+			std::unique_lock<std::mutex> l(m_Workers[index]->cleanupMutex);
+			tunnels.swap (m_Workers[index]->cleanupTunnels);
+		}
+		for (auto& it: tunnels)
+			it->Cleanup ();
+	}
+
+	void Tunnels::HandleTunnelGatewayMsg (TunnelBase * tunnel, std::shared_ptr<I2NPMessage> msg)
 	{
 		if (!tunnel)
 		{
@@ -615,6 +951,7 @@ namespace tunnel
 		ManageInboundTunnels ();
 		ManageOutboundTunnels ();
 		ManageTransitTunnels ();
+		m_Tunnels.Reclaim (); // removed while read
 	}
 
 	void Tunnels::ManagePendingTunnels ()
@@ -744,7 +1081,7 @@ namespace tunnel
 					auto pool = tunnel->GetTunnelPool ();
 					if (pool)
 						pool->TunnelExpired (tunnel);
-					m_Tunnels.erase (tunnel->GetTunnelID ());
+					m_Tunnels.Remove (tunnel->GetTunnelID ());
 					it = m_InboundTunnels.erase (it);
 				}
 				else
@@ -764,7 +1101,7 @@ namespace tunnel
 
 						if (ts + TUNNEL_EXPIRATION_THRESHOLD > tunnel->GetCreationTime () + TUNNEL_EXPIRATION_TIMEOUT)
 							tunnel->SetState (eTunnelStateExpiring);
-						else // we don't need to cleanup expiring tunnels
+						else if (!m_NumWorkers) // we don't need to cleanup expiring tunnels
 							tunnel->Cleanup ();
 					}
 					it++;
@@ -810,21 +1147,29 @@ namespace tunnel
 	void Tunnels::ManageTransitTunnels ()
 	{
 		uint32_t ts = i2p::util::GetSecondsSinceEpoch ();
-		for (auto it = m_TransitTunnels.begin (); it != m_TransitTunnels.end ();)
+		std::vector<std::shared_ptr<TransitTunnel> > expired;
 		{
-			auto tunnel = *it;
-			if (ts > tunnel->GetCreationTime () + TUNNEL_EXPIRATION_TIMEOUT)
+			std::unique_lock<std::mutex> l(m_TransitTunnelsMutex);
+			for (auto it = m_TransitTunnels.begin (); it != m_TransitTunnels.end ();)
 			{
-				LogPrint (eLogDebug, "Tunnel: Transit tunnel with id ", tunnel->GetTunnelID (), " expired");
-				m_Tunnels.erase (tunnel->GetTunnelID ());
-				it = m_TransitTunnels.erase (it);
-			}
-			else
-			{
-				tunnel->Cleanup ();
-				it++;
+				auto tunnel = *it;
+				if (ts > tunnel->GetCreationTime () + TUNNEL_EXPIRATION_TIMEOUT)
+				{
+					LogPrint (eLogDebug, "Tunnel: Transit tunnel with id ", tunnel->GetTunnelID (), " expired");
+					expired.push_back (tunnel);
+					it = m_TransitTunnels.erase (it);
+				}
+				else
+				{
+					if (!m_NumWorkers) // otherwise cleaned up by worker
+						tunnel->Cleanup ();
+					it++;
+				}
 			}
 		}
+		// removal from table and tunnels' destructors don't block transit tunnels' creation
+		for (auto& it: expired)
+			m_Tunnels.Remove (it->GetTunnelID ());
 	}
 
 	void Tunnels::ManageTunnelPools (uint64_t ts)
@@ -839,12 +1184,92 @@ namespace tunnel
 
 	void Tunnels::PostTunnelData (std::shared_ptr<I2NPMessage> msg)
 	{
-		if (msg) m_Queue.Put (msg);
+		if (!msg) return;
+		if (m_NumWorkers)
+		{
+			auto typeID = msg->GetTypeID ();
+			if (typeID == eI2NPTunnelData || typeID == eI2NPTunnelGateway)
+			{
+				// same tunnel always goes to the same worker
+				m_Workers[GetWorkerIndex (bufbe32toh (msg->GetPayload ()))]->queue.Put (msg);
+				return;
+			}
+		}
+		m_Queue.Put (msg); // build messages
 	}
 
 	void Tunnels::PostTunnelData (const std::vector<std::shared_ptr<I2NPMessage> >& msgs)
 	{
-		m_Queue.Put (msgs);
+		size_t numWorkers = m_NumWorkers;
+		if (!numWorkers)
+		{
+			m_Queue.Put (msgs);
+			return;
+		}
+		// preserve order within each shard
+		std::vector<std::vector<std::shared_ptr<I2NPMessage> > > shards (numWorkers);
+		std::vector<std::shared_ptr<I2NPMessage> > buildMsgs;
+		for (const auto& it: msgs)
+		{
+			auto typeID = it->GetTypeID ();
+			if (typeID == eI2NPTunnelData || typeID == eI2NPTunnelGateway)
+				shards[GetWorkerIndex (bufbe32toh (it->GetPayload ()))].push_back (it);
+			else
+				buildMsgs.push_back (it);
+		}
+		for (size_t i = 0; i < numWorkers; i++)
+			m_Workers[i]->queue.Put (shards[i]);
+		m_Queue.Put (buildMsgs);
+	}
+
+	void Tunnels::PostTunnelBuildRequest (std::shared_ptr<I2NPMessage> msg)
+	{
+		if (!msg) return;
+		m_NumBuildRequests++;
+		if (m_BuildWorkers.empty ())
+		{
+			HandleTunnelBuildRequestMsg (msg, false, nullptr);
+			return;
+		}
+		// bounded admission, rejection still requires decryption of our record
+		int size = m_BuildRequests.GetSize ();
+		if (size >= 2*m_MaxNumBuildRequests)
+		{
+			LogPrint (eLogWarning, "Tunnel: Too many build requests in queue ", size, ", dropped");
+			m_NumDroppedBuildRequests++;
+			return;
+		}
+		bool reject = size >= m_MaxNumBuildRequests;
+		if (reject) m_NumQueueRejectedBuildRequests++;
+		m_BuildRequests.Put (std::make_shared<TunnelBuildRequest> (msg, reject));
+	}
+
+	void Tunnels::AddTunnelBuildStageTime (TunnelBuildStage stage, std::chrono::steady_clock::time_point& start)
+	{
+		auto ts = std::chrono::steady_clock::now ();
+		m_BuildStageTimes[stage] += std::chrono::duration_cast<std::chrono::microseconds>(ts - start).count ();
+		start = ts;
+	}
+
+	void Tunnels::AddTunnelBuildResult (bool accepted)
+	{
+		if (accepted)
+			m_NumAcceptedBuildRequests++;
+		else
+			m_NumRejectedBuildRequests++;
+	}
+
+	TunnelBuildStats Tunnels::GetTunnelBuildStats () const
+	{
+		TunnelBuildStats stats;
+		stats.numRequests = m_NumBuildRequests;
+		stats.numAccepted = m_NumAcceptedBuildRequests;
+		stats.numRejected = m_NumRejectedBuildRequests;
+		stats.numQueueRejected = m_NumQueueRejectedBuildRequests;
+		stats.numDropped = m_NumDroppedBuildRequests;
+		for (int i = 0; i < eNumTunnelBuildStages; i++)
+			stats.stageTimes[i] = m_BuildStageTimes[i];
+		return stats;
 	}
 
 	template<class TTunnel>
@@ -854,7 +1279,7 @@ namespace tunnel
 		auto newTunnel = std::make_shared<TTunnel> (config);
 		newTunnel->SetTunnelPool (pool);
 		uint32_t replyMsgID;
-		RAND_bytes ((uint8_t *)&replyMsgID, 4);
+		replyMsgID = i2p::crypto::RandUInt32 ();
 		AddPendingTunnel (replyMsgID, newTunnel);
 		newTunnel->Build (replyMsgID, outboundTunnel);
 		return newTunnel;
@@ -900,7 +1325,7 @@ namespace tunnel
 
 	void Tunnels::AddInboundTunnel (std::shared_ptr<InboundTunnel> newTunnel)
 	{
-		if (m_Tunnels.emplace (newTunnel->GetTunnelID (), newTunnel).second)
+		if (m_Tunnels.Add (newTunnel))
 		{
 			m_InboundTunnels.push_back (newTunnel);
 			auto pool = newTunnel->GetTunnelPool ();
@@ -930,7 +1355,7 @@ namespace tunnel
 		inboundTunnel->SetTunnelPool (pool);
 		inboundTunnel->SetState (eTunnelStateEstablished);
 		m_InboundTunnels.push_back (inboundTunnel);
-		m_Tunnels[inboundTunnel->GetTunnelID ()] = inboundTunnel;
+		m_Tunnels.Add (inboundTunnel, true);
 		return inboundTunnel;
 	}
 
@@ -966,7 +1391,7 @@ namespace tunnel
 	{
 		int timeout = 0;
 		uint32_t ts = i2p::util::GetSecondsSinceEpoch ();
-		// TODO: possible race condition with I2PControl
+		std::unique_lock<std::mutex> l(m_TransitTunnelsMutex);
 		for (const auto& it : m_TransitTunnels)
 		{
 			int t = it->GetCreationTime () + TUNNEL_EXPIRATION_TIMEOUT - ts;
@@ -977,10 +1402,16 @@ namespace tunnel
 
 	size_t Tunnels::CountTransitTunnels() const
 	{
-		// TODO: locking
+		std::unique_lock<std::mutex> l(m_TransitTunnelsMutex);
 		return m_TransitTunnels.size();
 	}
 
+	std::list<std::shared_ptr<TransitTunnel> > Tunnels::GetTransitTunnels () const
+	{
+		std::unique_lock<std::mutex> l(m_TransitTunnelsMutex);
+		return m_TransitTunnels;
+	}
+
 	size_t Tunnels::CountInboundTunnels() const
 	{
 		// TODO: locking
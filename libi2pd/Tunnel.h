@@ -13,11 +13,14 @@
 #include <map>
 #include <unordered_map>
 #include <list>
+#include <deque>
 #include <vector>
 #include <string>
 #include <thread>
 #include <mutex>
+#include <atomic>
 #include <memory>
+#include <chrono>
 #include "util.h"
 #include "Queue.h"
 #include "Crypto.h"
@@ -40,6 +43,14 @@ namespace tunnel
 	const int STANDARD_NUM_RECORDS = 4; // in VariableTunnelBuild message
 	const int MAX_NUM_RECORDS = 8;
 	const int HIGH_LATENCY_PER_HOP = 250; // in milliseconds
+	const int MAX_NUM_TUNNEL_THREADS = 16; // tunnel data workers
+	const int TUNNEL_THREADS_CLEANUP_INTERVAL = 15; // in seconds
+	const int MAX_NUM_TUNNEL_BUILD_THREADS = 8; // build requests decryption workers
+	const int DEFAULT_MAX_NUM_TUNNEL_BUILD_REQUESTS = 256; // waiting for decryption, rejected above
+	const size_t TUNNELS_TABLE_MIN_SIZE = 1024; // slots, power of 2
+	const int TUNNELS_TABLE_MAX_LOAD = 50; // in percents of slots, including removed tunnels
+	const int TUNNELS_TABLE_MAX_NUM_READERS = MAX_NUM_TUNNEL_THREADS + 1; // tunnels thread and workers
+	const int TUNNELS_TABLE_MAX_NUM_READ_MESSAGES = 64; // handled by reader before removed tunnels can be deleted
 
 	const size_t I2NP_TUNNEL_MESSAGE_SIZE = TUNNEL_DATA_MSG_SIZE + I2NP_HEADER_SIZE + 34; // reserved for alignment and NTCP 16 + 6 + 12
 	const size_t I2NP_TUNNEL_ENPOINT_MESSAGE_SIZE = 2*TUNNEL_DATA_MSG_SIZE + I2NP_HEADER_SIZE + TUNNEL_GATEWAY_HEADER_SIZE + 28; // reserved for alignment and NTCP 16 + 6 + 6
@@ -194,8 +205,116 @@ namespace tunnel
 			size_t m_NumSentBytes;
 	};
 
+	class TunnelsTable // tunnelID -> tunnel, open addressing, lock-free lookups
+	{
+		struct Slot
+		{
+			std::atomic<uint32_t> tunnelID; // 0 if never used, kept after removal
+			std::atomic<TunnelBase *> tunnel; // nullptr if removed
+		};
+
+		struct Table
+		{
+			Table (size_t size);
+			size_t GetIndex (uint32_t tunnelID, uint64_t seed) const { return ((tunnelID ^ seed)*0x9E3779B97F4A7C15ULL) >> shift; };
+
+			size_t mask;
+			int shift;
+			std::unique_ptr<Slot[]> slots;
+			std::vector<std::shared_ptr<TunnelBase> > tunnels; // own tunnels of slots, writers only
+		};
+
+		struct Reader
+		{
+			std::atomic<uint64_t> epoch; // 0 if not reading
+			uint8_t padding[56]; // one cache line per reader
+		};
+
+		struct Retired // freed when all readers have left older epochs
+		{
+			uint64_t epoch;
+			std::shared_ptr<TunnelBase> tunnel;
+			std::unique_ptr<Table> table;
+		};
+
+		public:
+
+			TunnelsTable ();
+			~TunnelsTable ();
+
+			bool Add (std::shared_ptr<TunnelBase> tunnel, bool replace = false); // false if exists
+			bool Remove (uint32_t tunnelID);
+			std::shared_ptr<TunnelBase> Get (uint32_t tunnelID) const; // from any thread
+			size_t GetSize () const;
+			template<typename Visitor>
+			void ForEach (Visitor v) const // tunnelID, tunnel. Don't call other methods from visitor
+			{
+				std::unique_lock<std::mutex> l(m_Mutex);
+				auto table = m_Table.load ();
+				for (size_t i = 0; i <= table->mask; i++)
+					if (table->tunnels[i])
+						v (table->slots[i].tunnelID.load (), table->tunnels[i]);
+			}
+			void Reclaim (); // free removed tunnels nobody reads anymore
+
+			// lookups without locks and reference counting for readers with own index,
+			// tunnel stays valid until EndRead even if removed meanwhile
+			void BeginRead (int reader);
+			TunnelBase * Find (uint32_t tunnelID) const; // between BeginRead and EndRead only
+			void EndRead (int reader);
+
+		private:
+
+			Slot * FindSlot (Table * table, uint32_t tunnelID) const; // existing or first empty
+			void Rehash ();
+			void Retire (std::shared_ptr<TunnelBase> tunnel, Table * table);
+
+		private:
+
+			mutable std::mutex m_Mutex; // writers
+			std::atomic<Table *> m_Table;
+			size_t m_NumUsed, m_NumTunnels; // slots
+			uint64_t m_Seed;
+			std::atomic<uint64_t> m_Epoch;
+			Reader m_Readers[TUNNELS_TABLE_MAX_NUM_READERS];
+			std::deque<Retired> m_Retired;
+	};
+
+	enum TunnelBuildStage
+	{
+		eTunnelBuildStageQueue = 0, // waiting for build worker
+		eTunnelBuildStageDecrypt, // our record
+		eTunnelBuildStageAccept, // limits check and transit tunnel creation
+		eTunnelBuildStageReply, // records encryption and sending
+		eNumTunnelBuildStages
+	};
+
+	struct TunnelBuildStats
+	{
+		uint64_t numRequests, numAccepted, numRejected, numQueueRejected, numDropped;
+		uint64_t stageTimes[eNumTunnelBuildStages]; // total, in microseconds
+	};
+
 	class Tunnels
 	{
+		struct TunnelsWorker
+		{
+			TunnelsWorker (): thread (nullptr) {};
+			std::thread * thread;
+			i2p::util::MPSCQueue<std::shared_ptr<I2NPMessage> > queue;
+			std::mutex cleanupMutex;
+			std::vector<std::shared_ptr<TunnelBase> > cleanupTunnels; // distributed by tunnels thread
+		};
+
+		struct TunnelBuildRequest
+		{
+			TunnelBuildRequest (std::shared_ptr<I2NPMessage> m, bool r):
+				msg (m), queued (std::chrono::steady_clock::now ()), reject (r) {};
+			std::shared_ptr<I2NPMessage> msg;
+			std::chrono::steady_clock::time_point queued;
+			bool reject; // queue is full
+		};
+
 		public:
 
 			Tunnels ();
@@ -217,6 +336,10 @@ namespace tunnel
 			std::shared_ptr<OutboundTunnel> CreateOutboundTunnel (std::shared_ptr<TunnelConfig> config, std::shared_ptr<TunnelPool> pool);
 			void PostTunnelData (std::shared_ptr<I2NPMessage> msg);
 			void PostTunnelData (const std::vector<std::shared_ptr<I2NPMessage> >& msgs);
+			void PostTunnelBuildRequest (std::shared_ptr<I2NPMessage> msg); // from tunnels thread
+			void AddTunnelBuildStageTime (TunnelBuildStage stage, std::chrono::steady_clock::time_point& start); // and restart
+			void AddTunnelBuildResult (bool accepted);
+			TunnelBuildStats GetTunnelBuildStats () const;
 			void AddPendingTunnel (uint32_t replyMsgID, std::shared_ptr<InboundTunnel> tunnel);
 			void AddPendingTunnel (uint32_t replyMsgID, std::shared_ptr<OutboundTunnel> tunnel);
 			std::shared_ptr<TunnelPool> CreateTunnelPool (int numInboundHops, int numOuboundHops, 
@@ -235,9 +358,16 @@ namespace tunnel
 			template<class TTunnel>
 			std::shared_ptr<TTunnel> GetPendingTunnel (uint32_t replyMsgID, const std::map<uint32_t, std::shared_ptr<TTunnel> >& pendingTunnels);
 
-			void HandleTunnelGatewayMsg (std::shared_ptr<TunnelBase> tunnel, std::shared_ptr<I2NPMessage> msg);
+			void HandleTunnelGatewayMsg (TunnelBase * tunnel, std::shared_ptr<I2NPMessage> msg);
+			void HandleTunnelMessages (std::shared_ptr<I2NPMessage> msg, i2p::util::MPSCQueue<std::shared_ptr<I2NPMessage> >& queue,
+				int reader); // 0 for tunnels thread, worker index + 1 for workers
+			size_t GetWorkerIndex (uint32_t tunnelID) const { return tunnelID % m_NumWorkers; };
 
 			void Run ();
+			void RunWorker (size_t index);
+			void RunBuildWorker (int index);
+			void DistributeWorkerTunnels ();
+			void CleanupWorkerTunnels (size_t index);
 			void ManageTunnels ();
 			void ManageOutboundTunnels ();
 			void ManageInboundTunnels ();
@@ -259,11 +389,20 @@ namespace tunnel
 			std::list<std::shared_ptr<InboundTunnel> > m_InboundTunnels;
 			std::list<std::shared_ptr<OutboundTunnel> > m_OutboundTunnels;
 			std::list<std::shared_ptr<TransitTunnel> > m_TransitTunnels;
-			std::unordered_map<uint32_t, std::shared_ptr<TunnelBase> > m_Tunnels; // tunnelID->tunnel known by this id
+			mutable std::mutex m_TransitTunnelsMutex; // added by build workers
+			TunnelsTable m_Tunnels; // tunnelID->tunnel known by this id
 			std::mutex m_PoolsMutex;
 			std::list<std::shared_ptr<TunnelPool>> m_Pools;
 			std::shared_ptr<TunnelPool> m_ExploratoryPool;
-			i2p::util::Queue<std::shared_ptr<I2NPMessage> > m_Queue;
+			i2p::util::MPSCQueue<std::shared_ptr<I2NPMessage> > m_Queue; // build messages, and tunnel data if no workers
+			std::vector<std::unique_ptr<TunnelsWorker> > m_Workers; // tunnel data and gateway, sharded by tunnelID
+			std::atomic<size_t> m_NumWorkers;
+			std::vector<std::thread *> m_BuildWorkers;
+			i2p::util::Queue<std::shared_ptr<TunnelBuildRequest> > m_BuildRequests;
+			int m_MaxNumBuildRequests;
+			std::atomic<uint64_t> m_NumBuildRequests, m_NumAcceptedBuildRequests, m_NumRejectedBuildRequests,
+				m_NumQueueRejectedBuildRequests, m_NumDroppedBuildRequests;
+			std::atomic<uint64_t> m_BuildStageTimes[eNumTunnelBuildStages];
 			i2p::util::MemoryPoolMt<I2NPMessageBuffer<I2NP_TUNNEL_ENPOINT_MESSAGE_SIZE> > m_I2NPTunnelEndpointMessagesMemoryPool;
 			i2p::util::MemoryPoolMt<I2NPMessageBuffer<I2NP_TUNNEL_MESSAGE_SIZE> > m_I2NPTunnelMessagesMemoryPool;
 
@@ -275,13 +414,21 @@ namespace tunnel
 			// for HTTP only
 			const decltype(m_OutboundTunnels)& GetOutboundTunnels () const { return m_OutboundTunnels; };
 			const decltype(m_InboundTunnels)& GetInboundTunnels () const { return m_InboundTunnels; };
-			const decltype(m_TransitTunnels)& GetTransitTunnels () const { return m_TransitTunnels; };
+			decltype(m_TransitTunnels) GetTransitTunnels () const; // copy, list is changed by build workers
 
 			size_t CountTransitTunnels() const;
 			size_t CountInboundTunnels() const;
 			size_t CountOutboundTunnels() const;
 
-			int GetQueueSize () { return m_Queue.GetSize (); };
+			int GetQueueSize ()
+			{
+				int size = m_Queue.GetSize ();
+				for (size_t i = 0; i < m_NumWorkers; i++)
+					size += m_Workers[i]->queue.GetSize ();
+				return size;
+			};
+			size_t GetNumWorkers () const { return m_NumWorkers; };
+			int GetBuildQueueSize () { return m_BuildRequests.GetSize (); };
 			int GetTunnelCreationSuccessRate () const // in percents
 			{
 				int totalNum = m_NumSuccesiveTunnelCreations + m_NumFailedTunnelCreations;
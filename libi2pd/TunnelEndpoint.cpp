@@ -1,5 +1,5 @@
 /*
-* Copyright (c) 2013-2020, The PurpleI2P Project
+* Copyright (c) 2013-2022, The PurpleI2P Project
 *
 * This file is part of Purple i2pd project and licensed under BSD3
 *
@@ -23,6 +23,9 @@ namespace tunnel
 {
 	TunnelEndpoint::~TunnelEndpoint ()
 	{
+		for (auto& it: m_IncompleteMessages)
+			ReleaseFragments (it.second);
+		ReleaseFragments (m_CurrentMessage);
 	}
 
 	void TunnelEndpoint::HandleDecryptedTunnelDataMsg (std::shared_ptr<I2NPMessage> msg)
@@ -82,7 +85,6 @@ namespace tunnel
 						// Message ID
 						msgID = bufbe32toh (fragment);
 						fragment += 4;
-						m_CurrentMsgID = msgID;
 						isLastFragment = false;
 					}
 				}
@@ -97,6 +99,13 @@ namespace tunnel
 
 				uint16_t size = bufbe16toh (fragment);
 				fragment += 2;
+				// check fragment size
+				if (fragment + size > decrypted + TUNNEL_DATA_ENCRYPTED_SIZE)
+				{
+					LogPrint (eLogError, "TunnelMessage: Fragment is too long ", (int)size);
+					if (!isFollowOnFragment) m_CurrentMessage.data = nullptr;
+					return;
+				}
 
 				// handle fragment
 				if (isFollowOnFragment)
@@ -106,49 +115,59 @@ namespace tunnel
 						HandleCurrenMessageFollowOnFragment (fragment, size, isLastFragment); // previous
 					else
 					{
+						AddIncompleteCurrentMessage (); // it's continued in another tunnel message
 						HandleFollowOnFragment (msgID, isLastFragment, fragmentNum, fragment, size); // another
-						m_CurrentMsgID = 0; m_CurrentMessage.data = nullptr;
 					}
 				}
 				else
 				{
 					// new message
-					msg->offset = fragment - msg->buf;
-					msg->len = msg->offset + size;
-					// check message size
-					if (msg->len > msg->maxLen)
-					{
-						LogPrint (eLogError, "TunnelMessage: Fragment is too long ", (int)size);
-						m_CurrentMsgID = 0; m_CurrentMessage.data = nullptr;
-						return;
-					}
-					// create new or assign I2NP message
-					if (fragment + size < decrypted + TUNNEL_DATA_ENCRYPTED_SIZE)
-					{
-						// this is not last message. we have to copy it
-						m_CurrentMessage.data = NewI2NPTunnelMessage (true);
-						*(m_CurrentMessage.data) = *msg;
-					}
-					else
-						m_CurrentMessage.data = msg;
-
 					if (isLastFragment)
 					{
 						// single message
+						msg->offset = fragment - msg->buf;
+						msg->len = msg->offset + size;
+						if (fragment + size < decrypted + TUNNEL_DATA_ENCRYPTED_SIZE)
+						{
+							// this is not last message. we have to copy it
+							m_CurrentMessage.data = NewI2NPTunnelMessage (true);
+							*(m_CurrentMessage.data) = *msg;
+						}
+						else
+							m_CurrentMessage.data = msg;
 						HandleNextMessage (m_CurrentMessage);
-						m_CurrentMsgID = 0; m_CurrentMessage.data = nullptr;
+						m_CurrentMessage.data = nullptr;
 					}
 					else if (msgID)
 					{
 						// first fragment of a new message
-						m_CurrentMessage.nextFragmentNum = 1;
-						m_CurrentMessage.receiveTime = i2p::util::GetMillisecondsSinceEpoch ();
-						HandleOutOfSequenceFragments (msgID, m_CurrentMessage);
+						auto it = m_IncompleteMessages.find (msgID);
+						if (it == m_IncompleteMessages.end () || !it->second.data)
+						{
+							if (it != m_IncompleteMessages.end ())
+							{
+								// follow-on fragments came first, take them
+								m_CurrentMessage.savedFragments = it->second.savedFragments;
+								m_CurrentMessage.fragments = it->second.fragments;
+								m_IncompleteMessages.erase (it);
+							}
+							m_CurrentMessage.data = CreateIncompleteMessage (msg, fragment, size,
+								fragment + size >= decrypted + TUNNEL_DATA_ENCRYPTED_SIZE);
+							m_CurrentMessage.nextFragmentNum = 1;
+							m_CurrentMessage.receiveTime = i2p::util::GetMillisecondsSinceEpoch ();
+							m_CurrentMsgID = msgID;
+							HandleOutOfSequenceFragments (msgID, m_CurrentMessage);
+						}
+						else
+						{
+							LogPrint (eLogError, "TunnelMessage: Incomplete message ", msgID, " already exists");
+							m_CurrentMessage.data = nullptr;
+						}
 					}
 					else
 					{
 						LogPrint (eLogError, "TunnelMessage: Message is fragmented, but msgID is not presented");
-						m_CurrentMsgID = 0; m_CurrentMessage.data = nullptr;
+						m_CurrentMessage.data = nullptr;
 					}
 				}
 
@@ -159,11 +178,36 @@ namespace tunnel
 			LogPrint (eLogError, "TunnelMessage: Zero not found");
 	}
 
+	std::shared_ptr<I2NPMessage> TunnelEndpoint::CreateIncompleteMessage (std::shared_ptr<I2NPMessage> msg,
+		const uint8_t * fragment, size_t size, bool isLastInTunnelMessage) const
+	{
+		// first fragment starts with I2NP header, follow-on fragments are placed after it without reallocation
+		size_t msgLen = I2NP_MAX_MESSAGE_SIZE;
+		if (size >= I2NP_HEADER_SIZE)
+		{
+			msgLen = I2NP_HEADER_SIZE + bufbe16toh (fragment + I2NP_HEADER_SIZE_OFFSET);
+			if (msgLen < size) msgLen = size;
+			if (msgLen > I2NP_MAX_MESSAGE_SIZE) msgLen = I2NP_MAX_MESSAGE_SIZE;
+		}
+		msg->offset = fragment - msg->buf;
+		msg->len = msg->offset + size;
+		if (isLastInTunnelMessage && msg->offset + msgLen <= msg->maxLen)
+			return msg; // fits tunnel message buffer
+		auto newMsg = NewI2NPMessage (msgLen);
+		*newMsg = *msg;
+		return newMsg;
+	}
+
 	void TunnelEndpoint::HandleFollowOnFragment (uint32_t msgID, bool isLastFragment,
 		uint8_t fragmentNum, const uint8_t * fragment, size_t size)
 	{
+		if (!fragmentNum)
+		{
+			LogPrint (eLogError, "TunnelMessage: Follow-on fragment of message ", msgID, " has number 0, dropped");
+			return;
+		}
 		auto it = m_IncompleteMessages.find (msgID);
-		if (it != m_IncompleteMessages.end())
+		if (it != m_IncompleteMessages.end() && it->second.data)
 		{
 			auto& msg = it->second;
 			if (fragmentNum == msg.nextFragmentNum)
@@ -174,7 +218,7 @@ namespace tunnel
 					{
 						// message complete
 						HandleNextMessage (msg);
-						m_IncompleteMessages.erase (it);
+						RemoveMessage (msgID, msg);
 					}
 					else
 					{
@@ -184,20 +228,27 @@ namespace tunnel
 				}
 				else
 				{
-					LogPrint (eLogError, "TunnelMessage: Fragment ", fragmentNum, " of message ", msgID, "exceeds max I2NP message size, message dropped");
-					m_IncompleteMessages.erase (it);
+					LogPrint (eLogError, "TunnelMessage: Fragment ", (int)fragmentNum, " of message ", msgID, " exceeds max I2NP message size, message dropped");
+					RemoveMessage (msgID, msg);
 				}
 			}
 			else
 			{
 				LogPrint (eLogWarning, "TunnelMessage: Unexpected fragment ", (int)fragmentNum, " instead ", (int)msg.nextFragmentNum, " of message ", msgID, ", saved");
-				AddOutOfSequenceFragment (msgID, fragmentNum, isLastFragment, fragment, size);
+				AddOutOfSequenceFragment (msg, msgID, fragmentNum, isLastFragment, fragment, size);
 			}
 		}
 		else
 		{
 			LogPrint (eLogDebug, "TunnelMessage: First fragment of message ", msgID, " not found, saved");
-			AddOutOfSequenceFragment (msgID, fragmentNum, isLastFragment, fragment, size);
+			if (it == m_IncompleteMessages.end ())
+			{
+				TunnelMessageBlockEx msg;
+				msg.receiveTime = i2p::util::GetMillisecondsSinceEpoch ();
+				msg.nextFragmentNum = 0;
+				it = m_IncompleteMessages.emplace (msgID, msg).first;
+			}
+			AddOutOfSequenceFragment (it->second, msgID, fragmentNum, isLastFragment, fragment, size);
 		}
 	}
 
@@ -207,8 +258,9 @@ namespace tunnel
 		{
 			if (msg.data->len + size > msg.data->maxLen)
 			{
-			//	LogPrint (eLogWarning, "TunnelMessage: I2NP message size ", msg.data->maxLen, " is not enough");
-				auto newMsg = NewI2NPMessage ();
+				// I2NP header was wrong or not in first fragment
+				LogPrint (eLogDebug, "TunnelMessage: I2NP message size ", msg.data->maxLen, " is not enough");
+				auto newMsg = NewI2NPMessage (msg.data->len + size);
 				*newMsg = *(msg.data);
 				msg.data = newMsg;
 			}
@@ -231,7 +283,7 @@ namespace tunnel
 			{
 				// message complete
 				HandleNextMessage (m_CurrentMessage);
-				m_CurrentMsgID = 0; m_CurrentMessage.data = nullptr;
+				RemoveMessage (m_CurrentMsgID, m_CurrentMessage);
 			}
 			else
 			{
@@ -241,8 +293,8 @@ namespace tunnel
 		}
 		else
 		{
-			LogPrint (eLogError, "TunnelMessage: Fragment ", m_CurrentMessage.nextFragmentNum, " of message ", m_CurrentMsgID, " exceeds max I2NP message size, message dropped");
-			m_CurrentMsgID = 0; m_CurrentMessage.data = nullptr;
+			LogPrint (eLogError, "TunnelMessage: Fragment ", (int)m_CurrentMessage.nextFragmentNum, " of message ", m_CurrentMsgID, " exceeds max I2NP message size, message dropped");
+			RemoveMessage (m_CurrentMsgID, m_CurrentMessage);
 		}
 	}
 
@@ -252,66 +304,90 @@ namespace tunnel
 		{
 			auto ret = m_IncompleteMessages.emplace (m_CurrentMsgID, m_CurrentMessage);
 			if (!ret.second)
+			{
 				LogPrint (eLogError, "TunnelMessage: Incomplete message ", m_CurrentMsgID, " already exists");
+				ReleaseFragments (m_CurrentMessage);
+			}
+			m_CurrentMessage.savedFragments = 0;
+			m_CurrentMessage.fragments = nullptr;
 			m_CurrentMessage.data = nullptr;
 			m_CurrentMsgID = 0;
 		}
 	}
 
-	void TunnelEndpoint::AddOutOfSequenceFragment (uint32_t msgID, uint8_t fragmentNum,
+	void TunnelEndpoint::AddOutOfSequenceFragment (TunnelMessageBlockEx& msg, uint32_t msgID, uint8_t fragmentNum,
 		bool isLastFragment, const uint8_t * fragment, size_t size)
 	{
-		std::unique_ptr<Fragment> f(new Fragment (isLastFragment, i2p::util::GetMillisecondsSinceEpoch (), size));
-		memcpy (f->data.data (), fragment, size);
-		if (!m_OutOfSequenceFragments.emplace ((uint64_t)msgID << 32 | fragmentNum, std::move (f)).second)
-			LogPrint (eLogInfo, "TunnelMessage: Duplicate out-of-sequence fragment ", fragmentNum, " of message ", msgID);
+		uint64_t bit = (uint64_t)1 << fragmentNum;
+		if ((msg.savedFragments & bit) || fragmentNum < msg.nextFragmentNum)
+		{
+			LogPrint (eLogInfo, "TunnelMessage: Duplicate out-of-sequence fragment ", (int)fragmentNum, " of message ", msgID);
+			return;
+		}
+		auto f = m_FragmentsPool.Acquire ();
+		f->fragmentNum = fragmentNum;
+		f->isLastFragment = isLastFragment;
+		f->size = size;
+		memcpy (f->data, fragment, size);
+		// insert sorted
+		auto prev = &msg.fragments;
+		while (*prev && (*prev)->fragmentNum < fragmentNum)
+			prev = &(*prev)->next;
+		f->next = *prev;
+		*prev = f;
+		msg.savedFragments |= bit;
 	}
 
 	void TunnelEndpoint::HandleOutOfSequenceFragments (uint32_t msgID, TunnelMessageBlockEx& msg)
 	{
-		while (ConcatNextOutOfSequenceFragment (msgID, msg))
+		while (msg.nextFragmentNum < 64 && (msg.savedFragments & ((uint64_t)1 << msg.nextFragmentNum)))
 		{
-			if (!msg.nextFragmentNum) // message complete
+			// saved fragments before next are never kept, so it's first
+			auto f = msg.fragments;
+			msg.fragments = f->next;
+			msg.savedFragments &= ~((uint64_t)1 << msg.nextFragmentNum);
+			LogPrint (eLogDebug, "TunnelMessage: Out-of-sequence fragment ", (int)msg.nextFragmentNum, " of message ", msgID, " found");
+			bool isConcatenated = ConcatFollowOnFragment (msg, f->data, f->size), isLastFragment = f->isLastFragment;
+			m_FragmentsPool.Release (f);
+			if (!isConcatenated)
+			{
+				LogPrint (eLogError, "TunnelMessage: Fragment ", (int)msg.nextFragmentNum, " of message ", msgID, " exceeds max I2NP message size, message dropped");
+				RemoveMessage (msgID, msg);
+				break;
+			}
+			if (isLastFragment)
 			{
+				// message complete
 				HandleNextMessage (msg);
-				if (&msg == &m_CurrentMessage)
-				{
-					m_CurrentMsgID = 0;
-					m_CurrentMessage.data = nullptr;
-				}
-				else
-					m_IncompleteMessages.erase (msgID);
 				LogPrint (eLogDebug, "TunnelMessage: All fragments of message ", msgID, " found");
+				RemoveMessage (msgID, msg);
 				break;
 			}
+			msg.nextFragmentNum++;
 		}
 	}
 
-	bool TunnelEndpoint::ConcatNextOutOfSequenceFragment (uint32_t msgID, TunnelMessageBlockEx& msg)
+	void TunnelEndpoint::RemoveMessage (uint32_t msgID, TunnelMessageBlockEx& msg)
 	{
-		auto it = m_OutOfSequenceFragments.find ((uint64_t)msgID << 32 | msg.nextFragmentNum);
-		if (it != m_OutOfSequenceFragments.end ())
+		ReleaseFragments (msg);
+		if (&msg == &m_CurrentMessage)
 		{
-			LogPrint (eLogDebug, "TunnelMessage: Out-of-sequence fragment ", (int)msg.nextFragmentNum, " of message ", msgID, " found");
-			size_t size = it->second->data.size ();
-			if (msg.data->len + size > msg.data->maxLen)
-			{
-				LogPrint (eLogWarning, "TunnelMessage: Tunnel endpoint I2NP message size ", msg.data->maxLen, " is not enough");
-				auto newMsg = NewI2NPMessage ();
-				*newMsg = *(msg.data);
-				msg.data = newMsg;
-			}
-			if (msg.data->Concat (it->second->data.data (), size) < size) // concatenate out-of-sync fragment
-				LogPrint (eLogError, "TunnelMessage: Tunnel endpoint I2NP buffer overflow ", msg.data->maxLen);
-			if (it->second->isLastFragment)
-				// message complete
-				msg.nextFragmentNum = 0;
-			else
-				msg.nextFragmentNum++;
-			m_OutOfSequenceFragments.erase (it);
-			return true;
+			m_CurrentMsgID = 0;
+			m_CurrentMessage.data = nullptr;
+		}
+		else
+			m_IncompleteMessages.erase (msgID);
+	}
+
+	void TunnelEndpoint::ReleaseFragments (TunnelMessageBlockEx& msg)
+	{
+		while (msg.fragments)
+		{
+			auto f = msg.fragments;
+			msg.fragments = f->next;
+			m_FragmentsPool.Release (f);
 		}
-		return false;
+		msg.savedFragments = 0;
 	}
 
 	void TunnelEndpoint::HandleNextMessage (const TunnelMessageBlock& msg)
@@ -353,22 +429,19 @@ namespace tunnel
 	void TunnelEndpoint::Cleanup ()
 	{
 		auto ts = i2p::util::GetMillisecondsSinceEpoch ();
-		// out-of-sequence fragments
-		for (auto it = m_OutOfSequenceFragments.begin (); it != m_OutOfSequenceFragments.end ();)
-		{
-			if (ts > it->second->receiveTime + i2p::I2NP_MESSAGE_EXPIRATION_TIMEOUT)
-				it = m_OutOfSequenceFragments.erase (it);
-			else
-				++it;
-		}
-		// incomplete messages
+		// incomplete messages and out-of-sequence fragments
 		for (auto it = m_IncompleteMessages.begin (); it != m_IncompleteMessages.end ();)
 		{
 			if (ts > it->second.receiveTime + i2p::I2NP_MESSAGE_EXPIRATION_TIMEOUT)
+			{
+				ReleaseFragments (it->second);
 				it = m_IncompleteMessages.erase (it);
+			}
 			else
 				++it;
 		}
+		if (m_IncompleteMessages.empty () && !m_CurrentMessage.fragments)
+			m_FragmentsPool.CleanUp (); // return slots to heap
 	}
 }
 }
@@ -1,5 +1,5 @@
 /*
-* Copyright (c) 2013-2021, The PurpleI2P Project
+* Copyright (c) 2013-2022, The PurpleI2P Project
 *
 * This file is part of Purple i2pd project and licensed under BSD3
 *
@@ -13,6 +13,7 @@
 #include <vector>
 #include <string>
 #include <unordered_map>
+#include "util.h"
 #include "I2NPProtocol.h"
 #include "TunnelBase.h"
 
@@ -22,18 +23,21 @@ namespace tunnel
 {
 	class TunnelEndpoint
 	{
-		struct TunnelMessageBlockEx: public TunnelMessageBlock
+		struct Fragment
 		{
-			uint64_t receiveTime; // milliseconds since epoch
-			uint8_t nextFragmentNum;
+			Fragment * next; // saved fragments of a message are sorted by number
+			uint8_t fragmentNum;
+			bool isLastFragment;
+			uint16_t size;
+			uint8_t data[TUNNEL_DATA_MAX_PAYLOAD_SIZE];
 		};
 
-		struct Fragment
+		struct TunnelMessageBlockEx: public TunnelMessageBlock
 		{
-			Fragment (bool last, uint64_t t, size_t size): isLastFragment (last), receiveTime (t), data (size) {};
-			bool isLastFragment;
 			uint64_t receiveTime; // milliseconds since epoch
-			std::vector<uint8_t> data;
+			uint8_t nextFragmentNum; // 0 if first fragment is not received yet
+			uint64_t savedFragments = 0; // bitmap of out-of-sequence fragments
+			Fragment * fragments = nullptr;
 		};
 
 		public:
@@ -52,15 +56,18 @@ namespace tunnel
 			void HandleCurrenMessageFollowOnFragment (const uint8_t * fragment, size_t size, bool isLastFragment);
 			void HandleNextMessage (const TunnelMessageBlock& msg);
 
-			void AddOutOfSequenceFragment (uint32_t msgID, uint8_t fragmentNum, bool isLastFragment, const uint8_t * fragment, size_t size);
-			bool ConcatNextOutOfSequenceFragment (uint32_t msgID, TunnelMessageBlockEx& msg); // true if something added
+			std::shared_ptr<I2NPMessage> CreateIncompleteMessage (std::shared_ptr<I2NPMessage> msg,
+				const uint8_t * fragment, size_t size, bool isLastInTunnelMessage) const; // sized for whole I2NP message
+			void AddOutOfSequenceFragment (TunnelMessageBlockEx& msg, uint32_t msgID, uint8_t fragmentNum, bool isLastFragment, const uint8_t * fragment, size_t size);
 			void HandleOutOfSequenceFragments (uint32_t msgID, TunnelMessageBlockEx& msg);
 			void AddIncompleteCurrentMessage ();
+			void RemoveMessage (uint32_t msgID, TunnelMessageBlockEx& msg); // current or incomplete
+			void ReleaseFragments (TunnelMessageBlockEx& msg);
 
 		private:
 
-			std::unordered_map<uint32_t, TunnelMessageBlockEx> m_IncompleteMessages;
-			std::unordered_map<uint64_t, std::unique_ptr<Fragment> > m_OutOfSequenceFragments; // ((msgID << 8) + fragment#)->fragment
+			std::unordered_map<uint32_t, TunnelMessageBlockEx> m_IncompleteMessages; // including messages with out-of-sequence fragments only
+			i2p::util::MemoryPool<Fragment> m_FragmentsPool;
 			bool m_IsInbound;
 			size_t m_NumReceivedBytes;
 			TunnelMessageBlockEx m_CurrentMessage;
@@ -1,5 +1,5 @@
 /*
-* Copyright (c) 2013-2021, The PurpleI2P Project
+* Copyright (c) 2013-2022, The PurpleI2P Project
 *
 * This file is part of Purple i2pd project and licensed under BSD3
 *
@@ -171,7 +171,7 @@ namespace tunnel
 
 		m_CurrentTunnelDataMsg->offset = m_CurrentTunnelDataMsg->len - TUNNEL_DATA_MSG_SIZE - I2NP_HEADER_SIZE;
 		uint8_t * buf = m_CurrentTunnelDataMsg->GetPayload ();
-		RAND_bytes (buf + 4, 16); // original IV
+		i2p::crypto::RandBytes (buf + 4, 16); // original IV
 		memcpy (payload + size, buf + 4, 16); // copy IV for checksum
 		uint8_t hash[32];
 		SHA256(payload, size+16, hash);
@@ -184,11 +184,11 @@ namespace tunnel
 			if (!m_NonZeroRandomBuffer) // first time?
 			{
 				m_NonZeroRandomBuffer = new uint8_t[TUNNEL_DATA_MAX_PAYLOAD_SIZE];
-				RAND_bytes (m_NonZeroRandomBuffer, TUNNEL_DATA_MAX_PAYLOAD_SIZE);
+				i2p::crypto::RandBytes (m_NonZeroRandomBuffer, TUNNEL_DATA_MAX_PAYLOAD_SIZE);
 				for (size_t i = 0; i < TUNNEL_DATA_MAX_PAYLOAD_SIZE; i++)
 					if (!m_NonZeroRandomBuffer[i]) m_NonZeroRandomBuffer[i] = 1;
 			}
-			auto randomOffset = rand () % (TUNNEL_DATA_MAX_PAYLOAD_SIZE - paddingSize + 1);
+			auto randomOffset = i2p::crypto::RandUInt32 () % (TUNNEL_DATA_MAX_PAYLOAD_SIZE - paddingSize + 1);
 			memcpy (buf + 24, m_NonZeroRandomBuffer + randomOffset, paddingSize);
 		}
 
@@ -368,7 +368,7 @@ namespace tunnel
 			if (!failed)
 			{
 				uint32_t msgID;
-				RAND_bytes ((uint8_t *)&msgID, 4);
+				msgID = i2p::crypto::RandUInt32 ();
 				{
 					std::unique_lock<std::mutex> l(m_TestsMutex);
 					m_Tests[msgID] = std::make_pair (*it1, *it2);
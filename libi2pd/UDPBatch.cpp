@@ -0,0 +1,156 @@
+/*
+* Copyright (c) 2013-2022, The PurpleI2P Project
+*
+* This file is part of Purple i2pd project and licensed under BSD3
+*
+* See full license text in LICENSE file at top of project tree
+*/
+
+#include "Log.h"
+#include "UDPBatch.h"
+
+namespace i2p
+{
+namespace transport
+{
+	UDPBatchSender::UDPBatchSender (boost::asio::ip::udp::socket& socket):
+		m_Socket (socket), m_Packets (UDP_MAX_BATCH_SIZE), m_NumPackets (0)
+#ifdef UDP_BATCH_MMSG
+		, m_IsMmsg (true), m_IsGSO (false)
+#endif
+	{
+	}
+
+	bool UDPBatchSender::EnableSegmentationOffload ()
+	{
+#ifdef UDP_BATCH_MMSG
+		int size = 0;
+		socklen_t len = sizeof (size);
+		// option is known to kernel, segment size is set per message
+		m_IsGSO = m_IsMmsg && !getsockopt (m_Socket.native_handle (), SOL_UDP, UDP_SEGMENT, &size, &len);
+		return m_IsGSO;
+#else
+		return false;
+#endif
+	}
+
+	bool UDPBatchSender::Add (const uint8_t * buf, size_t len, const boost::asio::ip::udp::endpoint& to)
+	{
+		if (IsFull () || len > UDP_BATCH_MAX_PACKET_SIZE) return false;
+		auto& packet = m_Packets[m_NumPackets];
+		memcpy (packet.buf, buf, len);
+		packet.len = len;
+		packet.to = to;
+		m_NumPackets++;
+		return true;
+	}
+
+	bool UDPBatchSender::Add (const std::vector<boost::asio::const_buffer>& bufs, const boost::asio::ip::udp::endpoint& to)
+	{
+		if (IsFull () || boost::asio::buffer_size (bufs) > UDP_BATCH_MAX_PACKET_SIZE) return false;
+		auto& packet = m_Packets[m_NumPackets];
+		packet.len = boost::asio::buffer_copy (boost::asio::buffer (packet.buf), bufs);
+		packet.to = to;
+		m_NumPackets++;
+		return true;
+	}
+
+	size_t UDPBatchSender::Flush (boost::system::error_code& ec)
+	{
+		size_t numSent = 0;
+#ifdef UDP_BATCH_MMSG
+		if (m_IsMmsg)
+			numSent = SendMmsg (ec);
+#endif
+		// send_to waits if socket's buffer is full
+		for (size_t i = numSent; i < m_NumPackets; i++)
+		{
+			boost::system::error_code ec1;
+			m_Socket.send_to (boost::asio::buffer (m_Packets[i].buf, m_Packets[i].len), m_Packets[i].to, 0, ec1);
+			if (!ec1)
+				numSent++;
+			else
+				ec = ec1;
+		}
+		m_NumPackets = 0;
+		return numSent;
+	}
+
+#ifdef UDP_BATCH_MMSG
+	size_t UDPBatchSender::SendMmsg (boost::system::error_code& ec)
+	{
+		size_t numMsgs = 0;
+		for (size_t i = 0; i < m_NumPackets;)
+		{
+			auto& packet = m_Packets[i];
+			size_t j = i + 1, size = packet.len;
+			if (m_IsGSO)
+			{
+				// all segments but last must be the same size, last can be shorter
+				while (j < m_NumPackets && j - i < UDP_MAX_GSO_SEGMENTS && m_Packets[j].to == packet.to &&
+					m_Packets[j - 1].len == packet.len && m_Packets[j].len <= packet.len &&
+					size + m_Packets[j].len <= UDP_MAX_GSO_SIZE)
+				{
+					size += m_Packets[j].len;
+					j++;
+				}
+			}
+			for (size_t k = i; k < j; k++)
+			{
+				m_Iovs[k].iov_base = m_Packets[k].buf;
+				m_Iovs[k].iov_len = m_Packets[k].len;
+			}
+			auto& hdr = m_Msgs[numMsgs].msg_hdr;
+			memset (&hdr, 0, sizeof (hdr));
+			hdr.msg_name = packet.to.data ();
+			hdr.msg_namelen = packet.to.size ();
+			hdr.msg_iov = m_Iovs + i;
+			hdr.msg_iovlen = j - i;
+			if (j - i > 1)
+			{
+				hdr.msg_control = m_Controls[numMsgs];
+				hdr.msg_controllen = sizeof (m_Controls[numMsgs]);
+				auto cmsg = CMSG_FIRSTHDR (&hdr);
+				cmsg->cmsg_level = SOL_UDP;
+				cmsg->cmsg_type = UDP_SEGMENT;
+				cmsg->cmsg_len = CMSG_LEN (sizeof (uint16_t));
+				uint16_t segmentSize = packet.len;
+				memcpy (CMSG_DATA (cmsg), &segmentSize, sizeof (segmentSize));
+			}
+			m_NumSegments[numMsgs] = j - i;
+			numMsgs++;
+			i = j;
+		}
+		size_t numSent = 0, sentMsgs = 0;
+		while (sentMsgs < numMsgs)
+		{
+			int n = sendmmsg (m_Socket.native_handle (), m_Msgs + sentMsgs, numMsgs - sentMsgs, MSG_DONTWAIT);
+			if (n > 0)
+			{
+				for (int k = 0; k < n; k++)
+					numSent += m_NumSegments[sentMsgs++];
+			}
+			else
+			{
+				if (n < 0 && errno == ENOSYS)
+					m_IsMmsg = false; // not supported by kernel
+				else if (n < 0 && m_NumSegments[sentMsgs] > 1 && (errno == EIO || errno == EINVAL || errno == ENOPROTOOPT))
+				{
+					LogPrint (eLogWarning, "UDP: Segmentation offload failed: ", strerror (errno), ". Disabled");
+					m_IsGSO = false; // rest are sent one by one
+				}
+				else if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+				{
+					// skip datagrams failed to send
+					ec.assign (errno, boost::asio::error::get_system_category ());
+					numSent += m_NumSegments[sentMsgs++];
+					continue;
+				}
+				break; // rest are sent one by one
+			}
+		}
+		return numSent;
+	}
+#endif
+}
+}
@@ -0,0 +1,278 @@
+/*
+* Copyright (c) 2013-2022, The PurpleI2P Project
+*
+* This file is part of Purple i2pd project and licensed under BSD3
+*
+* See full license text in LICENSE file at top of project tree
+*/
+
+#ifndef UDP_BATCH_H__
+#define UDP_BATCH_H__
+
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <vector>
+#include <algorithm>
+#include <boost/asio.hpp>
+#include "util.h"
+
+#ifdef __linux__
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#define UDP_BATCH_MMSG // recvmmsg/sendmmsg
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103 // since Linux 4.18
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104 // since Linux 5.0
+#endif
+#endif
+
+namespace i2p
+{
+namespace transport
+{
+	const size_t UDP_MAX_BATCH_SIZE = 32; // datagrams per syscall
+	const size_t UDP_BATCH_MAX_PACKET_SIZE = 1536; // larger datagrams are sent directly
+	const size_t UDP_MAX_GSO_SEGMENTS = 64;
+	const size_t UDP_MAX_GSO_SIZE = 65000; // all segments together
+	const size_t UDP_MAX_GRO_SIZE = 65536; // coalesced datagram
+	const size_t UDP_MAX_GRO_BATCH_SIZE = 8; // coalesced datagrams per syscall
+
+	/** reads datagrams already available on a socket into packets from pool,
+	 *  by one recvmmsg call on Linux, by receive_from one by one otherwise.
+	 *  With receive offload (UDP_GRO) the kernel coalesces datagrams of the same flow
+	 *  and they are split back into packets.
+	 *  Packet must have uint8_t buf[], size_t len and endpoint from */
+	template<class Packet>
+	class UDPBatchReceiver
+	{
+		public:
+
+			UDPBatchReceiver (i2p::util::MemoryPoolMt<Packet>& pool): m_Pool (pool), m_NumPackets (0)
+#ifdef UDP_BATCH_MMSG
+				, m_IsMmsg (true), m_IsGRO (false)
+#endif
+			{
+			};
+			~UDPBatchReceiver ()
+			{
+				for (size_t i = 0; i < m_NumPackets; i++)
+					m_Pool.ReleaseMt (m_Packets[i]);
+			};
+
+			/** turns UDP_GRO on for socket if supported, must be called after socket is reopened.
+			 *  Datagrams must be received by Receive only then, coalesced ones don't fit Packet */
+			bool EnableReceiveOffload (boost::asio::ip::udp::socket& socket)
+			{
+#ifdef UDP_BATCH_MMSG
+				int on = 1;
+				m_IsGRO = m_IsMmsg && !setsockopt (socket.native_handle (), SOL_UDP, UDP_GRO, &on, sizeof (on));
+				if (m_IsGRO && m_GROBuffers.empty ())
+					m_GROBuffers.resize (UDP_MAX_GRO_BATCH_SIZE*UDP_MAX_GRO_SIZE);
+				return m_IsGRO;
+#else
+				return false;
+#endif
+			}
+			bool IsReceiveOffload () const
+			{
+#ifdef UDP_BATCH_MMSG
+				return m_IsGRO;
+#else
+				return false;
+#endif
+			}
+
+			/** appends up to num received packets, or num coalesced datagrams with receive offload, never blocks */
+			size_t Receive (boost::asio::ip::udp::socket& socket, size_t maxLen, size_t num,
+				std::vector<Packet *>& packets, boost::system::error_code& ec)
+			{
+				if (num > UDP_MAX_BATCH_SIZE) num = UDP_MAX_BATCH_SIZE;
+				if (!num) return 0;
+#ifdef UDP_BATCH_MMSG
+				if (m_IsGRO)
+					return ReceiveCoalesced (socket, maxLen, num, packets, ec);
+				if (m_IsMmsg)
+				{
+					// keep packets which were not filled for next call
+					for (; m_NumPackets < num; m_NumPackets++)
+						m_Packets[m_NumPackets] = m_Pool.AcquireMt ();
+					for (size_t i = 0; i < num; i++)
+					{
+						auto packet = m_Packets[i];
+						m_Iovs[i].iov_base = (uint8_t *)packet->buf;
+						m_Iovs[i].iov_len = maxLen;
+						memset (&m_Msgs[i].msg_hdr, 0, sizeof (m_Msgs[i].msg_hdr));
+						m_Msgs[i].msg_hdr.msg_name = packet->from.data ();
+						m_Msgs[i].msg_hdr.msg_namelen = packet->from.capacity ();
+						m_Msgs[i].msg_hdr.msg_iov = m_Iovs + i;
+						m_Msgs[i].msg_hdr.msg_iovlen = 1;
+					}
+					int n = recvmmsg (socket.native_handle (), m_Msgs, num, MSG_DONTWAIT, nullptr);
+					if (n < 0)
+					{
+						if (errno == ENOSYS)
+							m_IsMmsg = false; // not supported by kernel, use receive_from
+						else if (errno != EAGAIN && errno != EWOULDBLOCK)
+							ec.assign (errno, boost::asio::error::get_system_category ());
+						if (m_IsMmsg) return 0;
+					}
+					else
+					{
+						for (int i = 0; i < n; i++)
+						{
+							auto packet = m_Packets[i];
+							packet->len = m_Msgs[i].msg_len;
+							packet->from.resize (m_Msgs[i].msg_hdr.msg_namelen);
+							packets.push_back (packet);
+						}
+						// move unused packets to beginning
+						m_NumPackets -= n;
+						for (size_t i = 0; i < m_NumPackets; i++)
+							m_Packets[i] = m_Packets[i + n];
+						return n;
+					}
+				}
+#endif
+				size_t numReceived = 0;
+				size_t moreBytes = socket.available (ec);
+				while (!ec && moreBytes && numReceived < num)
+				{
+					auto packet = m_Pool.AcquireMt ();
+					packet->len = socket.receive_from (boost::asio::buffer (packet->buf, maxLen), packet->from, 0, ec);
+					if (!ec)
+					{
+						packets.push_back (packet);
+						numReceived++;
+						moreBytes = socket.available (ec);
+					}
+					else
+						m_Pool.ReleaseMt (packet);
+				}
+				return numReceived;
+			}
+
+		private:
+
+#ifdef UDP_BATCH_MMSG
+			size_t ReceiveCoalesced (boost::asio::ip::udp::socket& socket, size_t maxLen, size_t num,
+				std::vector<Packet *>& packets, boost::system::error_code& ec)
+			{
+				if (num > UDP_MAX_GRO_BATCH_SIZE) num = UDP_MAX_GRO_BATCH_SIZE;
+				for (size_t i = 0; i < num; i++)
+				{
+					m_Iovs[i].iov_base = m_GROBuffers.data () + i*UDP_MAX_GRO_SIZE;
+					m_Iovs[i].iov_len = UDP_MAX_GRO_SIZE;
+					memset (&m_Msgs[i].msg_hdr, 0, sizeof (m_Msgs[i].msg_hdr));
+					m_Msgs[i].msg_hdr.msg_name = m_GROEndpoints[i].data ();
+					m_Msgs[i].msg_hdr.msg_namelen = m_GROEndpoints[i].capacity ();
+					m_Msgs[i].msg_hdr.msg_iov = m_Iovs + i;
+					m_Msgs[i].msg_hdr.msg_iovlen = 1;
+					m_Msgs[i].msg_hdr.msg_control = m_GROControls[i];
+					m_Msgs[i].msg_hdr.msg_controllen = sizeof (m_GROControls[i]);
+				}
+				int n = recvmmsg (socket.native_handle (), m_Msgs, num, MSG_DONTWAIT, nullptr);
+				if (n < 0)
+				{
+					if (errno != EAGAIN && errno != EWOULDBLOCK)
+						ec.assign (errno, boost::asio::error::get_system_category ());
+					return 0;
+				}
+				size_t numReceived = 0;
+				for (int i = 0; i < n; i++)
+				{
+					const auto& hdr = m_Msgs[i].msg_hdr;
+					size_t len = m_Msgs[i].msg_len, segmentSize = len;
+					for (auto cmsg = CMSG_FIRSTHDR (&hdr); cmsg; cmsg = CMSG_NXTHDR ((msghdr *)&hdr, cmsg))
+						if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO)
+						{
+							int size; memcpy (&size, CMSG_DATA (cmsg), sizeof (size));
+							if (size > 0) segmentSize = size;
+						}
+					m_GROEndpoints[i].resize (hdr.msg_namelen);
+					const uint8_t * buf = m_GROBuffers.data () + i*UDP_MAX_GRO_SIZE;
+					for (size_t offset = 0; offset < len; offset += segmentSize)
+					{
+						size_t l = std::min (segmentSize, len - offset);
+						if (l > maxLen) continue; // wouldn't fit without offload either
+						auto packet = m_Pool.AcquireMt ();
+						memcpy ((uint8_t *)packet->buf, buf + offset, l);
+						packet->len = l;
+						packet->from = m_GROEndpoints[i];
+						packets.push_back (packet);
+						numReceived++;
+					}
+				}
+				return numReceived;
+			}
+#endif
+
+		private:
+
+			i2p::util::MemoryPoolMt<Packet>& m_Pool;
+			Packet * m_Packets[UDP_MAX_BATCH_SIZE]; // acquired from pool in advance
+			size_t m_NumPackets;
+#ifdef UDP_BATCH_MMSG
+			bool m_IsMmsg, m_IsGRO;
+			mmsghdr m_Msgs[UDP_MAX_BATCH_SIZE];
+			iovec m_Iovs[UDP_MAX_BATCH_SIZE];
+			std::vector<uint8_t> m_GROBuffers;
+			boost::asio::ip::udp::endpoint m_GROEndpoints[UDP_MAX_GRO_BATCH_SIZE];
+			uint8_t m_GROControls[UDP_MAX_GRO_BATCH_SIZE][CMSG_SPACE(sizeof (int))];
+#endif
+	};
+
+	/** collects outgoing datagrams and sends them together by one sendmmsg call on Linux,
+	 *  by send_to one by one otherwise. With segmentation offload (UDP_SEGMENT) consecutive
+	 *  datagrams of the same size to the same endpoint are passed to the kernel as one.
+	 *  Must be used from one thread */
+	class UDPBatchSender
+	{
+		public:
+
+			UDPBatchSender (boost::asio::ip::udp::socket& socket);
+
+			bool EnableSegmentationOffload (); // if supported, must be called after socket is reopened
+			bool IsEmpty () const { return !m_NumPackets; };
+			bool IsFull () const { return m_NumPackets >= UDP_MAX_BATCH_SIZE; };
+			/** copies datagram, returns false if it doesn't fit. Flush must be called if full */
+			bool Add (const uint8_t * buf, size_t len, const boost::asio::ip::udp::endpoint& to);
+			bool Add (const std::vector<boost::asio::const_buffer>& bufs, const boost::asio::ip::udp::endpoint& to);
+			size_t Flush (boost::system::error_code& ec); // returns number of sent datagrams, all are removed
+
+		private:
+
+#ifdef UDP_BATCH_MMSG
+			size_t SendMmsg (boost::system::error_code& ec); // returns number of processed datagrams
+#endif
+
+		private:
+
+			struct Packet
+			{
+				uint8_t buf[UDP_BATCH_MAX_PACKET_SIZE];
+				size_t len;
+				boost::asio::ip::udp::endpoint to;
+			};
+
+			boost::asio::ip::udp::socket& m_Socket;
+			std::vector<Packet> m_Packets;
+			size_t m_NumPackets;
+#ifdef UDP_BATCH_MMSG
+			bool m_IsMmsg, m_IsGSO;
+			mmsghdr m_Msgs[UDP_MAX_BATCH_SIZE];
+			iovec m_Iovs[UDP_MAX_BATCH_SIZE];
+			size_t m_NumSegments[UDP_MAX_BATCH_SIZE]; // datagrams in message
+			uint8_t m_Controls[UDP_MAX_BATCH_SIZE][CMSG_SPACE(sizeof (uint16_t))];
+#endif
+	};
+}
+}
+
+#endif
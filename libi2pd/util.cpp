@@ -67,6 +67,8 @@ int inet_pton_xp (int af, const char *src, void *dst)
 }
 #else /* !_WIN32 => UNIX */
 #include <sys/types.h>
+#include <stdio.h>
+#include <unistd.h>
 #ifdef ANDROID
 #include "ifaddrs.h"
 #else
@@ -122,6 +124,53 @@ namespace util
 		}
 	}
 
+	void RunnableServicePool::Start (int numThreads)
+	{
+		std::unique_lock<std::mutex> l(m_ServicesMutex);
+		if (m_IsRunning || numThreads <= 0) return;
+		if (m_Services.empty ())
+			for (int i = 0; i < numThreads; i++)
+				m_Services.emplace_back (new Service (m_Name));
+		for (auto& it: m_Services)
+			it->Start ();
+		m_IsRunning = true;
+	}
+
+	void RunnableServicePool::Stop ()
+	{
+		{
+			std::unique_lock<std::mutex> l(m_ServicesMutex);
+			if (!m_IsRunning) return;
+			m_IsRunning = false;
+		}
+		// join without lock, handler might release last object calling Release
+		for (auto& it: m_Services)
+			it->Stop ();
+	}
+
+	boost::asio::io_service& RunnableServicePool::Acquire (boost::asio::io_service& own)
+	{
+		std::unique_lock<std::mutex> l(m_ServicesMutex);
+		if (!m_IsRunning) return own;
+		Service * leastLoaded = nullptr;
+		for (auto& it: m_Services)
+			if (!leastLoaded || it->numUsers < leastLoaded->numUsers)
+				leastLoaded = it.get ();
+		leastLoaded->numUsers++;
+		return leastLoaded->GetService ();
+	}
+
+	void RunnableServicePool::Release (boost::asio::io_service& service)
+	{
+		std::unique_lock<std::mutex> l(m_ServicesMutex);
+		for (auto& it: m_Services)
+			if (&it->GetService () == &service)
+			{
+				it->numUsers--;
+				break;
+			}
+	}
+
 	void SetThreadName (const char *name) {
 #if defined(__APPLE__) && !defined(__powerpc__)
 		pthread_setname_np((char*)name);
@@ -134,6 +183,22 @@ namespace util
 #endif
 	}
 
+	size_t GetResidentMemory ()
+	{
+#if defined(__linux__)
+		size_t size = 0, resident = 0;
+		FILE * f = fopen ("/proc/self/statm", "r");
+		if (f)
+		{
+			if (fscanf (f, "%zu %zu", &size, &resident) != 2) resident = 0;
+			fclose (f);
+		}
+		return resident*sysconf (_SC_PAGESIZE);
+#else
+		return 0;
+#endif
+	}
+
 namespace net
 {
 #ifdef _WIN32
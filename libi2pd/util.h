@@ -1,5 +1,5 @@
 /*
-* Copyright (c) 2013-2021, The PurpleI2P Project
+* Copyright (c) 2013-2022, The PurpleI2P Project
 *
 * This file is part of Purple i2pd project and licensed under BSD3
 *
@@ -15,6 +15,7 @@
 #include <mutex>
 #include <thread>
 #include <utility>
+#include <vector>
 #include <boost/asio.hpp>
 
 #ifdef ANDROID
@@ -199,7 +200,46 @@ namespace util
 			boost::asio::io_service::work m_Work;
 	};
 
+	/** fixed number of threads running own io_service each, instead of thread per object.
+	 *  Object acquires io_service of least loaded thread and is pinned to it,
+	 *  its handlers are called in one thread as with own thread */
+	class RunnableServicePool
+	{
+		class Service: public RunnableServiceWithWork
+		{
+			public:
+
+				Service (const std::string& name): RunnableServiceWithWork (name), numUsers (0) {};
+				boost::asio::io_service& GetService () { return GetIOService (); };
+				void Start () { GetIOService ().reset (); StartIOService (); }; // might be stopped before
+				void Stop () { StopIOService (); };
+
+				int numUsers;
+		};
+
+		public:
+
+			RunnableServicePool (const std::string& name): m_Name (name), m_IsRunning (false) {};
+			~RunnableServicePool () { Stop (); };
+
+			void Start (int numThreads);
+			void Stop ();
+			bool IsRunning () const { return m_IsRunning; };
+			size_t GetNumThreads () const { return m_IsRunning ? m_Services.size () : 0; };
+
+			boost::asio::io_service& Acquire (boost::asio::io_service& own); // own if not running
+			void Release (boost::asio::io_service& service);
+
+		private:
+
+			std::string m_Name;
+			bool m_IsRunning;
+			std::mutex m_ServicesMutex;
+			std::vector<std::unique_ptr<Service> > m_Services; // created once, objects might still refer to them after Stop
+	};
+
 	void SetThreadName (const char *name);
+	size_t GetResidentMemory (); // in bytes, 0 if unknown
 
 	template<typename T>
 	class SaveStateHelper
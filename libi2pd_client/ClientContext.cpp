@@ -42,6 +42,14 @@ namespace client
 
 	void ClientContext::Start ()
 	{
+		// destinations threads
+		uint16_t numDestinationThreads; i2p::config::GetOption("limits.destinationthreads", numDestinationThreads);
+		if (numDestinationThreads)
+		{
+			LogPrint (eLogInfo, "Clients: Running destinations in ", (int)numDestinationThreads, " threads");
+			destinationsPool.Start (numDestinationThreads);
+		}
+
 		// shared local destination
 		if (!m_SharedLocalDestination)
 			CreateNewSharedLocalDestination ();
@@ -203,6 +211,8 @@ namespace client
 
 		m_SharedLocalDestination->Release ();
 		m_SharedLocalDestination = nullptr;
+
+		destinationsPool.Stop ();
 	}
 
 	void ClientContext::ReloadConfig ()
@@ -462,6 +472,7 @@ namespace client
 		options[I2CP_PARAM_MAX_TUNNEL_LATENCY] = GetI2CPOption(section, I2CP_PARAM_MAX_TUNNEL_LATENCY, DEFAULT_MAX_TUNNEL_LATENCY);
 		options[I2CP_PARAM_STREAMING_INITIAL_ACK_DELAY] = GetI2CPOption(section, I2CP_PARAM_STREAMING_INITIAL_ACK_DELAY, DEFAULT_INITIAL_ACK_DELAY);
 		options[I2CP_PARAM_STREAMING_ANSWER_PINGS] = GetI2CPOption(section, I2CP_PARAM_STREAMING_ANSWER_PINGS, isServer ? DEFAULT_ANSWER_PINGS : false);
+		options[I2CP_PARAM_STREAMING_CONGESTION_CONTROL] = GetI2CPStringOption(section, I2CP_PARAM_STREAMING_CONGESTION_CONTROL, DEFAULT_STREAMING_CONGESTION_CONTROL);
 		options[I2CP_PARAM_LEASESET_TYPE] = GetI2CPOption(section, I2CP_PARAM_LEASESET_TYPE, DEFAULT_LEASESET_TYPE);
 		std::string encType = GetI2CPStringOption(section, I2CP_PARAM_LEASESET_ENCRYPTION_TYPE, "0,4");
 		if (encType.length () > 0) options[I2CP_PARAM_LEASESET_ENCRYPTION_TYPE] = encType;
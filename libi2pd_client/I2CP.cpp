@@ -246,31 +246,36 @@ namespace client
 	RunnableI2CPDestination::RunnableI2CPDestination (std::shared_ptr<I2CPSession> owner,
 		std::shared_ptr<const i2p::data::IdentityEx> identity, bool isPublic, const std::map<std::string, std::string>& params):
 		RunnableService ("I2CP"),
-		I2CPDestination (GetIOService (), owner, identity, isPublic, params)
+		I2CPDestination (destinationsPool.Acquire (GetIOService ()), owner, identity, isPublic, params),
+		m_IsPooled (&GetService () != &GetIOService ()), m_IsStarted (false)
 	{
 	}
 
 	RunnableI2CPDestination::~RunnableI2CPDestination ()
 	{
-		if (IsRunning ())
+		if (m_IsStarted)
 			Stop ();
+		if (m_IsPooled)
+			destinationsPool.Release (GetService ());
 	}
 
 	void RunnableI2CPDestination::Start ()
 	{
-		if (!IsRunning ())
+		if (!m_IsStarted)
 		{
+			m_IsStarted = true;
 			I2CPDestination::Start ();
-			StartIOService ();
+			if (!m_IsPooled) StartIOService ();
 		}
 	}
 
 	void RunnableI2CPDestination::Stop ()
 	{
-		if (IsRunning ())
+		if (m_IsStarted)
 		{
+			m_IsStarted = false;
 			I2CPDestination::Stop ();
-			StopIOService ();
+			if (!m_IsPooled) StopIOService ();
 		}
 	}
 
@@ -135,6 +135,10 @@ namespace client
 
 			void Start ();
 			void Stop ();
+
+		private:
+
+			bool m_IsPooled, m_IsStarted; // in thread from destinationsPool
 	};
 
 	class I2CPServer;
@@ -1,5 +1,5 @@
 /*
-* Copyright (c) 2013-2021, The PurpleI2P Project
+* Copyright (c) 2013-2022, The PurpleI2P Project
 *
 * This file is part of Purple i2pd project and licensed under BSD3
 *
@@ -423,8 +423,9 @@ namespace client
 				m_OutHeader << m_InHeader.str ().substr (m_InHeader.tellg ()); // data right after header
 				m_InHeader.str ("");
 				m_ResponseHeaderSent = true;
-				I2PTunnelConnection::WriteToStream ((uint8_t *)m_OutHeader.str ().c_str (), m_OutHeader.str ().length ());
+				m_ResponseHeader = m_OutHeader.str (); // stream refers to it until sent
 				m_OutHeader.str ("");
+				I2PTunnelConnection::WriteToStream ((const uint8_t *)m_ResponseHeader.c_str (), m_ResponseHeader.length ());
 			}
 			else
 				Receive ();
@@ -0,0 +1,70 @@
+#ifndef TEST_UTILS_H__
+#define TEST_UTILS_H__
+
+#include <inttypes.h>
+#include <string>
+#include <vector>
+#include <boost/filesystem.hpp>
+
+#include "Config.h"
+#include "FS.h"
+#include "Log.h"
+#include "Crypto.h"
+#include "RouterContext.h"
+
+// router of test process: config from options, data directory in temp directory removed by destructor,
+// crypto and router context initialized, logs are off
+class TestRouter
+{
+	public:
+
+		TestRouter (const std::string& name, const std::vector<std::string>& options = {}):
+			m_DataDir (boost::filesystem::temp_directory_path () / boost::filesystem::unique_path (name + "-%%%%%%%%"))
+		{
+			boost::filesystem::create_directories (m_DataDir);
+			std::vector<std::string> args { name, "--datadir=" + m_DataDir.string () };
+			args.insert (args.end (), options.begin (), options.end ());
+			args.push_back ("--loglevel=none");
+			std::vector<char *> argv;
+			for (auto& it: args) argv.push_back (&it[0]);
+			i2p::config::Init ();
+			i2p::config::ParseCmdline (argv.size (), argv.data ());
+			i2p::config::Finalize ();
+			i2p::fs::DetectDataDir (m_DataDir.string ());
+			i2p::fs::Init ();
+			i2p::log::Logger ().SetLogLevel ("none");
+			i2p::crypto::InitCrypto (false, true, true, false);
+			i2p::context.Init ();
+		}
+
+		~TestRouter ()
+		{
+			boost::filesystem::remove_all (m_DataDir);
+		}
+
+	private:
+
+		boost::filesystem::path m_DataDir;
+};
+
+// message n has length min + random % range with given percentage, same for every run
+struct MessageLengths
+{
+	int percent;
+	size_t min, range;
+};
+
+template<size_t N>
+size_t GetMessageLength (uint32_t n, const MessageLengths (&lengths)[N])
+{
+	n = n*2654435761U; // scatter
+	int r = n % 100;
+	for (size_t i = 0; i < N - 1; i++)
+	{
+		if (r < lengths[i].percent) return lengths[i].min + n % lengths[i].range;
+		r -= lengths[i].percent;
+	}
+	return lengths[N - 1].min + n % lengths[N - 1].range;
+}
+
+#endif
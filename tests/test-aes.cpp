@@ -0,0 +1,206 @@
+#include <cassert>
+#include <inttypes.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <openssl/rand.h>
+#include <openssl/evp.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "CPU.h"
+#include "Crypto.h"
+
+const int NUM_MESSAGES = 64;
+const int NUM_ROUNDS = 200;
+const size_t MSG_SIZE = 1024; // tunnel message, 16 IV + 1008 data
+
+static uint64_t GetCycles ()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc ();
+#else
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now ().time_since_epoch ()).count ();
+#endif
+}
+
+void TunnelEncryptionTest ()
+{
+	i2p::crypto::AESKey layerKey, ivKey;
+	RAND_bytes (layerKey, 32);
+	RAND_bytes (ivKey, 32);
+	i2p::crypto::TunnelEncryption encryption;
+	encryption.SetKeys (layerKey, ivKey);
+
+	std::vector<uint8_t> msgs (NUM_MESSAGES*MSG_SIZE), expected (NUM_MESSAGES*MSG_SIZE), out (NUM_MESSAGES*MSG_SIZE);
+	RAND_bytes (msgs.data (), msgs.size ());
+	const uint8_t * in[NUM_MESSAGES]; uint8_t * outs[NUM_MESSAGES];
+	for (int i = 0; i < NUM_MESSAGES; i++)
+	{
+		encryption.Encrypt (msgs.data () + i*MSG_SIZE, expected.data () + i*MSG_SIZE);
+		in[i] = msgs.data () + i*MSG_SIZE;
+		outs[i] = out.data () + i*MSG_SIZE;
+	}
+	// every batch size, including tails
+	for (int num = 1; num <= NUM_MESSAGES; num++)
+	{
+		memset (out.data (), 0, out.size ());
+		encryption.Encrypt (num, in, outs);
+		assert (!memcmp (out.data (), expected.data (), num*MSG_SIZE));
+	}
+	// in place
+	out = msgs;
+	for (int i = 0; i < NUM_MESSAGES; i++) outs[i] = out.data () + i*MSG_SIZE;
+	encryption.Encrypt (NUM_MESSAGES, (const uint8_t * const *)outs, outs);
+	assert (out == expected);
+
+	// bytes per cycle
+	auto ts = GetCycles ();
+	for (int r = 0; r < NUM_ROUNDS; r++)
+		for (int i = 0; i < NUM_MESSAGES; i++)
+			encryption.Encrypt (outs[i], outs[i]);
+	auto single = GetCycles () - ts;
+	ts = GetCycles ();
+	for (int r = 0; r < NUM_ROUNDS; r++)
+		encryption.Encrypt (NUM_MESSAGES, (const uint8_t * const *)outs, outs);
+	auto batch = GetCycles () - ts;
+	double bytes = (double)NUM_ROUNDS*NUM_MESSAGES*MSG_SIZE;
+	std::cout << "TunnelEncryption: single " << bytes/single << " bytes/cycle, batch " << bytes/batch << " bytes/cycle" << std::endl;
+}
+
+void CBCDecryptionTest ()
+{
+	i2p::crypto::AESKey key;
+	uint8_t iv[16];
+	RAND_bytes (key, 32);
+	RAND_bytes (iv, 16);
+	const int maxBlocks = 67; // 8 + 4 + tail
+	uint8_t in[maxBlocks*16], expected[maxBlocks*16], out[maxBlocks*16];
+	RAND_bytes (in, sizeof (in));
+	// reference
+	auto ctx = EVP_CIPHER_CTX_new ();
+	EVP_DecryptInit_ex (ctx, EVP_aes_256_cbc (), NULL, key, iv);
+	EVP_CIPHER_CTX_set_padding (ctx, 0);
+	int len = 0;
+	EVP_DecryptUpdate (ctx, expected, &len, in, sizeof (in));
+	EVP_CIPHER_CTX_free (ctx);
+
+	i2p::crypto::CBCDecryption decryption;
+	decryption.SetKey (key);
+	for (int num = 1; num <= maxBlocks; num++)
+	{
+		decryption.SetIV (iv);
+		decryption.Decrypt (in, num*16, out);
+		assert (!memcmp (out, expected, num*16));
+		// IV is updated for next call
+		uint8_t nextIV[16];
+		decryption.GetIV (nextIV);
+		assert (!memcmp (nextIV, in + (num - 1)*16, 16));
+	}
+	// in place, split
+	memcpy (out, in, sizeof (in));
+	decryption.SetIV (iv);
+	decryption.Decrypt (out, 21*16, out);
+	decryption.Decrypt (out + 21*16, sizeof (in) - 21*16, out + 21*16);
+	assert (!memcmp (out, expected, sizeof (in)));
+}
+
+void TunnelDecryptionTest ()
+{
+	i2p::crypto::AESKey layerKey, ivKey;
+	RAND_bytes (layerKey, 32);
+	RAND_bytes (ivKey, 32);
+	i2p::crypto::TunnelEncryption encryption;
+	encryption.SetKeys (layerKey, ivKey);
+	i2p::crypto::TunnelDecryption decryption;
+	decryption.SetKeys (layerKey, ivKey);
+
+	uint8_t msg[MSG_SIZE], encrypted[MSG_SIZE], decrypted[MSG_SIZE];
+	RAND_bytes (msg, MSG_SIZE);
+	encryption.Encrypt (msg, encrypted);
+	decryption.Decrypt (encrypted, decrypted);
+	assert (!memcmp (msg, decrypted, MSG_SIZE));
+	// in place
+	decryption.Decrypt (encrypted, encrypted);
+	assert (!memcmp (msg, encrypted, MSG_SIZE));
+
+	auto ts = GetCycles ();
+	for (int r = 0; r < NUM_ROUNDS*NUM_MESSAGES; r++)
+		decryption.Decrypt (msg, msg);
+	auto cycles = GetCycles () - ts;
+	std::cout << "TunnelDecryption: " << (double)NUM_ROUNDS*NUM_MESSAGES*MSG_SIZE/cycles << " bytes/cycle" << std::endl;
+}
+
+void TunnelLayersDecryptionTest ()
+{
+	// outbound tunnel gateway, all hops at once must match hop by hop
+	const int MAX_NUM_LAYERS = i2p::crypto::MAX_NUM_FUSED_TUNNEL_LAYERS + 1;
+	std::vector<i2p::crypto::TunnelDecryption> decryptions (MAX_NUM_LAYERS);
+	i2p::crypto::TunnelDecryption * layers[MAX_NUM_LAYERS];
+	for (int i = 0; i < MAX_NUM_LAYERS; i++)
+	{
+		i2p::crypto::AESKey layerKey, ivKey;
+		RAND_bytes (layerKey, 32);
+		RAND_bytes (ivKey, 32);
+		decryptions[i].SetKeys (layerKey, ivKey);
+		layers[i] = &decryptions[i];
+	}
+	uint8_t msg[MSG_SIZE], expected[MSG_SIZE], out[MSG_SIZE];
+	for (int numLayers = 1; numLayers <= MAX_NUM_LAYERS; numLayers++)
+	{
+		RAND_bytes (msg, MSG_SIZE);
+		memcpy (expected, msg, MSG_SIZE);
+		for (int i = 0; i < numLayers; i++)
+			layers[i]->Decrypt (expected, expected);
+		i2p::crypto::TunnelDecryption::Decrypt (numLayers, layers, msg, out);
+		assert (!memcmp (out, expected, MSG_SIZE));
+		// in place
+		i2p::crypto::TunnelDecryption::Decrypt (numLayers, layers, msg, msg);
+		assert (!memcmp (msg, expected, MSG_SIZE));
+	}
+
+	for (int numLayers: { 1, 3, 7 })
+	{
+		uint64_t hopByHop = -1, fused = -1; // best of few, alternately
+		for (int n = 0; n < 5; n++)
+		{
+			auto ts = GetCycles ();
+			for (int r = 0; r < NUM_ROUNDS*NUM_MESSAGES/5; r++)
+				for (int i = 0; i < numLayers; i++)
+					layers[i]->Decrypt (msg, msg);
+			hopByHop = std::min (hopByHop, GetCycles () - ts);
+			ts = GetCycles ();
+			for (int r = 0; r < NUM_ROUNDS*NUM_MESSAGES/5; r++)
+				i2p::crypto::TunnelDecryption::Decrypt (numLayers, layers, msg, msg);
+			fused = std::min (fused, GetCycles () - ts);
+		}
+		double bytes = (double)NUM_ROUNDS*NUM_MESSAGES/5*MSG_SIZE;
+		std::cout << "TunnelDecryption " << numLayers << " hops: hop by hop " << bytes/hopByHop << " bytes/cycle, fused "
+			<< bytes/fused << " bytes/cycle" << std::endl;
+	}
+}
+
+void Test ()
+{
+	TunnelEncryptionTest ();
+	CBCDecryptionTest ();
+	TunnelDecryptionTest ();
+	TunnelLayersDecryptionTest ();
+}
+
+int main ()
+{
+	// portable
+	Test ();
+	// AES-NI, VAES if available
+	i2p::cpu::Detect (true, true, false);
+	Test ();
+	if (i2p::cpu::vaes)
+	{
+		i2p::cpu::vaes = false;
+		Test ();
+	}
+}
@@ -0,0 +1,126 @@
+#include <cassert>
+#include <inttypes.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <iostream>
+#include <boost/filesystem.hpp>
+
+#include "Destination.h"
+#include "TestUtils.h"
+
+// usage: test-destination-pool
+// creates client destinations with thread per destination and with destinations pool,
+// checks that number of threads doesn't grow with pool, destinations are spread evenly
+// and handlers of a destination are called in order and never at the same time
+
+const int NUM_DESTINATIONS = 64;
+const int NUM_POOL_THREADS = 4;
+const int NUM_HANDLERS = 10000; // per destination
+
+static int GetNumThreads ()
+{
+	int num = 0;
+	for (boost::filesystem::directory_iterator it ("/proc/self/task"), end; it != end; it++)
+		num++;
+	return num;
+}
+
+static std::vector<std::shared_ptr<i2p::client::RunnableClientDestination> > CreateDestinations (int num)
+{
+	std::map<std::string, std::string> params
+	{
+		{ i2p::client::I2CP_PARAM_INBOUND_TUNNELS_QUANTITY, "1" },
+		{ i2p::client::I2CP_PARAM_OUTBOUND_TUNNELS_QUANTITY, "1" }
+	};
+	std::vector<std::shared_ptr<i2p::client::RunnableClientDestination> > destinations;
+	for (int i = 0; i < num; i++)
+	{
+		auto keys = i2p::data::PrivateKeys::CreateRandomKeys (i2p::data::SIGNING_KEY_TYPE_EDDSA_SHA512_ED25519,
+			i2p::data::CRYPTO_KEY_TYPE_ECIES_X25519_AEAD);
+		auto dest = std::make_shared<i2p::client::RunnableClientDestination> (keys, false, &params);
+		dest->Start ();
+		destinations.push_back (dest);
+	}
+	return destinations;
+}
+
+static void StopDestinations (std::vector<std::shared_ptr<i2p::client::RunnableClientDestination> >& destinations)
+{
+	for (auto& it: destinations)
+		it->Stop ();
+	destinations.clear ();
+}
+
+struct Sequence
+{
+	int next = 0;
+	std::atomic<bool> isInside { false };
+	std::atomic<bool> isFailed { false };
+};
+
+// posts handlers to every destination, each checks that it's called after previous and alone
+static bool CheckOrder (std::vector<std::shared_ptr<i2p::client::RunnableClientDestination> >& destinations)
+{
+	std::vector<Sequence> sequences (destinations.size ());
+	std::atomic<int> numCalled (0);
+	for (int n = 0; n < NUM_HANDLERS; n++)
+		for (size_t i = 0; i < destinations.size (); i++)
+		{
+			auto& s = sequences[i];
+			destinations[i]->GetService ().post ([&s, &numCalled, n]()
+				{
+					if (s.isInside.exchange (true)) s.isFailed = true;
+					if (s.next != n) s.isFailed = true;
+					s.next = n + 1;
+					s.isInside = false;
+					numCalled++;
+				});
+		}
+	for (int i = 0; i < 1000 && numCalled < NUM_HANDLERS*(int)destinations.size (); i++)
+		std::this_thread::sleep_for (std::chrono::milliseconds (10));
+	if (numCalled != NUM_HANDLERS*(int)destinations.size ()) return false;
+	for (auto& it: sequences)
+		if (it.isFailed || it.next != NUM_HANDLERS) return false;
+	return true;
+}
+
+int main ()
+{
+	TestRouter router ("test-destination-pool");
+
+	// thread per destination
+	int numThreads = GetNumThreads ();
+	auto destinations = CreateDestinations (NUM_DESTINATIONS);
+	for (auto& it: destinations)
+		assert (!it->IsPooled ());
+	std::cout << NUM_DESTINATIONS << " destinations, own threads: " << GetNumThreads () - numThreads << " threads added" << std::endl;
+	assert (GetNumThreads () == numThreads + NUM_DESTINATIONS);
+	assert (CheckOrder (destinations));
+	StopDestinations (destinations);
+	assert (GetNumThreads () == numThreads);
+
+	// pool
+	i2p::client::destinationsPool.Start (NUM_POOL_THREADS);
+	assert (GetNumThreads () == numThreads + NUM_POOL_THREADS);
+	destinations = CreateDestinations (NUM_DESTINATIONS);
+	std::map<boost::asio::io_service *, int> numPerService;
+	for (auto& it: destinations)
+	{
+		assert (it->IsPooled ());
+		numPerService[&it->GetService ()]++;
+	}
+	std::cout << NUM_DESTINATIONS << " destinations, pool: " << GetNumThreads () - numThreads << " threads added" << std::endl;
+	assert (GetNumThreads () == numThreads + NUM_POOL_THREADS);
+	assert (numPerService.size () == NUM_POOL_THREADS);
+	for (auto& it: numPerService)
+		assert (it.second == NUM_DESTINATIONS/NUM_POOL_THREADS);
+	assert (CheckOrder (destinations));
+	StopDestinations (destinations);
+	i2p::client::destinationsPool.Stop ();
+	assert (GetNumThreads () == numThreads);
+}
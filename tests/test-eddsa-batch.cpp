@@ -0,0 +1,154 @@
+#include <cassert>
+#include <inttypes.h>
+#include <string.h>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <iostream>
+#include <openssl/rand.h>
+
+#include "Signature.h"
+#include "Ed25519Batch.h"
+
+// usage: test-eddsa-batch
+// checks batch verification against one by one verification and compares verifies/sec
+
+const int NUM_KEYS = 64;
+const int NUM_SIGNATURES = 2048;
+
+struct Signed
+{
+	uint8_t publicKey[32];
+	std::vector<uint8_t> buf;
+	uint8_t signature[64];
+};
+
+static std::vector<Signed> CreateSigned ()
+{
+	std::vector<Signed> res (NUM_SIGNATURES);
+	std::vector<std::pair<i2p::crypto::Signer *, std::vector<uint8_t> > > signers;
+	for (int i = 0; i < NUM_KEYS; i++)
+	{
+		uint8_t priv[32], pub[32];
+		i2p::crypto::CreateEDDSA25519RandomKeys (priv, pub);
+		signers.emplace_back (new i2p::crypto::EDDSA25519Signer (priv), std::vector<uint8_t>(pub, pub + 32));
+	}
+	for (int i = 0; i < NUM_SIGNATURES; i++)
+	{
+		auto& s = res[i];
+		const auto& signer = signers[i % NUM_KEYS];
+		memcpy (s.publicKey, signer.second.data (), 32);
+		uint16_t len;
+		RAND_bytes ((uint8_t *)&len, 2);
+		s.buf.resize (300 + len % 700); // as RouterInfo
+		RAND_bytes (s.buf.data (), s.buf.size ());
+		signer.first->Sign (s.buf.data (), s.buf.size (), s.signature);
+	}
+	for (auto& it: signers) delete it.first;
+	return res;
+}
+
+static bool VerifyOne (const Signed& s)
+{
+	i2p::crypto::EDDSA25519Verifier verifier;
+	verifier.SetPublicKey (s.publicKey);
+	return verifier.Verify (s.buf.data (), s.buf.size (), s.signature);
+}
+
+int main ()
+{
+	auto signatures = CreateSigned ();
+	// valid
+	i2p::crypto::EDDSA25519BatchVerifier batch;
+	std::vector<bool> results;
+	for (int i = 0; i < 64; i++)
+		batch.Add (signatures[i].publicKey, signatures[i].buf.data (), signatures[i].buf.size (), signatures[i].signature);
+	assert (batch.GetSize () == 64);
+	assert (batch.Verify (results));
+	for (auto r: results) assert (r);
+	// one invalid signature of each kind in a batch, only it must fail
+	for (int n = 0; n < 6; n++)
+	{
+		batch.Clear ();
+		int bad = (n*11) % 32;
+		for (int i = 0; i < 32; i++)
+		{
+			Signed s = signatures[i];
+			if (i == bad)
+			{
+				switch (n)
+				{
+					case 0: s.buf[5] ^= 1; break; // data
+					case 1: s.signature[3] ^= 1; break; // R
+					case 2: s.signature[40] ^= 1; break; // S
+					case 3: s.publicKey[7] ^= 1; break; // public key
+					case 4: memset (s.signature + 32, 0xFF, 32); break; // S >= l
+					case 5: memcpy (s.publicKey, signatures[i + 1].publicKey, 32); break; // other key
+				}
+				assert (!VerifyOne (s));
+			}
+			batch.Add (s.publicKey, s.buf.data (), s.buf.size (), s.signature);
+		}
+		assert (!batch.Verify (results));
+		for (int i = 0; i < 32; i++)
+			assert (results[i] == (i != bad));
+	}
+	// small order R and A are rejected by batch, results are the same as of one by one
+	for (int n = 0; n < 2; n++)
+	{
+		Signed s = signatures[0];
+		memset (s.publicKey, 0, 32); s.publicKey[0] = 1; // identity
+		if (!n)
+		{
+			memset (s.signature, 0, 64); s.signature[0] = 1; // R is identity, S = 0
+			assert (VerifyOne (s)); // 0*B = identity + h*identity
+		}
+		else
+			assert (!VerifyOne (s));
+		batch.Clear ();
+		for (int i = 0; i < 32; i++)
+		{
+			const Signed& it = (i == 7) ? s : signatures[i];
+			batch.Add (it.publicKey, it.buf.data (), it.buf.size (), it.signature);
+		}
+		assert (batch.Verify (results) == !n);
+		for (int i = 0; i < 32; i++)
+			assert (results[i] == (i != 7 || !n));
+	}
+	// small batches are verified one by one
+	batch.Clear ();
+	batch.Add (signatures[0].publicKey, signatures[0].buf.data (), signatures[0].buf.size (), signatures[0].signature);
+	assert (batch.Verify (results) && results[0]);
+	batch.Clear ();
+	assert (batch.Verify (results) && results.empty ());
+
+	// performance, verifiers are created in advance as IdentityEx does
+	std::vector<std::unique_ptr<i2p::crypto::EDDSA25519Verifier> > verifiers;
+	for (int i = 0; i < NUM_KEYS; i++)
+	{
+		verifiers.emplace_back (new i2p::crypto::EDDSA25519Verifier ());
+		verifiers.back ()->SetPublicKey (signatures[i].publicKey);
+	}
+	auto start = std::chrono::steady_clock::now ();
+	for (size_t i = 0; i < signatures.size (); i++)
+	{
+		bool verified = verifiers[i % NUM_KEYS]->Verify (signatures[i].buf.data (), signatures[i].buf.size (), signatures[i].signature);
+		assert (verified);
+	}
+	auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now () - start).count ();
+	std::cout << "one by one: " << (uint64_t)signatures.size ()*1000000/(elapsed ? elapsed : 1) << " verifies/sec" << std::endl;
+	for (size_t batchSize: { 1, 8, 32, 64 })
+	{
+		start = std::chrono::steady_clock::now ();
+		for (size_t i = 0; i < signatures.size (); i += batchSize)
+		{
+			batch.Clear ();
+			for (size_t j = i; j < i + batchSize && j < signatures.size (); j++)
+				batch.Add (signatures[j].publicKey, signatures[j].buf.data (), signatures[j].buf.size (), signatures[j].signature);
+			bool verified = batch.Verify (results);
+			assert (verified);
+		}
+		elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now () - start).count ();
+		std::cout << "batch " << batchSize << ": " << (uint64_t)signatures.size ()*1000000/(elapsed ? elapsed : 1) << " verifies/sec" << std::endl;
+	}
+}
@@ -0,0 +1,171 @@
+#include <cassert>
+#include <inttypes.h>
+#include <string.h>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "util.h"
+#include "I2NPProtocol.h"
+#include "TestUtils.h"
+
+// usage: test-i2np-buffers
+// checks size classes of I2NP messages buffers and their statistics,
+// then runs synthetic load of mixed size messages created by one thread and released by another
+// with allocation by size (as before) and with buffers, reports allocation rate and RSS
+
+const int NUM_MESSAGES = 1000000;
+const int NUM_IN_FLIGHT = 4096; // messages alive at once
+const int BATCH_SIZE = 64;
+
+const MessageLengths MESSAGE_LENGTHS[] = // tunnel data, small, streaming and large messages
+{
+	{ 60, 1028, 1 },
+	{ 25, 1, 4000 },
+	{ 10, 4000, 12000 },
+	{ 5, 16000, 46000 }
+};
+
+static std::shared_ptr<i2p::I2NPMessage> NewMessageBySize (size_t len) // NewI2NPMessage (size_t) before buffers
+{
+	if (len < i2p::I2NP_MAX_SHORT_MESSAGE_SIZE - i2p::I2NP_HEADER_SIZE - 2)
+		return std::make_shared<i2p::I2NPMessageBuffer<i2p::I2NP_MAX_SHORT_MESSAGE_SIZE> >();
+	return std::make_shared<i2p::I2NPMessageBuffer<i2p::I2NP_MAX_MESSAGE_SIZE> >();
+}
+
+template<typename Allocator>
+static void RunLoad (const char * name, Allocator allocator)
+{
+	std::mutex mutex;
+	std::condition_variable cond;
+	std::deque<std::vector<std::shared_ptr<i2p::I2NPMessage> > > queue;
+	bool isFinished = false;
+	std::thread consumer ([&]()
+		{
+			for (;;)
+			{
+				std::vector<std::shared_ptr<i2p::I2NPMessage> > batch;
+				{
+					std::unique_lock<std::mutex> l(mutex);
+					while (queue.empty () && !isFinished) cond.wait (l);
+					if (queue.empty ()) break;
+					batch = std::move (queue.front ());
+					queue.pop_front ();
+				}
+				for (auto& it: batch)
+					assert (it->GetPayload ()[0] == (uint8_t)it->GetLength ());
+			}
+		});
+	size_t rss = i2p::util::GetResidentMemory (), maxRss = rss;
+	auto start = std::chrono::steady_clock::now ();
+	// messages live in queues, oldest are released by other thread
+	std::vector<std::shared_ptr<i2p::I2NPMessage> > inFlight (NUM_IN_FLIGHT), batch;
+	for (int i = 0; i < NUM_MESSAGES; i++)
+	{
+		auto len = GetMessageLength (i, MESSAGE_LENGTHS);
+		auto msg = allocator (len);
+		memset (msg->GetPayload (), 0, len);
+		msg->len += len;
+		msg->GetPayload ()[0] = msg->GetLength ();
+		auto& slot = inFlight[i % NUM_IN_FLIGHT];
+		if (slot) batch.push_back (std::move (slot));
+		slot = msg;
+		if (batch.size () >= BATCH_SIZE)
+		{
+			std::unique_lock<std::mutex> l(mutex);
+			queue.push_back (std::move (batch));
+			batch.clear ();
+			cond.notify_one ();
+		}
+		if (!(i % 10000))
+		{
+			auto r = i2p::util::GetResidentMemory ();
+			if (r > maxRss) maxRss = r;
+		}
+	}
+	{
+		std::unique_lock<std::mutex> l(mutex);
+		isFinished = true;
+	}
+	cond.notify_one ();
+	consumer.join ();
+	auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now () - start).count ();
+	std::cout << std::setw (8) << name << ": " << std::setw (8) << (uint64_t)NUM_MESSAGES*1000000/(elapsed ? elapsed : 1) << " messages/s, RSS grown by "
+		<< std::setw (4) << (maxRss - rss)/(1024*1024) << " MiB" << std::endl;
+}
+
+template<typename Allocator>
+static void RunLoadInProcess (const char * name, Allocator allocator) // don't let modes share heap
+{
+	std::cout.flush ();
+	auto pid = fork ();
+	assert (pid >= 0);
+	if (!pid)
+	{
+		RunLoad (name, allocator);
+		std::cout.flush ();
+		_exit (0);
+	}
+	int status = 0;
+	waitpid (pid, &status, 0);
+	assert (WIFEXITED (status) && !WEXITSTATUS (status));
+}
+
+int main ()
+{
+	// smallest fitting size class
+	assert (i2p::NewI2NPMessage ((size_t)100)->maxLen == 2048);
+	assert (i2p::NewI2NPMessage (1028)->maxLen == 2048);
+	assert (i2p::NewI2NPMessage (3000)->maxLen == i2p::I2NP_MAX_SHORT_MESSAGE_SIZE);
+	assert (i2p::NewI2NPMessage (5000)->maxLen == 16384);
+	assert (i2p::NewI2NPMessage (20000)->maxLen == i2p::I2NP_MAX_MESSAGE_SIZE);
+	assert (i2p::NewI2NPMessage ()->maxLen == i2p::I2NP_MAX_MESSAGE_SIZE);
+	assert (i2p::NewI2NPShortMessage ()->maxLen == i2p::I2NP_MAX_SHORT_MESSAGE_SIZE);
+	for (size_t len = 1; len < i2p::I2NP_MAX_MESSAGE_SIZE - i2p::I2NP_BUFFER_HEADROOM; len += 97)
+	{
+		// room for payload and tunnel gateway header
+		auto msg = i2p::NewI2NPMessage (len);
+		assert (msg->maxLen >= len + 2*i2p::I2NP_HEADER_SIZE + 6 + msg->offset);
+	}
+	// message is copied into smaller buffer
+	std::vector<uint8_t> payload (3000, 0x5A);
+	auto msg = i2p::CreateI2NPMessage (i2p::eI2NPData, payload.data (), payload.size ());
+	auto copy = i2p::CreateI2NPMessage (msg->GetBuffer (), msg->GetLength ());
+	assert (copy->maxLen == i2p::I2NP_MAX_SHORT_MESSAGE_SIZE);
+	assert (copy->GetLength () == msg->GetLength () && !memcmp (copy->GetBuffer (), msg->GetBuffer (), msg->GetLength ()));
+	msg = nullptr; copy = nullptr;
+
+	// blocks are reused and counted, released by other threads
+	{
+		std::vector<std::shared_ptr<i2p::I2NPMessage> > msgs;
+		for (int i = 0; i < 1000; i++)
+			msgs.push_back (i2p::NewI2NPMessage ((size_t)100));
+		std::thread ([&msgs]() { msgs.clear (); }).join ();
+	}
+	auto stats = i2p::GetI2NPBuffersStats ();
+	assert (stats.size () == i2p::eNumI2NPBufferSizeClasses);
+	assert (stats[i2p::eI2NPBuffer2K].numAllocations >= 1000 - i2p::I2NP_BUFFERS_STATS_FLUSH_INTERVAL); // counters of thread are added later
+	assert (stats[i2p::eI2NPBuffer2K].numCached > 0);
+	auto numHeapAllocations = stats[i2p::eI2NPBuffer2K].numHeapAllocations;
+	{
+		std::vector<std::shared_ptr<i2p::I2NPMessage> > msgs;
+		for (int i = 0; i < 100; i++)
+			msgs.push_back (i2p::NewI2NPMessage ((size_t)100));
+	}
+	stats = i2p::GetI2NPBuffersStats ();
+	assert (stats[i2p::eI2NPBuffer2K].numHeapAllocations == numHeapAllocations);
+	for (const auto& it: stats)
+		assert (it.numCached*(it.size + i2p::I2NP_BUFFER_OVERHEAD) <= i2p::I2NP_BUFFERS_MAX_CACHED_SIZE);
+
+	RunLoadInProcess ("by size", NewMessageBySize);
+	RunLoadInProcess ("buffers", [](size_t len) { return i2p::NewI2NPMessage (len); });
+}
@@ -0,0 +1,285 @@
+#include <cassert>
+#include <inttypes.h>
+#include <string.h>
+#include <vector>
+#include <set>
+#include <unordered_map>
+#include <memory>
+#include <array>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <openssl/rand.h>
+
+#include "NetDbIndex.h"
+
+const int NUM_LOOKUPS = 100000;
+
+enum
+{
+	eAll = 0,
+	eHighBandwidth,
+	eIntroducer,
+	eEmpty,
+	eNumPartitions
+};
+
+struct Router
+{
+	uint32_t id;
+	bool highBandwidth, introducer;
+	bool unreachable;
+};
+
+typedef i2p::data::PartitionedIndex<Router, eNumPartitions> Index;
+
+static uint32_t GetPartitions (const Router& r)
+{
+	uint32_t partitions = 1 << eAll;
+	if (r.highBandwidth) partitions |= 1 << eHighBandwidth;
+	if (r.introducer) partitions |= 1 << eIntroducer;
+	return partitions;
+}
+
+// previous implementation, random position in unordered_map followed by linear scan
+template<typename Filter>
+std::shared_ptr<Router> GetRandomFromMap (const std::unordered_map<uint32_t, std::shared_ptr<Router> >& routers, Filter filter)
+{
+	uint32_t ind;
+	RAND_bytes ((uint8_t *)&ind, sizeof (ind));
+	ind %= routers.size ();
+	auto it = routers.begin ();
+	std::advance (it, ind);
+	for (auto it1 = it; it1 != routers.end (); it1++)
+		if (filter (it1->second)) return it1->second;
+	for (auto it1 = routers.begin (); it1 != it; it1++)
+		if (filter (it1->second)) return it1->second;
+	return nullptr;
+}
+
+template<typename F>
+double LookupsPerSecond (F f, int numLookups = NUM_LOOKUPS)
+{
+	auto start = std::chrono::steady_clock::now ();
+	for (int i = 0; i < numLookups; i++) f ();
+	auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now () - start).count ();
+	return (double)numLookups*1000000/(elapsed ? elapsed : 1);
+}
+
+void Run (size_t numRouters)
+{
+	std::unordered_map<uint32_t, std::shared_ptr<Router> > routers;
+	std::vector<uint8_t> rnd (numRouters);
+	RAND_bytes (rnd.data (), rnd.size ());
+	Index::Builder builder (numRouters);
+	for (size_t i = 0; i < numRouters; i++)
+	{
+		auto r = std::make_shared<Router> ();
+		r->id = i;
+		r->highBandwidth = rnd[i] < 64; // 25%
+		r->introducer = !rnd[i]; // 0.4%
+		r->unreachable = (rnd[i] & 0x0F) == 0x0F; // 6%
+		routers.emplace (i, r);
+		builder.Add (r, GetPartitions (*r));
+	}
+	Index index;
+	index.Publish (builder);
+	assert (index.GetSize (eAll) == numRouters);
+	assert (!index.GetRandom (eEmpty, [](std::shared_ptr<const Router>) { return true; }));
+
+	auto highBandwidth = [](std::shared_ptr<const Router> r) { return !r->unreachable && r->highBandwidth; };
+	auto introducer = [](std::shared_ptr<const Router> r) { return !r->unreachable && r->introducer; };
+	auto none = [](std::shared_ptr<const Router> r) { return r->id == (uint32_t)-1; };
+	for (int i = 0; i < 1000; i++)
+	{
+		auto r = index.GetRandom (eHighBandwidth, highBandwidth);
+		assert (r && highBandwidth (r));
+		r = index.GetRandom (eIntroducer, introducer);
+		if (r) assert (introducer (r));
+	}
+	assert (!index.GetRandom (eAll, none));
+
+	// visit random
+	size_t visited = index.VisitRandom (eHighBandwidth, highBandwidth,
+		[&highBandwidth](std::shared_ptr<const Router> r) { assert (highBandwidth (r)); }, 10);
+	assert (visited == 10);
+
+	double mapRate = LookupsPerSecond ([&routers, &highBandwidth]() { GetRandomFromMap (routers, highBandwidth); }, NUM_LOOKUPS/100);
+	double indexRate = LookupsPerSecond ([&index, &highBandwidth]() { index.GetRandom (eHighBandwidth, highBandwidth); });
+	double introducerRate = LookupsPerSecond ([&index, &introducer]() { index.GetRandom (eIntroducer, introducer); });
+
+	// readers while writer republishes
+	std::atomic<bool> done (false);
+	std::thread writer ([&done, &routers, &index]()
+		{
+			while (!done)
+			{
+				Index::Builder b (routers.size ());
+				for (const auto& it: routers)
+					b.Add (it.second, GetPartitions (*it.second));
+				index.Publish (b);
+			}
+		});
+	double concurrentRate = LookupsPerSecond ([&index, &highBandwidth]()
+		{
+			auto r = index.GetRandom (eHighBandwidth, highBandwidth);
+			assert (r && highBandwidth (r));
+		});
+	done = true;
+	writer.join ();
+
+	std::cout << numRouters << " routers: map " << (uint64_t)mapRate << " lookups/sec, index " << (uint64_t)indexRate
+		<< " lookups/sec, introducer " << (uint64_t)introducerRate << " lookups/sec, with writer "
+		<< (uint64_t)concurrentRate << " lookups/sec" << std::endl;
+}
+
+struct Floodfill
+{
+	i2p::data::Tag<32> ident;
+	bool unreachable;
+	const i2p::data::Tag<32>& GetIdentHash () const { return ident; };
+};
+
+typedef std::array<uint8_t, 32> Metric;
+
+static Metric GetMetric (const i2p::data::Tag<32>& key1, const i2p::data::Tag<32>& key2)
+{
+	Metric m;
+	for (int i = 0; i < 32; i++) m[i] = key1[i] ^ key2[i];
+	return m;
+}
+
+// previous GetClosestFloodfills, full scan
+std::vector<i2p::data::Tag<32> > GetClosestFloodfillsScan (const std::vector<std::shared_ptr<Floodfill> >& floodfills,
+	const i2p::data::Tag<32>& key, size_t num, const std::set<i2p::data::Tag<32> >& excluded, const Metric * ourMetric)
+{
+	std::vector<std::pair<Metric, std::shared_ptr<Floodfill> > > sorted;
+	for (const auto& it: floodfills)
+	{
+		if (it->unreachable) continue;
+		auto m = GetMetric (key, it->ident);
+		if (ourMetric && *ourMetric < m) continue;
+		sorted.push_back ({m, it});
+	}
+	std::partial_sort (sorted.begin (), sorted.begin () + std::min (num, sorted.size ()), sorted.end (),
+		[](const std::pair<Metric, std::shared_ptr<Floodfill> >& a, const std::pair<Metric, std::shared_ptr<Floodfill> >& b)
+		{
+			return a.first < b.first;
+		});
+	std::vector<i2p::data::Tag<32> > res;
+	for (size_t i = 0; i < sorted.size () && i < num; i++)
+		if (!excluded.count (sorted[i].second->ident)) res.push_back (sorted[i].second->ident);
+	return res;
+}
+
+std::vector<i2p::data::Tag<32> > GetClosestFloodfillsIndex (const i2p::data::KademliaIndex<Floodfill>& index,
+	const i2p::data::Tag<32>& key, size_t num, const std::set<i2p::data::Tag<32> >& excluded, const Metric * ourMetric)
+{
+	std::vector<i2p::data::Tag<32> > res;
+	size_t i = 0;
+	if (!num) return res;
+	index.VisitClosest (key, [&](const std::shared_ptr<Floodfill>& it)->bool
+		{
+			if (ourMetric && *ourMetric < GetMetric (key, it->ident)) return false;
+			if (it->unreachable) return true;
+			if (!excluded.count (it->ident)) res.push_back (it->ident);
+			return ++i < num;
+		});
+	return res;
+}
+
+void KademliaTest ()
+{
+	i2p::data::KademliaIndex<Floodfill> index;
+	std::vector<std::shared_ptr<Floodfill> > floodfills;
+	for (int i = 0; i < 3000; i++)
+	{
+		auto f = std::make_shared<Floodfill> ();
+		f->ident.Randomize ();
+		if (i < 32) f->ident[0] = 0x5A; // long common prefixes
+		if (i < 8) memset (f->ident, 0x5A, 24);
+		uint8_t r; RAND_bytes (&r, 1);
+		f->unreachable = r < 32;
+		assert (index.Insert (f));
+		floodfills.push_back (f);
+	}
+	assert (!index.Insert (floodfills[0])); // duplicate
+	assert (index.size () == floodfills.size ());
+	for (auto it = index.begin (); it + 1 != index.end (); it++)
+		assert ((*it)->ident < (*(it + 1))->ident);
+
+	for (int n = 0; n < 2000; n++)
+	{
+		if (n % 10 == 0)
+		{
+			// remove and add some floodfills
+			uint16_t ind; RAND_bytes ((uint8_t *)&ind, 2);
+			auto f = floodfills[ind % floodfills.size ()];
+			assert (index.Remove (f->ident));
+			assert (!index.Remove (f->ident));
+			f->ident.Randomize ();
+			assert (index.Insert (f));
+		}
+		i2p::data::Tag<32> key;
+		key.Randomize ();
+		if (n % 7 == 0) memcpy (key, floodfills[n % 8]->ident, 31); // close to existing one
+		std::set<i2p::data::Tag<32> > excluded;
+		for (int i = 0; i < n % 5; i++)
+			excluded.insert (floodfills[(n*13 + i*101) % floodfills.size ()]->ident);
+		if (n % 3 == 0)
+		{
+			// closest ones are excluded
+			auto closest = GetClosestFloodfillsScan (floodfills, key, 2, excluded, nullptr);
+			excluded.insert (closest.begin (), closest.end ());
+		}
+		Metric ourMetric = GetMetric (key, floodfills[n % floodfills.size ()]->ident);
+		const Metric * our = (n & 1) ? &ourMetric : nullptr;
+		size_t num = n % 8;
+		assert (GetClosestFloodfillsScan (floodfills, key, num, excluded, our) ==
+			GetClosestFloodfillsIndex (index, key, num, excluded, our));
+		if (n % 20) continue;
+		// all in order
+		Metric prev; prev.fill (0);
+		size_t visited = 0;
+		index.VisitClosest (key, [&](const std::shared_ptr<Floodfill>& it)->bool
+			{
+				auto m = GetMetric (key, it->ident);
+				assert (visited == 0 || prev < m);
+				prev = m; visited++;
+				return true;
+			});
+		assert (visited == floodfills.size ());
+	}
+
+	// 3 closest, as for DatabaseLookup
+	std::set<i2p::data::Tag<32> > excluded;
+	i2p::data::Tag<32> key;
+	double scanRate = LookupsPerSecond ([&]()
+		{
+			key.Randomize ();
+			GetClosestFloodfillsScan (floodfills, key, 3, excluded, nullptr);
+		}, NUM_LOOKUPS/100);
+	double indexRate = LookupsPerSecond ([&]()
+		{
+			key.Randomize ();
+			GetClosestFloodfillsIndex (index, key, 3, excluded, nullptr);
+		});
+	std::cout << floodfills.size () << " floodfills: scan " << (uint64_t)scanRate << " lookups/sec, index "
+		<< (uint64_t)indexRate << " lookups/sec" << std::endl;
+
+	index.RemoveIf ([](const std::shared_ptr<Floodfill>& it) { return it->unreachable; });
+	for (const auto& it: index) assert (!it->unreachable);
+	index.Clear ();
+	assert (index.empty ());
+	index.VisitClosest (i2p::data::Tag<32>(), [](const std::shared_ptr<Floodfill>&) { assert (false); return true; });
+}
+
+int main ()
+{
+	KademliaTest ();
+	Run (10000);
+	Run (50000);
+	Run (100000);
+}
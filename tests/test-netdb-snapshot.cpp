@@ -0,0 +1,173 @@
+#include <cassert>
+#include <inttypes.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <boost/filesystem.hpp>
+#include <openssl/rand.h>
+
+#include "NetDbSnapshot.h"
+
+// usage: test-netdb-snapshot
+// checks snapshot format and compares reading of snapshot with reading of separate files
+
+const int NUM_RECORDS = 5000;
+
+typedef std::map<i2p::data::IdentHash, std::vector<uint8_t> > Records;
+
+static std::vector<uint8_t> RandomBuffer ()
+{
+	uint16_t len;
+	RAND_bytes ((uint8_t *)&len, 2);
+	std::vector<uint8_t> buf (400 + len % 600);
+	RAND_bytes (buf.data (), buf.size ());
+	return buf;
+}
+
+static std::vector<i2p::data::NetDbSnapshot::Record> ToRecords (const Records& records)
+{
+	std::vector<i2p::data::NetDbSnapshot::Record> res;
+	for (const auto& it: records)
+		res.push_back ({it.first, it.second.data (), it.second.size ()});
+	return res;
+}
+
+static void Check (const i2p::data::NetDbSnapshot& snapshot, const Records& records)
+{
+	assert (snapshot.IsOpen ());
+	assert (snapshot.GetNumRecords () == records.size ());
+	for (const auto& it: records)
+	{
+		size_t len = 0;
+		auto buf = snapshot.Find (it.first, len);
+		assert (buf && len == it.second.size () && !memcmp (buf, it.second.data (), len));
+	}
+	i2p::data::IdentHash ident;
+	ident.Randomize ();
+	size_t len = 0;
+	assert (!snapshot.Find (ident, len));
+	// all parts together visit every record once
+	size_t visited = 0;
+	for (int part = 0; part < 3; part++)
+		snapshot.Visit ([&records, &visited](const i2p::data::IdentHash& ident, const uint8_t * buf, size_t len)
+			{
+				auto it = records.find (ident);
+				assert (it != records.end () && it->second.size () == len && !memcmp (it->second.data (), buf, len));
+				visited++;
+			}, part, 3);
+	assert (visited == records.size ());
+}
+
+int main ()
+{
+	auto dir = boost::filesystem::temp_directory_path () / boost::filesystem::unique_path ();
+	boost::filesystem::create_directories (dir);
+	std::string path = (dir / "netDb.snapshot").string ();
+
+	Records records;
+	for (int i = 0; i < NUM_RECORDS; i++)
+	{
+		i2p::data::IdentHash ident;
+		ident.Randomize ();
+		records[ident] = RandomBuffer ();
+	}
+	i2p::data::NetDbSnapshot snapshot;
+	assert (!snapshot.Open (path)); // doesn't exist
+	assert (snapshot.Create (path, ToRecords (records)));
+	Check (snapshot, records);
+	assert (!snapshot.GetGarbageSize ());
+
+	// append updated, new and removed
+	std::vector<i2p::data::IdentHash> removed;
+	Records changed;
+	auto it = records.begin ();
+	for (int i = 0; i < 100; i++, it++)
+	{
+		it->second = RandomBuffer ();
+		changed[it->first] = it->second;
+	}
+	for (int i = 0; i < 50; i++)
+	{
+		removed.push_back (it->first);
+		it = records.erase (it);
+	}
+	for (int i = 0; i < 100; i++)
+	{
+		i2p::data::IdentHash ident;
+		ident.Randomize ();
+		records[ident] = RandomBuffer ();
+		changed[ident] = records[ident];
+	}
+	assert (snapshot.Append (ToRecords (changed), removed));
+	Check (snapshot, records);
+	assert (snapshot.GetGarbageSize () > 0);
+	assert (snapshot.Append ({}, {}));
+	Check (snapshot, records);
+
+	// reopen
+	snapshot.Close ();
+	assert (snapshot.Open (path));
+	Check (snapshot, records);
+
+	// compact, records point to the snapshot itself
+	std::vector<i2p::data::NetDbSnapshot::Record> current;
+	snapshot.Visit ([&current](const i2p::data::IdentHash& ident, const uint8_t * buf, size_t len)
+		{
+			current.push_back ({ident, buf, len});
+		});
+	size_t size = snapshot.GetFileSize ();
+	assert (snapshot.Create (path, current));
+	Check (snapshot, records);
+	assert (!snapshot.GetGarbageSize () && snapshot.GetFileSize () < size);
+
+	// truncated and corrupted files must be rejected
+	snapshot.Close ();
+	boost::filesystem::resize_file (path, size/2);
+	assert (!snapshot.Open (path));
+	{
+		std::ofstream f (path, std::ofstream::binary | std::ofstream::trunc);
+		std::vector<uint8_t> garbage (10000);
+		RAND_bytes (garbage.data (), garbage.size ());
+		memcpy (garbage.data (), i2p::data::NETDB_SNAPSHOT_MAGIC, 8);
+		memcpy (garbage.data () + garbage.size () - 8, i2p::data::NETDB_SNAPSHOT_MAGIC, 8);
+		f.write ((const char *)garbage.data (), garbage.size ());
+	}
+	assert (!snapshot.Open (path));
+	assert (!snapshot.Append (ToRecords (changed), removed));
+
+	// reading performance, snapshot vs one file per record
+	assert (snapshot.Create (path, ToRecords (records)));
+	auto files = dir / "files";
+	boost::filesystem::create_directories (files);
+	for (const auto& it: records)
+	{
+		std::ofstream f ((files / (it.first.ToBase64 () + ".dat")).string (), std::ofstream::binary);
+		f.write ((const char *)it.second.data (), it.second.size ());
+	}
+	snapshot.Close ();
+	auto start = std::chrono::steady_clock::now ();
+	uint8_t sum = 0;
+	for (boost::filesystem::directory_iterator it (files), end; it != end; it++)
+	{
+		std::ifstream f (it->path ().string (), std::ifstream::binary);
+		std::vector<uint8_t> buf ((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+		sum += buf[0];
+	}
+	auto fromFiles = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now () - start).count ();
+	start = std::chrono::steady_clock::now ();
+	assert (snapshot.Open (path));
+	snapshot.Visit ([&sum](const i2p::data::IdentHash& ident, const uint8_t * buf, size_t len)
+		{
+			std::vector<uint8_t> b (buf, buf + len);
+			sum += b[0];
+		});
+	auto fromSnapshot = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now () - start).count ();
+	std::cout << records.size () << " records: files " << fromFiles << " us, snapshot " << fromSnapshot << " us (" << (int)sum << ")" << std::endl;
+
+	snapshot.Close ();
+	boost::filesystem::remove_all (dir);
+}
@@ -0,0 +1,83 @@
+#include <cassert>
+#include <inttypes.h>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <memory>
+#include <algorithm>
+#include <iostream>
+
+#include "Queue.h"
+
+const int NUM_PRODUCERS = 4;
+const int NUM_MESSAGES = 200000; // per producer
+
+struct Msg
+{
+	Msg (int p, int s): producer (p), seqn (s) {};
+	int producer, seqn;
+};
+
+template<class Q>
+void Run (const char * name)
+{
+	Q queue;
+	std::vector<std::vector<uint64_t> > latencies (NUM_PRODUCERS);
+	auto start = std::chrono::steady_clock::now ();
+	std::vector<std::thread> producers;
+	for (int i = 0; i < NUM_PRODUCERS; i++)
+		producers.emplace_back ([&queue, &latencies, i]()
+			{
+				auto& lat = latencies[i];
+				lat.reserve (NUM_MESSAGES);
+				for (int j = 0; j < NUM_MESSAGES; j++)
+				{
+					auto msg = std::make_shared<Msg>(i, j);
+					auto ts = std::chrono::steady_clock::now ();
+					queue.Put (msg);
+					lat.push_back (std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now () - ts).count ());
+				}
+			});
+	// consumer, check order per producer
+	std::vector<int> next (NUM_PRODUCERS, 0);
+	int received = 0;
+	while (received < NUM_PRODUCERS*NUM_MESSAGES)
+	{
+		auto msg = queue.GetNextWithTimeout (100);
+		while (msg)
+		{
+			assert (msg->seqn == next[msg->producer]);
+			next[msg->producer]++;
+			received++;
+			msg = queue.Get ();
+		}
+	}
+	auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now () - start).count ();
+	for (auto& it: producers) it.join ();
+	assert (queue.IsEmpty ());
+
+	std::vector<uint64_t> all;
+	for (auto& it: latencies) all.insert (all.end (), it.begin (), it.end ());
+	std::sort (all.begin (), all.end ());
+	std::cout << name << ": " << (uint64_t)received*1000000/(elapsed ? elapsed : 1) << " msgs/sec, p99 enqueue "
+		<< all[all.size ()*99/100] << " ns" << std::endl;
+}
+
+int main ()
+{
+	Run<i2p::util::Queue<std::shared_ptr<Msg> > >("Queue");
+	Run<i2p::util::MPSCQueue<std::shared_ptr<Msg> > >("MPSCQueue");
+	Run<i2p::util::MPSCQueue<std::shared_ptr<Msg>, 64> >("MPSCQueue with overflow");
+	Run<i2p::util::MPSCQueue<std::shared_ptr<Msg>, 4> >("MPSCQueue with small ring"); // claimed cells at head are often not published yet
+
+	// batch dequeue
+	i2p::util::MPSCQueue<std::shared_ptr<Msg>, 4> queue;
+	for (int i = 0; i < 10; i++) queue.Put (std::make_shared<Msg>(0, i));
+	assert (queue.GetSize () == 10);
+	assert (queue.Peek ()->seqn == 0);
+	std::vector<std::shared_ptr<Msg> > msgs;
+	queue.GetAll (msgs);
+	assert (msgs.size () == 10);
+	for (int i = 0; i < 10; i++) assert (msgs[i]->seqn == i);
+	assert (queue.IsEmpty () && !queue.Get ());
+}
@@ -0,0 +1,89 @@
+#include <cassert>
+#include <inttypes.h>
+#include <string.h>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <openssl/rand.h>
+
+#include "Crypto.h"
+
+// usage: test-random
+// checks that i2p::crypto::RandBytes output looks uniform and differs between calls and threads,
+// compares throughput and call latency with RAND_bytes for sizes of IVs, nonces and padding
+
+const size_t SIZES[] = { 4, 16, 64, 1024 };
+const int NUM_CALLS = 200000; // per measurement
+const int NUM_THREADS = 4;
+
+template<typename Generator>
+static double Measure (Generator generator, size_t size, int numThreads) // returns calls per second
+{
+	auto start = std::chrono::steady_clock::now ();
+	std::vector<std::thread> threads;
+	for (int i = 0; i < numThreads; i++)
+		threads.emplace_back ([generator, size, numThreads]()
+			{
+				uint8_t buf[1024];
+				for (int j = 0; j < NUM_CALLS/numThreads; j++)
+					generator (buf, size);
+			});
+	for (auto& it: threads) it.join ();
+	auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now () - start).count ();
+	return (double)NUM_CALLS*1000000/(elapsed ? elapsed : 1);
+}
+
+int main ()
+{
+	// different every call
+	uint8_t buf1[32], buf2[32];
+	i2p::crypto::RandBytes (buf1, 32);
+	i2p::crypto::RandBytes (buf2, 32);
+	assert (memcmp (buf1, buf2, 32));
+	// and in other thread
+	std::thread ([&buf2]() { i2p::crypto::RandBytes (buf2, 32); }).join ();
+	assert (memcmp (buf1, buf2, 32));
+	// spans buffer refills
+	std::vector<uint8_t> large (3*i2p::crypto::RANDOM_BUFFER_SIZE + 17);
+	i2p::crypto::RandBytes (large.data (), large.size ());
+	assert (memcmp (large.data () + i2p::crypto::RANDOM_BUFFER_SIZE, large.data (), i2p::crypto::RANDOM_BUFFER_SIZE));
+
+	// uniform bytes, chi-square with 255 degrees of freedom, p = 0.0001 at 347
+	const int NUM_SAMPLES = 2560000;
+	std::vector<int> counts (256);
+	uint8_t buf[1000];
+	for (int i = 0; i < NUM_SAMPLES/1000; i++)
+	{
+		i2p::crypto::RandBytes (buf, sizeof (buf));
+		for (auto b: buf) counts[b]++;
+	}
+	double chi2 = 0, expected = NUM_SAMPLES/256.0;
+	for (auto c: counts) chi2 += (c - expected)*(c - expected)/expected;
+	std::cout << "chi-square " << chi2 << std::endl;
+	assert (chi2 < 347);
+
+	// RandUInt32 covers all bits
+	uint32_t ored = 0, anded = 0xFFFFFFFF;
+	for (int i = 0; i < 1000; i++)
+	{
+		auto r = i2p::crypto::RandUInt32 ();
+		ored |= r; anded &= r;
+	}
+	assert (ored == 0xFFFFFFFF && !anded);
+
+	auto randBytes = [](uint8_t * buf, size_t len) { RAND_bytes (buf, len); };
+	auto fastRandBytes = [](uint8_t * buf, size_t len) { i2p::crypto::RandBytes (buf, len); };
+	for (int numThreads: { 1, NUM_THREADS })
+	{
+		std::cout << numThreads << " thread(s):" << std::endl;
+		for (auto size: SIZES)
+		{
+			auto slow = Measure (randBytes, size, numThreads), fast = Measure (fastRandBytes, size, numThreads);
+			std::cout << std::setw (5) << size << " bytes: RAND_bytes " << std::setw (5) << (uint64_t)(slow*size/1000000) << " MB/s, "
+				<< std::setw (5) << (uint64_t)(1000000000/slow) << " ns/call; RandBytes " << std::setw (5) << (uint64_t)(fast*size/1000000) << " MB/s, "
+				<< std::setw (5) << (uint64_t)(1000000000/fast) << " ns/call" << std::endl;
+		}
+	}
+}
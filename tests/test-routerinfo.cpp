@@ -0,0 +1,132 @@
+#include <cassert>
+#include <inttypes.h>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <boost/filesystem.hpp>
+#include <openssl/rand.h>
+
+#include "Identity.h"
+#include "RouterInfo.h"
+#include "version.h"
+
+// usage: test-routerinfo [netDb directory]
+// parses RouterInfo files from netDb if specified, or generated ones otherwise
+
+const int NUM_GENERATED = 1000;
+const int NUM_ROUNDS = 20;
+
+std::vector<std::string> Generate (const std::string& dir)
+{
+	std::vector<std::string> files;
+	boost::filesystem::create_directories (dir);
+	for (int i = 0; i < NUM_GENERATED; i++)
+	{
+		auto keys = i2p::data::PrivateKeys::CreateRandomKeys (i2p::data::SIGNING_KEY_TYPE_EDDSA_SHA512_ED25519,
+			i2p::data::CRYPTO_KEY_TYPE_ECIES_X25519_AEAD);
+		i2p::data::LocalRouterInfo ri;
+		ri.SetRouterIdentity (keys.GetPublic ());
+		uint8_t key[32], iv[16];
+		RAND_bytes (key, 32); RAND_bytes (iv, 16);
+		std::string host = "10.0." + std::to_string (i >> 8) + "." + std::to_string (i & 0xFF);
+		ri.AddNTCP2Address (key, iv, boost::asio::ip::address::from_string (host), 10000 + i);
+		ri.AddSSUAddress (host.c_str (), 10000 + i, key, 1484);
+		if (i & 1)
+		{
+			std::string host6 = "2001:db8::" + std::to_string (i + 1);
+			ri.AddNTCP2Address (key, iv, boost::asio::ip::address::from_string (host6), 20000 + i);
+			ri.AddSSUAddress (host6.c_str (), 20000 + i, key, 1488);
+		}
+		ri.SetProperty ("caps", (i & 3) ? "LR" : "XfR");
+		ri.SetProperty ("netId", std::to_string (I2PD_NET_ID));
+		ri.SetProperty ("router.version", "0.9.55");
+		ri.SetProperty ("coreVersion", "0.9.55");
+		ri.SetProperty ("netdb.knownRouters", std::to_string (5000 + i));
+		ri.SetProperty ("netdb.knownLeaseSets", std::to_string (i));
+		ri.CreateBuffer (keys);
+		std::string path = dir + "/routerInfo-" + ri.GetIdentHashBase64 () + ".dat";
+		ri.SaveToFile (path);
+		files.push_back (path);
+		// must be parsed back
+		i2p::data::RouterInfo r (ri.GetBuffer (), ri.GetBufferLen ());
+		assert (!r.IsUnreachable ());
+		assert (r.GetIdentHash () == ri.GetIdentHash ());
+		assert (r.GetTimestamp () == ri.GetTimestamp ());
+		assert (r.GetVersion () == MAKE_VERSION_NUMBER(0, 9, 55));
+		assert (r.IsFloodfill () == !(i & 3));
+		assert (r.IsReachable ());
+		assert (r.IsNTCP2 (true) && r.IsSSU (true));
+		assert (r.IsNTCP2V6 () == (bool)(i & 1) && r.IsSSUV6 () == (bool)(i & 1));
+		auto ntcp2 = r.GetPublishedNTCP2V4Address ();
+		assert (ntcp2 && ntcp2->port == 10000 + i && ntcp2->host.to_string () == host);
+		assert (!memcmp (ntcp2->s, key, 32) && !memcmp (ntcp2->i, iv, 16));
+		auto ssu = r.GetSSUAddress (true);
+		assert (ssu && ssu->ssu->mtu == 1484 && !memcmp (ssu->i, key, 32));
+		// truncated must not crash
+		i2p::data::RouterInfo truncated (ri.GetBuffer (), ri.GetBufferLen () - 100);
+		assert (truncated.IsUnreachable ());
+	}
+	return files;
+}
+
+int main (int argc, char * argv[])
+{
+	std::vector<std::string> files;
+	std::string dir;
+	if (argc > 1)
+	{
+		for (boost::filesystem::recursive_directory_iterator it (argv[1]), end; it != end; it++)
+			if (it->path ().extension () == ".dat")
+				files.push_back (it->path ().string ());
+	}
+	else
+	{
+		dir = (boost::filesystem::temp_directory_path () / boost::filesystem::unique_path ()).string ();
+		files = Generate (dir);
+	}
+	if (files.empty ()) return 0;
+	// load files to memory
+	std::vector<std::vector<uint8_t> > buffers;
+	for (const auto& it: files)
+	{
+		std::ifstream f (it, std::ifstream::binary);
+		buffers.emplace_back ((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+	}
+
+	// file reading only
+	auto start = std::chrono::steady_clock::now ();
+	for (int r = 0; r < NUM_ROUNDS; r++)
+		for (const auto& it: files)
+		{
+			std::ifstream f (it, std::ifstream::binary);
+			i2p::data::RouterInfo::Buffer buf;
+			f.read ((char *)buf.data (), buf.size ());
+		}
+	auto reading = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now () - start).count ();
+	// from files, as NetDb::Load does
+	size_t numValid = 0;
+	start = std::chrono::steady_clock::now ();
+	for (int r = 0; r < NUM_ROUNDS; r++)
+		for (const auto& it: files)
+		{
+			i2p::data::RouterInfo ri (it);
+			if (!ri.IsUnreachable ()) numValid++;
+		}
+	auto fromFiles = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now () - start).count ();
+	// update from buffer, as DatabaseStore does, signature verification included
+	start = std::chrono::steady_clock::now ();
+	for (size_t i = 0; i < buffers.size (); i++)
+	{
+		i2p::data::RouterInfo ri (files[i]);
+		ri.Update (buffers[i].data (), buffers[i].size ());
+	}
+	auto updates = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now () - start).count ();
+	std::cout << files.size () << " RouterInfos (" << numValid/NUM_ROUNDS << " valid): "
+		<< (uint64_t)files.size ()*NUM_ROUNDS*1000000/(fromFiles ? fromFiles : 1) << " files/sec, "
+		<< (uint64_t)files.size ()*NUM_ROUNDS*1000000/(fromFiles > reading ? fromFiles - reading : 1) << " parsed/sec excluding file reading, "
+		<< (uint64_t)files.size ()*1000000/(updates ? updates : 1) << " updates/sec" << std::endl;
+
+	if (!dir.empty ()) boost::filesystem::remove_all (dir);
+}
@@ -0,0 +1,271 @@
+#include <cassert>
+#include <inttypes.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <thread>
+#include <future>
+#include <functional>
+#include <atomic>
+#include <random>
+#include <iostream>
+#include <unistd.h>
+
+#include "Config.h"
+#include "RouterContext.h"
+#include "Transports.h"
+#include "Tunnel.h"
+#include "SSU2.h"
+#include "TestUtils.h"
+
+// usage: test-ssu2
+// transfers I2NP messages between two SSU2 servers of the same router over loopback,
+// checks that every message is delivered once and reports throughput.
+// then connects another pair through a proxy corrupting SessionConfirmed and dropping packets,
+// checks fast retransmit of a single lost packet, ACK ranges for several holes and random losses
+
+const int NUM_MESSAGES = 10000;
+const int NUM_LARGE_MESSAGES = 200;
+const size_t LARGE_MESSAGE_SIZE = 20000; // 14 fragments
+const int CHUNK_SIZE = 200; // two chunks must fit SSU2_MAX_OUTGOING_QUEUE_SIZE
+const int NUM_LOSSY_MESSAGES = 100; // for single loss and holes
+const int HOLES_INTERVAL = 4; // every packet of
+const int NUM_HOLES = 10;
+const double LOSS_RATE = 0.03; // both directions
+
+// forwards datagrams between A and B, drops some or sends corrupted copy before original
+class Proxy
+{
+	public:
+
+		enum Action { ePass, eDrop, eCorrupt };
+		typedef std::function<Action (bool toB, int num, size_t len)> Filter; // num is counted from SetFilter per direction
+
+		Proxy (uint16_t port, uint16_t portB):
+			m_Work (m_Service),
+			m_SocketA (m_Service, boost::asio::ip::udp::endpoint (boost::asio::ip::address_v4::loopback (), port)),
+			m_SocketB (m_Service, boost::asio::ip::udp::endpoint (boost::asio::ip::address_v4::loopback (), 0)),
+			m_EndpointB (boost::asio::ip::address_v4::loopback (), portB), m_NumToA (0), m_NumToB (0)
+		{
+			Receive (true);
+			Receive (false);
+			m_Thread = std::thread ([this]() { m_Service.run (); });
+		}
+
+		~Proxy ()
+		{
+			m_Service.stop ();
+			m_Thread.join ();
+		}
+
+		void SetFilter (Filter filter)
+		{
+			std::promise<void> done;
+			m_Service.post ([this, filter, &done]()
+				{
+					m_Filter = filter;
+					m_NumToA = 0; m_NumToB = 0;
+					done.set_value ();
+				});
+			done.get_future ().wait ();
+		}
+
+		int GetNumToB () const { return m_NumToB; };
+
+	private:
+
+		void Receive (bool fromA)
+		{
+			auto& socket = fromA ? m_SocketA : m_SocketB;
+			socket.async_receive_from (boost::asio::buffer (fromA ? m_BufA : m_BufB, sizeof (m_BufA)), fromA ? m_EndpointA : m_From,
+				[this, fromA](const boost::system::error_code& ecode, std::size_t len)
+				{
+					if (ecode == boost::asio::error::operation_aborted) return;
+					if (!ecode) Forward (fromA, len);
+					Receive (fromA);
+				});
+		}
+
+		void Forward (bool toB, size_t len)
+		{
+			uint8_t * buf = toB ? m_BufA : m_BufB;
+			auto& socket = toB ? m_SocketB : m_SocketA;
+			const auto& to = toB ? m_EndpointB : m_EndpointA;
+			int num = toB ? m_NumToB++ : m_NumToA++;
+			auto action = m_Filter ? m_Filter (toB, num, len) : ePass;
+			boost::system::error_code ec;
+			if (action == eCorrupt && len > 100)
+			{
+				std::vector<uint8_t> corrupted (buf, buf + len);
+				corrupted[70] ^= 0x01; // payload, but not header mask sample
+				socket.send_to (boost::asio::buffer (corrupted), to, 0, ec);
+			}
+			if (action != eDrop)
+				socket.send_to (boost::asio::buffer (buf, len), to, 0, ec);
+		}
+
+	private:
+
+		boost::asio::io_service m_Service;
+		boost::asio::io_service::work m_Work;
+		boost::asio::ip::udp::socket m_SocketA, m_SocketB;
+		boost::asio::ip::udp::endpoint m_EndpointA, m_EndpointB, m_From;
+		uint8_t m_BufA[1500], m_BufB[1500];
+		Filter m_Filter;
+		std::atomic<int> m_NumToA, m_NumToB;
+		std::thread m_Thread;
+};
+
+static std::shared_ptr<i2p::data::RouterInfo::Address> CreateAddress (uint16_t port)
+{
+	auto address = std::make_shared<i2p::data::RouterInfo::Address> ();
+	address->transportStyle = i2p::data::RouterInfo::eTransportSSU2;
+	address->host = boost::asio::ip::address::from_string ("127.0.0.1");
+	address->port = port;
+	memcpy (address->s, i2p::context.GetSSU2StaticPublicKey (), 32);
+	memcpy (address->i, i2p::context.GetSSU2IntroKey (), 32);
+	address->published = true;
+	return address;
+}
+
+static std::shared_ptr<i2p::transport::SSU2Session> GetEstablishedSession (i2p::transport::SSU2Server& server)
+{
+	for (int i = 0; i < 100; i++)
+	{
+		std::promise<std::shared_ptr<i2p::transport::SSU2Session> > result;
+		server.GetService ().post ([&server, &result]()
+			{
+				std::shared_ptr<i2p::transport::SSU2Session> session;
+				for (const auto& it: server.GetSSU2Sessions ())
+					if (it.second->IsEstablished ()) session = it.second;
+				result.set_value (session);
+			});
+		auto session = result.get_future ().get ();
+		if (session) return session;
+		std::this_thread::sleep_for (std::chrono::milliseconds (50));
+	}
+	return nullptr;
+}
+
+static bool WaitForQueueSize (int size)
+{
+	for (int i = 0; i < 10000 && i2p::tunnel::tunnels.GetQueueSize () < size; i++)
+		std::this_thread::sleep_for (std::chrono::milliseconds (1));
+	return i2p::tunnel::tunnels.GetQueueSize () >= size;
+}
+
+// returns microseconds
+static uint64_t Transfer (std::shared_ptr<i2p::transport::SSU2Session> session, int num, size_t size)
+{
+	auto start = std::chrono::steady_clock::now ();
+	std::vector<uint8_t> buf (size);
+	int sent = 0, received = i2p::tunnel::tunnels.GetQueueSize ();
+	while (sent < num)
+	{
+		std::vector<std::shared_ptr<i2p::I2NPMessage> > msgs;
+		for (int i = 0; i < CHUNK_SIZE && sent < num; i++, sent++)
+		{
+			htobe32buf (buf.data (), sent); // tunnelID
+			msgs.push_back (i2p::CreateI2NPMessage (size > i2p::tunnel::TUNNEL_DATA_MSG_SIZE ? i2p::eI2NPTunnelGateway : i2p::eI2NPTunnelData,
+				buf.data (), buf.size ()));
+		}
+		// keep two chunks in flight at most
+		if (sent > 2*CHUNK_SIZE) assert (WaitForQueueSize (received + sent - 2*CHUNK_SIZE));
+		session->SendI2NPMessages (msgs);
+	}
+	assert (WaitForQueueSize (received + num));
+	auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now () - start).count ();
+	std::this_thread::sleep_for (std::chrono::milliseconds (100));
+	assert (i2p::tunnel::tunnels.GetQueueSize () == received + num); // no duplicates
+	return elapsed ? elapsed : 1;
+}
+
+int main ()
+{
+	TestRouter router ("test-ssu2", { "--ssu2.enabled=true", "--ntcp2.enabled=false", "--host=127.0.0.1" });
+	i2p::transport::transports.Start (false, false, false); // for X25519 keys and PeerConnected
+
+	// two servers of the same router, A connects to B
+	uint16_t portA = 20000 + getpid () % 20000, portB = portA + 1;
+	i2p::config::SetOption ("ssu2.port", portA);
+	i2p::transport::SSU2Server serverA;
+	serverA.Start ();
+	i2p::config::SetOption ("ssu2.port", portB);
+	i2p::transport::SSU2Server serverB;
+	serverB.Start ();
+	auto start = std::chrono::steady_clock::now ();
+	assert (serverA.CreateSession (i2p::context.GetSharedRouterInfo (), CreateAddress (portB)));
+	auto sessionA = GetEstablishedSession (serverA), sessionB = GetEstablishedSession (serverB);
+	assert (sessionA && sessionB);
+	std::cout << "established in " << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now () - start).count ()
+		<< " ms" << std::endl;
+
+	for (auto session: { sessionA, sessionB })
+	{
+		// single packet and fragmented messages
+		auto elapsed = Transfer (session, NUM_MESSAGES, i2p::tunnel::TUNNEL_DATA_MSG_SIZE);
+		std::cout << (session == sessionA ? "A to B" : "B to A") << ": " << NUM_MESSAGES << " tunnel data messages, "
+			<< (uint64_t)NUM_MESSAGES*i2p::tunnel::TUNNEL_DATA_MSG_SIZE/elapsed << " MB/s, " << (uint64_t)NUM_MESSAGES*1000000/elapsed << " messages/sec, "
+			<< "RTT " << session->GetRTT () << " ms, RTO " << session->GetRTO () << " ms, window " << session->GetWindowSize () << std::endl;
+		elapsed = Transfer (session, NUM_LARGE_MESSAGES, LARGE_MESSAGE_SIZE);
+		std::cout << (session == sessionA ? "A to B" : "B to A") << ": " << NUM_LARGE_MESSAGES << " fragmented messages, "
+			<< (uint64_t)NUM_LARGE_MESSAGES*LARGE_MESSAGE_SIZE/elapsed << " MB/s" << std::endl;
+	}
+
+	// C connects to D through proxy, corrupted copy of SessionConfirmed comes first
+	uint16_t portC = portA + 2, portD = portA + 3, portProxy = portA + 4;
+	i2p::config::SetOption ("ssu2.port", portC);
+	i2p::transport::SSU2Server serverC;
+	serverC.Start ();
+	i2p::config::SetOption ("ssu2.port", portD);
+	i2p::transport::SSU2Server serverD;
+	serverD.Start ();
+	Proxy proxy (portProxy, portD);
+	bool isCorrupted = false;
+	proxy.SetFilter ([isCorrupted](bool toB, int num, size_t len) mutable
+		{
+			if (!toB || len < 200 || isCorrupted) return Proxy::ePass; // SessionRequest is shorter
+			isCorrupted = true;
+			return Proxy::eCorrupt;
+		});
+	assert (serverC.CreateSession (i2p::context.GetSharedRouterInfo (), CreateAddress (portProxy)));
+	auto sessionC = GetEstablishedSession (serverC), sessionD = GetEstablishedSession (serverD);
+	assert (sessionC && sessionD);
+	proxy.SetFilter (nullptr);
+	Transfer (sessionC, NUM_LOSSY_MESSAGES, i2p::tunnel::TUNNEL_DATA_MSG_SIZE); // RTT and window
+	// single lost packet is resent after later packets are acked, before RTO
+	int rto = sessionC->GetRTO ();
+	proxy.SetFilter ([](bool toB, int num, size_t len) { return toB && num == 5 ? Proxy::eDrop : Proxy::ePass; });
+	auto elapsed = Transfer (sessionC, NUM_LOSSY_MESSAGES, i2p::tunnel::TUNNEL_DATA_MSG_SIZE);
+	std::cout << "single loss: recovered in " << elapsed/1000 << " ms, RTO " << rto << " ms" << std::endl;
+	assert (elapsed < (uint64_t)rto*1000);
+	// several holes, packets between them are acked by ranges and not resent
+	proxy.SetFilter ([](bool toB, int num, size_t len)
+		{
+			return toB && num % HOLES_INTERVAL == 1 && num < HOLES_INTERVAL*NUM_HOLES ? Proxy::eDrop : Proxy::ePass;
+		});
+	elapsed = Transfer (sessionC, NUM_LOSSY_MESSAGES, i2p::tunnel::TUNNEL_DATA_MSG_SIZE);
+	std::cout << "holes: " << NUM_HOLES << " lost, " << proxy.GetNumToB () << " packets sent for " << NUM_LOSSY_MESSAGES
+		<< " messages, recovered in " << elapsed/1000 << " ms" << std::endl;
+	assert (proxy.GetNumToB () <= NUM_LOSSY_MESSAGES + 2*NUM_HOLES);
+	// random losses in both directions
+	std::mt19937 rng (getpid ());
+	proxy.SetFilter ([rng](bool toB, int num, size_t len) mutable
+		{
+			return std::uniform_real_distribution<double>(0, 1)(rng) < LOSS_RATE ? Proxy::eDrop : Proxy::ePass;
+		});
+	elapsed = Transfer (sessionC, NUM_MESSAGES/5, i2p::tunnel::TUNNEL_DATA_MSG_SIZE);
+	std::cout << "random loss: " << NUM_MESSAGES/5 << " tunnel data messages, " << (uint64_t)NUM_MESSAGES/5*1000000/elapsed << " messages/sec, "
+		<< "window " << sessionC->GetWindowSize () << std::endl;
+	Transfer (sessionC, NUM_LARGE_MESSAGES/4, LARGE_MESSAGE_SIZE);
+	Transfer (sessionD, NUM_MESSAGES/5, i2p::tunnel::TUNNEL_DATA_MSG_SIZE);
+	proxy.SetFilter (nullptr);
+
+	serverA.Stop ();
+	serverB.Stop ();
+	serverC.Stop ();
+	serverD.Stop ();
+	i2p::transport::transports.Stop ();
+}
@@ -0,0 +1,286 @@
+#include <cassert>
+#include <inttypes.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <atomic>
+#include <random>
+#include <future>
+#include <chrono>
+#include <thread>
+#include <iostream>
+#include <iomanip>
+#include <unistd.h>
+
+#include "Timestamp.h"
+#include "Transports.h"
+#include "Tunnel.h"
+#include "I2NPProtocol.h"
+#include "Destination.h"
+#include "TestUtils.h"
+
+// usage: test-streaming-cc
+// bulk transfer through a stream between two local destinations with zero hops tunnels.
+// Destinations pass every streaming message through tunnel-like path with latency, jitter,
+// limited bandwidth and random loss. Compares goodput, RTT and queue overflows of congestion control algorithms
+
+struct Link
+{
+	const char * name;
+	int delay, jitter; // one way, in milliseconds
+	uint64_t bandwidth; // bytes per second
+	size_t queueSize; // bytes at bottleneck
+	double loss;
+};
+
+const Link LINKS[] =
+{
+	{ "fast tunnels", 100, 20, 500000, 100000, 0 },
+	{ "typical tunnels", 250, 50, 200000, 100000, 0.005 },
+	{ "slow lossy tunnels", 500, 100, 50000, 50000, 0.02 }
+};
+
+const int DURATION = 20; // in seconds
+const size_t CHUNK_SIZE = 65536;
+const int NUM_CHUNKS = 4; // queued at once
+const uint8_t PATTERN_LENGTH = 251; // prime, byte n is n % 251
+
+class PathDestination: public i2p::client::RunnableClientDestination
+{
+	public:
+
+		PathDestination (const i2p::data::PrivateKeys& keys, const std::map<std::string, std::string>& params, const Link& link):
+			RunnableClientDestination (keys, true, &params), m_Link (link), m_Random (getpid ()), m_LinkFree (0),
+			m_NumMessages (0), m_NumOverflows (0)
+		{
+		}
+
+		uint64_t GetNumMessages () const { return m_NumMessages; }
+		uint64_t GetNumOverflows () const { return m_NumOverflows; } // dropped by full queue
+
+		void AddRemoteLeaseSet (std::shared_ptr<const i2p::data::LocalLeaseSet> leaseSet)
+		{
+			// as DatabaseStore reply to lookup
+			auto msg = i2p::CreateDatabaseStoreMsg (leaseSet);
+			auto s = std::static_pointer_cast<PathDestination>(shared_from_this ());
+			GetService ().post ([s, msg]() { s->HandleI2NPMessage (msg->GetBuffer (), msg->GetLength ()); });
+		}
+
+	protected:
+
+		// drop-tail queue at bottleneck, then latency with jitter
+		void HandleDataMessage (const uint8_t * buf, size_t len)
+		{
+			auto ts = i2p::util::GetMonotonicMicroseconds ();
+			uint64_t start = std::max (ts, m_LinkFree);
+			m_NumMessages++;
+			if ((start - ts)*m_Link.bandwidth/1000000 + len > m_Link.queueSize)
+			{
+				m_NumOverflows++; // queue is full
+				return;
+			}
+			m_LinkFree = start + len*1000000/m_Link.bandwidth;
+			if (std::uniform_real_distribution<double>(0, 1)(m_Random) < m_Link.loss) return; // lost
+			uint64_t delay = m_LinkFree - ts + (m_Link.delay + std::uniform_int_distribution<int>(0, m_Link.jitter)(m_Random))*1000;
+			auto msg = std::make_shared<std::vector<uint8_t> > (buf, buf + len);
+			auto timer = std::make_shared<boost::asio::deadline_timer> (GetService ());
+			timer->expires_from_now (boost::posix_time::microseconds (delay));
+			auto s = std::static_pointer_cast<PathDestination>(shared_from_this ());
+			timer->async_wait ([s, msg, timer](const boost::system::error_code& ecode)
+				{
+					if (ecode != boost::asio::error::operation_aborted)
+						s->ClientDestination::HandleDataMessage (msg->data (), msg->size ());
+				});
+		}
+
+	private:
+
+		Link m_Link;
+		std::mt19937 m_Random;
+		uint64_t m_LinkFree; // in microseconds
+		std::atomic<uint64_t> m_NumMessages, m_NumOverflows;
+};
+
+static std::shared_ptr<PathDestination> CreateDestination (const Link& link, const std::string& congestionControl)
+{
+	auto keys = i2p::data::PrivateKeys::CreateRandomKeys (i2p::data::SIGNING_KEY_TYPE_EDDSA_SHA512_ED25519,
+		i2p::data::CRYPTO_KEY_TYPE_ECIES_X25519_AEAD);
+	std::map<std::string, std::string> params
+	{
+		{ i2p::client::I2CP_PARAM_INBOUND_TUNNEL_LENGTH, "0" },
+		{ i2p::client::I2CP_PARAM_OUTBOUND_TUNNEL_LENGTH, "0" },
+		{ i2p::client::I2CP_PARAM_INBOUND_TUNNELS_QUANTITY, "1" },
+		{ i2p::client::I2CP_PARAM_OUTBOUND_TUNNELS_QUANTITY, "1" },
+		{ i2p::client::I2CP_PARAM_STREAMING_CONGESTION_CONTROL, congestionControl }
+	};
+	auto dest = std::make_shared<PathDestination> (keys, params, link);
+	dest->Start ();
+	return dest;
+}
+
+// keeps few chunks queued by Stream::AsyncSend
+class Sender: public std::enable_shared_from_this<Sender>
+{
+	public:
+
+		Sender (std::shared_ptr<i2p::stream::Stream> stream, boost::asio::io_service& service):
+			m_Stream (stream), m_Service (service), m_Chunks (NUM_CHUNKS, std::vector<uint8_t>(CHUNK_SIZE)),
+			m_Sent (0), m_IsStopped (false) {}
+
+		void Start ()
+		{
+			auto s = shared_from_this ();
+			m_Service.post ([s]()
+				{
+					for (int i = 0; i < NUM_CHUNKS; i++)
+						s->Send (i);
+				});
+		}
+		void Stop () { m_IsStopped = true; }
+
+	private:
+
+		void Send (int n)
+		{
+			auto& chunk = m_Chunks[n];
+			for (size_t i = 0; i < CHUNK_SIZE; i++)
+				chunk[i] = (m_Sent + i) % PATTERN_LENGTH;
+			m_Sent += CHUNK_SIZE;
+			auto s = shared_from_this ();
+			// handler is called with stream's send buffer locked, handlers are called in order, chunk n is free
+			m_Stream->AsyncSend (chunk.data (), chunk.size (), [s, n](const boost::system::error_code& ecode)
+				{
+					if (!ecode && !s->m_IsStopped)
+						s->m_Service.post ([s, n]() { s->Send (n); });
+				});
+		}
+
+	private:
+
+		std::shared_ptr<i2p::stream::Stream> m_Stream;
+		boost::asio::io_service& m_Service;
+		std::vector<std::vector<uint8_t> > m_Chunks;
+		uint64_t m_Sent;
+		std::atomic<bool> m_IsStopped;
+};
+
+class Receiver: public std::enable_shared_from_this<Receiver>
+{
+	public:
+
+		Receiver (std::shared_ptr<i2p::stream::Stream> stream): m_Stream (stream),
+			m_Received (0), m_IsCorrupted (false) {}
+
+		uint64_t GetReceived () const { return m_Received; }
+		bool IsCorrupted () const { return m_IsCorrupted; }
+
+		void Receive ()
+		{
+			m_Stream->AsyncReceive (boost::asio::buffer (m_Buffer, sizeof (m_Buffer)),
+				std::bind (&Receiver::HandleReceived, shared_from_this (), std::placeholders::_1, std::placeholders::_2), 10);
+		}
+
+	private:
+
+		void HandleReceived (const boost::system::error_code& ecode, std::size_t len)
+		{
+			uint64_t received = m_Received;
+			for (size_t i = 0; i < len; i++)
+				if (m_Buffer[i] != (received + i) % PATTERN_LENGTH) m_IsCorrupted = true;
+			m_Received += len;
+			if (!ecode || ecode == boost::asio::error::timed_out)
+				Receive ();
+		}
+
+	private:
+
+		std::shared_ptr<i2p::stream::Stream> m_Stream;
+		uint8_t m_Buffer[CHUNK_SIZE];
+		std::atomic<uint64_t> m_Received;
+		std::atomic<bool> m_IsCorrupted;
+};
+
+// returns goodput in bytes per second, RTT and percent of data messages dropped by full queue
+static uint64_t Transfer (const Link& link, const std::string& congestionControl, int& rtt, double& overflows)
+{
+	auto client = CreateDestination (link, congestionControl), server = CreateDestination (link, congestionControl);
+	for (int i = 0; i < 600 && !(client->IsReady () && server->IsReady ()); i++)
+		std::this_thread::sleep_for (std::chrono::milliseconds (100));
+	assert (client->IsReady () && server->IsReady ());
+	client->AddRemoteLeaseSet (server->GetLeaseSet ()); // no floodfills to lookup
+	std::shared_ptr<const i2p::data::LeaseSet> remoteLeaseSet;
+	for (int i = 0; i < 100 && !remoteLeaseSet; i++)
+	{
+		std::this_thread::sleep_for (std::chrono::milliseconds (10));
+		remoteLeaseSet = client->FindLeaseSet (server->GetIdentHash ());
+	}
+	assert (remoteLeaseSet);
+
+	std::promise<std::shared_ptr<Receiver> > accepted;
+	server->GetStreamingDestination ()->AcceptOnce ([&accepted](std::shared_ptr<i2p::stream::Stream> stream)
+		{
+			auto receiver = std::make_shared<Receiver> (stream);
+			receiver->Receive ();
+			accepted.set_value (receiver);
+		});
+	auto stream = client->GetStreamingDestination ()->CreateNewOutgoingStream (remoteLeaseSet);
+	auto sender = std::make_shared<Sender> (stream, client->GetService ());
+	sender->Start ();
+
+	// wait for stream to be established and slow start to begin
+	auto acceptedFuture = accepted.get_future ();
+	assert (acceptedFuture.wait_for (std::chrono::seconds (60)) == std::future_status::ready);
+	auto receiver = acceptedFuture.get ();
+	for (int i = 0; i < 600 && !receiver->GetReceived (); i++)
+		std::this_thread::sleep_for (std::chrono::milliseconds (100));
+	assert (receiver->GetReceived () > 0);
+	auto start = receiver->GetReceived ();
+	auto numMessages = server->GetNumMessages (), numOverflows = server->GetNumOverflows ();
+	std::this_thread::sleep_for (std::chrono::seconds (DURATION));
+	auto goodput = (receiver->GetReceived () - start)/DURATION;
+	rtt = stream->GetRTT ();
+	numMessages = server->GetNumMessages () - numMessages;
+	overflows = numMessages ? (server->GetNumOverflows () - numOverflows)*100.0/numMessages : 0;
+
+	sender->Stop ();
+	stream->Close ();
+	assert (!receiver->IsCorrupted ());
+	client->Stop ();
+	server->Stop ();
+	return goodput;
+}
+
+int main ()
+{
+	assert (i2p::stream::GetCongestionControlType ("bbr") == i2p::stream::eCongestionControlBBR);
+	assert (i2p::stream::GetCongestionControlType ("reno") == i2p::stream::eCongestionControlReno);
+	assert (i2p::stream::GetCongestionControlType ("unknown") == i2p::stream::eCongestionControlReno);
+
+	TestRouter router ("test-streaming-cc", { "--ssu2.enabled=false", "--ntcp2.enabled=false", "--host=127.0.0.1" });
+	// messages to ourself go through loopback
+	i2p::transport::transports.Start (false, false, false);
+	i2p::tunnel::tunnels.Start ();
+
+	for (const auto& link: LINKS)
+	{
+		std::cout << link.name << ": RTT " << 2*link.delay << " ms, " << link.bandwidth/1000 << " KB/s, loss "
+			<< link.loss*100 << "%" << std::endl;
+		uint64_t goodput[2];
+		for (auto type: { i2p::stream::eCongestionControlReno, i2p::stream::eCongestionControlBBR })
+		{
+			auto congestionControl = (type == i2p::stream::eCongestionControlBBR) ? "bbr" : "reno";
+			int rtt = 0;
+			double overflows = 0;
+			goodput[type] = Transfer (link, congestionControl, rtt, overflows);
+			assert (goodput[type] > 0 && goodput[type] <= link.bandwidth);
+			std::cout << "  " << std::setw (4) << congestionControl << ": " << goodput[type]/1000 << " KB/s, "
+				<< goodput[type]*100/link.bandwidth << "% of bandwidth, RTT " << rtt << " ms, "
+				<< std::setprecision (2) << overflows << "% dropped by full queue" << std::endl;
+		}
+	}
+
+	i2p::tunnel::tunnels.Stop ();
+	i2p::transport::transports.Stop ();
+}
@@ -0,0 +1,227 @@
+#include <cassert>
+#include <inttypes.h>
+#include <string.h>
+#include <string>
+#include <map>
+#include <memory>
+#include <atomic>
+#include <random>
+#include <chrono>
+#include <thread>
+#include <iostream>
+#include <iomanip>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "Transports.h"
+#include "Tunnel.h"
+#include "I2NPProtocol.h"
+#include "Destination.h"
+#include "I2PTunnel.h"
+#include "TestUtils.h"
+
+// usage: test-streaming-loss
+// bulk transfer from TCP socket to TCP socket through client and server tunnels (I2PTunnelConnection)
+// of two local destinations with zero hops tunnels. Destinations delay every streaming message
+// and drop it at random to emulate tunnels. Checks received data and reports goodput per loss rate
+// and congestion control
+
+const int DELAY = 100; // one way, in milliseconds
+const double LOSSES[] = { 0, 0.01, 0.03 };
+const int DURATION = 15; // in seconds
+const uint8_t PATTERN_LENGTH = 251; // prime, byte n is n % 251
+
+class LossyDestination: public i2p::client::RunnableClientDestination
+{
+	public:
+
+		LossyDestination (const i2p::data::PrivateKeys& keys, const std::map<std::string, std::string>& params):
+			RunnableClientDestination (keys, true, &params), m_Random (getpid ()), m_Delay (0), m_Loss (0)
+		{
+		}
+
+		void SetPath (int delay, double loss)
+		{
+			m_Delay = delay;
+			m_Loss = loss*1000000;
+		}
+
+		void AddRemoteLeaseSet (std::shared_ptr<const i2p::data::LocalLeaseSet> leaseSet)
+		{
+			// as DatabaseStore reply to lookup
+			auto msg = i2p::CreateDatabaseStoreMsg (leaseSet);
+			auto s = std::static_pointer_cast<LossyDestination>(shared_from_this ());
+			GetService ().post ([s, msg]() { s->HandleI2NPMessage (msg->GetBuffer (), msg->GetLength ()); });
+		}
+
+	protected:
+
+		void HandleDataMessage (const uint8_t * buf, size_t len)
+		{
+			if (std::uniform_int_distribution<int>(0, 999999)(m_Random) < m_Loss) return; // lost
+			auto msg = std::make_shared<std::vector<uint8_t> > (buf, buf + len);
+			auto timer = std::make_shared<boost::asio::deadline_timer> (GetService ());
+			timer->expires_from_now (boost::posix_time::milliseconds (m_Delay.load ()));
+			auto s = std::static_pointer_cast<LossyDestination>(shared_from_this ());
+			timer->async_wait ([s, msg, timer](const boost::system::error_code& ecode)
+				{
+					if (ecode != boost::asio::error::operation_aborted)
+						s->ClientDestination::HandleDataMessage (msg->data (), msg->size ());
+				});
+		}
+
+	private:
+
+		std::mt19937 m_Random;
+		std::atomic<int> m_Delay, m_Loss; // loss in millionths
+};
+
+static std::shared_ptr<LossyDestination> CreateDestination (const std::string& congestionControl)
+{
+	auto keys = i2p::data::PrivateKeys::CreateRandomKeys (i2p::data::SIGNING_KEY_TYPE_EDDSA_SHA512_ED25519,
+		i2p::data::CRYPTO_KEY_TYPE_ECIES_X25519_AEAD);
+	std::map<std::string, std::string> params
+	{
+		{ i2p::client::I2CP_PARAM_INBOUND_TUNNEL_LENGTH, "0" },
+		{ i2p::client::I2CP_PARAM_OUTBOUND_TUNNEL_LENGTH, "0" },
+		{ i2p::client::I2CP_PARAM_INBOUND_TUNNELS_QUANTITY, "1" },
+		{ i2p::client::I2CP_PARAM_OUTBOUND_TUNNELS_QUANTITY, "1" },
+		{ i2p::client::I2CP_PARAM_STREAMING_CONGESTION_CONTROL, congestionControl }
+	};
+	auto dest = std::make_shared<LossyDestination> (keys, params);
+	dest->Start ();
+	return dest;
+}
+
+static int Listen (uint16_t port)
+{
+	int s = socket (AF_INET, SOCK_STREAM, 0);
+	int on = 1;
+	setsockopt (s, SOL_SOCKET, SO_REUSEADDR, &on, sizeof (on));
+	sockaddr_in addr;
+	memset (&addr, 0, sizeof (addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+	addr.sin_port = htons (port);
+	assert (!bind (s, (sockaddr *)&addr, sizeof (addr)));
+	assert (!listen (s, 1));
+	return s;
+}
+
+static int Connect (uint16_t port)
+{
+	int s = socket (AF_INET, SOCK_STREAM, 0);
+	sockaddr_in addr;
+	memset (&addr, 0, sizeof (addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+	addr.sin_port = htons (port);
+	assert (!connect (s, (sockaddr *)&addr, sizeof (addr)));
+	return s;
+}
+
+// returns goodput in bytes per second
+static uint64_t Transfer (int listener, uint16_t port, std::shared_ptr<LossyDestination> client,
+	std::shared_ptr<LossyDestination> server, double loss)
+{
+	client->SetPath (DELAY, 0);
+	server->SetPath (DELAY, 0);
+	std::atomic<uint64_t> received (0);
+	std::atomic<bool> isCorrupted (false);
+	int source = Connect (port);
+	std::thread sender ([source]()
+		{
+			uint8_t buf[65536];
+			uint64_t sent = 0;
+			for (;;)
+			{
+				for (size_t i = 0; i < sizeof (buf); i++)
+					buf[i] = (sent + i) % PATTERN_LENGTH;
+				auto len = send (source, buf, sizeof (buf), MSG_NOSIGNAL);
+				if (len <= 0) break;
+				sent += len;
+				if (len < (ssize_t)sizeof (buf)) break;
+			}
+		});
+	int sink = accept (listener, nullptr, nullptr);
+	assert (sink >= 0);
+	std::thread receiver ([sink, &received, &isCorrupted]()
+		{
+			uint8_t buf[65536];
+			for (;;)
+			{
+				auto len = recv (sink, buf, sizeof (buf), 0);
+				if (len <= 0) break;
+				for (ssize_t i = 0; i < len; i++)
+					if (buf[i] != (received + i) % PATTERN_LENGTH) isCorrupted = true;
+				received += len;
+			}
+		});
+
+	// wait for stream to be established before loss
+	for (int i = 0; i < 600 && !received; i++)
+		std::this_thread::sleep_for (std::chrono::milliseconds (100));
+	assert (received > 0);
+	client->SetPath (DELAY, loss);
+	server->SetPath (DELAY, loss);
+	auto start = received.load ();
+	std::this_thread::sleep_for (std::chrono::seconds (DURATION));
+	auto goodput = (received - start)/DURATION;
+
+	shutdown (source, SHUT_RDWR);
+	shutdown (sink, SHUT_RDWR);
+	sender.join ();
+	receiver.join ();
+	close (source);
+	close (sink);
+	assert (!isCorrupted);
+	return goodput;
+}
+
+int main ()
+{
+	TestRouter router ("test-streaming-loss", { "--ssu2.enabled=false", "--ntcp2.enabled=false", "--host=127.0.0.1" });
+	// messages to ourself go through loopback
+	i2p::transport::transports.Start (false, false, false);
+	i2p::tunnel::tunnels.Start ();
+
+	uint16_t port = 20000 + getpid () % 20000;
+	std::cout << "RTT " << 2*DELAY << " ms, " << DURATION << " seconds" << std::endl;
+	for (auto congestionControl: { "reno", "bbr" })
+	{
+		auto client = CreateDestination (congestionControl), server = CreateDestination (congestionControl);
+		for (int i = 0; i < 600 && !(client->IsReady () && server->IsReady ()); i++)
+			std::this_thread::sleep_for (std::chrono::milliseconds (100));
+		assert (client->IsReady () && server->IsReady ());
+		client->AddRemoteLeaseSet (server->GetLeaseSet ()); // no floodfills to lookup
+
+		uint16_t clientPort = port++, serverPort = port++;
+		int listener = Listen (serverPort);
+		auto serverTunnel = std::make_shared<i2p::client::I2PServerTunnel> ("server", "127.0.0.1", serverPort, server);
+		serverTunnel->SetUniqueLocal (false);
+		serverTunnel->Start ();
+		auto clientTunnel = std::make_shared<i2p::client::I2PClientTunnel> ("client",
+			server->GetIdentHash ().ToBase32 () + ".b32.i2p", "127.0.0.1", clientPort, client, serverPort);
+		clientTunnel->Start ();
+
+		for (auto loss: LOSSES)
+		{
+			auto goodput = Transfer (listener, clientPort, client, server, loss);
+			std::cout << std::setw (4) << congestionControl << ", loss " << std::setw (2) << loss*100 << "%: "
+				<< goodput/1000 << " KB/s" << std::endl;
+			assert (goodput > 0);
+		}
+		client->SetPath (0, 0);
+		server->SetPath (0, 0);
+
+		close (listener);
+		clientTunnel->Stop ();
+		serverTunnel->Stop ();
+		client->Stop ();
+		server->Stop ();
+	}
+	i2p::tunnel::tunnels.Stop ();
+	i2p::transport::transports.Stop ();
+}
@@ -0,0 +1,223 @@
+#include <cassert>
+#include <inttypes.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <chrono>
+#include <thread>
+#include <iostream>
+#include <unistd.h>
+
+#include "Transports.h"
+#include "Tunnel.h"
+#include "I2NPProtocol.h"
+#include "Destination.h"
+#include "TestUtils.h"
+
+// usage: test-streaming-throughput
+// bulk transfer through a stream between two local destinations with zero hops tunnels,
+// sender keeps few chunks queued by Stream::AsyncSend, receiver checks data.
+// Reports throughput for uncompressed and gzip streaming destinations
+
+const int DURATION = 5; // in seconds
+const size_t CHUNK_SIZE = 65536;
+const int NUM_CHUNKS = 4; // queued at once
+const uint8_t PATTERN_LENGTH = 251; // prime, byte n is n % 251
+
+class LoopbackDestination: public i2p::client::RunnableClientDestination
+{
+	public:
+
+		LoopbackDestination (const i2p::data::PrivateKeys& keys, const std::map<std::string, std::string>& params):
+			RunnableClientDestination (keys, true, &params)
+		{
+		}
+
+		void AddRemoteLeaseSet (std::shared_ptr<const i2p::data::LocalLeaseSet> leaseSet)
+		{
+			// as DatabaseStore reply to lookup
+			auto msg = i2p::CreateDatabaseStoreMsg (leaseSet);
+			auto s = std::static_pointer_cast<LoopbackDestination>(shared_from_this ());
+			GetService ().post ([s, msg]() { s->HandleI2NPMessage (msg->GetBuffer (), msg->GetLength ()); });
+		}
+};
+
+static std::shared_ptr<LoopbackDestination> CreateDestination ()
+{
+	auto keys = i2p::data::PrivateKeys::CreateRandomKeys (i2p::data::SIGNING_KEY_TYPE_EDDSA_SHA512_ED25519,
+		i2p::data::CRYPTO_KEY_TYPE_ECIES_X25519_AEAD);
+	std::map<std::string, std::string> params
+	{
+		{ i2p::client::I2CP_PARAM_INBOUND_TUNNEL_LENGTH, "0" },
+		{ i2p::client::I2CP_PARAM_OUTBOUND_TUNNEL_LENGTH, "0" },
+		{ i2p::client::I2CP_PARAM_INBOUND_TUNNELS_QUANTITY, "1" },
+		{ i2p::client::I2CP_PARAM_OUTBOUND_TUNNELS_QUANTITY, "1" }
+	};
+	auto dest = std::make_shared<LoopbackDestination> (keys, params);
+	dest->Start ();
+	return dest;
+}
+
+class Receiver: public std::enable_shared_from_this<Receiver>
+{
+	public:
+
+		Receiver (std::shared_ptr<i2p::stream::Stream> stream): m_Stream (stream),
+			m_Received (0), m_IsCorrupted (false), m_IsClosed (false) {}
+
+		uint64_t GetReceived () const { return m_Received; }
+		bool IsCorrupted () const { return m_IsCorrupted; }
+		bool IsClosed () const { return m_IsClosed; }
+
+		void Receive ()
+		{
+			m_Stream->AsyncReceive (boost::asio::buffer (m_Buffer, sizeof (m_Buffer)),
+				std::bind (&Receiver::HandleReceived, shared_from_this (), std::placeholders::_1, std::placeholders::_2), 10);
+		}
+
+	private:
+
+		void HandleReceived (const boost::system::error_code& ecode, std::size_t len)
+		{
+			uint64_t received = m_Received;
+			for (size_t i = 0; i < len; i++)
+				if (m_Buffer[i] != (received + i) % PATTERN_LENGTH) m_IsCorrupted = true;
+			m_Received += len;
+			if (!ecode || ecode == boost::asio::error::timed_out)
+				Receive ();
+			else
+				m_IsClosed = true;
+		}
+
+	private:
+
+		std::shared_ptr<i2p::stream::Stream> m_Stream;
+		uint8_t m_Buffer[CHUNK_SIZE];
+		std::atomic<uint64_t> m_Received;
+		std::atomic<bool> m_IsCorrupted, m_IsClosed;
+};
+
+// returns bytes per second
+static uint64_t Transfer (std::shared_ptr<i2p::stream::StreamingDestination> local,
+	std::shared_ptr<LoopbackDestination> remote, std::shared_ptr<const i2p::data::LeaseSet> remoteLeaseSet)
+{
+	std::promise<std::shared_ptr<Receiver> > accepted;
+	auto acceptedFuture = accepted.get_future ();
+	remote->GetStreamingDestination ()->AcceptOnce ([&accepted](std::shared_ptr<i2p::stream::Stream> stream)
+		{
+			auto receiver = std::make_shared<Receiver> (stream);
+			receiver->Receive ();
+			accepted.set_value (receiver);
+		});
+	auto stream = local->CreateNewOutgoingStream (remoteLeaseSet);
+
+	// chunks are referenced by stream until handler is called
+	std::vector<std::vector<uint8_t> > chunks (NUM_CHUNKS, std::vector<uint8_t>(CHUNK_SIZE));
+	std::mutex mutex;
+	std::condition_variable completed;
+	int numQueued = 0;
+	bool isFailed = false;
+	uint64_t sent = 0;
+	auto Send = [&](int n)
+		{
+			auto& chunk = chunks[n];
+			for (size_t i = 0; i < CHUNK_SIZE; i++)
+				chunk[i] = (sent + i) % PATTERN_LENGTH;
+			sent += CHUNK_SIZE;
+			// handler is called with stream's send buffer locked, don't hold our lock while sending
+			stream->AsyncSend (chunk.data (), chunk.size (), [&](const boost::system::error_code& ecode)
+				{
+					std::unique_lock<std::mutex> l(mutex);
+					if (ecode) isFailed = true;
+					numQueued--;
+					completed.notify_one ();
+				});
+		};
+
+	std::shared_ptr<Receiver> receiver;
+	uint64_t start = 0;
+	auto startTime = std::chrono::steady_clock::now ();
+	auto endTime = startTime + std::chrono::seconds (60); // for connection establishment
+	for (int n = 0; std::chrono::steady_clock::now () < endTime; n = (n + 1) % NUM_CHUNKS)
+	{
+		std::unique_lock<std::mutex> l(mutex);
+		while (numQueued >= NUM_CHUNKS && !isFailed)
+			completed.wait (l);
+		assert (!isFailed);
+		numQueued++;
+		l.unlock ();
+		Send (n); // handlers are called in order, n is free
+		if (!receiver && acceptedFuture.wait_for (std::chrono::seconds (0)) == std::future_status::ready)
+		{
+			receiver = acceptedFuture.get ();
+			start = receiver->GetReceived ();
+			startTime = std::chrono::steady_clock::now ();
+			endTime = startTime + std::chrono::seconds (DURATION);
+		}
+	}
+	assert (receiver);
+	auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now () - startTime).count ();
+	auto throughput = (receiver->GetReceived () - start)*1000000/elapsed;
+
+	// receive the rest
+	{
+		std::unique_lock<std::mutex> l(mutex);
+		while (numQueued > 0 && !isFailed)
+			completed.wait (l);
+	}
+	for (int i = 0; i < 600 && receiver->GetReceived () < sent; i++)
+		std::this_thread::sleep_for (std::chrono::milliseconds (10));
+	assert (receiver->GetReceived () == sent);
+	assert (!receiver->IsCorrupted ());
+	stream->AsyncClose ();
+	for (int i = 0; i < 600 && !receiver->IsClosed (); i++)
+		std::this_thread::sleep_for (std::chrono::milliseconds (10));
+	return throughput;
+}
+
+int main ()
+{
+	TestRouter router ("test-streaming-throughput", { "--ssu2.enabled=false", "--ntcp2.enabled=false", "--host=127.0.0.1" });
+	// messages to ourself go through loopback
+	i2p::transport::transports.Start (false, false, false);
+	i2p::tunnel::tunnels.Start ();
+
+	auto client = CreateDestination (), server = CreateDestination ();
+	for (int i = 0; i < 600 && !(client->IsReady () && server->IsReady ()); i++)
+		std::this_thread::sleep_for (std::chrono::milliseconds (100));
+	assert (client->IsReady () && server->IsReady ());
+	client->AddRemoteLeaseSet (server->GetLeaseSet ()); // no floodfills to lookup
+	std::shared_ptr<const i2p::data::LeaseSet> remoteLeaseSet;
+	for (int i = 0; i < 100 && !remoteLeaseSet; i++)
+	{
+		std::this_thread::sleep_for (std::chrono::milliseconds (10));
+		remoteLeaseSet = client->FindLeaseSet (server->GetIdentHash ());
+	}
+	assert (remoteLeaseSet);
+
+	auto throughput = Transfer (client->GetStreamingDestination (), server, remoteLeaseSet);
+	std::cout << "uncompressed: " << throughput/1000000.0 << " MB/s" << std::endl;
+	assert (throughput > 0);
+	// replace default streaming destination, replies don't come to other ports
+	std::promise<std::shared_ptr<i2p::stream::StreamingDestination> > gzip;
+	client->GetService ().post ([client, &gzip]()
+		{
+			auto dest = client->CreateStreamingDestination (0, true);
+			dest->Start ();
+			gzip.set_value (dest);
+		});
+	throughput = Transfer (gzip.get_future ().get (), server, remoteLeaseSet);
+	std::cout << "gzip: " << throughput/1000000.0 << " MB/s" << std::endl;
+	assert (throughput > 0);
+
+	client->Stop ();
+	server->Stop ();
+	i2p::tunnel::tunnels.Stop ();
+	i2p::transport::transports.Stop ();
+}
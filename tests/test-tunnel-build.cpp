@@ -0,0 +1,170 @@
+#include <cassert>
+#include <inttypes.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <thread>
+#include <iostream>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "Crypto.h"
+#include "RouterContext.h"
+#include "Transports.h"
+#include "Tunnel.h"
+#include "TunnelConfig.h"
+#include "I2NPProtocol.h"
+#include "TestUtils.h"
+
+// usage: test-tunnel-build
+// sends ShortTunnelBuild requests with a record for our router to tunnels, handled by tunnels thread
+// or by build workers, decrypts replies and checks counters. Floods build workers to check that requests
+// above admission queue are rejected with code 30 and dropped above twice of it.
+// Reports requests per second and time of build request stages
+
+const int NUM_RECORDS = 4;
+const int NUM_REQUESTS = 1000;
+const int NUM_FLOOD_REQUESTS = 1500;
+const int BATCH_SIZE = 32;
+const int MAX_NUM_BUILD_REQUESTS = 64; // admission queue
+
+struct BuildRequest
+{
+	std::shared_ptr<i2p::I2NPMessage> msg;
+	std::unique_ptr<i2p::tunnel::ShortECIESTunnelHopConfig> hop;
+};
+
+static BuildRequest CreateBuildRequest (int n)
+{
+	BuildRequest request;
+	request.hop.reset (new i2p::tunnel::ShortECIESTunnelHopConfig (i2p::context.GetIdentity ()));
+	i2p::data::IdentHash nextIdent;
+	i2p::crypto::RandBytes (nextIdent, 32);
+	request.hop->SetNextIdent (nextIdent);
+	request.hop->isGateway = false; // participant
+	request.hop->recordIndex = n % NUM_RECORDS;
+	auto msg = i2p::NewI2NPShortMessage ();
+	uint8_t * payload = msg->GetPayload ();
+	payload[0] = NUM_RECORDS;
+	i2p::crypto::RandBytes (payload + 1, NUM_RECORDS*i2p::SHORT_TUNNEL_BUILD_RECORD_SIZE); // other hops
+	request.hop->CreateBuildRequestRecord (payload + 1, i2p::crypto::RandUInt32 ());
+	msg->len += 1 + NUM_RECORDS*i2p::SHORT_TUNNEL_BUILD_RECORD_SIZE;
+	msg->FillI2NPMessageHeader (i2p::eI2NPShortTunnelBuild, i2p::crypto::RandUInt32 ()); // not a pending tunnel
+	request.msg = msg;
+	return request;
+}
+
+static uint64_t GetNumHandled ()
+{
+	auto stats = i2p::tunnel::tunnels.GetTunnelBuildStats ();
+	return stats.numAccepted + stats.numRejected + stats.numDropped;
+}
+
+static bool WaitForHandled (uint64_t num)
+{
+	for (int i = 0; i < 30000 && GetNumHandled () < num; i++)
+		std::this_thread::sleep_for (std::chrono::milliseconds (1));
+	return GetNumHandled () >= num;
+}
+
+// returns number of replies with code 30, -1 if reply is wrong
+static int CheckReplies (std::vector<BuildRequest>& requests)
+{
+	std::this_thread::sleep_for (std::chrono::milliseconds (50)); // reply is encrypted after result
+	int numRejected = 0;
+	for (auto& it: requests)
+	{
+		uint8_t * records = it.msg->GetPayload () + 1;
+		if (!it.hop->DecryptBuildResponseRecord (records)) continue; // dropped
+		auto retCode = it.hop->GetRetCode (records);
+		if (retCode == 30)
+			numRejected++;
+		else if (retCode)
+			return -1;
+	}
+	return numRejected;
+}
+
+static void RunRequests (int numBuildThreads)
+{
+	std::cout << numBuildThreads << " build thread(s):" << std::endl;
+	// paced, admission queue is never full
+	std::vector<BuildRequest> requests;
+	for (int i = 0; i < NUM_REQUESTS; i++)
+		requests.push_back (CreateBuildRequest (i));
+	auto start = std::chrono::steady_clock::now ();
+	for (int i = 0; i < NUM_REQUESTS; i += BATCH_SIZE)
+	{
+		for (int j = i; j < i + BATCH_SIZE && j < NUM_REQUESTS; j++)
+			i2p::tunnel::tunnels.PostTunnelData (requests[j].msg);
+		assert (WaitForHandled (std::min (i + BATCH_SIZE, NUM_REQUESTS)));
+	}
+	auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now () - start).count ();
+	auto stats = i2p::tunnel::tunnels.GetTunnelBuildStats ();
+	assert (stats.numRequests == NUM_REQUESTS);
+	assert (stats.numAccepted == NUM_REQUESTS);
+	assert (!stats.numRejected && !stats.numQueueRejected && !stats.numDropped);
+	assert (!CheckReplies (requests));
+	assert (i2p::tunnel::tunnels.CountTransitTunnels () == NUM_REQUESTS);
+	std::cout << "  " << (uint64_t)NUM_REQUESTS*1000000/(elapsed ? elapsed : 1) << " requests/s, per request:";
+	const char * stages[] = { "queue", "decrypt", "accept", "reply" };
+	for (int i = 0; i < i2p::tunnel::eNumTunnelBuildStages; i++)
+		std::cout << " " << stages[i] << " " << stats.stageTimes[i]/NUM_REQUESTS << "us";
+	std::cout << std::endl;
+	if (!numBuildThreads) return;
+
+	// flood, posted at once
+	requests.clear ();
+	for (int i = 0; i < NUM_FLOOD_REQUESTS; i++)
+		requests.push_back (CreateBuildRequest (i));
+	std::vector<std::shared_ptr<i2p::I2NPMessage> > msgs;
+	for (auto& it: requests)
+		msgs.push_back (it.msg);
+	auto numHandled = GetNumHandled ();
+	i2p::tunnel::tunnels.PostTunnelData (msgs);
+	assert (WaitForHandled (numHandled + NUM_FLOOD_REQUESTS));
+	auto floodStats = i2p::tunnel::tunnels.GetTunnelBuildStats ();
+	auto numAccepted = floodStats.numAccepted - stats.numAccepted;
+	std::cout << "  flood of " << NUM_FLOOD_REQUESTS << ": accepted " << numAccepted << ", rejected " << floodStats.numRejected
+		<< ", queue full " << floodStats.numQueueRejected << ", dropped " << floodStats.numDropped << std::endl;
+	assert (floodStats.numQueueRejected > 0 && floodStats.numDropped > 0);
+	assert (floodStats.numRejected == floodStats.numQueueRejected);
+	assert (numAccepted + floodStats.numRejected + floodStats.numDropped == NUM_FLOOD_REQUESTS);
+	assert (floodStats.numQueueRejected <= MAX_NUM_BUILD_REQUESTS + numAccepted); // queue was drained meanwhile
+	assert (CheckReplies (requests) == (int)floodStats.numRejected);
+	assert (!i2p::tunnel::tunnels.GetBuildQueueSize ());
+}
+
+static void RunRequestsInProcess (int numBuildThreads) // tunnels and counters start from scratch
+{
+	std::cout.flush ();
+	auto pid = fork ();
+	assert (pid >= 0);
+	if (!pid)
+	{
+		{
+			TestRouter router ("test-tunnel-build", { "--limits.tunnelbuildthreads=" + std::to_string (numBuildThreads),
+				"--limits.tunnelbuildqueue=" + std::to_string (MAX_NUM_BUILD_REQUESTS), "--host=127.0.0.1" });
+			i2p::transport::transports.SetOnline (false); // replies are not sent
+			i2p::tunnel::tunnels.Start ();
+
+			RunRequests (numBuildThreads);
+
+			i2p::tunnel::tunnels.Stop ();
+		} // before _exit
+		std::cout.flush ();
+		_exit (0);
+	}
+	int status = 0;
+	waitpid (pid, &status, 0);
+	assert (WIFEXITED (status) && !WEXITSTATUS (status));
+}
+
+int main ()
+{
+	for (int numBuildThreads: { 0, 1, 2 })
+		RunRequestsInProcess (numBuildThreads);
+}
@@ -0,0 +1,201 @@
+#include <cassert>
+#include <inttypes.h>
+#include <string.h>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+
+#include "I2NPProtocol.h"
+#include "Garlic.h"
+#include "Tunnel.h"
+#include "TunnelPool.h"
+#include "TunnelGateway.h"
+#include "TunnelEndpoint.h"
+#include "TestUtils.h"
+
+// usage: test-tunnel-endpoint
+// splits I2NP messages of mixed sizes to tunnel data messages by tunnel gateway buffer and replays them
+// through TunnelEndpoint::HandleDecryptedTunnelDataMsg in order, reordered and with losses,
+// checks reassembled messages and reports throughput and I2NP buffers allocated per message
+
+const int NUM_MESSAGES = 20000;
+const int NUM_ROUNDS = 10; // for benchmark
+const int REORDER_WINDOW = 4; // tunnel messages
+const int LOSS_INTERVAL = 97; // every tunnel message of
+
+const MessageLengths MESSAGE_LENGTHS[] = // single fragment, few fragments and large messages
+{
+	{ 60, 4, 900 },
+	{ 30, 1000, 3000 },
+	{ 10, 4000, 26000 }
+};
+
+class Receiver: public i2p::garlic::GarlicDestination
+{
+	public:
+
+		Receiver (): m_Received (NUM_MESSAGES), m_NumReceived (0), m_NumBytes (0), m_IsCorrupted (false) {}
+
+		void Reset ()
+		{
+			std::fill (m_Received.begin (), m_Received.end (), 0);
+			m_NumReceived = 0; m_NumBytes = 0;
+		}
+		int GetNumReceived () const { return m_NumReceived; }
+		uint64_t GetNumBytes () const { return m_NumBytes; }
+		bool IsCorrupted () const { return m_IsCorrupted; }
+		int GetNumDuplicates () const
+		{
+			int num = 0;
+			for (auto it: m_Received)
+				if (it > 1) num++;
+			return num;
+		}
+
+		// called by endpoint for local delivery
+		void ProcessGarlicMessage (std::shared_ptr<i2p::I2NPMessage> msg)
+		{
+			const uint8_t * payload = msg->GetPayload ();
+			size_t len = msg->GetPayloadLength ();
+			uint32_t n = NUM_MESSAGES;
+			if (len >= 4) memcpy (&n, payload, 4);
+			if (n >= NUM_MESSAGES || len != GetMessageLength (n, MESSAGE_LENGTHS) || msg->GetSize () != len)
+			{
+				m_IsCorrupted = true;
+				return;
+			}
+			for (size_t i = 4; i < len; i++)
+				if (payload[i] != (uint8_t)(n + i)) m_IsCorrupted = true;
+			m_Received[n]++;
+			m_NumReceived++;
+			m_NumBytes += len;
+		}
+
+		bool Decrypt (const uint8_t * encrypted, uint8_t * data, i2p::data::CryptoKeyType preferredCrypto) const { return false; }
+		std::shared_ptr<const i2p::data::IdentityEx> GetIdentity () const { return nullptr; }
+		std::shared_ptr<const i2p::data::LocalLeaseSet> GetLeaseSet () { return nullptr; }
+		std::shared_ptr<i2p::tunnel::TunnelPool> GetTunnelPool () const { return nullptr; }
+
+	protected:
+
+		void HandleI2NPMessage (const uint8_t * buf, size_t len) {}
+		bool HandleCloveI2NPMessage (i2p::I2NPMessageType typeID, const uint8_t * payload, size_t len, uint32_t msgID) { return false; }
+
+	private:
+
+		std::vector<int> m_Received;
+		int m_NumReceived;
+		uint64_t m_NumBytes;
+		bool m_IsCorrupted;
+};
+
+// decrypted tunnel data messages as produced by gateway
+static std::vector<std::shared_ptr<const i2p::I2NPMessage> > CreateTunnelDataMsgs ()
+{
+	i2p::tunnel::TunnelGatewayBuffer buffer;
+	for (uint32_t n = 0; n < NUM_MESSAGES; n++)
+	{
+		std::vector<uint8_t> payload (GetMessageLength (n, MESSAGE_LENGTHS));
+		memcpy (payload.data (), &n, 4);
+		for (size_t i = 4; i < payload.size (); i++)
+			payload[i] = n + i;
+		i2p::tunnel::TunnelMessageBlock block;
+		block.deliveryType = i2p::tunnel::eDeliveryTypeLocal;
+		block.data = i2p::CreateI2NPMessage (i2p::eI2NPGarlic, payload.data (), payload.size ());
+		buffer.PutI2NPMsg (block);
+	}
+	buffer.CompleteCurrentTunnelDataMessage ();
+	return buffer.GetTunnelDataMsgs ();
+}
+
+// returns tunnel messages per second
+static uint64_t Replay (i2p::tunnel::TunnelEndpoint& endpoint, std::shared_ptr<i2p::tunnel::InboundTunnel> tunnel,
+	const std::vector<std::shared_ptr<const i2p::I2NPMessage> >& tunnelMsgs, int numRounds)
+{
+	auto start = std::chrono::steady_clock::now ();
+	for (int i = 0; i < numRounds; i++)
+		for (auto& it: tunnelMsgs)
+		{
+			// as decrypted by inbound tunnel
+			auto msg = i2p::NewI2NPTunnelMessage (true);
+			*msg = *it;
+			msg->from = tunnel;
+			endpoint.HandleDecryptedTunnelDataMsg (msg);
+		}
+	auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now () - start).count ();
+	return (uint64_t)tunnelMsgs.size ()*numRounds*1000000/(elapsed ? elapsed : 1);
+}
+
+static uint64_t GetNumI2NPBuffers ()
+{
+	uint64_t num = 0;
+	for (const auto& it: i2p::GetI2NPBuffersStats ())
+		num += it.numAllocations;
+	return num;
+}
+
+int main ()
+{
+	TestRouter router ("test-tunnel-endpoint"); // context for zero hops tunnel
+
+	auto receiver = std::make_shared<Receiver> ();
+	auto pool = std::make_shared<i2p::tunnel::TunnelPool> (0, 0, 1, 1, 0, 0);
+	pool->SetLocalDestination (receiver);
+	auto tunnel = std::make_shared<i2p::tunnel::ZeroHopsInboundTunnel> ();
+	tunnel->SetTunnelPool (pool);
+
+	auto tunnelMsgs = CreateTunnelDataMsgs ();
+	std::cout << NUM_MESSAGES << " messages in " << tunnelMsgs.size () << " tunnel messages" << std::endl;
+	assert (tunnelMsgs.size () > (size_t)NUM_MESSAGES/2);
+	// follow-on fragments come before first fragments and previous follow-on fragments
+	auto reordered = tunnelMsgs;
+	for (size_t i = 0; i + REORDER_WINDOW <= reordered.size (); i += REORDER_WINDOW)
+		std::reverse (reordered.begin () + i, reordered.begin () + i + REORDER_WINDOW);
+	// fragments of some messages never come
+	std::vector<std::shared_ptr<const i2p::I2NPMessage> > lossy;
+	for (size_t i = 0; i < reordered.size (); i++)
+		if (i % LOSS_INTERVAL) lossy.push_back (reordered[i]);
+
+	// everything is reassembled once
+	{
+		i2p::tunnel::TunnelEndpoint endpoint (true);
+		Replay (endpoint, tunnel, tunnelMsgs, 1);
+		assert (!receiver->IsCorrupted ());
+		assert (receiver->GetNumReceived () == NUM_MESSAGES && !receiver->GetNumDuplicates ());
+		receiver->Reset ();
+		Replay (endpoint, tunnel, reordered, 1);
+		assert (!receiver->IsCorrupted ());
+		assert (receiver->GetNumReceived () == NUM_MESSAGES && !receiver->GetNumDuplicates ());
+		receiver->Reset ();
+	}
+	{
+		i2p::tunnel::TunnelEndpoint endpoint (true);
+		Replay (endpoint, tunnel, lossy, 1);
+		std::cout << "lossy: " << receiver->GetNumReceived () << " of " << NUM_MESSAGES << " messages reassembled" << std::endl;
+		assert (!receiver->IsCorrupted ());
+		assert (receiver->GetNumReceived () < NUM_MESSAGES && receiver->GetNumReceived () > NUM_MESSAGES*9/10);
+		assert (!receiver->GetNumDuplicates ());
+		endpoint.Cleanup (); // incomplete messages are not expired yet
+		receiver->Reset ();
+	}
+
+	// benchmark
+	for (auto traffic: { std::make_pair ("in order", &tunnelMsgs), std::make_pair ("reordered", &reordered) })
+	{
+		i2p::tunnel::TunnelEndpoint endpoint (true);
+		auto numBuffers = GetNumI2NPBuffers ();
+		auto rate = Replay (endpoint, tunnel, *traffic.second, NUM_ROUNDS);
+		numBuffers = GetNumI2NPBuffers () - numBuffers;
+		assert (!receiver->IsCorrupted ());
+		assert (receiver->GetNumReceived () == NUM_MESSAGES*NUM_ROUNDS);
+		std::cout << std::setw (9) << traffic.first << ": " << std::setw (7) << rate << " tunnel messages/s, "
+			<< std::setw (4) << rate*receiver->GetNumBytes ()/(traffic.second->size ()*NUM_ROUNDS)/1000000 << " MB/s reassembled, "
+			<< std::setw (4) << (double)numBuffers/(NUM_MESSAGES*NUM_ROUNDS) << " I2NP buffers per message" << std::endl;
+		receiver->Reset ();
+	}
+
+	pool->SetLocalDestination (nullptr);
+}
@@ -0,0 +1,249 @@
+#include <cassert>
+#include <inttypes.h>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+
+#include "Crypto.h"
+#include "TransitTunnel.h"
+#include "Tunnel.h"
+
+// usage: test-tunnels-table
+// checks tunnelID -> tunnel table, that removed tunnels are deleted after readers are done with them
+// and lookups while other thread adds and removes tunnels, then compares lookups rate with
+// unordered_map and mutex (as before) for 5k, 20k and 50k transit tunnels and few reader threads
+
+const int NUM_TUNNELS[] = { 5000, 20000, 50000 };
+const int NUM_LOOKUPS = 4000000; // per measurement
+const int NUM_THREADS = 4;
+const int BATCH_SIZE = 64; // lookups per read, as tunnel messages from queue
+const int NUM_CHURN_ROUNDS = 200;
+
+static std::shared_ptr<i2p::tunnel::TunnelBase> CreateTunnel (uint32_t tunnelID)
+{
+	uint8_t keys[32 + 32 + 32];
+	i2p::crypto::RandBytes (keys, sizeof (keys));
+	return std::make_shared<i2p::tunnel::TransitTunnelParticipant> (tunnelID, keys, i2p::crypto::RandUInt32 (), keys + 32, keys + 64);
+}
+
+static std::vector<uint32_t> CreateTunnelIDs (int num)
+{
+	std::vector<uint32_t> tunnelIDs;
+	std::unordered_map<uint32_t, bool> used;
+	while ((int)tunnelIDs.size () < num)
+	{
+		auto tunnelID = i2p::crypto::RandUInt32 ();
+		if (tunnelID && used.emplace (tunnelID, true).second)
+			tunnelIDs.push_back (tunnelID);
+	}
+	return tunnelIDs;
+}
+
+class MapTable // as Tunnels::GetTunnel before
+{
+	public:
+
+		void Add (std::shared_ptr<i2p::tunnel::TunnelBase> tunnel)
+		{
+			std::unique_lock<std::mutex> l(m_Mutex);
+			m_Tunnels.emplace (tunnel->GetTunnelID (), tunnel);
+		}
+
+		std::shared_ptr<i2p::tunnel::TunnelBase> Get (uint32_t tunnelID)
+		{
+			std::unique_lock<std::mutex> l(m_Mutex);
+			auto it = m_Tunnels.find (tunnelID);
+			if (it != m_Tunnels.end ())
+				return it->second;
+			return nullptr;
+		}
+
+	private:
+
+		std::unordered_map<uint32_t, std::shared_ptr<i2p::tunnel::TunnelBase> > m_Tunnels;
+		std::mutex m_Mutex;
+};
+
+template<typename Lookup>
+static double Measure (Lookup lookup, const std::vector<uint32_t>& tunnelIDs, int numThreads) // returns lookups per second
+{
+	std::atomic<bool> isFailed (false);
+	auto start = std::chrono::steady_clock::now ();
+	std::vector<std::thread> threads;
+	for (int i = 0; i < numThreads; i++)
+		threads.emplace_back ([lookup, &tunnelIDs, &isFailed, numThreads, i]()
+			{
+				uint32_t n = i*7919;
+				for (int j = 0; j < NUM_LOOKUPS/numThreads; j += BATCH_SIZE)
+				{
+					n = n*1103515245 + 12345;
+					if (!lookup (i, tunnelIDs, n)) isFailed = true;
+				}
+			});
+	for (auto& it: threads) it.join ();
+	assert (!isFailed);
+	auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now () - start).count ();
+	return (double)NUM_LOOKUPS*1000000/(elapsed ? elapsed : 1);
+}
+
+int main ()
+{
+	// add, find, replace and remove
+	{
+		i2p::tunnel::TunnelsTable table;
+		auto tunnelIDs = CreateTunnelIDs (10000);
+		std::vector<i2p::tunnel::TunnelBase *> tunnels;
+		for (auto tunnelID: tunnelIDs)
+		{
+			auto tunnel = CreateTunnel (tunnelID);
+			tunnels.push_back (tunnel.get ());
+			assert (table.Add (tunnel));
+		}
+		assert (table.GetSize () == tunnelIDs.size ());
+		assert (!table.Add (CreateTunnel (tunnelIDs[0])));
+		assert (!table.Add (CreateTunnel (0)));
+		table.BeginRead (0);
+		for (size_t i = 0; i < tunnelIDs.size (); i++)
+		{
+			assert (table.Find (tunnelIDs[i]) == tunnels[i]);
+			assert (table.Get (tunnelIDs[i]).get () == tunnels[i]);
+		}
+		assert (!table.Find (0));
+		table.EndRead (0);
+		int num = 0;
+		table.ForEach ([&num](uint32_t tunnelID, const std::shared_ptr<i2p::tunnel::TunnelBase>& tunnel)
+			{
+				assert (tunnel->GetTunnelID () == tunnelID);
+				num++;
+			});
+		assert (num == (int)tunnelIDs.size ());
+		for (size_t i = 0; i < tunnelIDs.size (); i += 2)
+			assert (table.Remove (tunnelIDs[i]));
+		assert (!table.Remove (tunnelIDs[0]));
+		assert (table.GetSize () == tunnelIDs.size ()/2);
+		table.BeginRead (0);
+		for (size_t i = 0; i < tunnelIDs.size (); i++)
+			assert (table.Find (tunnelIDs[i]) == (i & 1 ? tunnels[i] : nullptr));
+		table.EndRead (0);
+		auto tunnel = CreateTunnel (tunnelIDs[0]); // same ID again
+		assert (table.Add (tunnel));
+		auto replacement = CreateTunnel (tunnelIDs[0]);
+		assert (table.Add (replacement, true));
+		assert (table.Get (tunnelIDs[0]) == replacement);
+		assert (table.GetSize () == tunnelIDs.size ()/2 + 1);
+	}
+
+	// removed tunnel is deleted after reader is done
+	{
+		i2p::tunnel::TunnelsTable table;
+		auto tunnel = CreateTunnel (12345);
+		std::weak_ptr<i2p::tunnel::TunnelBase> weak = tunnel;
+		table.Add (tunnel);
+		tunnel = nullptr;
+		table.BeginRead (1);
+		auto found = table.Find (12345);
+		assert (found);
+		assert (table.Remove (12345));
+		table.Reclaim ();
+		assert (!weak.expired () && found->GetTunnelID () == 12345);
+		assert (!table.Find (12345));
+		table.EndRead (1);
+		table.Reclaim ();
+		assert (weak.expired ());
+	}
+
+	// lookups while tunnels are added and removed, table is rehashed
+	{
+		i2p::tunnel::TunnelsTable table;
+		auto tunnelIDs = CreateTunnelIDs (20000);
+		for (size_t i = 0; i < tunnelIDs.size ()/2; i++)
+			table.Add (CreateTunnel (tunnelIDs[i]));
+		std::atomic<bool> isRunning (true), isFailed (false);
+		std::atomic<uint64_t> numFound (0);
+		std::vector<std::thread> readers;
+		for (int i = 0; i < NUM_THREADS; i++)
+			readers.emplace_back ([&table, &tunnelIDs, &isRunning, &isFailed, &numFound, i]()
+				{
+					uint32_t n = i;
+					while (isRunning)
+					{
+						table.BeginRead (i);
+						for (int j = 0; j < BATCH_SIZE; j++)
+						{
+							n = n*1103515245 + 12345;
+							auto tunnelID = tunnelIDs[n % tunnelIDs.size ()];
+							auto tunnel = table.Find (tunnelID);
+							if (tunnel)
+							{
+								if (tunnel->GetTunnelID () != tunnelID) isFailed = true;
+								numFound++;
+							}
+						}
+						table.EndRead (i);
+					}
+				});
+		for (int r = 0; r < NUM_CHURN_ROUNDS; r++)
+		{
+			// replace first or second half
+			size_t from = (r & 1) ? 0 : tunnelIDs.size ()/2, to = (r & 1) ? tunnelIDs.size ()/2 : 0;
+			for (size_t i = 0; i < tunnelIDs.size ()/2; i++)
+			{
+				table.Add (CreateTunnel (tunnelIDs[to + i]));
+				table.Remove (tunnelIDs[from + i]);
+			}
+		}
+		isRunning = false;
+		for (auto& it: readers) it.join ();
+		std::cout << "churn: " << numFound << " tunnels found while replaced" << std::endl;
+		assert (!isFailed && numFound > 0);
+		assert (table.GetSize () == tunnelIDs.size ()/2);
+	}
+
+	// benchmark
+	for (auto numTunnels: NUM_TUNNELS)
+	{
+		auto tunnelIDs = CreateTunnelIDs (numTunnels);
+		MapTable map;
+		i2p::tunnel::TunnelsTable table;
+		for (auto tunnelID: tunnelIDs)
+		{
+			auto tunnel = CreateTunnel (tunnelID);
+			map.Add (tunnel);
+			table.Add (tunnel);
+		}
+		auto mapLookup = [&map](int reader, const std::vector<uint32_t>& tunnelIDs, uint32_t n)
+			{
+				for (int i = 0; i < BATCH_SIZE; i++)
+				{
+					auto tunnelID = tunnelIDs[(n + i*2654435761U) % tunnelIDs.size ()];
+					auto tunnel = map.Get (tunnelID);
+					if (!tunnel || tunnel->GetTunnelID () != tunnelID) return false;
+				}
+				return true;
+			};
+		auto tableLookup = [&table](int reader, const std::vector<uint32_t>& tunnelIDs, uint32_t n)
+			{
+				table.BeginRead (reader);
+				for (int i = 0; i < BATCH_SIZE; i++)
+				{
+					auto tunnelID = tunnelIDs[(n + i*2654435761U) % tunnelIDs.size ()];
+					auto tunnel = table.Find (tunnelID);
+					if (!tunnel || tunnel->GetTunnelID () != tunnelID) { table.EndRead (reader); return false; }
+				}
+				table.EndRead (reader);
+				return true;
+			};
+		for (int numThreads: { 1, NUM_THREADS })
+		{
+			auto slow = Measure (mapLookup, tunnelIDs, numThreads), fast = Measure (tableLookup, tunnelIDs, numThreads);
+			std::cout << std::setw (5) << numTunnels << " tunnels, " << numThreads << " thread(s): map " << std::setw (6) << (uint64_t)(1000000000/slow)
+				<< " ns/lookup, table " << std::setw (6) << (uint64_t)(1000000000/fast) << " ns/lookup" << std::endl;
+		}
+	}
+}
@@ -0,0 +1,178 @@
+#include <cassert>
+#include <inttypes.h>
+#include <string.h>
+#include <vector>
+#include <chrono>
+#include <ctime>
+#include <iostream>
+#include <boost/asio.hpp>
+
+#include "UDPBatch.h"
+
+// usage: test-udp-batch
+// sends datagrams over loopback one by one, by batches and by batches with segmentation and receive offload,
+// compares packets/sec and CPU per packet
+
+const int NUM_PACKETS = 200000;
+const size_t PACKET_SIZE = 1200;
+
+struct Packet
+{
+	uint8_t buf[1500];
+	size_t len;
+	boost::asio::ip::udp::endpoint from;
+};
+
+static void Fill (uint8_t * buf, int n)
+{
+	memset (buf, n & 0xFF, PACKET_SIZE);
+	memcpy (buf, &n, sizeof (n));
+}
+
+static void Check (const Packet * packet, int n, const boost::asio::ip::udp::endpoint& from)
+{
+	assert (packet->len == PACKET_SIZE);
+	int m; memcpy (&m, packet->buf, sizeof (m));
+	assert (m == n);
+	assert (packet->buf[PACKET_SIZE - 1] == (n & 0xFF));
+	assert (packet->from == from);
+}
+
+static void Report (const char * name, std::chrono::steady_clock::time_point start, std::clock_t cpuStart)
+{
+	auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now () - start).count ();
+	double cpu = (double)(std::clock () - cpuStart)/CLOCKS_PER_SEC;
+	std::cout << name << ": " << (uint64_t)NUM_PACKETS*1000000/(elapsed ? elapsed : 1) << " packets/sec, "
+		<< cpu*1e9/NUM_PACKETS << " ns CPU per packet" << std::endl;
+}
+
+int main ()
+{
+	boost::asio::io_service service;
+	boost::asio::ip::udp::socket rx (service, boost::asio::ip::udp::endpoint (boost::asio::ip::address_v4::loopback (), 0));
+	boost::asio::ip::udp::socket tx (service, boost::asio::ip::udp::endpoint (boost::asio::ip::address_v4::loopback (), 0));
+	rx.set_option (boost::asio::socket_base::receive_buffer_size (0x1FFFFF));
+	auto to = rx.local_endpoint (), from = tx.local_endpoint ();
+
+	i2p::util::MemoryPoolMt<Packet> pool;
+	i2p::transport::UDPBatchReceiver<Packet> receiver (pool);
+	i2p::transport::UDPBatchSender sender (tx);
+	std::vector<Packet *> packets;
+	boost::system::error_code ec;
+	uint8_t buf[PACKET_SIZE];
+
+	// nothing to receive, must not block
+	assert (!receiver.Receive (rx, 1500, i2p::transport::UDP_MAX_BATCH_SIZE, packets, ec) && !ec && packets.empty ());
+	// full batch, datagrams keep order and sender's endpoint
+	for (size_t i = 0; i < i2p::transport::UDP_MAX_BATCH_SIZE; i++)
+	{
+		Fill (buf, i);
+		assert (sender.Add (buf, PACKET_SIZE, to));
+	}
+	assert (sender.IsFull () && !sender.Add (buf, PACKET_SIZE, to));
+	assert (sender.Flush (ec) == i2p::transport::UDP_MAX_BATCH_SIZE && !ec && sender.IsEmpty ());
+	assert (receiver.Receive (rx, 1500, 10, packets, ec) == 10); // partially
+	while (receiver.Receive (rx, 1500, i2p::transport::UDP_MAX_BATCH_SIZE, packets, ec));
+	assert (packets.size () == i2p::transport::UDP_MAX_BATCH_SIZE);
+	for (size_t i = 0; i < packets.size (); i++)
+		Check (packets[i], i, from);
+	pool.ReleaseMt (packets);
+	packets.clear ();
+	// gathered buffers
+	Fill (buf, 12345);
+	std::vector<boost::asio::const_buffer> bufs { boost::asio::buffer (buf, 100), boost::asio::buffer (buf + 100, PACKET_SIZE - 100) };
+	assert (sender.Add (bufs, to));
+	assert (sender.Flush (ec) == 1);
+	assert (receiver.Receive (rx, 1500, 1, packets, ec) == 1);
+	Check (packets[0], 12345, from);
+	pool.ReleaseMt (packets);
+	packets.clear ();
+	// too long
+	std::vector<uint8_t> longBuf (i2p::transport::UDP_BATCH_MAX_PACKET_SIZE + 1);
+	assert (!sender.Add (longBuf.data (), longBuf.size (), to));
+
+	// one by one
+	auto start = std::chrono::steady_clock::now ();
+	auto cpuStart = std::clock ();
+	Packet packet;
+	for (int i = 0; i < NUM_PACKETS; i += i2p::transport::UDP_MAX_BATCH_SIZE)
+	{
+		for (size_t j = 0; j < i2p::transport::UDP_MAX_BATCH_SIZE; j++)
+		{
+			Fill (buf, i + j);
+			tx.send_to (boost::asio::buffer (buf, PACKET_SIZE), to);
+		}
+		for (size_t j = 0; j < i2p::transport::UDP_MAX_BATCH_SIZE; j++)
+		{
+			packet.len = rx.receive_from (boost::asio::buffer (packet.buf, 1500), packet.from);
+			Check (&packet, i + j, from);
+		}
+	}
+	Report ("one by one", start, cpuStart);
+
+	// batches
+	start = std::chrono::steady_clock::now ();
+	cpuStart = std::clock ();
+	for (int i = 0; i < NUM_PACKETS; i += i2p::transport::UDP_MAX_BATCH_SIZE)
+	{
+		for (size_t j = 0; j < i2p::transport::UDP_MAX_BATCH_SIZE; j++)
+		{
+			Fill (buf, i + j);
+			sender.Add (buf, PACKET_SIZE, to);
+		}
+		sender.Flush (ec);
+		while (packets.size () < i2p::transport::UDP_MAX_BATCH_SIZE &&
+			receiver.Receive (rx, 1500, i2p::transport::UDP_MAX_BATCH_SIZE - packets.size (), packets, ec));
+		assert (packets.size () == i2p::transport::UDP_MAX_BATCH_SIZE);
+		for (size_t j = 0; j < packets.size (); j++)
+			Check (packets[j], i + j, from);
+		pool.ReleaseMt (packets);
+		packets.clear ();
+	}
+	Report ("batch", start, cpuStart);
+
+	// segmentation and receive offload, if supported
+	bool gso = sender.EnableSegmentationOffload (), gro = receiver.EnableReceiveOffload (rx);
+	std::cout << "segmentation offload " << (gso ? "enabled" : "not supported") << ", receive offload " << (gro ? "enabled" : "not supported") << std::endl;
+	// same size and shorter last one to the same endpoint, other endpoint in the middle
+	auto other = tx.local_endpoint ();
+	for (int i = 0; i < 10; i++)
+	{
+		Fill (buf, i);
+		assert (sender.Add (buf, (i == 4 || i == 9) ? PACKET_SIZE - 100 : PACKET_SIZE, to));
+		if (i == 6) assert (sender.Add (buf, 100, other));
+	}
+	assert (sender.Flush (ec) == 11 && !ec);
+	boost::asio::ip::udp::endpoint ep;
+	assert (tx.receive_from (boost::asio::buffer (buf, PACKET_SIZE), ep) == 100);
+	while (receiver.Receive (rx, 1500, i2p::transport::UDP_MAX_BATCH_SIZE, packets, ec));
+	assert (packets.size () == 10);
+	for (size_t i = 0; i < packets.size (); i++)
+	{
+		assert (packets[i]->len == ((i == 4 || i == 9) ? PACKET_SIZE - 100 : PACKET_SIZE));
+		int m; memcpy (&m, packets[i]->buf, sizeof (m));
+		assert (m == (int)i && packets[i]->from == from);
+	}
+	pool.ReleaseMt (packets);
+	packets.clear ();
+
+	start = std::chrono::steady_clock::now ();
+	cpuStart = std::clock ();
+	for (int i = 0; i < NUM_PACKETS; i += i2p::transport::UDP_MAX_BATCH_SIZE)
+	{
+		for (size_t j = 0; j < i2p::transport::UDP_MAX_BATCH_SIZE; j++)
+		{
+			Fill (buf, i + j);
+			sender.Add (buf, PACKET_SIZE, to);
+		}
+		sender.Flush (ec);
+		while (packets.size () < i2p::transport::UDP_MAX_BATCH_SIZE &&
+			receiver.Receive (rx, 1500, i2p::transport::UDP_MAX_BATCH_SIZE, packets, ec));
+		assert (packets.size () == i2p::transport::UDP_MAX_BATCH_SIZE);
+		for (size_t j = 0; j < packets.size (); j++)
+			Check (packets[j], i + j, from);
+		pool.ReleaseMt (packets);
+		packets.clear ();
+	}
+	Report ("batch with offload", start, cpuStart);
+}